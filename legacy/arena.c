@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for MAP_ANONYMOUS */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* C99 has no max_align_t */
+union arena_align {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*fp)(void);
+};
+#define ARENA_ALIGN sizeof(union arena_align)
+
+/*
+ * Blocks are chained newest first.
+ *
+ * Positions in the arena (see arena_mark) count every byte of every older
+ * block, used or not, so a position identifies a block and an offset.
+ */
+struct arena_block {
+    struct arena_block *prev;
+    size_t start;               /* position of data[0] */
+    size_t size;                /* bytes available in data */
+    size_t used;
+    int mapped;                 /* 0 for the caller's reserve */
+    union arena_align data[];
+};
+
+static size_t align_up(size_t n, size_t alignment)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+void arena_init(struct arena *arena, void *reserve, size_t size)
+{
+    arena->current = NULL;
+    arena->peak = 0;
+    arena->fixed = 0;
+
+    if (reserve == NULL) {
+        return;
+    }
+
+    uintptr_t addr = (uintptr_t)reserve;
+    size_t skip = align_up(addr, ARENA_ALIGN) - addr;
+    if (size < skip + sizeof(struct arena_block) + ARENA_ALIGN) {
+        return;
+    }
+
+    struct arena_block *block = (struct arena_block *)((char *)reserve + skip);
+    block->prev = NULL;
+    block->start = 0;
+    block->size = (size - skip - sizeof(*block)) / ARENA_ALIGN * ARENA_ALIGN;
+    block->used = 0;
+    block->mapped = 0;
+    arena->current = block;
+}
+
+static struct arena_block *map_block(struct arena *arena, size_t size)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0) {
+        pagesize = 4096;
+    }
+
+    if (size > SIZE_MAX - sizeof(struct arena_block) - (size_t)pagesize) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t mapsize = sizeof(struct arena_block) + size;
+    if (mapsize < ARENA_BLOCK_MIN) {
+        mapsize = ARENA_BLOCK_MIN;
+    }
+    mapsize = align_up(mapsize, (size_t)pagesize);
+
+    void *p = mmap(NULL, mapsize, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    struct arena_block *block = p;
+    struct arena_block *prev = arena->current;
+    block->prev = prev;
+    block->start = prev != NULL ? prev->start + prev->size : 0;
+    block->size = mapsize - sizeof(*block);
+    block->used = 0;
+    block->mapped = 1;
+    return block;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > SIZE_MAX - ARENA_ALIGN) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = align_up(size, ARENA_ALIGN);
+
+    struct arena_block *block = arena->current;
+    if (block == NULL || block->size - block->used < size) {
+        if (arena->fixed) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        block = map_block(arena, size);
+        if (block == NULL) {
+            return NULL;
+        }
+        arena->current = block;
+    }
+
+    void *p = (char *)block->data + block->used;
+    block->used += size;
+
+    size_t inuse = block->start + block->used;
+    if (inuse > arena->peak) {
+        arena->peak = inuse;
+    }
+    return p;
+}
+
+char *arena_strdup(struct arena *arena, const char *string)
+{
+    size_t len = strlen(string) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy != NULL) {
+        memcpy(copy, string, len);
+    }
+    return copy;
+}
+
+void arena_fix(struct arena *arena)
+{
+    arena->fixed = 1;
+}
+
+size_t arena_mark(const struct arena *arena)
+{
+    const struct arena_block *block = arena->current;
+    return block != NULL ? block->start + block->used : 0;
+}
+
+void arena_rewind(struct arena *arena, size_t mark)
+{
+    struct arena_block *block = arena->current;
+    while (block != NULL && block->mapped && block->start >= mark) {
+        struct arena_block *prev = block->prev;
+        munmap(block, sizeof(*block) + block->size);
+        block = prev;
+    }
+    if (block != NULL) {
+        block->used = mark - block->start;
+    }
+    arena->current = block;
+}
+
+size_t arena_peak(const struct arena *arena)
+{
+    return arena->peak;
+}
+
+void arena_release(struct arena *arena)
+{
+    arena_rewind(arena, 0);
+    arena->current = NULL;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
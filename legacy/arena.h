@@ -0,0 +1,68 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * the smallest block mapped once the reserve is used up
+ */
+#ifndef ARENA_BLOCK_MIN
+#define ARENA_BLOCK_MIN (64 * 1024)
+#endif
+
+struct arena_block;
+
+/*
+ * A bump allocator for everything one invocation of root needs.
+ *
+ * Allocations come from a caller-supplied reserve (typically static) and,
+ * once that is full, from blocks mapped with mmap(2).  Nothing is freed
+ * individually: memory is returned all at once by arena_release, or by
+ * rewinding to a position saved with arena_mark.
+ */
+struct arena {
+    struct arena_block *current;
+    size_t peak;                /* the most ever in use, see arena_peak */
+    int fixed;                  /* see arena_fix */
+};
+
+/*
+ * Start an empty arena that allocates from reserve first.
+ *
+ * reserve may be NULL, in which case the first allocation maps a block.
+ */
+void arena_init(struct arena *arena, void *reserve, size_t size);
+
+/*
+ * Return size bytes aligned for any type, or NULL with errno set.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *string);
+
+/*
+ * Allocate only from the memory the arena already has: once that is used
+ * up, arena_alloc fails with ENOMEM instead of mapping another block.
+ */
+void arena_fix(struct arena *arena);
+
+/*
+ * A position in the arena, and a way to go back to it, discarding
+ * everything allocated since.  Marks must be rewound in the reverse order
+ * they were taken.
+ */
+size_t arena_mark(const struct arena *arena);
+void arena_rewind(struct arena *arena, size_t mark);
+
+/*
+ * The most bytes the arena has ever had in use, including the reserve.
+ */
+size_t arena_peak(const struct arena *arena);
+
+/*
+ * Unmap every mapped block.  The arena must be initialized again before
+ * it is reused.
+ */
+void arena_release(struct arena *arena);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+
+static char reserve[1024];
+
+static int in_reserve(const void *p)
+{
+    return (const char *)p >= reserve && (const char *)p < reserve + sizeof(reserve);
+}
+
+void test_alloc_uses_reserve_first(void)
+{
+    printf("Running %s\n", __func__);
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+
+    char *a = arena_alloc(&arena, 10);
+    char *b = arena_alloc(&arena, 10);
+    assert(a != NULL && b != NULL);
+    assert(in_reserve(a) && in_reserve(b));
+    assert(b > a);
+
+    /* every allocation is aligned for any type */
+    assert((uintptr_t)b % sizeof(long double) == 0);
+
+    arena_release(&arena);
+}
+
+void test_alloc_maps_when_reserve_full(void)
+{
+    printf("Running %s\n", __func__);
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+
+    char *big = arena_alloc(&arena, 4 * sizeof(reserve));
+    assert(big != NULL);
+    assert(!in_reserve(big));
+    memset(big, 'x', 4 * sizeof(reserve));
+
+    /* and without a reserve at all */
+    struct arena mapped;
+    arena_init(&mapped, NULL, 0);
+    assert(arena_strdup(&mapped, "hello") != NULL);
+    arena_release(&mapped);
+
+    arena_release(&arena);
+}
+
+void test_fixed(void)
+{
+    printf("Running %s\n", __func__);
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+    arena_fix(&arena);
+
+    char *a = arena_alloc(&arena, 100);
+    assert(a != NULL && in_reserve(a));
+    errno = 0;
+    assert(arena_alloc(&arena, sizeof(reserve)) == NULL);
+    assert(errno == ENOMEM);
+
+    /* what's left, and what's rewound, can still be used */
+    size_t mark = arena_mark(&arena);
+    assert(arena_alloc(&arena, 100) != NULL);
+    arena_rewind(&arena, mark);
+    assert(arena_alloc(&arena, 100) != NULL);
+
+    /* and without a reserve, nothing */
+    struct arena none;
+    arena_init(&none, NULL, 0);
+    arena_fix(&none);
+    assert(arena_alloc(&none, 1) == NULL);
+
+    arena_release(&arena);
+}
+
+void test_rewind(void)
+{
+    printf("Running %s\n", __func__);
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+
+    char *kept = arena_strdup(&arena, "kept");
+    size_t mark = arena_mark(&arena);
+    char *first = arena_alloc(&arena, 100);
+    assert(arena_alloc(&arena, 4 * sizeof(reserve)) != NULL);
+    arena_rewind(&arena, mark);
+
+    assert(arena_mark(&arena) == mark);
+    assert(arena_alloc(&arena, 100) == first);
+    assert(strcmp(kept, "kept") == 0);
+
+    arena_release(&arena);
+}
+
+void test_peak(void)
+{
+    printf("Running %s\n", __func__);
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+    assert(arena_peak(&arena) == 0);
+
+    size_t mark = arena_mark(&arena);
+    assert(arena_alloc(&arena, 200) != NULL);
+    size_t peak = arena_peak(&arena);
+    assert(peak >= 200);
+
+    /* rewinding doesn't lower the peak, and reuse doesn't raise it */
+    arena_rewind(&arena, mark);
+    assert(arena_peak(&arena) == peak);
+    assert(arena_alloc(&arena, 100) != NULL);
+    assert(arena_peak(&arena) == peak);
+
+    arena_release(&arena);
+}
+
+int main(int argc, const char *argv[])
+{
+    test_alloc_uses_reserve_first();
+    test_alloc_maps_when_reserve_full();
+    test_fixed();
+    test_rewind();
+    test_peak();
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -1,13 +1,194 @@
 #include "args.h"
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
+int parse_duration(const char *s, long *msp)
+{
+    /* strtod would also take signs, hex, "inf" and "nan" */
+    if ((*s < '0' || *s > '9') && *s != '.') {
+        return -1;
+    }
+
+    char *end;
+    double seconds = strtod(s, &end);
+    if (end == s) {
+        return -1;
+    }
+
+    double multiplier = 1;
+    if (*end != '\0') {
+        switch (*end) {
+        case 's': multiplier = 1; break;
+        case 'm': multiplier = 60; break;
+        case 'h': multiplier = 60 * 60; break;
+        case 'd': multiplier = 24 * 60 * 60; break;
+        default: return -1;
+        }
+        if (end[1] != '\0') {
+            return -1;
+        }
+    }
+
+    double ms = seconds * multiplier * 1000;
+    /* a thousand years is as good as forever */
+    if (ms > 1000.0 * 365 * 24 * 60 * 60 * 1000) {
+        return -1;
+    }
+    *msp = (long)ms;
+    if (*msp < ms) {
+        (*msp)++;
+    }
+    return 0;
+}
+
+int split_pipeline(const char **args, const char *delimiter,
+                   const char **stages[], int maxstages)
+{
+    int nstages = 0;
+    const char **start = args;
+
+    for (const char **arg = args; ; arg++) {
+        if (*arg != NULL && strcmp(*arg, delimiter) != 0) {
+            continue;
+        }
+        if (arg == start || nstages == maxstages) {
+            return -1;
+        }
+        stages[nstages++] = start;
+        if (*arg == NULL) {
+            return nstages;
+        }
+        *arg = NULL;
+        start = arg + 1;
+    }
+}
+
+/*
+ * If arg is the long option name, which takes a value, store the value
+ * (after "=", or else the next argument, advancing *ip) in *valuep.
+ *
+ * Returns 1 if arg is name, with *valuep NULL if the value is missing,
+ * or 0 if it is not.
+ */
+static int match_valued(const char *arg, const char *name,
+                        int argc, const char *const *argv,
+                        int *ip, const char **valuep)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0) {
+        return 0;
+    }
+    if (arg[len] == '=') {
+        *valuep = arg + len + 1;
+        return 1;
+    }
+    if (arg[len] != '\0') {
+        return 0;
+    }
+    *valuep = *ip + 1 < argc ? argv[++*ip] : NULL;
+    return 1;
+}
+
+/*
+ * Store the lock name and number of slots in value, "NAME" if haveslots
+ * is 0, else "NAME:N", in opts.  Returns 0, or -1 if value is not one.
+ */
+static int parse_lock(const char *value, int haveslots, struct options *opts)
+{
+    if (value == NULL) {
+        return -1;
+    }
+    size_t len = strlen(value);
+    long slots = 1;
+    if (haveslots) {
+        const char *colon = strrchr(value, ':');
+        if (colon == NULL || colon[1] < '0' || colon[1] > '9') {
+            return -1;
+        }
+        char *end;
+        slots = strtol(colon + 1, &end, 10);
+        if (*end != '\0' || slots < 1 || slots > LOCK_MAX_SLOTS) {
+            return -1;
+        }
+        len = colon - value;
+    }
+    if (len >= sizeof(opts->lock)) {
+        return -1;
+    }
+    memcpy(opts->lock, value, len);
+    opts->lock[len] = '\0';
+    if (!locks_valid_name(opts->lock)) {
+        return -1;
+    }
+    opts->slots = (int)slots;
+    return 0;
+}
+
+/*
+ * Note the file operation op on file and, for --copy, to, in opts.  Returns
+ * 0, or -1 if a file is missing or empty or there already was one.
+ */
+static int set_fileop(struct options *opts, enum fileop op,
+                      const char *file, const char *to)
+{
+    if (opts->fileop != FILEOP_NONE || file == NULL || *file == '\0'
+        || (op == FILEOP_COPY && (to == NULL || *to == '\0'))) {
+        return -1;
+    }
+    opts->fileop = op;
+    opts->files[0] = file;
+    opts->files[1] = to;
+    return 0;
+}
+
+/*
+ * Store the process ID in value, a decimal number from 1 up, in *pidp.
+ * Returns 0, or -1 if value is not one.
+ */
+static int parse_pid(const char *value, long *pidp)
+{
+    if (value == NULL || *value < '1' || *value > '9') {
+        return -1;
+    }
+    char *end;
+    long pid = strtol(value, &end, 10);
+    /* pid_t is an int on every system root runs on */
+    if (*end != '\0' || pid > INT_MAX) {
+        return -1;
+    }
+    *pidp = pid;
+    return 0;
+}
+
 int parse_args(int argc, const char *const *argv,
                struct options *opts, const char *const **argsp)
 {
     opts->set_home = 1;
     opts->debug = 0;
+    opts->record = 0;
+    opts->resolve = 0;
+    opts->timeout_ms = 0;
+    opts->kill_after_ms = DEFAULT_KILL_AFTER_MS;
+    opts->pipeline = 0;
+    opts->delimiter = DEFAULT_PIPELINE_DELIMITER;
+    opts->user = NULL;
+    opts->lock[0] = '\0';
+    opts->slots = 0;
+    opts->every_ms = 0;
+    opts->nwatch = 0;
+    opts->fileop = FILEOP_NONE;
+    opts->files[0] = NULL;
+    opts->files[1] = NULL;
+    opts->ns_pid = 0;
+    opts->low_memory = 0;
 
+    int have_timeout = 0;
+    int have_kill_after = 0;
+    int have_lock = 0;
+    int have_slots = 0;
+    const char *value;
     int i = 1; /* skip the program name */
     while (i < argc) {
         const char *arg = argv[i];
@@ -42,6 +223,91 @@ int parse_args(int argc, const char *const *argv,
             else if (strcmp(arg, "--nohome") == 0) {
                 opts->set_home = 0;
             }
+            else if (strcmp(arg, "--record") == 0) {
+                opts->record = 1;
+            }
+            else if (strcmp(arg, "--resolve") == 0) {
+                opts->resolve = 1;
+            }
+            else if (strcmp(arg, "--low-memory") == 0) {
+                opts->low_memory = 1;
+            }
+            else if (strcmp(arg, "--pipeline") == 0) {
+                opts->pipeline = 1;
+            }
+            else if (strncmp(arg, "--pipeline=", 11) == 0 && arg[11] != '\0') {
+                opts->pipeline = 1;
+                opts->delimiter = arg + 11;
+            }
+            else if (match_valued(arg, "--timeout", argc, argv, &i, &value)) {
+                if (value == NULL || parse_duration(value, &opts->timeout_ms) != 0) {
+                    return -1;
+                }
+                have_timeout = 1;
+            }
+            else if (match_valued(arg, "--kill-after", argc, argv, &i, &value)) {
+                if (value == NULL || parse_duration(value, &opts->kill_after_ms) != 0) {
+                    return -1;
+                }
+                have_kill_after = 1;
+            }
+            else if (match_valued(arg, "--user", argc, argv, &i, &value)) {
+                if (value == NULL || *value == '\0') {
+                    return -1;
+                }
+                opts->user = value;
+            }
+            else if (match_valued(arg, "--lock", argc, argv, &i, &value)) {
+                if (parse_lock(value, 0, opts) != 0) {
+                    return -1;
+                }
+                have_lock = 1;
+            }
+            else if (match_valued(arg, "--slots", argc, argv, &i, &value)) {
+                if (parse_lock(value, 1, opts) != 0) {
+                    return -1;
+                }
+                have_slots = 1;
+            }
+            else if (match_valued(arg, "--every", argc, argv, &i, &value)) {
+                if (value == NULL || parse_duration(value, &opts->every_ms) != 0
+                    || opts->every_ms == 0) {
+                    return -1;
+                }
+            }
+            else if (match_valued(arg, "--on-change", argc, argv, &i, &value)) {
+                if (value == NULL || *value == '\0' || opts->nwatch == REPEAT_MAX_PATHS) {
+                    return -1;
+                }
+                opts->watch[opts->nwatch++] = value;
+            }
+            else if (match_valued(arg, "--write", argc, argv, &i, &value)) {
+                if (set_fileop(opts, FILEOP_WRITE, value, NULL) != 0) {
+                    return -1;
+                }
+            }
+            else if (match_valued(arg, "--append", argc, argv, &i, &value)) {
+                if (set_fileop(opts, FILEOP_APPEND, value, NULL) != 0) {
+                    return -1;
+                }
+            }
+            else if (match_valued(arg, "--read", argc, argv, &i, &value)) {
+                if (set_fileop(opts, FILEOP_READ, value, NULL) != 0) {
+                    return -1;
+                }
+            }
+            else if (match_valued(arg, "--ns", argc, argv, &i, &value)) {
+                if (parse_pid(value, &opts->ns_pid) != 0) {
+                    return -1;
+                }
+            }
+            else if (strcmp(arg, "--copy") == 0) {
+                if (i + 2 >= argc
+                    || set_fileop(opts, FILEOP_COPY, argv[i + 1], argv[i + 2]) != 0) {
+                    return -1;
+                }
+                i += 2;
+            }
             else {
                 return -1;
             }
@@ -55,6 +321,16 @@ int parse_args(int argc, const char *const *argv,
                 else if (*p == 'H') {
                     opts->set_home = 0;
                 }
+                else if (*p == 'u') {
+                    /* the rest of this argument, or else the next one */
+                    value = p[1] != '\0' ? p + 1
+                          : i + 1 < argc ? argv[++i] : NULL;
+                    if (value == NULL || *value == '\0') {
+                        return -1;
+                    }
+                    opts->user = value;
+                    break;
+                }
                 else {
                     return -1;
                 }
@@ -64,6 +340,13 @@ int parse_args(int argc, const char *const *argv,
         i++;
     }
 
+    if (have_kill_after && !have_timeout) {
+        return -1;
+    }
+    if (have_lock && have_slots) {
+        return -1;
+    }
+
     *argsp = argv + i;
     return 0;
 }
@@ -1,34 +1,110 @@
 #ifndef ARGS_H
 #define ARGS_H
 
+#include "fileops.h"
+#include "locks.h"
+#include "repeat.h"
+
+/*
+ * how long --timeout waits between SIGTERM and SIGKILL, unless --kill-after
+ * says otherwise
+ */
+#define DEFAULT_KILL_AFTER_MS 10000L
+
+/*
+ * what separates the stages of a --pipeline, unless --pipeline=<delimiter>
+ * says otherwise
+ */
+#define DEFAULT_PIPELINE_DELIMITER "::"
+
+/* the most stages a --pipeline can have */
+#define PIPELINE_MAX_STAGES 32
+
 /*
  * Parsed command-line options.
  *
- * Defaults (set by parse_args): set_home = 1, debug = 0.
+ * Defaults (set by parse_args): set_home = 1, debug = 0, record = 0,
+ * resolve = 0, timeout_ms = 0 (none), kill_after_ms = DEFAULT_KILL_AFTER_MS,
+ * pipeline = 0, delimiter = DEFAULT_PIPELINE_DELIMITER, user = NULL (root),
+ * lock = "" (none), slots = 0, every_ms = 0 (none), nwatch = 0,
+ * fileop = FILEOP_NONE, ns_pid = 0 (none), low_memory = 0.
  */
 struct options {
     int set_home;
     int debug;
+    int record;
+    int resolve;
+    long timeout_ms;
+    long kill_after_ms;
+    int pipeline;
+    const char *delimiter;
+    const char *user;
+    char lock[LOCK_NAME_MAX];
+    int slots;
+    long every_ms;
+    const char *watch[REPEAT_MAX_PATHS];
+    int nwatch;
+    enum fileop fileop;         /* --write, --append, --copy or --read */
+    const char *files[2];       /* its file, or --copy's source and destination */
+    long ns_pid;                /* --ns, the process whose namespaces to run in */
+    int low_memory;             /* --low-memory */
 };
 
 /*
  * Parse argv with POSIX `+` semantics: option processing stops at the first
  * non-option argument.
  *
- * Only the exact long options --debug, --home, and --nohome are accepted;
- * abbreviations (e.g. --deb) are rejected, matching the Rust parser. Short
- * options -d and -H may be combined (e.g. -dH). A bare "--" terminates option
+ * Only the exact long options --debug, --home, --nohome, --record,
+ * --resolve, --timeout, --kill-after, --pipeline, --user, --lock, --slots,
+ * --every, --on-change, --write, --append, --copy, --read, --ns and
+ * --low-memory are accepted;
+ * abbreviations (e.g. --deb) are rejected, matching the Rust parser.
+ * --pipeline takes an optional delimiter, only after "=".
+ * --timeout and --kill-after take a duration (see parse_duration), either as
+ * the next argument or after "=".  --user takes a user name the same way,
+ * --lock a lock name (see locks_valid_name), and --slots a lock name and a
+ * number of slots, e.g. "builds:4"; --lock NAME is --slots NAME:1.
+ * --every takes a duration more than 0, and --on-change a path; it may be
+ * given up to REPEAT_MAX_PATHS times.  --write, --append and --read take a
+ * file the same way, and --copy takes the next two arguments; only one of
+ * them may be given.  --ns takes a process ID, more than 0.
+ * Short options -d and -H may be combined (e.g. -dH), and may be followed
+ * by -u, which takes a user name as the rest of the argument or the next
+ * argument (e.g. -Hu svc or -usvc). A bare "--" terminates option
  * processing and is consumed.
  *
  * On success, *opts is filled in and *argsp is set to the command-and-arguments
  * slice (argv beginning at the first non-option), then 0 is returned. Because
  * argv is NULL-terminated, (*argsp)[0] is NULL when no command was given.
  *
- * On an unknown or abbreviated option, -1 is returned and *argsp is left
- * unchanged.
+ * On an unknown or abbreviated option, a missing or invalid duration, a
+ * missing or empty user name, an invalid lock name or number of slots,
+ * a missing or empty path, too many paths, a missing or invalid process
+ * ID, --kill-after without --timeout, both --lock and --slots, or more
+ * than one file operation, -1 is returned and *argsp is left unchanged.
  */
 int parse_args(int argc, const char *const *argv,
                struct options *opts, const char *const **argsp);
 
+/*
+ * Split args, a NULL-terminated command and arguments, into the stages of a
+ * pipeline by replacing each delimiter with NULL.
+ *
+ * Stores the start of each stage in stages and returns the number of
+ * stages, or -1 if any stage is empty or there are more than maxstages.
+ */
+int split_pipeline(const char **args, const char *delimiter,
+                   const char **stages[], int maxstages);
+
+/*
+ * Parse a duration as timeout(1) does: a non-negative decimal number of
+ * seconds, optionally followed by s, m, h or d for seconds, minutes, hours
+ * or days, e.g. "30" or "1.5m".
+ *
+ * Stores it in *msp, rounded up to a whole millisecond, and returns 0, or
+ * returns -1 if s is not a duration (or is too long to wait for).
+ */
+int parse_duration(const char *s, long *msp);
+
 #endif
 /* vim: set ts=4 sw=4 tw=0 et:*/
@@ -22,6 +22,18 @@ void test_defaults(void)
     assert(parse_args(2, argv, &opts, &rest) == 0);
     assert(opts.set_home == 1);
     assert(opts.debug == 0);
+    assert(opts.record == 0);
+    assert(opts.resolve == 0);
+    assert(opts.timeout_ms == 0);
+    assert(opts.kill_after_ms == DEFAULT_KILL_AFTER_MS);
+    assert(opts.pipeline == 0);
+    assert(opts.user == NULL);
+    assert(opts.lock[0] == '\0');
+    assert(opts.slots == 0);
+    assert(opts.every_ms == 0);
+    assert(opts.nwatch == 0);
+    assert(opts.fileop == FILEOP_NONE);
+    assert(opts.low_memory == 0);
     assert(rest_count(argv, 2, rest) == 1);
     assert(strcmp(rest[0], "ls") == 0);
 }
@@ -66,6 +78,350 @@ void test_home_overrides_nohome(void)
     assert(opts.set_home == 1);
 }
 
+void test_record(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const argv[] = {"root", "--record", "ls", NULL};
+    struct options opts;
+    const char *const *rest;
+    assert(parse_args(3, argv, &opts, &rest) == 0);
+    assert(opts.record == 1);
+    assert(strcmp(rest[0], "ls") == 0);
+}
+
+void test_resolve(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const argv[] = {"root", "--resolve", "ls", "cat", NULL};
+    const char *const bare[] = {"root", "--resolve", NULL};
+    struct options opts;
+    const char *const *rest;
+    assert(parse_args(4, argv, &opts, &rest) == 0);
+    assert(opts.resolve == 1);
+    assert(rest_count(argv, 4, rest) == 2);
+
+    assert(parse_args(2, bare, &opts, &rest) == 0);
+    assert(opts.resolve == 1);
+    assert(rest[0] == NULL);
+}
+
+void test_low_memory(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const argv[] = {"root", "--low-memory", "-d", "kill", "-9", "1234", NULL};
+    const char *const abbreviated[] = {"root", "--low", "kill", NULL};
+    struct options opts;
+    const char *const *rest;
+    assert(parse_args(6, argv, &opts, &rest) == 0);
+    assert(opts.low_memory == 1);
+    assert(opts.debug == 1);
+    assert(rest_count(argv, 6, rest) == 3);
+
+    assert(parse_args(3, abbreviated, &opts, &rest) == -1);
+}
+
+void test_pipeline(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const plain[] = {"root", "--pipeline", "ls", "::", "wc", NULL};
+    const char *const custom[] = {"root", "--pipeline=|", "ls", "|", "wc", NULL};
+    const char *const empty[] = {"root", "--pipeline=", "ls", NULL};
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(5, plain, &opts, &rest) == 0);
+    assert(opts.pipeline == 1);
+    assert(strcmp(opts.delimiter, DEFAULT_PIPELINE_DELIMITER) == 0);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(5, custom, &opts, &rest) == 0);
+    assert(opts.pipeline == 1);
+    assert(strcmp(opts.delimiter, "|") == 0);
+
+    assert(parse_args(3, empty, &opts, &rest) == -1);
+}
+
+void test_user(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const separate[] = {"root", "-u", "svc", "ls", NULL};
+    const char *const attached[] = {"root", "-usvc", "ls", NULL};
+    const char *const combined[] = {"root", "-dHu", "svc", "ls", NULL};
+    const char *const longform[] = {"root", "--user=svc", "ls", NULL};
+    const char *const longsep[] = {"root", "--user", "svc", "ls", NULL};
+    const char *const missing[] = {"root", "-u", NULL};
+    const char *const empty[] = {"root", "--user=", "ls", NULL};
+    const char *const abbrev[] = {"root", "--us=svc", "ls", NULL};
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(4, separate, &opts, &rest) == 0);
+    assert(strcmp(opts.user, "svc") == 0);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(3, attached, &opts, &rest) == 0);
+    assert(strcmp(opts.user, "svc") == 0);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(4, combined, &opts, &rest) == 0);
+    assert(opts.debug == 1);
+    assert(opts.set_home == 0);
+    assert(strcmp(opts.user, "svc") == 0);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(3, longform, &opts, &rest) == 0);
+    assert(strcmp(opts.user, "svc") == 0);
+    assert(parse_args(4, longsep, &opts, &rest) == 0);
+    assert(strcmp(opts.user, "svc") == 0);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(2, missing, &opts, &rest) == -1);
+    assert(parse_args(3, empty, &opts, &rest) == -1);
+    assert(parse_args(3, abbrev, &opts, &rest) == -1);
+}
+
+void test_lock(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const lock[] = {"root", "--lock", "apt", "apt-get", NULL};
+    const char *const lockeq[] = {"root", "--lock=apt", "apt-get", NULL};
+    const char *const slots[] = {"root", "--slots", "builds:4", "make", NULL};
+    const char *const slotseq[] = {"root", "--slots=builds:64", "make", NULL};
+    const char *const both[] = {"root", "--lock=a", "--slots=b:2", "ls", NULL};
+    const char *const badname[] = {"root", "--lock=a/b", "ls", NULL};
+    const char *const colon[] = {"root", "--lock=a:1", "ls", NULL};
+    const char *const nocount[] = {"root", "--slots=builds", "ls", NULL};
+    const char *const zero[] = {"root", "--slots=builds:0", "ls", NULL};
+    const char *const toomany[] = {"root", "--slots=builds:65", "ls", NULL};
+    const char *const junk[] = {"root", "--slots=builds:2x", "ls", NULL};
+    const char *const noname[] = {"root", "--slots=:2", "ls", NULL};
+    const char *const missing[] = {"root", "--lock", NULL};
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(4, lock, &opts, &rest) == 0);
+    assert(strcmp(opts.lock, "apt") == 0);
+    assert(opts.slots == 1);
+    assert(strcmp(rest[0], "apt-get") == 0);
+    assert(parse_args(3, lockeq, &opts, &rest) == 0);
+    assert(strcmp(opts.lock, "apt") == 0);
+
+    assert(parse_args(4, slots, &opts, &rest) == 0);
+    assert(strcmp(opts.lock, "builds") == 0);
+    assert(opts.slots == 4);
+    assert(strcmp(rest[0], "make") == 0);
+    assert(parse_args(3, slotseq, &opts, &rest) == 0);
+    assert(opts.slots == 64);
+
+    assert(parse_args(4, both, &opts, &rest) == -1);
+    assert(parse_args(3, badname, &opts, &rest) == -1);
+    assert(parse_args(3, colon, &opts, &rest) == -1);
+    assert(parse_args(3, nocount, &opts, &rest) == -1);
+    assert(parse_args(3, zero, &opts, &rest) == -1);
+    assert(parse_args(3, toomany, &opts, &rest) == -1);
+    assert(parse_args(3, junk, &opts, &rest) == -1);
+    assert(parse_args(3, noname, &opts, &rest) == -1);
+    assert(parse_args(2, missing, &opts, &rest) == -1);
+}
+
+void test_repeat(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const every[] = {"root", "--every", "5", "check", NULL};
+    const char *const everyeq[] = {"root", "--every=1.5m", "check", NULL};
+    const char *const zero[] = {"root", "--every=0", "check", NULL};
+    const char *const bad[] = {"root", "--every=soon", "check", NULL};
+    const char *const change[] = {"root", "--on-change", "/etc/a", "--on-change=/etc/b",
+                                  "reload", NULL};
+    const char *const both[] = {"root", "--every=1h", "--on-change=/etc/a", "reload", NULL};
+    const char *const empty[] = {"root", "--on-change=", "reload", NULL};
+    const char *const missing[] = {"root", "--on-change", NULL};
+    const char *many[REPEAT_MAX_PATHS + 3];
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(4, every, &opts, &rest) == 0);
+    assert(opts.every_ms == 5000);
+    assert(strcmp(rest[0], "check") == 0);
+    assert(parse_args(3, everyeq, &opts, &rest) == 0);
+    assert(opts.every_ms == 90000);
+    assert(parse_args(3, zero, &opts, &rest) == -1);
+    assert(parse_args(3, bad, &opts, &rest) == -1);
+
+    assert(parse_args(5, change, &opts, &rest) == 0);
+    assert(opts.nwatch == 2);
+    assert(strcmp(opts.watch[0], "/etc/a") == 0);
+    assert(strcmp(opts.watch[1], "/etc/b") == 0);
+    assert(strcmp(rest[0], "reload") == 0);
+
+    assert(parse_args(4, both, &opts, &rest) == 0);
+    assert(opts.every_ms == 3600000);
+    assert(opts.nwatch == 1);
+
+    assert(parse_args(3, empty, &opts, &rest) == -1);
+    assert(parse_args(2, missing, &opts, &rest) == -1);
+
+    many[0] = "root";
+    for (int i = 1; i <= REPEAT_MAX_PATHS + 1; i++) {
+        many[i] = "--on-change=/etc/a";
+    }
+    many[REPEAT_MAX_PATHS + 2] = NULL;
+    assert(parse_args(REPEAT_MAX_PATHS + 1, many, &opts, &rest) == 0);
+    assert(opts.nwatch == REPEAT_MAX_PATHS);
+    assert(parse_args(REPEAT_MAX_PATHS + 2, many, &opts, &rest) == -1);
+}
+
+void test_fileops(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const writing[] = {"root", "--write", "/etc/motd", NULL};
+    const char *const appending[] = {"root", "-u", "svc", "--append=/var/log/x", NULL};
+    const char *const reading[] = {"root", "--read", "/var/log/secure", "extra", NULL};
+    const char *const copying[] = {"root", "--copy", "a", "/etc/b", "-d", NULL};
+    const char *const copyshort[] = {"root", "--copy", "a", NULL};
+    const char *const copyeq[] = {"root", "--copy=a", "b", NULL};
+    const char *const empty[] = {"root", "--write=", NULL};
+    const char *const missing[] = {"root", "--read", NULL};
+    const char *const two[] = {"root", "--write", "a", "--read", "b", NULL};
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(3, writing, &opts, &rest) == 0);
+    assert(opts.fileop == FILEOP_WRITE);
+    assert(strcmp(opts.files[0], "/etc/motd") == 0);
+    assert(rest[0] == NULL);
+
+    assert(parse_args(4, appending, &opts, &rest) == 0);
+    assert(opts.fileop == FILEOP_APPEND);
+    assert(strcmp(opts.files[0], "/var/log/x") == 0);
+    assert(strcmp(opts.user, "svc") == 0);
+
+    /* the caller decides what to make of anything after it */
+    assert(parse_args(4, reading, &opts, &rest) == 0);
+    assert(opts.fileop == FILEOP_READ);
+    assert(strcmp(rest[0], "extra") == 0);
+
+    assert(parse_args(5, copying, &opts, &rest) == 0);
+    assert(opts.fileop == FILEOP_COPY);
+    assert(strcmp(opts.files[0], "a") == 0);
+    assert(strcmp(opts.files[1], "/etc/b") == 0);
+    assert(opts.debug);
+
+    assert(parse_args(3, copyshort, &opts, &rest) == -1);
+    assert(parse_args(3, copyeq, &opts, &rest) == -1);
+    assert(parse_args(2, empty, &opts, &rest) == -1);
+    assert(parse_args(2, missing, &opts, &rest) == -1);
+    assert(parse_args(5, two, &opts, &rest) == -1);
+}
+
+void test_ns(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const ns[] = {"root", "--ns", "1234", "ps", NULL};
+    const char *const eq[] = {"root", "--ns=1", "ps", NULL};
+    const char *const zero[] = {"root", "--ns", "0", "ps", NULL};
+    const char *const negative[] = {"root", "--ns", "-5", "ps", NULL};
+    const char *const name[] = {"root", "--ns", "web", "ps", NULL};
+    const char *const huge[] = {"root", "--ns", "99999999999", "ps", NULL};
+    const char *const missing[] = {"root", "--ns", NULL};
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(1, ns, &opts, &rest) == 0);
+    assert(opts.ns_pid == 0);
+
+    assert(parse_args(4, ns, &opts, &rest) == 0);
+    assert(opts.ns_pid == 1234);
+    assert(strcmp(rest[0], "ps") == 0);
+
+    assert(parse_args(3, eq, &opts, &rest) == 0);
+    assert(opts.ns_pid == 1);
+
+    assert(parse_args(4, zero, &opts, &rest) == -1);
+    assert(parse_args(4, negative, &opts, &rest) == -1);
+    assert(parse_args(4, name, &opts, &rest) == -1);
+    assert(parse_args(4, huge, &opts, &rest) == -1);
+    assert(parse_args(2, missing, &opts, &rest) == -1);
+}
+
+void test_split_pipeline(void)
+{
+    printf("Running %s\n", __func__);
+    const char *args[] = {"grep", "-v", "x", "::", "sort", "::", "uniq", "-c", NULL};
+    const char **stages[4];
+
+    assert(split_pipeline(args, "::", stages, 4) == 3);
+    assert(strcmp(stages[0][0], "grep") == 0);
+    assert(strcmp(stages[0][2], "x") == 0 && stages[0][3] == NULL);
+    assert(strcmp(stages[1][0], "sort") == 0 && stages[1][1] == NULL);
+    assert(strcmp(stages[2][0], "uniq") == 0 && stages[2][2] == NULL);
+
+    const char *single[] = {"ls", NULL};
+    assert(split_pipeline(single, "::", stages, 4) == 1);
+    assert(stages[0] == single);
+
+    const char *leading[] = {"::", "ls", NULL};
+    const char *trailing[] = {"ls", "::", NULL};
+    const char *doubled[] = {"ls", "::", "::", "wc", NULL};
+    const char *none[] = {NULL};
+    const char *toomany[] = {"a", "::", "b", "::", "c", NULL};
+    assert(split_pipeline(leading, "::", stages, 4) == -1);
+    assert(split_pipeline(trailing, "::", stages, 4) == -1);
+    assert(split_pipeline(doubled, "::", stages, 4) == -1);
+    assert(split_pipeline(none, "::", stages, 4) == -1);
+    assert(split_pipeline(toomany, "::", stages, 2) == -1);
+}
+
+void test_timeout(void)
+{
+    printf("Running %s\n", __func__);
+    const char *const separate[] = {"root", "--timeout", "1.5m", "ls", NULL};
+    const char *const joined[] = {"root", "--timeout=30", "--kill-after=2s", "ls", NULL};
+    const char *const missing[] = {"root", "--timeout", NULL};
+    const char *const invalid[] = {"root", "--timeout=soon", "ls", NULL};
+    const char *const alone[] = {"root", "--kill-after", "5", "ls", NULL};
+    struct options opts;
+    const char *const *rest;
+
+    assert(parse_args(4, separate, &opts, &rest) == 0);
+    assert(opts.timeout_ms == 90000);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(4, joined, &opts, &rest) == 0);
+    assert(opts.timeout_ms == 30000);
+    assert(opts.kill_after_ms == 2000);
+    assert(strcmp(rest[0], "ls") == 0);
+
+    assert(parse_args(2, missing, &opts, &rest) == -1);
+    assert(parse_args(3, invalid, &opts, &rest) == -1);
+    assert(parse_args(4, alone, &opts, &rest) == -1);
+}
+
+void test_parse_duration(void)
+{
+    printf("Running %s\n", __func__);
+    long ms;
+
+    assert(parse_duration("0", &ms) == 0 && ms == 0);
+    assert(parse_duration("10", &ms) == 0 && ms == 10000);
+    assert(parse_duration("0.25s", &ms) == 0 && ms == 250);
+    assert(parse_duration(".5", &ms) == 0 && ms == 500);
+    assert(parse_duration("2m", &ms) == 0 && ms == 120000);
+    assert(parse_duration("1h", &ms) == 0 && ms == 3600000);
+    assert(parse_duration("1d", &ms) == 0 && ms == 86400000);
+    /* rounded up, so a tiny timeout is still a timeout */
+    assert(parse_duration("0.0001", &ms) == 0 && ms == 1);
+
+    assert(parse_duration("", &ms) == -1);
+    assert(parse_duration("s", &ms) == -1);
+    assert(parse_duration("-1", &ms) == -1);
+    assert(parse_duration("+1", &ms) == -1);
+    assert(parse_duration("inf", &ms) == -1);
+    assert(parse_duration("1x", &ms) == -1);
+    assert(parse_duration("1ms", &ms) == -1);
+    assert(parse_duration("1e300", &ms) == -1);
+}
+
 void test_combined_short_options(void)
 {
     printf("Running %s\n", __func__);
@@ -135,12 +491,14 @@ void test_rejects_abbreviated_long_options(void)
     const char *const deb[]   = {"root", "--deb", "ls", NULL};
     const char *const nohom[] = {"root", "--nohom", "ls", NULL};
     const char *const hom[]   = {"root", "--hom", "ls", NULL};
+    const char *const tim[]   = {"root", "--time=5", "ls", NULL};
     struct options opts;
     const char *const *rest;
 
     assert(parse_args(3, deb, &opts, &rest) == -1);
     assert(parse_args(3, nohom, &opts, &rest) == -1);
     assert(parse_args(3, hom, &opts, &rest) == -1);
+    assert(parse_args(3, tim, &opts, &rest) == -1);
 }
 
 int main(int argc, const char *argv[])
@@ -149,6 +507,18 @@ int main(int argc, const char *argv[])
     test_debug_long_and_short();
     test_nohome();
     test_home_overrides_nohome();
+    test_record();
+    test_resolve();
+    test_low_memory();
+    test_pipeline();
+    test_user();
+    test_lock();
+    test_repeat();
+    test_fileops();
+    test_ns();
+    test_split_pipeline();
+    test_timeout();
+    test_parse_duration();
     test_combined_short_options();
     test_stops_at_first_non_option();
     test_double_dash_separator();
@@ -0,0 +1,180 @@
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coalesce.h"
+#include "digest.h"
+#include "statefile.h"
+
+int coalesce_open(struct coalesce *c, const char *path)
+{
+    c->fd = -1;
+    c->table = statefile_map_existing(path, sizeof(struct coalesce_table), &c->fd);
+    return c->table != NULL ? 0 : -1;
+}
+
+void coalesce_close(struct coalesce *c)
+{
+    if (c->table != NULL) {
+        munmap(c->table, sizeof(*c->table));
+        c->table = NULL;
+    }
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+void coalesce_key(const char *record,
+                  const char *const *args,
+                  unsigned char key[DIGEST_SIZE])
+{
+    struct digest d;
+    digest_init(&d);
+    digest_update(&d, record, strlen(record) + 1);
+    for (size_t i = 0; args[i] != NULL; i++) {
+        digest_update(&d, args[i], strlen(args[i]) + 1);
+    }
+    digest_final(&d, key);
+}
+
+/*
+ * Copy text into dst, which holds COALESCE_TEXT_MAX bytes, ending it with
+ * "..." if it doesn't fit, cut before a UTF-8 continuation byte.
+ */
+static void keep_text(char *dst, const char *text)
+{
+    size_t len = strlen(text);
+    if (len < COALESCE_TEXT_MAX) {
+        memcpy(dst, text, len + 1);
+        return;
+    }
+    len = COALESCE_TEXT_MAX - 4;
+    while (len > 0 && (text[len] & 0xc0) == 0x80) {
+        len--;
+    }
+    memcpy(dst, text, len);
+    memcpy(dst + len, "...", 4);
+}
+
+static int window_open(const struct coalesce_entry *e, uint64_t now_ms)
+{
+    /* behind us is a reboot, which /run doesn't survive anyway */
+    return now_ms >= e->window_ms && now_ms - e->window_ms < COALESCE_WINDOW_MS;
+}
+
+/*
+ * Tell e's counts into summary and forget them.
+ */
+static void tell(struct coalesce_entry *e, struct coalesce_summary *summary)
+{
+    summary->uid = (uid_t)(e->uid_plus1 - 1);
+    summary->count = e->count;
+    summary->min_us = e->min_us;
+    summary->mean_us = e->total_us / e->count;
+    summary->max_us = e->max_us;
+    memcpy(summary->record, e->record, sizeof(summary->record));
+    memcpy(summary->args, e->args, sizeof(summary->args));
+    e->count = 0;
+    e->total_us = e->min_us = e->max_us = 0;
+}
+
+/*
+ * A free entry, or else the one idle longest, is reused first.  Entries
+ * with counts still to be told are never reused.
+ */
+static int better_to_reuse(const struct coalesce_entry *e,
+                           const struct coalesce_entry *than)
+{
+    if (than->uid_plus1 == 0) {
+        return 0;
+    }
+    return e->uid_plus1 == 0 || e->last_ms < than->last_ms;
+}
+
+/* whether e has counts whose window has closed */
+static int expired(const struct coalesce_entry *e, uint64_t now_ms)
+{
+    return e->count > 0 && !window_open(e, now_ms);
+}
+
+static void count(struct coalesce_entry *e, uint64_t now_ms, uint64_t us)
+{
+    if (e->count == 0 || us < e->min_us) {
+        e->min_us = us;
+    }
+    if (us > e->max_us) {
+        e->max_us = us;
+    }
+    e->count++;
+    e->total_us += us;
+    e->last_ms = now_ms;
+}
+
+int coalesce_admit(struct coalesce *c,
+                   uid_t uid,
+                   const unsigned char key[DIGEST_SIZE],
+                   const char *record,
+                   const char *args,
+                   uint64_t now_ms,
+                   uint64_t us,
+                   struct coalesce_summary *summaries,
+                   int *nsummariesp)
+{
+    *nsummariesp = 0;
+    if (c->table == NULL || flock(c->fd, LOCK_EX|LOCK_NB) == -1) {
+        return 1;
+    }
+
+    uint32_t uid_plus1 = (uint32_t)uid + 1;
+    uint32_t own = (uint32_t)(uid_plus1 * 2654435761u) % COALESCE_SETS;
+    struct coalesce_entry *set = c->table->entries[own];
+    struct coalesce_entry *found = NULL, *reuse = NULL;
+
+    for (int i = 0; i < COALESCE_WAYS; i++) {
+        struct coalesce_entry *e = &set[i];
+        if (e->uid_plus1 == uid_plus1 && memcmp(e->key, key, DIGEST_SIZE) == 0) {
+            found = e;
+        }
+        /* whoever's they are, so a user who stops running root is told */
+        if (expired(e, now_ms)) {
+            tell(e, &summaries[(*nsummariesp)++]);
+        }
+        if (e->count == 0 && (reuse == NULL || better_to_reuse(e, reuse))) {
+            reuse = e;
+        }
+    }
+
+    int full = 1;
+    if (found != NULL && window_open(found, now_ms)) {
+        count(found, now_ms, us);
+        full = 0;
+    }
+    else {
+        struct coalesce_entry *e = found != NULL ? found : reuse;
+        if (e != NULL) {
+            memcpy(e->key, key, DIGEST_SIZE);
+            e->uid_plus1 = uid_plus1;
+            e->window_ms = e->last_ms = now_ms;
+            keep_text(e->record, record);
+            keep_text(e->args, args);
+        }
+    }
+
+    /* and those of users whose sets no one else has run in since */
+    for (uint32_t s = 1; s < COALESCE_SETS && *nsummariesp < COALESCE_WAYS; s++) {
+        struct coalesce_entry *other = c->table->entries[(own + s) % COALESCE_SETS];
+        for (int i = 0; i < COALESCE_WAYS && *nsummariesp < COALESCE_WAYS; i++) {
+            if (expired(&other[i], now_ms)) {
+                tell(&other[i], &summaries[(*nsummariesp)++]);
+            }
+        }
+    }
+
+    flock(c->fd, LOCK_UN);
+    return full;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
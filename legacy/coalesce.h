@@ -0,0 +1,140 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "digest.h"
+
+/*
+ * Coalesced Running records, for callers such as monitoring agents that
+ * run the same command every few seconds.
+ *
+ * A run is logged in full (its Running and Arguments records) the first
+ * time in a window of COALESCE_WINDOW_MS.  Later runs in the window by the
+ * same user with the same records are only counted, and the count, with
+ * how long root took for them, is logged as one summary record by the
+ * first run of anyone after the window closes.  Refusals are never
+ * coalesced.
+ */
+
+/*
+ * where the counts are kept
+ *
+ * root never creates it: coalescing is on while it exists, e.g. after
+ * "install -m 600 /dev/null /run/root/coalesce" or the tmpfiles.d(5) line
+ * "f /run/root/coalesce 0600 root root -".  Override at build time, e.g.
+ * make CFLAGS+=-DCOALESCE_PATH='"/var/run/root.coalesce"'
+ */
+#ifndef COALESCE_PATH
+#define COALESCE_PATH "/run/root/coalesce"
+#endif
+
+/*
+ * how long after a run is logged in full the same runs are only counted
+ */
+#ifndef COALESCE_WINDOW_MS
+#define COALESCE_WINDOW_MS 60000
+#endif
+
+/*
+ * the table: each user's commands share one of COALESCE_SETS sets of
+ * COALESCE_WAYS entries, so every run need only look at one set
+ */
+#define COALESCE_SETS 16
+#define COALESCE_WAYS 16
+
+/*
+ * how much of the Running record, and of the arguments (see format_args),
+ * an entry keeps for its summary, including the terminating NUL
+ */
+#define COALESCE_TEXT_MAX 256
+
+struct coalesce_entry {
+    unsigned char key[DIGEST_SIZE];     /* see coalesce_key */
+    uint32_t uid_plus1;         /* 0 if the entry is free */
+    uint32_t count;             /* runs counted, not logged, in the window */
+    uint64_t window_ms;         /* when the last run logged in full was */
+    uint64_t last_ms;           /* the last run, to choose one to reuse */
+    uint64_t total_us;          /* how long root took for the counted runs */
+    uint64_t min_us;
+    uint64_t max_us;
+    char record[COALESCE_TEXT_MAX];
+    char args[COALESCE_TEXT_MAX];
+};
+
+/*
+ * The shared state, exactly as it is in the file; a file of zeros is the
+ * initial state.
+ *
+ * Every process maps the same pages and changes them only while it holds
+ * flock(2) on the file.  It never waits for the lock: a run that can't
+ * have it at once is logged in full, so a stuck root costs log volume,
+ * never a run, and a killed one releases it.
+ */
+struct coalesce_table {
+    struct coalesce_entry entries[COALESCE_SETS][COALESCE_WAYS];
+};
+
+struct coalesce {
+    struct coalesce_table *table;
+    int fd;
+};
+
+/* what a summary record says about one entry's window */
+struct coalesce_summary {
+    uid_t uid;                  /* whose runs they were */
+    unsigned long count;
+    unsigned long min_us;
+    unsigned long mean_us;
+    unsigned long max_us;
+    char record[COALESCE_TEXT_MAX];
+    char args[COALESCE_TEXT_MAX];
+};
+
+/*
+ * Map the table at path, which must exist.
+ *
+ * Returns 0 on success, or -1 with errno set.  ENOENT means coalescing is
+ * off, EPERM that the file is not a regular file owned by us and
+ * inaccessible to anyone else, and EINVAL that it is the wrong size.
+ */
+int coalesce_open(struct coalesce *c, const char *path);
+void coalesce_close(struct coalesce *c);
+
+/*
+ * Set key to what identifies the run whose Running record is record and
+ * whose arguments are the NULL-terminated args: the BLAKE3 digest of each
+ * followed by a NUL byte.
+ */
+void coalesce_key(const char *record,
+                  const char *const *args,
+                  unsigned char key[DIGEST_SIZE]);
+
+/*
+ * Whether uid's run with key, which took root us microseconds, at now_ms
+ * (CLOCK_MONOTONIC), should be logged in full.
+ *
+ * Returns 1 if so: it is the first in its window, or can't be counted
+ * (the table is busy, or the user's set is full of counts still to be
+ * told).  record and args are then kept, cut down to fit, for its
+ * summary.  Returns 0 if the run was counted instead.
+ *
+ * summaries (which holds COALESCE_WAYS) is filled with the windows, of
+ * any user, that have closed since they were last told: all of those in
+ * uid's set, including this key's, then as many from the other sets as
+ * there is room for, the rest being left for later runs.  *nsummariesp is
+ * set to how many; those counts are forgotten, so log them.
+ */
+int coalesce_admit(struct coalesce *c,
+                   uid_t uid,
+                   const unsigned char key[DIGEST_SIZE],
+                   const char *record,
+                   const char *args,
+                   uint64_t now_ms,
+                   uint64_t us,
+                   struct coalesce_summary *summaries,
+                   int *nsummariesp);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,328 @@
+#define _DEFAULT_SOURCE /* for mkdtemp() and flock(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() and flock() */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coalesce.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char path[512];
+
+/* an arbitrary time well after boot */
+#define START_MS 1000000
+
+static const char *const args[] = { "smartctl", "-a", "/dev/sda", NULL };
+
+static void open_fresh(struct coalesce *c)
+{
+    unlink(path);
+    int fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0600);
+    assert(fd != -1);
+    close(fd);
+    assert(coalesce_open(c, path) == 0);
+}
+
+/*
+ * admit uid's run of record with args, and return whether it was logged
+ * in full; *nsummariesp is how many summaries it came with
+ */
+static int run(struct coalesce *c, uid_t uid, const char *record, uint64_t now_ms,
+               uint64_t us, struct coalesce_summary *summaries, int *nsummariesp)
+{
+    unsigned char key[DIGEST_SIZE];
+    coalesce_key(record, args, key);
+    return coalesce_admit(c, uid, key, record, "smartctl -a /dev/sda", now_ms, us,
+                          summaries, nsummariesp);
+}
+
+void test_off_unless_present(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+
+    unlink(path);
+    errno = 0;
+    assert(coalesce_open(&c, path) == -1);
+    assert(errno == ENOENT);
+    assert(access(path, F_OK) == -1);
+
+    /* an empty file turns it on, and is sized */
+    open_fresh(&c);
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    assert((size_t)st.st_size == sizeof(struct coalesce_table));
+    coalesce_close(&c);
+}
+
+void test_counts_repeats(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    open_fresh(&c);
+
+    assert(run(&c, 1000, "Running /usr/sbin/smartctl", START_MS, 5, summaries, &n) == 1);
+    assert(n == 0);
+    for (int i = 1; i <= 3; i++) {
+        assert(run(&c, 1000, "Running /usr/sbin/smartctl", START_MS + i, i * 10,
+                   summaries, &n) == 0);
+        assert(n == 0);
+    }
+
+    /* the same by someone else, or with other records, is logged */
+    assert(run(&c, 2000, "Running /usr/sbin/smartctl", START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, "Running /usr/sbin/smartctl (as svc)", START_MS, 5,
+               summaries, &n) == 1);
+    unsigned char key[DIGEST_SIZE];
+    coalesce_key("Running /usr/sbin/smartctl", (const char *const[]){ "smartctl", NULL }, key);
+    assert(coalesce_admit(&c, 1000, key, "Running /usr/sbin/smartctl", "smartctl",
+                          START_MS, 5, summaries, &n) == 1);
+
+    /* once the window closes, logged again, after the summary */
+    uint64_t later = START_MS + COALESCE_WINDOW_MS;
+    assert(run(&c, 1000, "Running /usr/sbin/smartctl", later, 5, summaries, &n) == 1);
+    assert(n == 1);
+    assert(summaries[0].count == 3);
+    assert(summaries[0].min_us == 10);
+    assert(summaries[0].mean_us == 20);
+    assert(summaries[0].max_us == 30);
+    assert(strcmp(summaries[0].record, "Running /usr/sbin/smartctl") == 0);
+    assert(strcmp(summaries[0].args, "smartctl -a /dev/sda") == 0);
+
+    /* and the next window starts counting afresh */
+    assert(run(&c, 1000, "Running /usr/sbin/smartctl", later + 1, 7, summaries, &n) == 0);
+    assert(n == 0);
+
+    coalesce_close(&c);
+}
+
+void test_summary_by_next_run(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    open_fresh(&c);
+
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 0);
+    assert(run(&c, 1000, "Running /bin/b", START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, "Running /bin/b", START_MS, 5, summaries, &n) == 0);
+
+    /* /bin/a stopped, but the user's next run of anything tells of it */
+    uint64_t later = START_MS + COALESCE_WINDOW_MS;
+    assert(run(&c, 1000, "Running /bin/c", later, 5, summaries, &n) == 1);
+    assert(n == 2);
+    assert(summaries[0].count == 1 && summaries[1].count == 1);
+    assert(strcmp(summaries[0].record, summaries[1].record) != 0);
+
+    /* only once */
+    assert(run(&c, 1000, "Running /bin/c", later, 5, summaries, &n) == 0);
+    assert(n == 0);
+
+    coalesce_close(&c);
+}
+
+void test_quiet_user(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    open_fresh(&c);
+
+    /* 1000 repeats a command, then never runs root again */
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 7, summaries, &n) == 0);
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 9, summaries, &n) == 0);
+
+    /* still counting while the window is open */
+    assert(run(&c, 2000, "Running /bin/b", START_MS + 1, 5, summaries, &n) == 1);
+    assert(n == 0);
+    coalesce_close(&c);
+
+    /* after it, anyone's next run tells of it, whichever set theirs is */
+    uint64_t later = START_MS + COALESCE_WINDOW_MS;
+    for (uid_t uid = 2001; uid < 2001 + COALESCE_SETS; uid++) {
+        open_fresh(&c);
+        assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 1);
+        assert(run(&c, 1000, "Running /bin/a", START_MS, 7, summaries, &n) == 0);
+        assert(run(&c, 1000, "Running /bin/a", START_MS, 9, summaries, &n) == 0);
+        assert(run(&c, uid, "Running /bin/b", later, 5, summaries, &n) == 1);
+        assert(n == 1);
+        assert(summaries[0].uid == 1000);
+        assert(summaries[0].count == 2);
+        assert(summaries[0].min_us == 7 && summaries[0].max_us == 9);
+        assert(strcmp(summaries[0].record, "Running /bin/a") == 0);
+
+        /* only once */
+        assert(run(&c, uid, "Running /bin/b", later, 5, summaries, &n) == 0);
+        assert(n == 0);
+        coalesce_close(&c);
+    }
+}
+
+void test_busy_table(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    open_fresh(&c);
+
+    /* as if another root were stuck holding the lock */
+    int other = open(path, O_RDWR);
+    assert(other != -1);
+    assert(flock(other, LOCK_EX) == 0);
+    for (int i = 0; i < 3; i++) {
+        assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 1);
+    }
+    close(other);
+
+    /* nothing was counted or kept while it was held */
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n) == 0);
+
+    coalesce_close(&c);
+}
+
+void test_full_set(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    char record[64];
+    open_fresh(&c);
+
+    /* counts still to be told are never thrown away to make room */
+    for (int i = 0; i < COALESCE_WAYS; i++) {
+        snprintf(record, sizeof(record), "Running /bin/%d", i);
+        assert(run(&c, 1000, record, START_MS, 5, summaries, &n) == 1);
+        assert(run(&c, 1000, record, START_MS, 5, summaries, &n) == 0);
+    }
+    assert(run(&c, 1000, "Running /bin/new", START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, "Running /bin/new", START_MS, 5, summaries, &n) == 1);
+
+    /* once they are told, there is */
+    uint64_t later = START_MS + COALESCE_WINDOW_MS;
+    assert(run(&c, 1000, "Running /bin/new", later, 5, summaries, &n) == 1);
+    assert(n == COALESCE_WAYS);
+    assert(run(&c, 1000, "Running /bin/new", later, 5, summaries, &n) == 0);
+
+    coalesce_close(&c);
+}
+
+void test_long_text(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    char record[2 * COALESCE_TEXT_MAX];
+    open_fresh(&c);
+
+    strcpy(record, "Running /");
+    memset(record + strlen(record), 'x', COALESCE_TEXT_MAX);
+    record[sizeof(record) - 1] = '\0';
+    assert(run(&c, 1000, record, START_MS, 5, summaries, &n) == 1);
+    assert(run(&c, 1000, record, START_MS, 5, summaries, &n) == 0);
+    assert(run(&c, 1000, record, START_MS + COALESCE_WINDOW_MS, 5, summaries, &n) == 1);
+    assert(n == 1);
+    assert(strlen(summaries[0].record) == COALESCE_TEXT_MAX - 1);
+    assert(strncmp(summaries[0].record, record, COALESCE_TEXT_MAX - 4) == 0);
+    assert(strcmp(summaries[0].record + COALESCE_TEXT_MAX - 4, "...") == 0);
+
+    coalesce_close(&c);
+}
+
+void test_concurrent_processes(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+    struct coalesce_summary summaries[COALESCE_WAYS];
+    int n;
+    int full = 0;
+    open_fresh(&c);
+
+    /* each child reports how many it logged in full in its exit status */
+    for (int i = 0; i < 8; i++) {
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            int mine = 0;
+            for (int j = 0; j < 200; j++) {
+                mine += run(&c, 1000, "Running /bin/a", START_MS, 5, summaries, &n);
+            }
+            _exit(mine);
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        int status;
+        assert(wait(&status) != -1);
+        assert(WIFEXITED(status));
+        full += WEXITSTATUS(status);
+    }
+    assert(full >= 1);
+
+    /* every run was either logged or counted */
+    assert(run(&c, 1000, "Running /bin/a", START_MS + COALESCE_WINDOW_MS, 5,
+               summaries, &n) == 1);
+    unsigned long counted = n == 1 ? summaries[0].count : 0;
+    assert(full + counted == 8 * 200);
+
+    coalesce_close(&c);
+}
+
+void test_rejects_unsafe_state(void)
+{
+    printf("Running %s\n", __func__);
+    struct coalesce c;
+
+    unlink(path);
+    int fd = open(path, O_WRONLY|O_CREAT, 0600);
+    assert(fd != -1);
+    assert(write(fd, "junk", 4) == 4);
+    close(fd);
+    errno = 0;
+    assert(coalesce_open(&c, path) == -1);
+    assert(errno == EINVAL);
+
+    assert(chmod(path, 0666) == 0);
+    errno = 0;
+    assert(coalesce_open(&c, path) == -1);
+    assert(errno == EPERM);
+    unlink(path);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(path, sizeof(path), "%s/coalesce", base);
+
+    test_off_unless_present();
+    test_counts_repeats();
+    test_summary_by_next_run();
+    test_quiet_user();
+    test_busy_table();
+    test_full_set();
+    test_long_text();
+    test_concurrent_processes();
+    test_rejects_unsafe_state();
+
+    unlink(path);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,89 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <sys/types.h>
+
+#include "arena.h"
+#include "coalesce.h"
+#include "path.h"
+#include "policy.h"
+#include "ratelimit.h"
+#include "verify.h"
+
+/*
+ * The passwd entry of the user root switches to, copied out of getpwuid's
+ * static storage (into the arena) so it can be reused.
+ */
+struct nss_request;
+
+struct target_user {
+    uid_t uid;
+    gid_t gid;
+    char *name;
+    char *dir;
+};
+
+/*
+ * Everything libroot remembers between calls.
+ *
+ * There is no global state in the library: each user of it holds its own
+ * context, created with root_ctx_new (see libroot.h).  The exception is the
+ * syslog connection, which the C library keeps per process.
+ *
+ * The context and everything it points to are allocated from its arena,
+ * and released together by root_ctx_free.
+ *
+ * This header is private to the library's modules.
+ */
+struct root_ctx {
+    struct arena arena;
+
+    /* logging.c */
+    char *progname;
+    int loglevel;
+    uid_t caller_uid;           /* whom records are attributed to: the real
+                                   uid when the context was created */
+    char *username;             /* name of username_uid, for log messages */
+    uid_t username_uid;
+    const char *ratelimit_path; /* NULL for no limit */
+    int ratelimit_state;        /* -1 until opened, 0 if none, 1 if open */
+    struct ratelimit ratelimit;
+    const char *coalesce_path;  /* NULL never to coalesce */
+    int coalesce_state;         /* -1 until opened, 0 if off, 1 if open */
+    struct coalesce coalesce;
+
+    /* nss.c */
+    long nss_timeout_ms;        /* 0 to wait for NSS indefinitely */
+    int nss_degraded;           /* NSS timed out (or low_memory), so use
+                                   the files */
+    struct nss_request *nss_prefetch;   /* see nss_prefetch, or NULL */
+    const char *passwd_path;
+    const char *group_path;
+
+    /* user.c */
+    int have_target;
+    struct target_user target;
+    int target_ngroups;         /* -1 until looked up for target */
+    gid_t *target_groups;       /* primary group first */
+    int in_user_ns;             /* see root_enter */
+    int ngroups;                /* -1 until looked up */
+    gid_t *groups;              /* primary group first */
+
+    /* libroot.c */
+    int low_memory;             /* see root_set_low_memory */
+    int permitted;              /* -1 until checked */
+    int have_pathlist;
+    struct pathlist pathlist;
+    const char *policy_path;
+    int policy_state;           /* -1 until opened, 0 if none, 1 if open */
+    struct policy policy;
+    const char *manifest_path;
+    int manifest_state;         /* -1 until opened, 0 if none, 1 if open */
+    struct manifest manifest;
+    const char *digest_cache_path;      /* NULL for no cache */
+    int digest_cache_state;     /* -1 until opened, 0 if none, 1 if open */
+    struct verify_cache digest_cache;
+};
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,275 @@
+#define _DEFAULT_SOURCE /* for syscall() and waitid(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for syscall() and waitid() */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "deadline.h"
+
+/* written to by the SIGCHLD handler, where there is no pidfd */
+static int sigchld_pipe[2] = { -1, -1 };
+
+static void note_sigchld(int sig)
+{
+    int saved_errno = errno;
+    ssize_t n = write(sigchld_pipe[1], "", 1);
+    (void)n;
+    errno = saved_errno;
+}
+
+static int watch_sigchld(void)
+{
+    if (sigchld_pipe[0] != -1) {
+        return 0;
+    }
+    if (pipe(sigchld_pipe) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = note_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    return sigaction(SIGCHLD, &sa, NULL);
+}
+
+/*
+ * whether pid has exited, leaving it to be reaped
+ */
+static int has_exited(pid_t pid)
+{
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+        /* gone already, so there is nothing to wait for */
+        return errno == ECHILD;
+    }
+    return info.si_pid == pid;
+}
+
+/*
+ * a file descriptor that becomes readable when pid exits
+ */
+static int open_childfd(pid_t pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    /* pidfds are always close-on-exec */
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd != -1 || errno != ENOSYS) {
+        return fd;
+    }
+#endif
+    if (watch_sigchld() == -1) {
+        return -1;
+    }
+    return sigchld_pipe[0];
+}
+
+static int arm(struct deadline *d, long ms)
+{
+    d->armed = 1;
+#ifdef __linux__
+    if (d->timerfd != -1) {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = ms / 1000;
+        its.it_value.tv_nsec = (ms % 1000) * 1000000;
+        return timerfd_settime(d->timerfd, 0, &its, NULL);
+    }
+#endif
+    if (clock_gettime(CLOCK_MONOTONIC, &d->due) == -1) {
+        return -1;
+    }
+    d->due.tv_sec += ms / 1000;
+    d->due.tv_nsec += (ms % 1000) * 1000000;
+    if (d->due.tv_nsec >= 1000000000) {
+        d->due.tv_sec++;
+        d->due.tv_nsec -= 1000000000;
+    }
+    return 0;
+}
+
+/*
+ * milliseconds until d->due, rounded up so poll doesn't wake early
+ */
+static int time_left(const struct deadline *d)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (long long)(d->due.tv_sec - now.tv_sec) * 1000
+                 + (d->due.tv_nsec - now.tv_nsec + 999999) / 1000000;
+    if (ms < 0) {
+        return 0;
+    }
+    return ms > INT32_MAX ? INT32_MAX : (int)ms;
+}
+
+static void expire(struct deadline *d)
+{
+    d->armed = 0;
+    if (d->stage == DEADLINE_RUNNING) {
+        kill(-d->pid, SIGTERM);
+        /* a stopped process can't act on SIGTERM */
+        kill(-d->pid, SIGCONT);
+        d->stage = DEADLINE_TERMINATED;
+        if (d->kill_after_ms > 0) {
+            arm(d, d->kill_after_ms);
+            return;
+        }
+    }
+    if (d->stage == DEADLINE_TERMINATED) {
+        kill(-d->pid, SIGKILL);
+        d->stage = DEADLINE_KILLED;
+    }
+}
+
+int deadline_start(struct deadline *d,
+                   pid_t pid,
+                   long timeout_ms,
+                   long kill_after_ms)
+{
+    d->pid = pid;
+    d->kill_after_ms = kill_after_ms;
+    d->stage = DEADLINE_RUNNING;
+    d->armed = 0;
+    d->exited = 0;
+    d->timerfd = -1;
+
+    d->childfd = open_childfd(pid);
+    if (d->childfd == -1) {
+        return -1;
+    }
+    if (d->childfd == sigchld_pipe[0]) {
+        /* it may have exited before the handler was installed */
+        d->exited = has_exited(pid);
+    }
+
+    if (timeout_ms <= 0) {
+        return 0;
+    }
+#ifdef __linux__
+    d->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (d->timerfd == -1) {
+        int saved_errno = errno;
+        deadline_close(d);
+        errno = saved_errno;
+        return -1;
+    }
+#endif
+    if (arm(d, timeout_ms) == -1) {
+        int saved_errno = errno;
+        deadline_close(d);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+int deadline_poll(struct deadline *d, struct pollfd *fds, nfds_t nfds)
+{
+    struct pollfd all[DEADLINE_MAX_FDS + 2];
+    if (nfds > DEADLINE_MAX_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nfds > 0) {
+        memcpy(all, fds, nfds * sizeof(*fds));
+    }
+
+    nfds_t n = nfds;
+    int child = -1, timer = -1;
+    if (!d->exited) {
+        all[n].fd = d->childfd;
+        all[n].events = POLLIN;
+        child = n++;
+    }
+    if (d->armed && d->timerfd != -1) {
+        all[n].fd = d->timerfd;
+        all[n].events = POLLIN;
+        timer = n++;
+    }
+    if (n == 0) {
+        /* nothing left to wait for */
+        return 0;
+    }
+
+    int timeout = -1;
+    if (d->armed && d->timerfd == -1) {
+        timeout = time_left(d);
+    }
+
+    int ready = poll(all, n, timeout);
+    if (ready == -1) {
+        return -1;
+    }
+
+    if (timer != -1 && all[timer].revents != 0) {
+        uint64_t expirations;
+        ssize_t len = read(d->timerfd, &expirations, sizeof(expirations));
+        (void)len;
+        expire(d);
+    }
+    else if (d->armed && d->timerfd == -1 && time_left(d) == 0) {
+        expire(d);
+    }
+
+    if (child != -1 && all[child].revents != 0) {
+        if (d->childfd == sigchld_pipe[0]) {
+            char buf[64];
+            while (read(d->childfd, buf, sizeof(buf)) > 0) {
+                continue;
+            }
+            d->exited = has_exited(d->pid);
+        }
+        else {
+            d->exited = 1;
+        }
+    }
+
+    ready = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        fds[i].revents = all[i].revents;
+        if (fds[i].revents != 0) {
+            ready++;
+        }
+    }
+    return ready;
+}
+
+void deadline_finish(struct deadline *d)
+{
+    if (d->stage != DEADLINE_RUNNING) {
+        kill(-d->pid, SIGKILL);
+    }
+}
+
+void deadline_close(struct deadline *d)
+{
+    if (d->timerfd != -1) {
+        close(d->timerfd);
+        d->timerfd = -1;
+    }
+    if (d->childfd != -1 && d->childfd != sigchld_pipe[0]) {
+        close(d->childfd);
+    }
+    d->childfd = -1;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,77 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <sys/types.h>
+#include <poll.h>
+#include <time.h>
+
+/*
+ * the most file descriptors deadline_poll watches for its caller
+ */
+#define DEADLINE_MAX_FDS 8
+
+enum deadline_stage {
+    DEADLINE_RUNNING,       /* the deadline has not passed */
+    DEADLINE_TERMINATED,    /* SIGTERM has been sent to the process group */
+    DEADLINE_KILLED,        /* so has SIGKILL */
+};
+
+/*
+ * A child being waited for, with an optional deadline.
+ *
+ * The child must lead its own process group if there is a deadline, because
+ * when it passes the signals go to the whole group.
+ *
+ * On Linux the child is watched with a pidfd and the deadline with a
+ * timerfd, so waiting is a single poll(2) with no signal handlers involved.
+ * Elsewhere (or on kernels without pidfd_open) a SIGCHLD handler writes to
+ * a pipe, and the deadline becomes poll's timeout.
+ */
+struct deadline {
+    pid_t pid;
+    long kill_after_ms;     /* from SIGTERM to SIGKILL */
+    enum deadline_stage stage;
+    int armed;              /* the current stage has a deadline */
+    int exited;             /* the child has exited, but is not yet reaped */
+    int childfd;            /* readable once the child has exited */
+    int timerfd;            /* readable once the deadline passes, or -1 */
+    struct timespec due;    /* when it passes, without a timerfd */
+};
+
+/*
+ * Start watching pid.
+ *
+ * If timeout_ms is more than 0, SIGTERM and SIGCONT are sent to pid's
+ * process group that long from now, and SIGKILL kill_after_ms after that
+ * (straight away if kill_after_ms is 0).
+ *
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int deadline_start(struct deadline *d,
+                   pid_t pid,
+                   long timeout_ms,
+                   long kill_after_ms);
+
+/*
+ * Like poll(2) on fds with no timeout, except that it also returns once
+ * the child has exited (setting d->exited), and sends the signals above
+ * when the deadline passes (advancing d->stage).
+ *
+ * Returns the number of fds with events, possibly 0, or -1 with errno set.
+ * EINTR should be retried.
+ */
+int deadline_poll(struct deadline *d, struct pollfd *fds, nfds_t nfds);
+
+/*
+ * Once the child has exited after the deadline passed, make sure nothing
+ * it started is left behind by sending SIGKILL to its process group.
+ *
+ * Must be called before the child is reaped, so the group cannot have been
+ * reused.
+ */
+void deadline_finish(struct deadline *d);
+
+void deadline_close(struct deadline *d);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
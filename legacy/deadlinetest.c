@@ -0,0 +1,154 @@
+#define _DEFAULT_SOURCE /* for clock_gettime(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for clock_gettime() */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "deadline.h"
+
+/*
+ * Start a shell running script in a process group of its own.
+ *
+ * If outfd is not -1, it becomes the shell's stdout.
+ */
+static pid_t start_with(const char *script, int outfd)
+{
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        setpgid(0, 0);
+        if (outfd != -1) {
+            dup2(outfd, STDOUT_FILENO);
+        }
+        execl("/bin/sh", "sh", "-c", script, (char *)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    return pid;
+}
+
+static pid_t start(const char *script)
+{
+    return start_with(script, -1);
+}
+
+/*
+ * Wait as root does, returning the wait status.
+ */
+static int run(struct deadline *d)
+{
+    while (!d->exited) {
+        assert(deadline_poll(d, NULL, 0) != -1 || errno == EINTR);
+    }
+    deadline_finish(d);
+
+    int status;
+    assert(waitpid(d->pid, &status, 0) == d->pid);
+    deadline_close(d);
+    return status;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void test_exits_in_time(void)
+{
+    printf("Running %s\n", __func__);
+    struct deadline d;
+    pid_t pid = start("exit 3");
+
+    assert(deadline_start(&d, pid, 5000, 5000) == 0);
+    int status = run(&d);
+    assert(d.stage == DEADLINE_RUNNING);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+}
+
+void test_no_timeout(void)
+{
+    printf("Running %s\n", __func__);
+    struct deadline d;
+    pid_t pid = start("sleep 0.2");
+
+    assert(deadline_start(&d, pid, 0, 0) == 0);
+    assert(d.timerfd == -1);
+    int status = run(&d);
+    assert(d.stage == DEADLINE_RUNNING);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_terminates(void)
+{
+    printf("Running %s\n", __func__);
+    struct deadline d;
+    pid_t pid = start("sleep 10");
+
+    double started = now();
+    assert(deadline_start(&d, pid, 100, 5000) == 0);
+    int status = run(&d);
+    assert(now() - started < 5);
+    assert(d.stage == DEADLINE_TERMINATED);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM);
+}
+
+void test_kills_after(void)
+{
+    printf("Running %s\n", __func__);
+    struct deadline d;
+    pid_t pid = start("trap '' TERM; sleep 10; sleep 10");
+
+    double started = now();
+    assert(deadline_start(&d, pid, 100, 100) == 0);
+    int status = run(&d);
+    assert(now() - started < 5);
+    assert(d.stage == DEADLINE_KILLED);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+}
+
+void test_kills_whole_group(void)
+{
+    printf("Running %s\n", __func__);
+    struct deadline d;
+    int fds[2];
+
+    /* the shell exits when told to, leaving its child behind */
+    assert(pipe(fds) == 0);
+    pid_t pid = start_with("sh -c 'trap \"\" TERM; sleep 10' & "
+                           "trap 'exit 0' TERM; wait", fds[1]);
+    close(fds[1]);
+
+    assert(deadline_start(&d, pid, 200, 5000) == 0);
+    int status = run(&d);
+    assert(d.stage == DEADLINE_TERMINATED);
+    assert(WIFEXITED(status));
+
+    /* deadline_finish took the rest of the group, which held the pipe */
+    struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+    char c;
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(read(fds[0], &c, 1) == 0);
+    close(fds[0]);
+}
+
+int main(int argc, const char *argv[])
+{
+    test_exits_in_time();
+    test_no_timeout();
+    test_terminates();
+    test_kills_after();
+    test_kills_whole_group();
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,245 @@
+#!/bin/sh
+#
+# difftest.sh
+#
+# run the same scenarios through two builds of root and compare them
+#
+# Usage: difftest.sh <root> <other-root>
+#
+# Typically <root> is the C build (legacy/root-bench, which is legacy/root
+# that also reports the memory it allocated) and <other-root> is the Rust
+# build (target/release/root); `make difftest` does that.
+#
+# Each scenario varies PATH, the command, the options or the size of argv and
+# the environment.  For every scenario the exit status, stdout, stderr and
+# syslog messages of the two builds must match exactly, apart from the C
+# build's Arguments records; syslog is captured with testshim.so.  The
+# scenario is also timed with rootbench, and any gap in median startup
+# time, peak RSS or system calls bigger than ROOT_DIFF_THRESHOLD percent
+# (default 50) is flagged.  The memory the C
+# build allocates (arena_bytes) is shown too, but only it reports that.
+#
+# Exits 0 if nothing was flagged, 1 otherwise.
+#
+# LD_PRELOAD doesn't apply to setuid programs run by other users, so run
+# this as root, or on copies of the binaries that aren't installed setuid.
+#
+# The C build's host-wide budget for refusal messages (ROOT_RATELIMIT,
+# default /run/root/ratelimit, see RATELIMIT_PATH) is reset before every
+# run that is compared, so the benchmarks can't use it up.
+
+set -u
+
+if [ $# -ne 2 ]; then
+    echo "Usage: difftest.sh <root> <other-root>" >&2
+    exit 2
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+a=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+b=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+shim=$here/testshim.so
+bench=$here/rootbench
+threshold=${ROOT_DIFF_THRESHOLD:-50}
+runs=${ROOT_DIFF_RUNS:-20}
+ratelimit=${ROOT_RATELIMIT:-/run/root/ratelimit}
+
+for f in "$a" "$b" "$bench"; do
+    if [ ! -x "$f" ]; then
+        echo "difftest.sh: $f is not executable" >&2
+        exit 2
+    fi
+done
+if [ ! -f "$shim" ]; then
+    echo "difftest.sh: $shim not found (run make testshim.so)" >&2
+    exit 2
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/rootdiff.XXXXXX") || exit 2
+trap 'rm -rf "$work"' EXIT
+
+#
+# fixtures
+#
+# $work/bin     an absolute PATH entry holding "hello"
+# $work/cwd     the working directory, holding its own "hello" and "sl",
+#               and a relative "bin" directory holding "hello"
+#
+mkdir -p "$work/bin" "$work/cwd/bin" "$work/cwd/notexec" "$work/out"
+for dir in "$work/bin" "$work/cwd" "$work/cwd/bin"; do
+    printf '#!/bin/sh\necho "hello from %s" "$#"\n' "$dir" >"$dir/hello"
+    chmod 755 "$dir/hello"
+done
+printf '#!/bin/sh\necho sl\n' >"$work/cwd/sl"
+chmod 755 "$work/cwd/sl"
+printf '#!/bin/sh\necho notexec\n' >"$work/cwd/notexec/cmd"
+
+sysdirs=/usr/bin:/bin
+longpath=
+i=0
+while [ $i -lt 200 ]; do
+    longpath="$longpath$work/missing$i:"
+    i=$((i + 1))
+done
+longpath="$longpath$work/bin:$sysdirs"
+
+bigenv=$work/bigenv
+i=0
+while [ $i -lt 500 ]; do
+    printf 'ROOT_DIFF_VAR_%d=%01000d\n' $i 0
+    i=$((i + 1))
+done >"$bigenv"
+
+flagged=0
+count=0
+
+flag()
+{
+    echo "$1"
+    flagged=$((flagged + 1))
+}
+
+#
+# in_env <syslog> <path> <command...>
+#
+# Runs the command in $work/cwd with a minimal environment, plus the
+# variables in $extraenv if it is set.
+#
+in_env()
+{
+    syslog=$1 path=$2
+    shift 2
+    cd "$work/cwd" || exit 2
+    # shellcheck disable=SC2046
+    exec env -i PATH="$path" HOME=/nonexistent \
+        LD_PRELOAD="$shim" ROOT_SHIM_SYSLOG="$syslog" \
+        $(if [ -n "$extraenv" ]; then cat "$extraenv"; fi) "$@"
+}
+
+#
+# run_one <binary> <tag> <path> <args...>
+#
+# Leaves $work/out/<tag>.{exit,stdout,stderr,syslog}.
+#
+run_one()
+{
+    bin=$1 tag=$2 path=$3
+    shift 3
+    out=$work/out/$tag
+    : >"$out.syslog"
+    rm -f "$ratelimit" 2>/dev/null
+    (in_env "$out.syslog" "$path" "$bin" "$@") >"$out.stdout" 2>"$out.stderr"
+    echo $? >"$out.exit"
+    # only the C build logs Arguments records, so they aren't compared
+    grep -v '^info [^ ]*: Arguments ' "$out.syslog" >"$out.syslog.tmp"
+    mv "$out.syslog.tmp" "$out.syslog"
+}
+
+#
+# bench_one <binary> <path> <args...>
+#
+bench_one()
+{
+    bin=$1 path=$2
+    shift 2
+    (in_env /dev/null "$path" "$bench" -n "$runs" -s -m "$bin" "$@")
+}
+
+field()
+{
+    echo "$1" | tr ' ' '\n' | sed -n "s/^$2=//p"
+}
+
+#
+# compare a and b, flagging b if it is more than threshold percent away
+#
+compare_metric()
+{
+    name=$1 metric=$2 x=$3 y=$4
+    if [ -z "$x" ] || [ -z "$y" ]; then
+        return
+    fi
+    awk -v x="$x" -v y="$y" -v t="$threshold" \
+        'BEGIN { lo = x < y ? x : y; hi = x < y ? y : x;
+                 exit !(lo > 0 ? (hi - lo) * 100 / lo > t : hi > 0) }' &&
+        flag "PERF $name: $metric $x vs $y"
+}
+
+#
+# scenario <name> <path> <args...>
+#
+scenario()
+{
+    name=$1 path=$2
+    shift 2
+    count=$((count + 1))
+
+    run_one "$a" a "$path" "$@"
+    run_one "$b" b "$path" "$@"
+
+    same=1
+    for part in exit stdout stderr syslog; do
+        if ! cmp -s "$work/out/a.$part" "$work/out/b.$part"; then
+            flag "DIFF $name: $part differs"
+            diff "$work/out/a.$part" "$work/out/b.$part" | sed 's/^/    /' | head -20
+            same=0
+        fi
+    done
+
+    ra=$(bench_one "$a" "$path" "$@")
+    rb=$(bench_one "$b" "$path" "$@")
+    for metric in wall_us_median maxrss_kb syscalls; do
+        compare_metric "$name" "$metric" "$(field "$ra" $metric)" "$(field "$rb" $metric)"
+    done
+
+    if [ $same -eq 1 ]; then
+        echo "ok   $name (exit $(cat "$work/out/a.exit"))"
+    fi
+    echo "     a: $ra"
+    echo "     b: $rb"
+}
+
+extraenv=
+
+# PATH shape
+scenario path-system            "$sysdirs"                      hello
+scenario path-fixture           "$work/bin:$sysdirs"            hello
+scenario path-long              "$longpath"                     hello
+scenario path-empty             ""                              hello
+scenario path-dot-first         ".:$work/bin:$sysdirs"          hello
+scenario path-dot-last          "$work/bin:$sysdirs:."          hello
+scenario path-dot-only-match    "$work/bin:$sysdirs:."          sl
+scenario path-empty-entry       ":$work/bin:$sysdirs"           hello
+scenario path-relative-entry    "bin:$sysdirs"                  hello
+scenario path-not-found         "$work/bin:$sysdirs"            no-such-command
+
+# qualified and unqualified commands
+scenario qualified-absolute     "$sysdirs"                      "$work/bin/hello" x
+scenario qualified-dot          "$sysdirs"                      ./hello x
+scenario qualified-dotdot       "$sysdirs"                      ../bin/hello x
+scenario qualified-missing      "$sysdirs"                      ./missing
+scenario qualified-notexec      "$sysdirs"                      ./notexec/cmd
+scenario qualified-directory    "$sysdirs"                      ./bin
+scenario unqualified-system     "$sysdirs"                      true
+
+# options
+scenario opt-home               "$sysdirs"      --home sh -c 'echo "$HOME"'
+scenario opt-nohome-short       "$sysdirs"      -H sh -c 'echo "$HOME"'
+scenario opt-nohome-long        "$sysdirs"      --nohome sh -c 'echo "$HOME"'
+scenario opt-debug-short        "$sysdirs"      -d true
+scenario opt-debug-combined     "$sysdirs"      -dH true
+scenario opt-double-dash        "$sysdirs"      -- true
+scenario opt-unknown            "$sysdirs"      --bogus true
+scenario opt-abbreviated        "$sysdirs"      --deb true
+scenario opt-no-command         "$sysdirs"
+scenario opt-empty-command      "$sysdirs"      ""
+
+# huge argv and environment
+# shellcheck disable=SC2046
+scenario argv-huge              "$work/bin:$sysdirs" hello $(seq 1 20000)
+extraenv=$bigenv
+scenario env-huge               "$work/bin:$sysdirs" hello
+extraenv=
+
+echo "$count scenarios, $flagged flagged"
+[ $flagged -eq 0 ]
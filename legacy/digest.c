@@ -0,0 +1,311 @@
+#define _DEFAULT_SOURCE /* for pread(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for pread() */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "digest.h"
+
+#define CHUNK_START (1 << 0)
+#define CHUNK_END   (1 << 1)
+#define PARENT      (1 << 2)
+#define ROOT        (1 << 3)
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static uint32_t rotr(uint32_t w, int c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+static uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8
+         | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store32(unsigned char *p, uint32_t w)
+{
+    p[0] = w;
+    p[1] = w >> 8;
+    p[2] = w >> 16;
+    p[3] = w >> 24;
+}
+
+#define G(a, b, c, d, x, y) \
+    do { \
+        a = a + b + (x); \
+        d = rotr(d ^ a, 16); \
+        c = c + d; \
+        b = rotr(b ^ c, 12); \
+        a = a + b + (y); \
+        d = rotr(d ^ a, 8); \
+        c = c + d; \
+        b = rotr(b ^ c, 7); \
+    } while (0)
+
+/*
+ * the compression function, leaving all 16 words of output in out
+ *
+ * The state is in separate variables rather than an array so it can stay
+ * in registers, and the four columns (then diagonals) of each round are
+ * independent of one another, so they can run side by side.
+ */
+static void compress(const uint32_t cv[8],
+                     const unsigned char block[DIGEST_BLOCK_LEN],
+                     uint8_t block_len,
+                     uint64_t counter,
+                     uint8_t flags,
+                     uint32_t out[16])
+{
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = load32(block + 4 * i);
+    }
+
+    uint32_t s0 = cv[0], s1 = cv[1], s2 = cv[2], s3 = cv[3];
+    uint32_t s4 = cv[4], s5 = cv[5], s6 = cv[6], s7 = cv[7];
+    uint32_t s8 = IV[0], s9 = IV[1], s10 = IV[2], s11 = IV[3];
+    uint32_t s12 = (uint32_t)counter, s13 = (uint32_t)(counter >> 32);
+    uint32_t s14 = block_len, s15 = flags;
+
+    for (int r = 0; r < 7; r++) {
+        const uint8_t *sc = MSG_SCHEDULE[r];
+        G(s0, s4, s8, s12, m[sc[0]], m[sc[1]]);
+        G(s1, s5, s9, s13, m[sc[2]], m[sc[3]]);
+        G(s2, s6, s10, s14, m[sc[4]], m[sc[5]]);
+        G(s3, s7, s11, s15, m[sc[6]], m[sc[7]]);
+        G(s0, s5, s10, s15, m[sc[8]], m[sc[9]]);
+        G(s1, s6, s11, s12, m[sc[10]], m[sc[11]]);
+        G(s2, s7, s8, s13, m[sc[12]], m[sc[13]]);
+        G(s3, s4, s9, s14, m[sc[14]], m[sc[15]]);
+    }
+
+    out[0] = s0 ^ s8;
+    out[1] = s1 ^ s9;
+    out[2] = s2 ^ s10;
+    out[3] = s3 ^ s11;
+    out[4] = s4 ^ s12;
+    out[5] = s5 ^ s13;
+    out[6] = s6 ^ s14;
+    out[7] = s7 ^ s15;
+    out[8] = s8 ^ cv[0];
+    out[9] = s9 ^ cv[1];
+    out[10] = s10 ^ cv[2];
+    out[11] = s11 ^ cv[3];
+    out[12] = s12 ^ cv[4];
+    out[13] = s13 ^ cv[5];
+    out[14] = s14 ^ cv[6];
+    out[15] = s15 ^ cv[7];
+}
+
+static void compress_cv(uint32_t cv[8],
+                        const unsigned char block[DIGEST_BLOCK_LEN],
+                        uint8_t block_len,
+                        uint64_t counter,
+                        uint8_t flags)
+{
+    uint32_t out[16];
+    compress(cv, block, block_len, counter, flags, out);
+    memcpy(cv, out, 8 * sizeof(*cv));
+}
+
+static void parent_block(const uint32_t left[8],
+                         const uint32_t right[8],
+                         unsigned char block[DIGEST_BLOCK_LEN])
+{
+    for (int i = 0; i < 8; i++) {
+        store32(block + 4 * i, left[i]);
+        store32(block + 32 + 4 * i, right[i]);
+    }
+}
+
+static size_t chunk_len(const struct digest *d)
+{
+    return (size_t)d->blocks_compressed * DIGEST_BLOCK_LEN + d->block_len;
+}
+
+static uint8_t start_flag(const struct digest *d)
+{
+    return d->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+void digest_init(struct digest *d)
+{
+    memcpy(d->cv, IV, sizeof(d->cv));
+    d->chunk_counter = 0;
+    memset(d->block, 0, sizeof(d->block));
+    d->block_len = 0;
+    d->blocks_compressed = 0;
+    d->cv_stack_len = 0;
+}
+
+/*
+ * Finish the current (full) chunk, merging it with every completed subtree
+ * of the same size, and start the next one.
+ */
+static void end_chunk(struct digest *d)
+{
+    uint32_t cv[8];
+    memcpy(cv, d->cv, sizeof(cv));
+    compress_cv(cv, d->block, d->block_len, d->chunk_counter,
+                start_flag(d) | CHUNK_END);
+
+    /* one merge per trailing zero bit of the number of chunks so far */
+    uint64_t total = d->chunk_counter + 1;
+    while ((total & 1) == 0) {
+        unsigned char block[DIGEST_BLOCK_LEN];
+        d->cv_stack_len--;
+        parent_block(d->cv_stack[d->cv_stack_len], cv, block);
+        memcpy(cv, IV, sizeof(cv));
+        compress_cv(cv, block, DIGEST_BLOCK_LEN, 0, PARENT);
+        total >>= 1;
+    }
+    memcpy(d->cv_stack[d->cv_stack_len++], cv, sizeof(cv));
+
+    memcpy(d->cv, IV, sizeof(d->cv));
+    d->chunk_counter++;
+    memset(d->block, 0, sizeof(d->block));
+    d->block_len = 0;
+    d->blocks_compressed = 0;
+}
+
+void digest_update(struct digest *d, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len > 0) {
+        /* only now do we know the chunk wasn't the last */
+        if (chunk_len(d) == DIGEST_CHUNK_LEN) {
+            end_chunk(d);
+        }
+        /* likewise the block */
+        if (d->block_len == DIGEST_BLOCK_LEN) {
+            compress_cv(d->cv, d->block, DIGEST_BLOCK_LEN, d->chunk_counter,
+                        start_flag(d));
+            d->blocks_compressed++;
+            memset(d->block, 0, sizeof(d->block));
+            d->block_len = 0;
+        }
+
+        size_t take = DIGEST_BLOCK_LEN - d->block_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(d->block + d->block_len, p, take);
+        d->block_len += take;
+        p += take;
+        len -= take;
+    }
+}
+
+void digest_final(struct digest *d, unsigned char out[DIGEST_SIZE])
+{
+    /* the output node: the last chunk, or the parent at the top */
+    uint32_t cv[8];
+    unsigned char block[DIGEST_BLOCK_LEN];
+    uint8_t block_len = d->block_len;
+    uint64_t counter = d->chunk_counter;
+    uint8_t flags = start_flag(d) | CHUNK_END;
+
+    memcpy(cv, d->cv, sizeof(cv));
+    memcpy(block, d->block, sizeof(block));
+
+    for (int i = d->cv_stack_len - 1; i >= 0; i--) {
+        /* the node so far is the right child of the next subtree up */
+        uint32_t right[8];
+        memcpy(right, cv, sizeof(right));
+        compress_cv(right, block, block_len, counter, flags);
+
+        parent_block(d->cv_stack[i], right, block);
+        memcpy(cv, IV, sizeof(cv));
+        block_len = DIGEST_BLOCK_LEN;
+        counter = 0;
+        flags = PARENT;
+    }
+
+    uint32_t words[16];
+    compress(cv, block, block_len, 0, flags | ROOT, words);
+    for (int i = 0; i < DIGEST_SIZE / 4; i++) {
+        store32(out + 4 * i, words[i]);
+    }
+}
+
+int digest_fd(int fd, unsigned char out[DIGEST_SIZE])
+{
+    struct digest d;
+    unsigned char buf[64 * 1024];
+    off_t offset = 0;
+
+    digest_init(&d);
+    for (;;) {
+        ssize_t n = pread(fd, buf, sizeof(buf), offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        digest_update(&d, buf, n);
+        offset += n;
+    }
+    digest_final(&d, out);
+    return 0;
+}
+
+void digest_to_hex(const unsigned char digest[DIGEST_SIZE], char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < DIGEST_SIZE; i++) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0xf];
+    }
+    hex[2 * DIGEST_SIZE] = '\0';
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+int digest_from_hex(const char *hex, unsigned char digest[DIGEST_SIZE])
+{
+    for (int i = 0; i < DIGEST_SIZE; i++) {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hi == -1 ? -1 : hex_value(hex[2 * i + 1]);
+        if (lo == -1) {
+            return -1;
+        }
+        digest[i] = hi << 4 | lo;
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
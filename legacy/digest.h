@@ -0,0 +1,59 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * BLAKE3, as b3sum(1) computes it: the default 32-byte output, unkeyed.
+ *
+ * BLAKE3 splits its input into 1 KiB chunks that are hashed independently
+ * and combined as a binary tree, which is what lets vector units work on
+ * many chunks at once.  This is a portable implementation that works on
+ * one chunk at a time; it is still fast enough that a digest is cheap
+ * next to reading the file.
+ */
+#define DIGEST_SIZE 32
+#define DIGEST_HEX_SIZE (2 * DIGEST_SIZE + 1)
+
+#define DIGEST_BLOCK_LEN 64
+#define DIGEST_CHUNK_LEN 1024
+#define DIGEST_MAX_DEPTH 54     /* enough for 2^64 bytes of input */
+
+struct digest {
+    uint32_t cv[8];             /* chaining value of the current chunk */
+    uint64_t chunk_counter;
+    unsigned char block[DIGEST_BLOCK_LEN];
+    uint8_t block_len;
+    uint8_t blocks_compressed;
+    uint8_t cv_stack_len;
+    uint32_t cv_stack[DIGEST_MAX_DEPTH][8];   /* completed subtrees */
+};
+
+void digest_init(struct digest *d);
+void digest_update(struct digest *d, const void *data, size_t len);
+void digest_final(struct digest *d, unsigned char out[DIGEST_SIZE]);
+
+/*
+ * Digest the whole of the open file fd, from its start, without moving its
+ * offset.
+ *
+ * Returns 0, or -1 with errno set.
+ */
+int digest_fd(int fd, unsigned char out[DIGEST_SIZE]);
+
+/*
+ * Format digest as lowercase hex into hex, which must hold
+ * DIGEST_HEX_SIZE bytes.
+ */
+void digest_to_hex(const unsigned char digest[DIGEST_SIZE], char *hex);
+
+/*
+ * Parse the DIGEST_SIZE * 2 hex digits at the start of hex.
+ *
+ * Returns 0, or -1 if they aren't all hex digits.
+ */
+int digest_from_hex(const char *hex, unsigned char digest[DIGEST_SIZE]);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,118 @@
+#define _DEFAULT_SOURCE /* for mkstemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkstemp() */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "digest.h"
+
+/* from b3sum, over bytes 0, 1, ..., 250, 0, 1, ... */
+static const struct {
+    size_t len;
+    const char *hex;
+} vectors[] = {
+    {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+    {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+    {64, "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98"},
+    {65, "de1e5fa0be70df6d2be8fffd0e99ceaa8eb6e8c93a63f2d8d1c30ecb6b263dee"},
+    {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+    {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+    {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    {3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+    {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+    {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+};
+#define NVECTORS (sizeof(vectors) / sizeof(vectors[0]))
+
+static unsigned char input[102400];
+
+void test_vectors(void)
+{
+    printf("Running %s\n", __func__);
+    for (size_t i = 0; i < NVECTORS; i++) {
+        struct digest d;
+        unsigned char out[DIGEST_SIZE];
+        char hex[DIGEST_HEX_SIZE];
+
+        digest_init(&d);
+        digest_update(&d, input, vectors[i].len);
+        digest_final(&d, out);
+        digest_to_hex(out, hex);
+        assert(strcmp(hex, vectors[i].hex) == 0);
+    }
+}
+
+void test_split_updates(void)
+{
+    printf("Running %s\n", __func__);
+    /* however the input arrives, the digest is the same */
+    const size_t sizes[] = {1, 63, 64, 1000, 1024, 4097};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        struct digest d;
+        unsigned char out[DIGEST_SIZE];
+        char hex[DIGEST_HEX_SIZE];
+
+        digest_init(&d);
+        for (size_t off = 0; off < sizeof(input); off += sizes[s]) {
+            size_t n = sizeof(input) - off < sizes[s] ? sizeof(input) - off : sizes[s];
+            digest_update(&d, input + off, n);
+        }
+        digest_final(&d, out);
+        digest_to_hex(out, hex);
+        assert(strcmp(hex, vectors[NVECTORS - 1].hex) == 0);
+    }
+}
+
+void test_fd(void)
+{
+    printf("Running %s\n", __func__);
+    char path[] = "/tmp/roottestXXXXXX";
+    unsigned char out[DIGEST_SIZE];
+    char hex[DIGEST_HEX_SIZE];
+
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    unlink(path);
+    assert(write(fd, input, sizeof(input)) == sizeof(input));
+
+    /* from the start, whatever the offset */
+    assert(digest_fd(fd, out) == 0);
+    digest_to_hex(out, hex);
+    assert(strcmp(hex, vectors[NVECTORS - 1].hex) == 0);
+    assert(lseek(fd, 0, SEEK_CUR) == sizeof(input));
+    close(fd);
+}
+
+void test_hex(void)
+{
+    printf("Running %s\n", __func__);
+    unsigned char digest[DIGEST_SIZE];
+    char hex[DIGEST_HEX_SIZE];
+
+    assert(digest_from_hex(vectors[1].hex, digest) == 0);
+    digest_to_hex(digest, hex);
+    assert(strcmp(hex, vectors[1].hex) == 0);
+    assert(digest_from_hex("2D3ADEDFF11B61F14C886E35AFA036736DCD87A74D27B5C1510225D0F592E213", digest) == 0);
+    assert(digest[0] == 0x2d);
+
+    assert(digest_from_hex("2d3a", digest) == -1);
+    assert(digest_from_hex("xd3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213", digest) == -1);
+}
+
+int main(int argc, const char *argv[])
+{
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = i % 251;
+    }
+
+    test_vectors();
+    test_split_updates();
+    test_fd();
+    test_hex();
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,203 @@
+#!/bin/sh
+#
+# faulttest.sh
+#
+# run root against slow, failing and stalled dependencies, and check that
+# it still does the right thing in the right time
+#
+# Usage: faulttest.sh <root>
+#
+# Each scenario injects faults with testshim.so (see ROOT_SHIM_FAULTS
+# there): a slow or hung directory service, a stalled or broken NFS
+# directory in PATH, a backed-up or unreachable syslog, too little memory.
+# The command is always "touch <marker>", and the scenario checks root's
+# exit status, that the command ran exactly when root said it succeeded,
+# how long root took (timed with rootbench), and optionally a message it
+# must have logged.  "hang" as the expected status means root must still be
+# waiting when the scenario's time is up; it is then killed.
+#
+# The bounds assume the default NSS_TIMEOUT_MS (3000).
+#
+# Exits 0 if every scenario passed, 1 otherwise.
+#
+# LD_PRELOAD doesn't apply to setuid programs run by other users, so run
+# this as root, or on a copy of root that isn't installed setuid.
+
+set -u
+
+if [ $# -ne 1 ]; then
+    echo "Usage: faulttest.sh <root>" >&2
+    exit 2
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+shim=$here/testshim.so
+bench=$here/rootbench
+
+for f in "$root" "$bench"; do
+    if [ ! -x "$f" ]; then
+        echo "faulttest.sh: $f is not executable" >&2
+        exit 2
+    fi
+done
+if [ ! -f "$shim" ]; then
+    echo "faulttest.sh: $shim not found (run make testshim.so)" >&2
+    exit 2
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/rootfault.XXXXXX") || exit 2
+trap 'rm -rf "$work"' EXIT
+
+#
+# fixtures
+#
+# $work/nfs     a PATH entry that faults are injected into
+#
+mkdir -p "$work/nfs"
+sysdirs=/usr/bin:/bin
+marker=$work/ran
+
+count=0
+failed=0
+
+fail()
+{
+    echo "FAIL $name: $1"
+    failed=$((failed + 1))
+    ok=0
+}
+
+#
+# scenario <name> <faults> <status> <min-ms> <max-ms> <path> <root-args...>
+#
+# Runs root <root-args...> touch <marker> with ROOT_SHIM_FAULTS=<faults>
+# and PATH=<path>, and checks it exits with <status> after <min-ms> to
+# <max-ms> milliseconds, logging $logged if that is set.  If $memory_kb is
+# set, no process may have more than that much address space.  If $caller
+# is set, root is run as if that uid had run it, and if $ran is set, the
+# command must (1) or must not (0) have run, whatever the status.
+#
+scenario()
+{
+    name=$1 faults=$2 status=$3 min_ms=$4 max_ms=$5 path=$6
+    shift 6
+    count=$((count + 1))
+    ok=1
+
+    rm -f "$marker"
+    : >"$work/syslog"
+    if [ "$status" = hang ]; then
+        limit=$(awk -v ms="$max_ms" 'BEGIN { printf "%.3f", ms / 1000 }')
+    else
+        limit=$(awk -v ms="$max_ms" 'BEGIN { printf "%.3f", ms / 1000 + 10 }')
+    fi
+    result=$(env -i PATH="$path" HOME=/nonexistent \
+             LD_PRELOAD="$shim" ROOT_SHIM_SYSLOG="$work/syslog" \
+             ROOT_SHIM_FAULTS="$faults" \
+             sh -c 'ulimit -v "$1" 2>/dev/null; shift; exec "$@"' sh "${memory_kb:-unlimited}" \
+             env ROOT_SHIM_UID="${caller:-}" \
+             timeout "$limit" "$bench" -n 1 "$root" "$@" touch "$marker")
+    timed_out=$?
+
+    exit=$(echo "$result" | tr ' ' '\n' | sed -n 's/^exit=//p')
+    wall_us=$(echo "$result" | tr ' ' '\n' | sed -n 's/^wall_us_min=//p')
+    if [ "$status" = hang ]; then
+        if [ $timed_out -ne 124 ]; then
+            fail "finished with status $exit, expected it to hang"
+        fi
+    elif [ $timed_out -eq 124 ]; then
+        fail "still running after ${limit}s"
+    else
+        if [ "$exit" != "$status" ]; then
+            fail "exit status $exit, expected $status"
+        fi
+        ms=$((wall_us / 1000))
+        if [ $ms -lt "$min_ms" ] || [ $ms -gt "$max_ms" ]; then
+            fail "took ${ms}ms, expected ${min_ms}ms to ${max_ms}ms"
+        fi
+    fi
+
+    should_run=${ran:-$([ "$status" = 0 ] && echo 1 || echo 0)}
+    if [ "$should_run" = 1 ] && [ ! -e "$marker" ]; then
+        fail "the command did not run"
+    elif [ "$should_run" = 0 ] && [ -e "$marker" ]; then
+        fail "the command ran"
+    fi
+
+    if [ -n "$logged" ] && ! grep -F -q "$logged" "$work/syslog"; then
+        fail "did not log \"$logged\""
+        sed 's/^/    /' "$work/syslog" | head -10
+    fi
+
+    if [ $ok -eq 1 ]; then
+        echo "ok   $name (exit $status${ms:+, ${ms}ms})"
+    fi
+    ms=
+}
+
+logged=
+ms=
+memory_kb=
+caller=
+ran=
+
+# nothing wrong
+scenario baseline           ""                      0  0     1000 "$sysdirs"
+
+# the directory service (sssd, LDAP) behind NSS
+logged="Running "
+scenario nss-slow           "nss=delay:200"         0  200   1500 "$sysdirs"
+logged="Timed out after 3000ms looking up uid 0"
+scenario nss-hung           "nss=hang"              0  2900  5000 "$sysdirs"
+logged="Cannot get passwd info for uid 0"
+scenario nss-error          "nss=fail:EIO"          124 0    1000 "$sysdirs"
+logged="Cannot get groups for root"
+scenario nss-groups-error   "getgrouplist=fail:EIO" 124 0    1000 "$sysdirs"
+
+# an NFS directory in PATH, before the one that has the command
+logged=
+scenario path-slow          "fs@$work/nfs=delay:300" 0 300   1500 "$work/nfs:$sysdirs"
+scenario path-error         "fs@$work/nfs=fail:EIO" 0  0     1000 "$work/nfs:$sysdirs"
+# nothing bounds a PATH search, so this waits for the server
+scenario path-hung          "fs@$work/nfs=hang"     hang 0   2000 "$work/nfs:$sysdirs"
+logged="Cannot determine real path to "
+scenario realpath-error     "realpath=fail:ESTALE"  127 0    1000 "$sysdirs"
+
+# journald or syslogd
+logged="Running "
+scenario syslog-slow        "syslog=delay:100"      0  200   2000 "$sysdirs"
+# the command never runs unlogged
+logged=
+scenario syslog-hung        "syslog=hang"           hang 0   2000 "$sysdirs"
+# as when syslog drops messages, which root can't tell
+scenario syslog-error       "syslog=fail:EIO"       0  0     1000 "$sysdirs"
+
+# the same with other options
+logged="Timed out after 3000ms looking up uid 0"
+scenario nss-hung-timeout   "nss=hang"              0  2900  5000 "$sysdirs" --timeout 10
+logged=
+scenario syslog-hung-record "syslog=hang"           hang 0   2000 "$sysdirs" --record
+
+# a host that is out of memory, here as a small address space
+memory_kb=4096
+logged="Running "
+scenario low-memory         ""                      0  0     1000 "$sysdirs" --low-memory
+# the files answer, so a hung directory service doesn't matter
+scenario low-memory-nss-hung "nss=hang"             0  0     1000 "$sysdirs" --low-memory
+# without it, there's no room for the helper thread that bounds a lookup
+logged=
+scenario nss-hung-no-memory "nss=hang"              hang 0   2000 "$sysdirs"
+memory_kb=
+
+# each run is logged by whoever ran root, though it runs as root
+caller=65534
+ran=1
+logged="nobody: Running "
+scenario every-caller       ""                      hang 0   1500 "$sysdirs" --every 1s
+caller=
+ran=
+logged=
+
+echo "$count scenarios, $failed failed"
+[ $failed -eq 0 ]
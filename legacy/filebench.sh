@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# filebench.sh
+#
+# compare root's own file operations with running the coreutils that they
+# replace through root
+#
+# Usage: filebench.sh <root> [<size-kb>...]
+#
+# For each size (default 4, 1024 and 65536 KB) the file operations are
+# timed with rootbench, against the commands people run instead:
+#   write    root --write <file> < <input>    root tee <file> < <input>
+#   append   root --append <file> < <input>   root tee -a <file> < <input>
+#   copy     root --copy <input> <file>       root cp <input> <file>
+#   read     root --read <input>              root cat <input>
+# (tee and cat write to /dev/null).  The two take turns, one run each, and
+# <file> is emptied before every run, so neither is measured against a
+# bigger file or a busier page cache than the other.  Prints a line for
+# each pair, with the median wall time of each in microseconds and the
+# throughput of each in MB/s.
+#
+# ROOT_BENCH_RUNS (default 20) is the number of runs of each.  Syslog goes
+# to a file with testshim.so, so run this as root, or on a copy of root
+# that isn't installed setuid.
+
+set -u
+
+if [ $# -lt 1 ]; then
+    echo "Usage: filebench.sh <root> [<size-kb>...]" >&2
+    exit 2
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+shift
+shim=$here/testshim.so
+bench=$here/rootbench
+runs=${ROOT_BENCH_RUNS:-20}
+
+for f in "$root" "$bench"; do
+    if [ ! -x "$f" ]; then
+        echo "filebench.sh: $f is not executable" >&2
+        exit 2
+    fi
+done
+if [ ! -f "$shim" ]; then
+    echo "filebench.sh: $shim not found (run make testshim.so)" >&2
+    exit 2
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/rootfile.XXXXXX") || exit 2
+trap 'rm -rf "$work"' EXIT
+
+input=$work/input
+file=$work/file
+tee=$(command -v tee)
+cp=$(command -v cp)
+cat=$(command -v cat)
+
+# microseconds one run of root <args...> took, reading stdin from $input
+time_once()
+{
+    : > "$file"
+    LD_PRELOAD=$shim ROOT_SHIM_SYSLOG=$work/syslog \
+        "$bench" -n 1 -i "$input" "$root" "$@" |
+        sed -n 's/.*wall_us_median=\([0-9]*\).*/\1/p'
+}
+
+# the median of the numbers in file <name>
+median()
+{
+    sort -n "$1" | awk '{ v[NR] = $1 } END { print v[int(NR / 2) + 1] }'
+}
+
+# compare <name> <size-kb> <ours...> -- <theirs...>
+compare()
+{
+    name=$1 kb=$2
+    shift 2
+    ours=
+    while [ "$1" != -- ]; do
+        ours="$ours $1"
+        shift
+    done
+    shift
+    : > "$work/ours"
+    : > "$work/theirs"
+    i=0
+    while [ $i -lt "$runs" ]; do
+        # shellcheck disable=SC2086
+        time_once $ours >> "$work/ours"
+        time_once "$@" >> "$work/theirs"
+        i=$((i + 1))
+    done
+    a=$(median "$work/ours")
+    b=$(median "$work/theirs")
+    awk -v name="$name" -v kb="$kb" -v a="$a" -v b="$b" 'BEGIN {
+        printf "%-7s size_kb=%-6d root_us=%-8d coreutils_us=%-8d root_mb_s=%-8.1f coreutils_mb_s=%.1f\n",
+               name, kb, a, b, kb / 1024 / (a / 1e6), kb / 1024 / (b / 1e6)
+    }'
+}
+
+for kb in ${@:-4 1024 65536}; do
+    head -c $((kb * 1024)) /dev/urandom > "$input"
+    compare write "$kb" --write "$file" -- "$tee" "$file"
+    compare append "$kb" --append "$file" -- "$tee" -a "$file"
+    compare copy "$kb" --copy "$input" "$file" -- "$cp" "$input" "$file"
+    compare read "$kb" --read "$input" -- "$cat" "$input"
+done
@@ -0,0 +1,691 @@
+#define _GNU_SOURCE     /* for copy_file_range(), splice() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <linux/magic.h>
+#include <sys/sendfile.h>
+#include <sys/vfs.h>
+#include <sys/xattr.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fileops.h"
+
+/* the most moved by one system call */
+#define CHUNK (1024 * 1024)
+
+/* the buffer for when the kernel can't move the data itself */
+static char buffer[64 * 1024];
+
+#ifdef __linux__
+/* the names of a file's extended attributes, at most XATTR_LIST_MAX */
+static char xattr_names[64 * 1024];
+#endif
+
+enum method {
+    BY_COPY_FILE_RANGE,     /* file to file, shared extents where possible */
+    BY_SENDFILE,            /* file to anything */
+    BY_SPLICE,              /* to or from a pipe */
+    BY_BUFFER,              /* read(2) and write(2) */
+};
+
+/* which end of a transfer failed */
+enum side {
+    SIDE_IN,
+    SIDE_OUT,
+};
+
+const char *fileops_name(enum fileop op)
+{
+    switch (op) {
+    case FILEOP_WRITE: return "--write";
+    case FILEOP_APPEND: return "--append";
+    case FILEOP_COPY: return "--copy";
+    case FILEOP_READ: return "--read";
+    default: return NULL;
+    }
+}
+
+/* the last component of path, ignoring trailing slashes, in name */
+static int last_component(const char *path, char name[NAME_MAX + 1])
+{
+    size_t end = strlen(path);
+    while (end > 1 && path[end - 1] == '/') {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    if (end - start > NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(name, path + start, end - start);
+    name[end - start] = '\0';
+    return 0;
+}
+
+/* resolved + "/" + name, in place */
+static int join(char resolved[PATH_MAX], const char *name)
+{
+    size_t len = strlen(resolved);
+    const char *slash = len > 0 && resolved[len - 1] == '/' ? "" : "/";
+    if ((size_t)snprintf(resolved + len, PATH_MAX - len, "%s%s", slash, name)
+        >= PATH_MAX - len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int fileops_resolve(const char *path, int may_create, const char *name,
+                    char *resolved)
+{
+    struct stat st;
+    char last[NAME_MAX + 1];
+
+    if (*path == '\0') {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (realpath(path, resolved) != NULL) {
+        if (name != NULL && stat(resolved, &st) == 0 && S_ISDIR(st.st_mode)) {
+            char inside[PATH_MAX];
+            strcpy(inside, resolved);
+            if (last_component(name, last) == -1 || join(inside, last) == -1) {
+                return -1;
+            }
+            return fileops_resolve(inside, may_create, NULL, resolved);
+        }
+        return 0;
+    }
+    if (errno != ENOENT || !may_create) {
+        return -1;
+    }
+
+    /* a symbolic link to nowhere is not somewhere to create a file */
+    if (lstat(path, &st) == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    size_t len = strlen(path);
+    if (path[len - 1] == '/') {
+        errno = EISDIR;
+        return -1;
+    }
+    if (last_component(path, last) == -1) {
+        return -1;
+    }
+    if (strcmp(last, ".") == 0 || strcmp(last, "..") == 0) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    }
+    else if (slash == path) {
+        strcpy(dir, "/");
+    }
+    else if ((size_t)(slash - path) >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    else {
+        memcpy(dir, path, slash - path);
+        dir[slash - path] = '\0';
+    }
+    if (realpath(dir, resolved) == NULL) {
+        return -1;
+    }
+    return join(resolved, last);
+}
+
+/*
+ * Open the directory that holds path, which must be absolute, and put the
+ * last component of path in name, without following a symbolic link on
+ * the way: what is opened is what path named when it was resolved, and a
+ * link put in its place since then fails with ELOOP.
+ *
+ * Returns the directory's file descriptor, or -1 with errno set.
+ */
+static int open_parent(const char *path, char name[NAME_MAX + 1])
+{
+    if (*path != '/') {
+        errno = EINVAL;
+        return -1;
+    }
+    int dirfd = open("/", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    const char *p = path;
+    while (dirfd != -1) {
+        while (*p == '/') {
+            p++;
+        }
+        size_t len = strcspn(p, "/");
+        const char *next = p + len;
+        while (*next == '/') {
+            next++;
+        }
+        if (len > NAME_MAX) {
+            close(dirfd);
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(name, p, len);
+        name[len] = '\0';
+        if (*next == '\0') {
+            if (len == 0) {
+                /* path is "/" */
+                strcpy(name, ".");
+            }
+            break;
+        }
+
+        int fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+        int saved_errno = errno;
+        struct stat st;
+        if (fd == -1 && saved_errno == ENOTDIR &&
+            fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            S_ISLNK(st.st_mode)) {
+            /* O_DIRECTORY wins over O_NOFOLLOW */
+            saved_errno = ELOOP;
+        }
+        close(dirfd);
+        errno = saved_errno;
+        dirfd = fd;
+        p = next;
+    }
+    return dirfd;
+}
+
+/*
+ * open(2) path, as open_parent would find it.
+ */
+static int open_resolved(const char *path, int flags, mode_t mode)
+{
+    char name[NAME_MAX + 1];
+    int dirfd = open_parent(path, name);
+    if (dirfd == -1) {
+        return -1;
+    }
+    int fd = openat(dirfd, name, flags|O_NOFOLLOW|O_CLOEXEC, mode);
+    int saved_errno = errno;
+    close(dirfd);
+    errno = saved_errno;
+    return fd;
+}
+
+static enum method best_method(int in, int out)
+{
+#ifdef __linux__
+    struct stat instat, outstat;
+    if (fstat(in, &instat) == -1 || fstat(out, &outstat) == -1) {
+        return BY_BUFFER;
+    }
+    if (S_ISREG(instat.st_mode) && S_ISREG(outstat.st_mode)) {
+        return BY_COPY_FILE_RANGE;
+    }
+    if (S_ISFIFO(instat.st_mode) || S_ISFIFO(outstat.st_mode)) {
+        return BY_SPLICE;
+    }
+    if (S_ISREG(instat.st_mode)) {
+        return BY_SENDFILE;
+    }
+#endif
+    return BY_BUFFER;
+}
+
+/* whether a method failed only because it can't be used for in and out */
+static int unsupported(void)
+{
+    return errno == EINVAL || errno == ENOSYS || errno == EXDEV
+        || errno == EOPNOTSUPP || errno == ENOTSUP
+        /* copy_file_range to a file opened with O_APPEND */
+        || errno == EBADF;
+}
+
+static ssize_t move_buffered(int in, int out, enum side *side)
+{
+    ssize_t n = read(in, buffer, sizeof(buffer));
+    if (n <= 0) {
+        *side = SIDE_IN;
+        return n;
+    }
+    for (ssize_t done = 0; done < n; ) {
+        ssize_t w = write(out, buffer + done, n - done);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *side = SIDE_OUT;
+            return -1;
+        }
+        done += w;
+    }
+    return n;
+}
+
+/*
+ * Move everything from in to out, from their current offsets, by the best
+ * method that works for them, adding how much to *bytes.
+ *
+ * Returns 0 at the end of in, or -1 with errno and *side set.
+ */
+static int transfer(int in, int out, long long *bytes, enum side *side)
+{
+    enum method method = best_method(in, out);
+    long long moved = 0;
+
+    for (;;) {
+        ssize_t n;
+        *side = SIDE_OUT;
+        switch (method) {
+#ifdef __linux__
+        case BY_COPY_FILE_RANGE:
+            n = copy_file_range(in, NULL, out, NULL, CHUNK, 0);
+            break;
+        case BY_SENDFILE:
+            n = sendfile(out, in, NULL, CHUNK);
+            break;
+        case BY_SPLICE:
+            n = splice(in, NULL, out, NULL, CHUNK, SPLICE_F_MOVE);
+            break;
+#endif
+        default:
+            n = move_buffered(in, out, side);
+            break;
+        }
+
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            if (method != BY_BUFFER && unsupported()) {
+                method = method == BY_COPY_FILE_RANGE ? BY_SENDFILE : BY_BUFFER;
+                continue;
+            }
+            if (errno == EISDIR) {
+                *side = SIDE_IN;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            /*
+             * Files in /proc and /sys say they are empty, and only read(2)
+             * finds out otherwise.
+             */
+            if (moved == 0 && method != BY_BUFFER && method != BY_SPLICE) {
+                method = BY_BUFFER;
+                continue;
+            }
+            return 0;
+        }
+        moved += n;
+        *bytes += n;
+    }
+}
+
+#ifdef __linux__
+/* whether dirfd is in a file system that can't have files replaced */
+static int pseudo_filesystem(int dirfd)
+{
+    struct statfs sfs;
+    if (fstatfs(dirfd, &sfs) == -1) {
+        return 0;
+    }
+    switch ((unsigned long)sfs.f_type) {
+    case PROC_SUPER_MAGIC:
+    case SYSFS_MAGIC:
+    case CGROUP_SUPER_MAGIC:
+    case CGROUP2_SUPER_MAGIC:
+    case DEBUGFS_MAGIC:
+    case SECURITYFS_MAGIC:
+    case TRACEFS_MAGIC:
+    case EFIVARFS_MAGIC:
+        return 1;
+    default:
+        return 0;
+    }
+}
+#endif
+
+/* whether the existing file st in dirfd must be written in place */
+static int in_place(int dirfd, const struct stat *st)
+{
+    if (!S_ISREG(st->st_mode) || st->st_nlink > 1) {
+        return 1;
+    }
+    /* only root can give the new file the old one's owner */
+    if (geteuid() != 0 && st->st_uid != geteuid()) {
+        return 1;
+    }
+#ifdef __linux__
+    if (pseudo_filesystem(dirfd)) {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/* write path, which is name in dirfd, in place */
+static int write_in_place(int dirfd, const char *name, const char *path,
+                          int in, const char *in_name,
+                          long long *bytes, const char **failed)
+{
+    enum side side;
+    int fd = openat(dirfd, name, O_WRONLY|O_TRUNC|O_NOCTTY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        *failed = path;
+        return -1;
+    }
+    if (transfer(in, fd, bytes, &side) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        *failed = side == SIDE_IN ? in_name : path;
+        errno = saved_errno;
+        return -1;
+    }
+    if (close(fd) == -1) {
+        *failed = path;
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+/* whether name is in the list of len bytes that flistxattr(2) gave */
+static int listed(const char *list, ssize_t len, const char *name)
+{
+    for (ssize_t i = 0; i < len; i += strlen(list + i) + 1) {
+        if (strcmp(list + i, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Give to the extended attributes of from, which carry its SELinux label,
+ * POSIX ACLs and capabilities, or only the one called only if that isn't
+ * NULL.  Copying them all also removes those to had of its own, such as an
+ * ACL inherited from its directory.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int copy_xattrs(int from, int to, const char *only)
+{
+#ifdef __linux__
+    ssize_t len = flistxattr(from, xattr_names, sizeof(xattr_names));
+    if (len == -1) {
+        return errno == ENOTSUP ? 0 : -1;
+    }
+    if (only == NULL) {
+        ssize_t own = flistxattr(to, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < own; i += strlen(buffer + i) + 1) {
+            if (!listed(xattr_names, len, buffer + i)
+                && fremovexattr(to, buffer + i) == -1) {
+                return -1;
+            }
+        }
+    }
+    for (ssize_t i = 0; i < len; i += strlen(xattr_names + i) + 1) {
+        const char *name = xattr_names + i;
+        if (only != NULL && strcmp(name, only) != 0) {
+            continue;
+        }
+        ssize_t size = fgetxattr(from, name, buffer, sizeof(buffer));
+        if (size == -1) {
+            if (errno == ENODATA) {
+                /* removed since it was listed */
+                continue;
+            }
+            return -1;
+        }
+        if (fsetxattr(to, name, buffer, size, 0) == -1) {
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Create a file in dirfd with a name made from name, for replace, putting
+ * its name in temp.
+ *
+ * Returns its file descriptor, or -1 with errno set.
+ */
+static int make_temp(int dirfd, const char *name, char temp[NAME_MAX + 1])
+{
+    static const char letters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long seed = (unsigned long)now.tv_nsec ^ ((unsigned long)getpid() << 16);
+
+    for (int tries = 0; tries < 100; tries++) {
+        char suffix[7];
+        for (int i = 0; i < 6; i++) {
+            seed = seed * 1103515245 + 12345;
+            suffix[i] = letters[(seed >> 16) % (sizeof(letters) - 1)];
+        }
+        suffix[6] = '\0';
+        snprintf(temp, NAME_MAX + 1, ".%.*s.root%s", NAME_MAX - 12, name, suffix);
+        int fd = openat(dirfd, temp, O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, 0600);
+        if (fd != -1 || errno != EEXIST) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Replace path with what can be read from in (called in_name, or NULL for
+ * stdin), as fileops_write and fileops_copy describe, giving it mode if it
+ * is new.
+ */
+static int replace(const char *path, int in, const char *in_name, mode_t mode,
+                   long long *bytes, const char **failed)
+{
+    struct stat st;
+    char name[NAME_MAX + 1];
+    char temp[NAME_MAX + 1];
+    int fd = -1, old = -1;
+
+    *failed = path;
+    int dirfd = open_parent(path, name);
+    if (dirfd == -1) {
+        return -1;
+    }
+    int exists = fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    int result = -1;
+
+    if (!exists && errno != ENOENT) {
+        goto done;
+    }
+    if (exists && S_ISLNK(st.st_mode)) {
+        errno = ELOOP;
+        goto done;
+    }
+    if (exists && S_ISDIR(st.st_mode)) {
+        errno = EISDIR;
+        goto done;
+    }
+    if (exists && in_place(dirfd, &st)) {
+        result = write_in_place(dirfd, name, path, in, in_name, bytes, failed);
+        goto done;
+    }
+
+    fd = make_temp(dirfd, name, temp);
+    if (fd == -1) {
+        if (exists && (errno == EACCES || errno == EPERM)) {
+            /* we can write to the file but not to its directory */
+            result = write_in_place(dirfd, name, path, in, in_name, bytes, failed);
+        }
+        goto done;
+    }
+
+    if (exists) {
+        mode = st.st_mode & 07777;
+        if (fchown(fd, st.st_uid, st.st_gid) == -1) {
+            goto fail;
+        }
+    }
+    else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode &= ~mask;
+    }
+    if (fchmod(fd, mode) == -1) {
+        goto fail;
+    }
+    if (exists) {
+        /*
+         * Nothing has been read from in yet, so a file whose attributes
+         * we can't read or give the new one is written in place instead,
+         * rather than losing e.g. its SELinux label.
+         */
+        old = openat(dirfd, name, O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_NOCTTY|O_CLOEXEC);
+        if (old == -1 || copy_xattrs(old, fd, NULL) == -1) {
+            close(fd);
+            fd = -1;
+            unlinkat(dirfd, temp, 0);
+            result = write_in_place(dirfd, name, path, in, in_name, bytes, failed);
+            goto done;
+        }
+    }
+
+    enum side side;
+    if (transfer(in, fd, bytes, &side) == -1) {
+        if (side == SIDE_IN) {
+            *failed = in_name;
+        }
+        goto fail;
+    }
+    /* writing drops capabilities, as chown(2) does */
+    if (old != -1 && copy_xattrs(old, fd, "security.capability") == -1) {
+        goto fail;
+    }
+    if (fsync(fd) == -1) {
+        goto fail;
+    }
+    if (close(fd) == -1) {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+    if (renameat(dirfd, temp, dirfd, name) == -1) {
+        goto fail;
+    }
+
+    /* so the rename survives a crash, as the data already does */
+    fsync(dirfd);
+    result = 0;
+    goto done;
+
+fail:
+    {
+        int saved_errno = errno;
+        if (fd != -1) {
+            close(fd);
+        }
+        unlinkat(dirfd, temp, 0);
+        errno = saved_errno;
+    }
+done:
+    {
+        int saved_errno = errno;
+        if (old != -1) {
+            close(old);
+        }
+        close(dirfd);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+int fileops_write(const char *path, int in, long long *bytes, const char **failed)
+{
+    *bytes = 0;
+    return replace(path, in, NULL, 0666, bytes, failed);
+}
+
+int fileops_append(const char *path, int in, long long *bytes, const char **failed)
+{
+    *bytes = 0;
+    int fd = open_resolved(path, O_WRONLY|O_APPEND|O_CREAT|O_NOCTTY, 0666);
+    if (fd == -1) {
+        *failed = path;
+        return -1;
+    }
+    enum side side;
+    if (transfer(in, fd, bytes, &side) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        *failed = side == SIDE_IN ? NULL : path;
+        errno = saved_errno;
+        return -1;
+    }
+    if (close(fd) == -1) {
+        *failed = path;
+        return -1;
+    }
+    return 0;
+}
+
+int fileops_copy(const char *from, const char *to, long long *bytes, const char **failed)
+{
+    struct stat st;
+
+    *bytes = 0;
+    *failed = from;
+    int fd = open_resolved(from, O_RDONLY|O_NOCTTY, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int statted = fstat(fd, &st) == 0;
+    if (!statted || S_ISDIR(st.st_mode)) {
+        int saved_errno = statted ? EISDIR : errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    int result = replace(to, fd, from, st.st_mode & 07777, bytes, failed);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return result;
+}
+
+int fileops_read(const char *path, int out, long long *bytes, const char **failed)
+{
+    *bytes = 0;
+    int fd = open_resolved(path, O_RDONLY|O_NOCTTY, 0);
+    if (fd == -1) {
+        *failed = path;
+        return -1;
+    }
+    enum side side;
+    int result = transfer(fd, out, bytes, &side);
+    int saved_errno = errno;
+    close(fd);
+    *failed = side == SIDE_IN ? path : NULL;
+    errno = saved_errno;
+    return result;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,62 @@
+#ifndef FILEOPS_H
+#define FILEOPS_H
+
+/*
+ * The file operations root does itself, instead of running tee, cp or cat:
+ * --write, --append, --copy and --read.
+ */
+enum fileop {
+    FILEOP_NONE,
+    FILEOP_WRITE,           /* stdin replaces a file */
+    FILEOP_APPEND,          /* stdin is added to the end of a file */
+    FILEOP_COPY,            /* one file replaces another */
+    FILEOP_READ,            /* a file goes to stdout */
+};
+
+/*
+ * The option for op, e.g. "--write", which is also what the policy calls it.
+ */
+const char *fileops_name(enum fileop op);
+
+/*
+ * Make path absolute, with no symbolic links, "." or "..", in resolved
+ * (which has room for PATH_MAX bytes), as realpath(3) does.
+ *
+ * If may_create is set, path need not exist yet, but its directory must.
+ * If it names an existing directory and name is not NULL, it means the
+ * last component of name in that directory, as cp's destination does.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int fileops_resolve(const char *path, int may_create, const char *name,
+                    char *resolved);
+
+/*
+ * Each of these does op on paths already resolved by fileops_resolve,
+ * as whoever the process is running as.  They never follow a symbolic link
+ * anywhere in a path, so they use what was resolved (and checked), and
+ * fail with ELOOP if a link has been put in its place since.  The data is
+ * moved by the kernel where it can be (copy_file_range(2), sendfile(2) or
+ * splice(2)), and through a buffer where it can't.
+ *
+ * fileops_write and fileops_copy replace the file atomically: they write a
+ * new file beside it, with the old one's mode, owner and extended
+ * attributes (such as its SELinux label and ACLs), sync it, and rename it
+ * over the old one, so readers see either all of the old file or all of
+ * the new.  A file that isn't a regular file, has other hard links, has
+ * attributes that can't be copied, or is in a filesystem like /proc or
+ * /sys, where a file can't be replaced, is written in place instead, as
+ * tee(1) would.  A new file gets mode 0666
+ * (or, for a copy, the source's mode) less the umask.
+ *
+ * Each returns 0 on success, or -1 with errno set, and *failed set to the
+ * path that couldn't be used, or NULL if it was stdin or stdout.  *bytes is
+ * how much was moved either way.
+ */
+int fileops_write(const char *path, int in, long long *bytes, const char **failed);
+int fileops_append(const char *path, int in, long long *bytes, const char **failed);
+int fileops_copy(const char *from, const char *to, long long *bytes, const char **failed);
+int fileops_read(const char *path, int out, long long *bytes, const char **failed);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,421 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), strdup(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp(), strdup() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/xattr.h>
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fileops.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char realbase[PATH_MAX];
+
+/* a path in realbase, which is never freed */
+static const char *in_base(const char *name)
+{
+    char path[PATH_MAX + NAME_MAX];
+    snprintf(path, sizeof(path), "%s/%s", realbase, name);
+    char *copy = strdup(path);
+    assert(copy != NULL);
+    return copy;
+}
+
+static void write_file(const char *path, const char *text)
+{
+    FILE *f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+/* the contents of path, which must be less than 64KB */
+static const char *contents(const char *path)
+{
+    static char buf[65536];
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    assert(n >= 0);
+    buf[n] = '\0';
+    close(fd);
+    return buf;
+}
+
+/* /proc/self/status as fileops_resolve would give it, without the link */
+static const char *proc_status(void)
+{
+    static char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/status", (long)getpid());
+    return path;
+}
+
+/* an fd to read text from, through a pipe or a file */
+static int source(const char *text, int use_pipe)
+{
+    if (use_pipe) {
+        int fds[2];
+        assert(pipe(fds) == 0);
+        assert(write(fds[1], text, strlen(text)) == (ssize_t)strlen(text));
+        close(fds[1]);
+        return fds[0];
+    }
+    const char *path = in_base("input");
+    write_file(path, text);
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    unlink(path);
+    return fd;
+}
+
+void test_names(void)
+{
+    printf("Running %s\n", __func__);
+    assert(strcmp(fileops_name(FILEOP_WRITE), "--write") == 0);
+    assert(strcmp(fileops_name(FILEOP_APPEND), "--append") == 0);
+    assert(strcmp(fileops_name(FILEOP_COPY), "--copy") == 0);
+    assert(strcmp(fileops_name(FILEOP_READ), "--read") == 0);
+    assert(fileops_name(FILEOP_NONE) == NULL);
+}
+
+void test_resolve(void)
+{
+    printf("Running %s\n", __func__);
+    char resolved[PATH_MAX];
+    char path[PATH_MAX];
+
+    write_file(in_base("file"), "x");
+    assert(symlink("file", in_base("link")) == 0);
+    assert(symlink("nowhere", in_base("dangling")) == 0);
+    assert(mkdir(in_base("dir"), 0755) == 0);
+
+    /* existing files, through symbolic links and .. */
+    snprintf(path, sizeof(path), "%s/dir/../link", base);
+    assert(fileops_resolve(path, 0, NULL, resolved) == 0);
+    assert(strcmp(resolved, in_base("file")) == 0);
+
+    /* new files only if asked for */
+    snprintf(path, sizeof(path), "%s/dir/../new", base);
+    errno = 0;
+    assert(fileops_resolve(path, 0, NULL, resolved) == -1);
+    assert(errno == ENOENT);
+    assert(fileops_resolve(path, 1, NULL, resolved) == 0);
+    assert(strcmp(resolved, in_base("new")) == 0);
+
+    /* but not in directories that don't exist */
+    snprintf(path, sizeof(path), "%s/missing/new", base);
+    assert(fileops_resolve(path, 1, NULL, resolved) == -1);
+    assert(errno == ENOENT);
+
+    /* nor through a link to nowhere */
+    assert(fileops_resolve(in_base("dangling"), 1, NULL, resolved) == -1);
+    assert(errno == ENOENT);
+
+    /* nor as a directory */
+    snprintf(path, sizeof(path), "%s/new/", base);
+    assert(fileops_resolve(path, 1, NULL, resolved) == -1);
+    assert(errno == EISDIR);
+
+    /* a directory means the name in it */
+    assert(fileops_resolve(in_base("dir"), 1, "/etc/hosts", resolved) == 0);
+    assert(strcmp(resolved, in_base("dir/hosts")) == 0);
+    assert(fileops_resolve(in_base("dir"), 1, NULL, resolved) == 0);
+    assert(strcmp(resolved, in_base("dir")) == 0);
+
+    unlink(in_base("link"));
+    unlink(in_base("dangling"));
+    rmdir(in_base("dir"));
+}
+
+void test_write(void)
+{
+    printf("Running %s\n", __func__);
+    const char *path = in_base("file");
+    const char *failed = "unset";
+    long long bytes;
+    struct stat before, after;
+
+    for (int use_pipe = 0; use_pipe <= 1; use_pipe++) {
+        /* a new file, as the umask says */
+        unlink(path);
+        mode_t mask = umask(022);
+        int in = source("one\n", use_pipe);
+        assert(fileops_write(path, in, &bytes, &failed) == 0);
+        close(in);
+        umask(mask);
+        assert(bytes == 4);
+        assert(strcmp(contents(path), "one\n") == 0);
+        assert(stat(path, &before) == 0);
+        assert((before.st_mode & 07777) == 0644);
+
+        /* replaced by a new file with the old one's mode */
+        assert(chmod(path, 0640) == 0);
+        in = source("two\n", use_pipe);
+        assert(fileops_write(path, in, &bytes, &failed) == 0);
+        close(in);
+        assert(strcmp(contents(path), "two\n") == 0);
+        assert(stat(path, &after) == 0);
+        assert(after.st_ino != before.st_ino);
+        assert((after.st_mode & 07777) == 0640);
+    }
+
+    /* with another link, in place */
+    assert(link(path, in_base("other")) == 0);
+    assert(stat(path, &before) == 0);
+    int in = source("three\n", 0);
+    assert(fileops_write(path, in, &bytes, &failed) == 0);
+    close(in);
+    assert(stat(path, &after) == 0);
+    assert(after.st_ino == before.st_ino);
+    assert(strcmp(contents(in_base("other")), "three\n") == 0);
+    unlink(in_base("other"));
+
+    /* nothing left behind */
+    assert(access(in_base(".file.rootXXXXXX"), F_OK) == -1);
+
+#ifdef __linux__
+    /* replaced with the old one's extended attributes, e.g. its label */
+    unlink(path);
+    write_file(path, "old\n");
+    if (setxattr(path, "user.root.test", "kept", 4, 0) == 0) {
+        char value[16];
+        assert(stat(path, &before) == 0);
+        in = source("five\n", 0);
+        assert(fileops_write(path, in, &bytes, &failed) == 0);
+        close(in);
+        assert(stat(path, &after) == 0);
+        assert(after.st_ino != before.st_ino);
+        assert(strcmp(contents(path), "five\n") == 0);
+        assert(getxattr(path, "user.root.test", value, sizeof(value)) == 4);
+        assert(memcmp(value, "kept", 4) == 0);
+    }
+    else {
+        /* no user attributes in this file system */
+        assert(errno == ENOTSUP);
+    }
+#endif
+
+    /* a directory can't be written */
+    in = source("four\n", 0);
+    errno = 0;
+    assert(fileops_write(realbase, in, &bytes, &failed) == -1);
+    assert(errno == EISDIR);
+    assert(failed == realbase);
+    close(in);
+}
+
+void test_append(void)
+{
+    printf("Running %s\n", __func__);
+    const char *path = in_base("file");
+    const char *failed;
+    long long bytes;
+
+    unlink(path);
+    for (int use_pipe = 0; use_pipe <= 1; use_pipe++) {
+        int in = source("line\n", use_pipe);
+        assert(fileops_append(path, in, &bytes, &failed) == 0);
+        assert(bytes == 5);
+        close(in);
+    }
+    assert(strcmp(contents(path), "line\nline\n") == 0);
+
+    errno = 0;
+    int in = source("x", 0);
+    assert(fileops_append(in_base("missing/file"), in, &bytes, &failed) == -1);
+    assert(errno == ENOENT);
+    assert(strcmp(failed, in_base("missing/file")) == 0);
+    close(in);
+}
+
+void test_copy(void)
+{
+    printf("Running %s\n", __func__);
+    const char *from = in_base("from");
+    const char *to = in_base("to");
+    const char *failed;
+    long long bytes;
+    struct stat st;
+
+    /* more than one system call's worth */
+    static char big[3 * 1024 * 1024 + 17];
+    for (size_t i = 0; i < sizeof(big); i++) {
+        big[i] = (char)('a' + i % 26);
+    }
+    int fd = open(from, O_WRONLY|O_CREAT|O_TRUNC, 0750);
+    assert(fd != -1);
+    assert(write(fd, big, sizeof(big)) == sizeof(big));
+    close(fd);
+    assert(chmod(from, 0750) == 0);
+
+    mode_t mask = umask(022);
+    unlink(to);
+    assert(fileops_copy(from, to, &bytes, &failed) == 0);
+    umask(mask);
+    assert(bytes == sizeof(big));
+    assert(stat(to, &st) == 0);
+    assert(st.st_size == sizeof(big));
+    assert((st.st_mode & 07777) == 0750);
+
+    fd = open(to, O_RDONLY);
+    static char check[sizeof(big)];
+    assert(read(fd, check, sizeof(check)) == sizeof(check));
+    assert(memcmp(big, check, sizeof(big)) == 0);
+    close(fd);
+
+    /* replacing a smaller file, keeping its mode */
+    write_file(from, "small");
+    assert(chmod(to, 0600) == 0);
+    assert(fileops_copy(from, to, &bytes, &failed) == 0);
+    assert(strcmp(contents(to), "small") == 0);
+    assert(stat(to, &st) == 0);
+    assert((st.st_mode & 07777) == 0600);
+
+    /* from what says it is empty but isn't */
+    assert(fileops_copy(proc_status(), to, &bytes, &failed) == 0);
+    assert(bytes > 0);
+    assert(strncmp(contents(to), "Name:", 5) == 0);
+
+    /* which one failed */
+    errno = 0;
+    assert(fileops_copy(in_base("missing"), to, &bytes, &failed) == -1);
+    assert(errno == ENOENT);
+    assert(strcmp(failed, in_base("missing")) == 0);
+    assert(fileops_copy(from, in_base("missing/to"), &bytes, &failed) == -1);
+    assert(strcmp(failed, in_base("missing/to")) == 0);
+    assert(fileops_copy(realbase, to, &bytes, &failed) == -1);
+    assert(errno == EISDIR);
+    assert(failed == realbase);
+
+    unlink(from);
+    unlink(to);
+}
+
+void test_read(void)
+{
+    printf("Running %s\n", __func__);
+    const char *path = in_base("file");
+    const char *failed;
+    long long bytes;
+    int fds[2];
+    char buf[64];
+
+    /* to a pipe */
+    write_file(path, "hello\n");
+    assert(pipe(fds) == 0);
+    assert(fileops_read(path, fds[1], &bytes, &failed) == 0);
+    assert(bytes == 6);
+    close(fds[1]);
+    assert(read(fds[0], buf, sizeof(buf)) == 6);
+    assert(memcmp(buf, "hello\n", 6) == 0);
+    close(fds[0]);
+
+    /* to a file */
+    int out = open(in_base("out"), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    assert(fileops_read(proc_status(), out, &bytes, &failed) == 0);
+    assert(bytes > 0);
+    close(out);
+    assert(strncmp(contents(in_base("out")), "Name:", 5) == 0);
+    unlink(in_base("out"));
+
+    /* to nobody */
+    assert(pipe(fds) == 0);
+    close(fds[0]);
+    errno = 0;
+    assert(fileops_read(path, fds[1], &bytes, &failed) == -1);
+    assert(errno == EPIPE);
+    assert(failed == NULL);
+    close(fds[1]);
+
+    errno = 0;
+    assert(fileops_read(in_base("missing"), STDOUT_FILENO, &bytes, &failed) == -1);
+    assert(errno == ENOENT);
+    assert(strcmp(failed, in_base("missing")) == 0);
+    unlink(path);
+}
+
+void test_no_links(void)
+{
+    printf("Running %s\n", __func__);
+    const char *dir = in_base("dir");
+    const char *file = in_base("dir/file");
+    const char *secret = in_base("secret");
+    const char *failed;
+    long long bytes;
+
+    /* resolved and checked, then swapped for links to something else */
+    assert(mkdir(dir, 0700) == 0);
+    write_file(file, "allowed\n");
+    write_file(secret, "secret\n");
+    assert(unlink(file) == 0);
+    assert(symlink(secret, file) == 0);
+
+    int out = open(in_base("out"), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    errno = 0;
+    assert(fileops_read(file, out, &bytes, &failed) == -1);
+    assert(errno == ELOOP);
+    assert(bytes == 0);
+    int in = source("evil\n", 0);
+    errno = 0;
+    assert(fileops_append(file, in, &bytes, &failed) == -1);
+    assert(errno == ELOOP);
+    errno = 0;
+    assert(fileops_write(file, in, &bytes, &failed) == -1);
+    assert(errno == ELOOP);
+    assert(failed == file);
+    errno = 0;
+    assert(fileops_copy(file, in_base("out"), &bytes, &failed) == -1);
+    assert(errno == ELOOP);
+    assert(strcmp(contents(secret), "secret\n") == 0);
+
+    /* the same for a directory on the way */
+    assert(unlink(file) == 0);
+    assert(rmdir(dir) == 0);
+    assert(symlink(realbase, dir) == 0);
+    errno = 0;
+    assert(fileops_read(in_base("dir/secret"), out, &bytes, &failed) == -1);
+    assert(errno == ELOOP);
+    errno = 0;
+    assert(fileops_write(in_base("dir/secret"), in, &bytes, &failed) == -1);
+    assert(errno == ELOOP);
+    assert(strcmp(contents(secret), "secret\n") == 0);
+    assert(strcmp(contents(in_base("out")), "") == 0);
+
+    close(in);
+    close(out);
+    unlink(dir);
+    unlink(secret);
+    unlink(in_base("out"));
+}
+
+int main(int argc, const char *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    assert(mkdtemp(base) != NULL);
+    assert(realpath(base, realbase) != NULL);
+
+    test_names();
+    test_resolve();
+    test_write();
+    test_append();
+    test_copy();
+    test_read();
+    test_no_links();
+
+    unlink(in_base("file"));
+    unlink(in_base("new"));
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,124 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flight.h"
+#include "statefile.h"
+
+/*
+ * The ring is shared between processes, so it needs atomic operations,
+ * which C99 doesn't have.  Compilers that can't do them go without.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define HAVE_ATOMICS 1
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+
+int flight_open(struct flight *f, const char *path, int existing)
+{
+    f->ring = NULL;
+
+#ifndef HAVE_ATOMICS
+    errno = ENOSYS;
+    return -1;
+#else
+    void *ring;
+    if (existing) {
+        int fd;
+        ring = statefile_map_existing(path, sizeof(struct flight_ring), &fd);
+        if (ring != NULL) {
+            close(fd);
+        }
+    }
+    else {
+        ring = statefile_map(path, sizeof(struct flight_ring));
+    }
+    if (ring == NULL) {
+        return -1;
+    }
+    f->ring = ring;
+    return 0;
+#endif
+}
+
+void flight_close(struct flight *f)
+{
+    if (f->ring != NULL) {
+        munmap(f->ring, sizeof(*f->ring));
+        f->ring = NULL;
+    }
+}
+
+uint64_t flight_claim(struct flight *f)
+{
+#ifndef HAVE_ATOMICS
+    return 0;
+#else
+    if (f->ring == NULL) {
+        return 0;
+    }
+
+    uint64_t seq = ADD(&f->ring->next, 1);
+    struct flight_record *slot = &f->ring->records[(seq - 1) % FLIGHT_RECORDS];
+    /* a seqlock with one writer per turn of the ring */
+    STORE_RELAXED(&slot->seq, 0);
+    return seq;
+#endif
+}
+
+void flight_write(struct flight *f, uint64_t seq, const struct flight_record *rec)
+{
+#ifdef HAVE_ATOMICS
+    if (f->ring == NULL || seq == 0) {
+        return;
+    }
+
+    struct flight_record *slot = &f->ring->records[(seq - 1) % FLIGHT_RECORDS];
+    FENCE_RELEASE();
+    memcpy((char *)slot + sizeof(slot->seq), (const char *)rec + sizeof(rec->seq),
+           sizeof(*rec) - sizeof(rec->seq));
+    STORE(&slot->seq, seq);
+#endif
+}
+
+int flight_read(const struct flight *f, struct flight_record *out, int max)
+{
+#ifndef HAVE_ATOMICS
+    return 0;
+#else
+    if (f->ring == NULL || max <= 0) {
+        return 0;
+    }
+
+    uint64_t next = LOAD(&f->ring->next);
+    uint64_t want = max < FLIGHT_RECORDS ? (uint64_t)max : FLIGHT_RECORDS;
+    uint64_t oldest = next > want ? next - want + 1 : 1;
+
+    int n = 0;
+    for (uint64_t seq = oldest; seq <= next; seq++) {
+        const struct flight_record *slot = &f->ring->records[(seq - 1) % FLIGHT_RECORDS];
+        if (LOAD(&slot->seq) != seq) {
+            /* being written, or already overwritten */
+            continue;
+        }
+        memcpy(&out[n], slot, sizeof(*slot));
+        FENCE_ACQUIRE();
+        if (LOAD_RELAXED(&slot->seq) != seq) {
+            continue;
+        }
+        out[n].seq = seq;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
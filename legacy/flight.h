@@ -0,0 +1,110 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+
+/*
+ * The flight recorder: a ring of the last FLIGHT_RECORDS invocations of
+ * root, with how long each spent in each phase, for finding out afterwards
+ * why root was slow.  It is always on; rootflight prints it.
+ *
+ * created by root if need be; override at build time, e.g.
+ * make CFLAGS+=-DFLIGHT_PATH='"/var/run/root.flight"'
+ */
+#ifndef FLIGHT_PATH
+#define FLIGHT_PATH "/run/root/flight"
+#endif
+
+/* how many invocations are kept; a power of two */
+#define FLIGHT_RECORDS 4096
+
+/* the phases of an invocation that are timed */
+enum flight_phase {
+    FLIGHT_LOGGING,             /* setting up logging */
+    FLIGHT_PERMISSION,          /* checking the caller is in group 0 */
+    FLIGHT_RESOLUTION,          /* finding the command in PATH */
+    FLIGHT_NSS,                 /* looking up the target user and groups */
+    FLIGHT_SETUID,              /* switching to the target user */
+    FLIGHT_PHASES
+};
+
+/* status when root went on to run the command, whose status it is */
+#define FLIGHT_RAN (-1)
+/* status when root stopped for a reason without a status of its own */
+#define FLIGHT_UNKNOWN (-2)
+
+/*
+ * One invocation, 64 bytes, exactly as it is in the file.
+ */
+struct flight_record {
+    uint64_t seq;               /* which invocation this was, from 1, or 0
+                                   while it is being written */
+    int64_t time_ns;            /* when root started, in ns since the
+                                   epoch */
+    uint32_t pid;
+    uint32_t ruid;              /* who ran it */
+    int16_t status;             /* root's exit status, or FLIGHT_RAN or
+                                   FLIGHT_UNKNOWN */
+    uint16_t probed;            /* PATH entries looked in */
+    uint32_t phase_ns[FLIGHT_PHASES];   /* see enum flight_phase; at most
+                                           UINT32_MAX (about 4.3 s) */
+    uint32_t total_us;          /* from starting to exec or exit */
+    char outcome[12];           /* as in the trace (see trace.h), e.g.
+                                   "ran" or "denied" */
+};
+
+/*
+ * The shared state, exactly as it is in the file; a file of zeros is an
+ * empty ring.
+ *
+ * Every invocation claims the next record with one atomic add when it
+ * starts, and marks it as being written until it fills it in, so writers
+ * never wait for each other or for a reader, and a killed one leaves one
+ * record that readers skip.
+ */
+struct flight_ring {
+    uint64_t next;              /* the seq of the last record claimed */
+    uint64_t reserved[7];       /* keeps records on 64-byte lines */
+    struct flight_record records[FLIGHT_RECORDS];
+};
+
+struct flight {
+    struct flight_ring *ring;
+};
+
+/*
+ * Map the ring at path, creating it (and its directory) if need be; if
+ * existing, only if it already exists.
+ *
+ * Returns 0 on success, or -1 with errno set.  EPERM means the file is not
+ * a regular file owned by us and inaccessible to anyone else, EINVAL that
+ * it is the wrong size, and ENOSYS that this compiler can't do the atomic
+ * operations.
+ */
+int flight_open(struct flight *f, const char *path, int existing);
+void flight_close(struct flight *f);
+
+/*
+ * Claim the next record, overwriting the oldest, and mark it as being
+ * written.  This touches its page, so that flight_write needn't wait for
+ * it to be faulted in.
+ *
+ * Returns its seq, or 0 if the ring isn't open.
+ */
+uint64_t flight_claim(struct flight *f);
+
+/*
+ * Fill in the record claimed as seq with rec (whose seq is ignored).
+ * Never fails or waits.
+ */
+void flight_write(struct flight *f, uint64_t seq, const struct flight_record *rec);
+
+/*
+ * Copy up to max of the newest complete records into out, oldest first.
+ *
+ * Returns how many were copied.
+ */
+int flight_read(const struct flight *f, struct flight_record *out, int max);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
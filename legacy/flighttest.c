@@ -0,0 +1,190 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char path[512];
+
+static struct flight_record out[FLIGHT_RECORDS];
+
+static void open_fresh(struct flight *f)
+{
+    unlink(path);
+    assert(flight_open(f, path, 0) == 0);
+}
+
+static void write_one(struct flight *f, uint32_t pid, const char *outcome)
+{
+    struct flight_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.seq = 12345;            /* ignored */
+    rec.pid = pid;
+    rec.ruid = 1000;
+    rec.status = FLIGHT_RAN;
+    rec.phase_ns[FLIGHT_NSS] = 250000;
+    snprintf(rec.outcome, sizeof(rec.outcome), "%s", outcome);
+    flight_write(f, flight_claim(f), &rec);
+}
+
+void test_layout(void)
+{
+    printf("Running %s\n", __func__);
+    assert(sizeof(struct flight_record) == 64);
+    assert(sizeof(struct flight_ring) == 64 + 64 * FLIGHT_RECORDS);
+}
+
+void test_write_then_read(void)
+{
+    printf("Running %s\n", __func__);
+    struct flight f;
+    open_fresh(&f);
+
+    assert(flight_read(&f, out, FLIGHT_RECORDS) == 0);
+
+    write_one(&f, 1, "ran");
+    write_one(&f, 2, "denied");
+    write_one(&f, 3, "not-found");
+    assert(flight_read(&f, out, FLIGHT_RECORDS) == 3);
+    assert(out[0].seq == 1 && out[0].pid == 1);
+    assert(out[2].seq == 3 && out[2].pid == 3);
+    assert(strcmp(out[1].outcome, "denied") == 0);
+    assert(out[0].status == FLIGHT_RAN);
+    assert(out[0].phase_ns[FLIGHT_NSS] == 250000);
+
+    /* the newest, oldest first */
+    assert(flight_read(&f, out, 2) == 2);
+    assert(out[0].pid == 2 && out[1].pid == 3);
+
+    /* through another mapping */
+    struct flight g;
+    assert(flight_open(&g, path, 1) == 0);
+    assert(flight_read(&g, out, 1) == 1);
+    assert(out[0].pid == 3);
+    flight_close(&g);
+
+    flight_close(&f);
+}
+
+void test_wraps(void)
+{
+    printf("Running %s\n", __func__);
+    struct flight f;
+    open_fresh(&f);
+
+    for (uint32_t i = 1; i <= FLIGHT_RECORDS + 10; i++) {
+        write_one(&f, i, "ran");
+    }
+    assert(flight_read(&f, out, FLIGHT_RECORDS) == FLIGHT_RECORDS);
+    assert(out[0].pid == 11);
+    assert(out[FLIGHT_RECORDS - 1].pid == FLIGHT_RECORDS + 10);
+    assert(out[FLIGHT_RECORDS - 1].seq == FLIGHT_RECORDS + 10);
+
+    flight_close(&f);
+}
+
+void test_skips_unfinished(void)
+{
+    printf("Running %s\n", __func__);
+    struct flight f;
+    open_fresh(&f);
+
+    write_one(&f, 1, "ran");
+    /* as a writer still running, or killed, leaves it */
+    uint64_t seq = flight_claim(&f);
+    assert(seq == 2);
+    write_one(&f, 3, "ran");
+    assert(flight_read(&f, out, FLIGHT_RECORDS) == 2);
+    assert(out[0].pid == 1 && out[1].pid == 3);
+
+    /* and once it's written, it's there */
+    struct flight_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.pid = 2;
+    flight_write(&f, seq, &rec);
+    assert(flight_read(&f, out, FLIGHT_RECORDS) == 3);
+    assert(out[1].pid == 2);
+
+    flight_close(&f);
+}
+
+void test_concurrent_processes(void)
+{
+    printf("Running %s\n", __func__);
+    struct flight f;
+    open_fresh(&f);
+
+    for (int i = 0; i < 8; i++) {
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            for (int j = 0; j < 1000; j++) {
+                write_one(&f, (uint32_t)(i * 1000 + j), "ran");
+            }
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        int status;
+        assert(wait(&status) != -1);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    /* every record claimed its own slot */
+    assert(f.ring->next == 8000);
+    int n = flight_read(&f, out, FLIGHT_RECORDS);
+    assert(n == FLIGHT_RECORDS);
+    for (int i = 1; i < n; i++) {
+        assert(out[i].seq == out[i - 1].seq + 1);
+    }
+
+    flight_close(&f);
+}
+
+void test_existing(void)
+{
+    printf("Running %s\n", __func__);
+    struct flight f;
+
+    unlink(path);
+    errno = 0;
+    assert(flight_open(&f, path, 1) == -1);
+    assert(errno == ENOENT);
+
+    /* created by the first writer */
+    assert(flight_open(&f, path, 0) == 0);
+    flight_close(&f);
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    assert((st.st_mode & 0777) == 0600);
+    assert(flight_open(&f, path, 1) == 0);
+    flight_close(&f);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(path, sizeof(path), "%s/flight", base);
+
+    test_layout();
+    test_write_then_read();
+    test_wraps();
+    test_skips_unfinished();
+    test_concurrent_processes();
+    test_existing();
+
+    unlink(path);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,717 @@
+#define _DEFAULT_SOURCE /* for realpath(), fexecve(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for realpath(), fexecve() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "coalesce.h"
+#include "context.h"
+#include "libroot.h"
+#include "logging.h"
+#include "namespaces.h"
+#include "nss.h"
+#include "prefetch.h"
+#include "path.h"
+#include "policy.h"
+#include "ratelimit.h"
+#include "root.h"
+#include "user.h"
+#include "verify.h"
+
+extern char **environ;
+
+/* realpath writes up to PATH_MAX bytes into absolute_command */
+#if defined(PATH_MAX) && PATH_MAX > ROOT_PATH_MAX
+#error "ROOT_PATH_MAX is smaller than PATH_MAX"
+#endif
+
+struct root_ctx *root_ctx_new(const char *progname)
+{
+    return root_ctx_new_in(progname, NULL, 0);
+}
+
+struct root_ctx *root_ctx_new_in(const char *progname,
+                                 void *reserve,
+                                 size_t size)
+{
+    /* the context lives in its own arena */
+    struct arena arena;
+    arena_init(&arena, reserve, size);
+    struct root_ctx *ctx = arena_alloc(&arena, sizeof(*ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->arena = arena;
+
+    if (initlog(ctx, progname) == -1) {
+        arena = ctx->arena;
+        arena_release(&arena);
+        return NULL;
+    }
+    ctx->permitted = -1;
+    ctx->nss_timeout_ms = NSS_TIMEOUT_MS;
+    ctx->passwd_path = NSS_PASSWD_PATH;
+    ctx->group_path = NSS_GROUP_PATH;
+    ctx->ngroups = -1;
+    ctx->target_ngroups = -1;
+    ctx->policy_path = POLICY_PATH;
+    ctx->policy_state = -1;
+    ctx->manifest_path = VERIFY_MANIFEST_PATH;
+    ctx->manifest_state = -1;
+    ctx->digest_cache_path = VERIFY_CACHE_PATH;
+    ctx->digest_cache_state = -1;
+    return ctx;
+}
+
+void root_ctx_free(struct root_ctx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->have_pathlist) {
+        pathlist_close(&ctx->pathlist);
+    }
+    if (ctx->policy_state == 1) {
+        policy_close(&ctx->policy);
+    }
+    if (ctx->manifest_state == 1) {
+        manifest_close(&ctx->manifest);
+    }
+    if (ctx->digest_cache_state == 1) {
+        verify_cache_close(&ctx->digest_cache);
+    }
+    nss_close(ctx);
+    freelog(ctx);
+
+    struct arena arena = ctx->arena;
+    arena_release(&arena);
+}
+
+size_t root_ctx_peak(const struct root_ctx *ctx)
+{
+    return arena_peak(&ctx->arena);
+}
+
+void *root_ctx_alloc(struct root_ctx *ctx, size_t size)
+{
+    return arena_alloc(&ctx->arena, size);
+}
+
+char *root_ctx_strdup(struct root_ctx *ctx, const char *string)
+{
+    return arena_strdup(&ctx->arena, string);
+}
+
+void root_set_loglevel(struct root_ctx *ctx, int level)
+{
+    setloglevel(ctx, level);
+}
+
+int root_set_path(struct root_ctx *ctx, const char *pathenv)
+{
+    if (pathenv == NULL) {
+        error(ctx, "root_set_path: pathenv is NULL");
+        return ROOT_PROGRAMMER_ERROR;
+    }
+
+    struct pathlist pathlist;
+    if (pathlist_init(&pathlist, &ctx->arena, pathenv) == -1) {
+        error(ctx, "Cannot allocate memory to hold pathenv");
+        return ROOT_SYSTEM_ERROR;
+    }
+    pathlist_open(&pathlist);
+
+    if (ctx->have_pathlist) {
+        pathlist_close(&ctx->pathlist);
+    }
+    ctx->pathlist = pathlist;
+    ctx->have_pathlist = 1;
+    return 0;
+}
+
+int root_permitted(struct root_ctx *ctx)
+{
+    if (ctx->permitted == -1) {
+        int member = in_group(ctx, ROOT_GID);
+        if (member == -1) {
+            return ROOT_SYSTEM_ERROR;
+        }
+        ctx->permitted = member;
+    }
+    return ctx->permitted ? 0 : ROOT_PERMISSION_DENIED;
+}
+
+void root_set_nss_timeout(struct root_ctx *ctx, long timeout_ms)
+{
+    ctx->nss_timeout_ms = timeout_ms;
+}
+
+void root_set_low_memory(struct root_ctx *ctx)
+{
+    ctx->low_memory = 1;
+    arena_fix(&ctx->arena);
+    /* straight to the files, as if NSS had already timed out */
+    ctx->nss_degraded = 1;
+}
+
+void root_prefetch(struct root_ctx *ctx, const char *name)
+{
+    if (ctx->low_memory) {
+        return;
+    }
+    connectlog(ctx);
+    nss_prefetch(ctx, ROOT_UID, name);
+}
+
+void root_prefetch_command(struct root_ctx *ctx, const char *absolute_command)
+{
+    if (ctx->low_memory) {
+        return;
+    }
+    prefetch_exec(absolute_command);
+}
+
+void root_log_args(struct root_ctx *ctx, const char *const *argv)
+{
+    log_args(ctx, argv);
+}
+
+void root_log_running(struct root_ctx *ctx,
+                      const char *record,
+                      const char *const *argv,
+                      unsigned long us)
+{
+    audit(ctx, record, argv, us);
+}
+
+void root_set_policy(struct root_ctx *ctx, const char *path)
+{
+    if (ctx->policy_state == 1) {
+        policy_close(&ctx->policy);
+    }
+    ctx->policy_path = path;
+    ctx->policy_state = -1;
+}
+
+void root_set_ratelimit(struct root_ctx *ctx, const char *path)
+{
+    if (ctx->ratelimit_state == 1) {
+        ratelimit_close(&ctx->ratelimit);
+    }
+    ctx->ratelimit_path = path;
+    ctx->ratelimit_state = -1;
+}
+
+void root_set_coalesce(struct root_ctx *ctx, const char *path)
+{
+    if (ctx->coalesce_state == 1) {
+        coalesce_close(&ctx->coalesce);
+    }
+    ctx->coalesce_path = path;
+    ctx->coalesce_state = -1;
+}
+
+void root_set_manifest(struct root_ctx *ctx, const char *path)
+{
+    if (ctx->manifest_state == 1) {
+        manifest_close(&ctx->manifest);
+    }
+    ctx->manifest_path = path;
+    ctx->manifest_state = -1;
+}
+
+void root_set_digest_cache(struct root_ctx *ctx, const char *path)
+{
+    if (ctx->digest_cache_state == 1) {
+        verify_cache_close(&ctx->digest_cache);
+    }
+    ctx->digest_cache_path = path;
+    ctx->digest_cache_state = -1;
+}
+
+/*
+ * Open the policy the first time it's needed.
+ *
+ * A missing, unsafe or damaged table means there is no policy, as if
+ * none had ever been installed.
+ */
+static void load_policy(struct root_ctx *ctx)
+{
+    if (ctx->policy_state != -1) {
+        return;
+    }
+
+    ctx->policy_state = 0;
+    if (policy_open(&ctx->policy, ctx->policy_path) == 0) {
+        ctx->policy_state = 1;
+    }
+    else if (errno == ENOENT) {
+        /* the usual case, and exactly as if policies didn't exist */
+    }
+    else if (errno == EPERM) {
+        warning(ctx, "Ignoring policy %s: not owned by root, or writable by others",
+                ctx->policy_path);
+    }
+    else if (errno == EINVAL) {
+        warning(ctx, "Ignoring policy %s: damaged or compiled for another machine",
+                ctx->policy_path);
+    }
+    else {
+        warning(ctx, "Ignoring policy %s: %s", ctx->policy_path, strerror(errno));
+    }
+}
+
+int root_check_policy(struct root_ctx *ctx,
+                      const char *absolute_command,
+                      const char *const *argv)
+{
+    load_policy(ctx);
+    if (ctx->policy_state != 1) {
+        return 0;
+    }
+
+    const gid_t *groups;
+    int ngroups = get_groups(ctx, &groups);
+    if (ngroups == -1) {
+        return ROOT_SYSTEM_ERROR;
+    }
+
+    if (!policy_permits(&ctx->policy, groups, ngroups, absolute_command, argv)) {
+        return ROOT_PERMISSION_DENIED;
+    }
+    return 0;
+}
+
+/*
+ * Open the manifest the first time it's needed, as for the policy.
+ */
+static void load_manifest(struct root_ctx *ctx)
+{
+    if (ctx->manifest_state != -1) {
+        return;
+    }
+
+    ctx->manifest_state = 0;
+    if (manifest_open(&ctx->manifest, ctx->manifest_path) == 0) {
+        ctx->manifest_state = 1;
+    }
+    else if (errno == ENOENT) {
+        /* the usual case, and exactly as if manifests didn't exist */
+    }
+    else if (errno == EPERM) {
+        warning(ctx, "Ignoring manifest %s: not owned by root, or writable by others",
+                ctx->manifest_path);
+    }
+    else {
+        warning(ctx, "Ignoring manifest %s: %s", ctx->manifest_path, strerror(errno));
+    }
+}
+
+/*
+ * The digest cache, opened the first time it's needed.
+ *
+ * Without one every file is read in full every time, which is slower but
+ * no less safe, so failing to open it is only worth a debug message.
+ */
+static struct verify_cache *digest_cache(struct root_ctx *ctx)
+{
+    static struct verify_cache none = { NULL };
+
+    if (ctx->digest_cache_state == -1) {
+        ctx->digest_cache_state = 0;
+        if (ctx->digest_cache_path == NULL) {
+            /* caching is off */
+        }
+        else if (verify_cache_open(&ctx->digest_cache, ctx->digest_cache_path) == 0) {
+            ctx->digest_cache_state = 1;
+        }
+        else {
+            debug(ctx, "Not caching digests in %s: %s",
+                  ctx->digest_cache_path, strerror(errno));
+        }
+    }
+    return ctx->digest_cache_state == 1 ? &ctx->digest_cache : &none;
+}
+
+int root_verify(struct root_ctx *ctx, const char *absolute_command, int *fdp)
+{
+    *fdp = -1;
+    load_manifest(ctx);
+    if (ctx->manifest_state != 1) {
+        return 0;
+    }
+
+    unsigned char expected[DIGEST_SIZE];
+    if (!manifest_lookup(&ctx->manifest, absolute_command, expected)) {
+        refuse(ctx, ROOT_PERMISSION_DENIED, "%s is not listed in %s",
+               absolute_command, ctx->manifest_path);
+        return ROOT_PERMISSION_DENIED;
+    }
+
+    /* the path was just resolved, so it ends in the file itself */
+    int fd = open(absolute_command, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        error(ctx, "Cannot open '%s' to verify it: %s", absolute_command, strerror(errno));
+        return ROOT_ERROR_EXECUTING_COMMAND;
+    }
+
+    unsigned char actual[DIGEST_SIZE];
+    int hashed;
+    if (verify_digest(digest_cache(ctx), fd, actual, &hashed) == -1) {
+        error(ctx, "Cannot read '%s' to verify it: %s", absolute_command, strerror(errno));
+        close(fd);
+        return ROOT_ERROR_EXECUTING_COMMAND;
+    }
+    debug(ctx, hashed ? "Computed digest of %s" : "Using cached digest of %s",
+          absolute_command);
+
+    if (memcmp(actual, expected, DIGEST_SIZE) != 0) {
+        char hex[DIGEST_HEX_SIZE];
+        digest_to_hex(actual, hex);
+        refuse(ctx, ROOT_PERMISSION_DENIED, "%s does not match %s (its digest is %s)",
+               absolute_command, ctx->manifest_path, hex);
+        close(fd);
+        return ROOT_PERMISSION_DENIED;
+    }
+
+    *fdp = fd;
+    return 0;
+}
+
+/*
+ * Returns 1 (true) if command is regarded as safe.
+ * Returns 0 (false) otherwise.
+ */
+static int command_is_safe(const char *path_command)
+{
+    /*
+     * Ensure the path is an absolute PATH to prevent running
+     * a malicious program installed by a rogue user in the current
+     * directory (or any relative entry in PATH).
+     *
+     * We could just check for a command starting with a dot, but I also
+     * want to handle the case where somebody puts something strange like
+     * "bin" in PATH (as opposed to "/bin"), which could also result in
+     * running an unintended command.  Ensuring the resultant path is
+     * absolute handles both cases.
+     */
+    return is_absolute_path(path_command);
+}
+
+int root_resolve(struct root_ctx *ctx,
+                 const char *command,
+                 struct root_resolution *res)
+{
+    if (res == NULL) {
+        error(ctx, "root_resolve: res is NULL");
+        return ROOT_PROGRAMMER_ERROR;
+    }
+
+    res->status = 0;
+    res->path_command[0] = '\0';
+    res->absolute_command[0] = '\0';
+    res->realpath_errno = 0;
+
+    if (command == NULL) {
+        error(ctx, "root_resolve: command is NULL");
+        return res->status = ROOT_PROGRAMMER_ERROR;
+    }
+
+    const char *qualified_command = command;
+    if (!is_qualified_path(command)) {
+        /*
+         * path didn't contain a slash,
+         * look it up in PATH and make sure it's safe
+         */
+        struct pathlist pathlist;
+        size_t mark = arena_mark(&ctx->arena);
+        if (!ctx->have_pathlist) {
+            const char *pathenv = getenv("PATH");
+            if (pathenv == NULL) {
+                error(ctx, "Cannot get PATH environment variable");
+                return res->status = ROOT_SYSTEM_ERROR;
+            }
+            debug(ctx, "Searching for command in PATH=%s", pathenv);
+            /* after logging, which may cache the username */
+            mark = arena_mark(&ctx->arena);
+            if (pathlist_init(&pathlist, &ctx->arena, pathenv) == -1) {
+                error(ctx, "Cannot allocate memory to hold pathenv");
+                return res->status = ROOT_SYSTEM_ERROR;
+            }
+        }
+
+        char *found = pathlist_find(ctx->have_pathlist ? &ctx->pathlist : &pathlist,
+                                    command,
+                                    res->path_command,
+                                    sizeof(res->path_command),
+                                    NULL);
+        int find_errno = errno;
+        arena_rewind(&ctx->arena, mark);
+
+        if (found == NULL) {
+            /* the last place tried */
+            res->path_command[0] = '\0';
+            if (find_errno == ENAMETOOLONG) {
+                /* realpath would have said the same */
+                res->realpath_errno = find_errno;
+                return res->status = ROOT_COMMAND_NOT_FOUND;
+            }
+            if (find_errno != ENOENT) {
+                error(ctx, "Cannot search PATH: %s", strerror(find_errno));
+                return res->status = ROOT_SYSTEM_ERROR;
+            }
+            debug(ctx, "%s not found in PATH", command);
+            return res->status = ROOT_COMMAND_NOT_FOUND;
+        }
+        qualified_command = res->path_command;
+    }
+
+    errno = 0;
+    if (realpath(qualified_command, res->absolute_command) == NULL) {
+        res->realpath_errno = errno;
+        res->absolute_command[0] = '\0';
+        return res->status = ROOT_COMMAND_NOT_FOUND;
+    }
+
+    if (res->path_command[0] != '\0' && !command_is_safe(res->path_command)) {
+        res->status = ROOT_RELATIVE_PATH_DISALLOWED;
+    }
+    return res->status;
+}
+
+int root_find_user(struct root_ctx *ctx, const char *name, uid_t *uidp)
+{
+    return find_user(ctx, name, uidp);
+}
+
+int root_hold_user(struct root_ctx *ctx, uid_t uid)
+{
+    return hold_user(ctx, uid);
+}
+
+int root_become(struct root_ctx *ctx, uid_t uid, int set_home)
+{
+    int status;
+
+    if (set_home) {
+        status = set_home_dir(ctx, uid);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    status = setup_groups(ctx, uid);
+    if (status != 0) {
+        return status;
+    }
+
+    /*
+     * if root is installed setuid, as it should be,
+     * become_user should always succeed
+     */
+    return become_user(ctx, uid);
+}
+
+int root_enter(struct root_ctx *ctx, pid_t pid, uid_t uid, pid_t *childp)
+{
+    *childp = 0;
+
+    struct namespaces ns;
+    if (namespaces_open(&ns, pid) == -1) {
+        if (errno == ESRCH) {
+            error(ctx, "No process %ld", (long)pid);
+            return ROOT_INVALID_USAGE;
+        }
+        if (errno == ENOSYS) {
+            error(ctx, "Cannot enter the namespaces of other processes on this system");
+            return ROOT_INVALID_USAGE;
+        }
+        error(ctx, "Cannot open the namespaces of process %ld: %s", (long)pid, strerror(errno));
+        return ROOT_SYSTEM_ERROR;
+    }
+
+    /* where it looks for commands, which is where the child should */
+    char pathenv[ROOT_PATH_MAX];
+    int have_path = namespaces_getenv(&ns, "PATH", pathenv, sizeof(pathenv)) == 0;
+    if (!have_path && errno == ESRCH) {
+        error(ctx, "No process %ld", (long)pid);
+        namespaces_close(&ns);
+        return ROOT_INVALID_USAGE;
+    }
+    if (!have_path) {
+        debug(ctx, "Not using the PATH of process %ld: %s", (long)pid,
+              errno == ENOENT ? "it has none" : strerror(errno));
+    }
+
+    /* while this host's files and name services are still in view */
+    holdlog(ctx);
+    const gid_t *groups;
+    int status = get_groups(ctx, &groups) == -1 ? ROOT_SYSTEM_ERROR : hold_user(ctx, uid);
+    if (status != 0) {
+        namespaces_close(&ns);
+        return status;
+    }
+    load_policy(ctx);
+    load_manifest(ctx);
+    digest_cache(ctx);
+
+    debug(ctx, "Entering the namespaces of process %ld", (long)pid);
+
+    /* only for children, and it can be done with threads, as we have */
+    if (namespaces_enter_pid(&ns) == -1) {
+        error(ctx, "Cannot enter the PID namespace of process %ld: %s", (long)pid,
+              strerror(errno));
+        namespaces_close(&ns);
+        return ROOT_SYSTEM_ERROR;
+    }
+
+    pid_t child = fork();
+    if (child == -1) {
+        error(ctx, "Cannot fork: %s", strerror(errno));
+        namespaces_close(&ns);
+        return ROOT_SYSTEM_ERROR;
+    }
+    if (child != 0) {
+        namespaces_close(&ns);
+        *childp = child;
+        return 0;
+    }
+
+    /* a child has one thread, and filesystem information of its own */
+    int user_ns = namespaces_have_user(&ns);
+    if (namespaces_enter(&ns) == -1) {
+        error(ctx, "Cannot enter the namespaces of process %ld: %s", (long)pid,
+              strerror(errno));
+        namespaces_close(&ns);
+        return ROOT_SYSTEM_ERROR;
+    }
+    namespaces_close(&ns);
+
+    if (user_ns) {
+        ctx->in_user_ns = 1;
+    }
+    if (have_path && setenv("PATH", pathenv, 1) != 0) {
+        error(ctx, "Cannot set PATH environment variable");
+        return ROOT_SYSTEM_ERROR;
+    }
+    if (ctx->have_pathlist && getenv("PATH") != NULL) {
+        /* the directories opened so far are this host's */
+        return root_set_path(ctx, getenv("PATH"));
+    }
+    return 0;
+}
+
+int root_exec(struct root_ctx *ctx,
+              const char *absolute_command,
+              const char *const *argv)
+{
+    /*
+     * IMPORTANT
+     * This must stay as execv, never execvp.
+     *
+     * The cast is required because execve doesn't enforce const'ness
+     * for backwards compatibility.
+     *
+     * See
+     * http://pubs.opengroup.org/onlinepubs/009695399/functions/exec.html
+     * http://stackoverflow.com/questions/190184/execv-and-const-ness
+     */
+    execv(absolute_command, (char *const *)argv);
+    /* execv does not return on success */
+    error(ctx, "Cannot exec '%s': %s", absolute_command, strerror(errno));
+    return ROOT_ERROR_EXECUTING_COMMAND;
+}
+
+int root_exec_fd(struct root_ctx *ctx,
+                 int fd,
+                 const char *absolute_command,
+                 const char *const *argv)
+{
+    /*
+     * The kernel runs a script's interpreter on /dev/fd/<fd>, which must
+     * still be open by then.  The interpreter inherits it as a result.
+     */
+    char magic[2];
+    if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+        && magic[0] == '#' && magic[1] == '!') {
+        fcntl(fd, F_SETFD, 0);
+    }
+
+    /* as for root_exec, the cast is only for const'ness */
+    fexecve(fd, (char *const *)argv, environ);
+    error(ctx, "Cannot exec '%s': %s", absolute_command, strerror(errno));
+    return ROOT_ERROR_EXECUTING_COMMAND;
+}
+
+void root_spawn_opts_init(struct root_spawn_opts *opts)
+{
+    opts->fds[0] = opts->fds[1] = opts->fds[2] = -1;
+    opts->uid = ROOT_UID;
+    opts->set_home = 1;
+    opts->become = 1;
+    opts->new_group = 0;
+    opts->exec_fd = -1;
+}
+
+int root_spawn(struct root_ctx *ctx,
+               const char *absolute_command,
+               const char *const *argv,
+               const struct root_spawn_opts *opts,
+               pid_t *pidp)
+{
+    pid_t pid = fork();
+    if (pid == -1) {
+        error(ctx, "Cannot fork: %s", strerror(errno));
+        return ROOT_SYSTEM_ERROR;
+    }
+
+    if (pid == 0) {
+        if (opts->new_group && setpgid(0, 0) == -1) {
+            _exit(ROOT_SYSTEM_ERROR);
+        }
+        for (int i = 0; i < 3; i++) {
+            if (opts->fds[i] != -1 && opts->fds[i] != i
+                && dup2(opts->fds[i], i) == -1) {
+                _exit(ROOT_SYSTEM_ERROR);
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            if (opts->fds[i] > 2) {
+                close(opts->fds[i]);
+            }
+        }
+
+        int status = 0;
+        if (opts->become) {
+            status = root_become(ctx, opts->uid, opts->set_home);
+        }
+        if (status == 0 && opts->exec_fd != -1) {
+            status = root_exec_fd(ctx, opts->exec_fd, absolute_command, argv);
+        }
+        else if (status == 0) {
+            status = root_exec(ctx, absolute_command, argv);
+        }
+        _exit(status);
+    }
+
+    /*
+     * Do it here as well, so the group exists by the time we return.
+     * This fails harmlessly if the child has already done it and exec'd.
+     */
+    if (opts->new_group) {
+        setpgid(pid, pid);
+    }
+
+    *pidp = pid;
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
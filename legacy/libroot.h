@@ -0,0 +1,344 @@
+#ifndef LIBROOT_H
+#define LIBROOT_H
+
+/*
+ * libroot
+ *
+ * root's permission check, PATH safety rules and user switching, for
+ * programs that would otherwise run root just to get them.
+ *
+ * Nothing here calls exit().  Functions that can fail return 0 on success
+ * or one of root's exit statuses (see root.h) on failure, having logged the
+ * reason through the context, exactly as root would.
+ *
+ * A context is not safe to share between threads, but there is no global
+ * state, so threads can each have their own.
+ */
+
+#include <sys/types.h>
+#include <stddef.h>
+
+#include "root.h"
+
+/*
+ * room for a path, at least PATH_MAX (which strict C99 callers can't see)
+ */
+#define ROOT_PATH_MAX 4096
+
+struct root_ctx;
+
+/*
+ * the outcome of resolving one command, see root_resolve
+ *
+ * held by the caller, so resolving allocates nothing
+ */
+struct root_resolution {
+    int status;                 /* 0, or the exit status for the failure */
+    char path_command[ROOT_PATH_MAX];       /* what the PATH search found,
+                                               or "" */
+    char absolute_command[ROOT_PATH_MAX];   /* the real path, or "" if it
+                                               couldn't be determined */
+    int realpath_errno;         /* why not, if it couldn't */
+};
+
+/*
+ * how root_spawn starts the child, see root_spawn_opts_init for defaults
+ */
+struct root_spawn_opts {
+    int fds[3];                 /* the child's stdin, stdout and stderr,
+                                   -1 to inherit ours */
+    uid_t uid;                  /* the user to become */
+    int set_home;               /* set HOME to uid's home directory */
+    int become;                 /* 0 if the caller is already uid */
+    int new_group;              /* put the child in a process group of
+                                   its own, led by itself */
+    int exec_fd;                /* execute this open file (see
+                                   root_verify) rather than the path,
+                                   or -1 */
+};
+
+/*
+ * Create a context, opening the syslog connection as progname.
+ *
+ * Everything the context logs is attributed to the real user at this
+ * point, even after root_become or root_enter.
+ *
+ * Returns NULL if memory could not be allocated.
+ */
+struct root_ctx *root_ctx_new(const char *progname);
+
+/*
+ * The same, but the context allocates from reserve before mapping memory
+ * of its own.  reserve must outlive the context.
+ *
+ * Everything a context needs comes from one arena that is released only by
+ * root_ctx_free, so a reserve of ROOT_CTX_RESERVE is usually all a single
+ * run of root touches.
+ */
+#define ROOT_CTX_RESERVE (16 * 1024)
+struct root_ctx *root_ctx_new_in(const char *progname,
+                                 void *reserve,
+                                 size_t size);
+void root_ctx_free(struct root_ctx *ctx);
+
+/*
+ * The most memory ctx has had allocated at once, in bytes.
+ */
+size_t root_ctx_peak(const struct root_ctx *ctx);
+
+/*
+ * Allocate size bytes, or a copy of string, from ctx's arena, to be
+ * released with ctx.  After root_set_low_memory, only what the arena
+ * already has is used.
+ *
+ * Returns NULL with errno set if there is no room.
+ */
+void *root_ctx_alloc(struct root_ctx *ctx, size_t size);
+char *root_ctx_strdup(struct root_ctx *ctx, const char *string);
+
+/*
+ * Show messages of priority level and more important on stderr.
+ *
+ * The default is LOG_ERR.  Use -1 to show nothing.
+ */
+void root_set_loglevel(struct root_ctx *ctx, int level);
+
+/*
+ * Parse pathenv and open its directories once for every later
+ * root_resolve.
+ *
+ * Without this, root_resolve reads PATH from the environment each time.
+ * A replaced PATH's memory is only reclaimed by root_ctx_free.
+ */
+int root_set_path(struct root_ctx *ctx, const char *pathenv);
+
+/*
+ * Whether the calling user may use root, i.e. is in group 0.
+ *
+ * Returns 0 if so, ROOT_PERMISSION_DENIED if not, or ROOT_SYSTEM_ERROR.
+ * The answer is remembered for the life of ctx.
+ */
+int root_permitted(struct root_ctx *ctx);
+
+/*
+ * Stop waiting for the name service switch after timeout_ms milliseconds
+ * in any one identity lookup, instead of the default (see root(1)), and
+ * use the local files instead.  0 waits for as long as it takes.
+ */
+void root_set_nss_timeout(struct root_ctx *ctx, long timeout_ms);
+
+/*
+ * Work for a host that is out of memory, as root --low-memory does: take no
+ * more memory than ctx already has (its reserve, see root_ctx_new_in), so
+ * that anything more fails with ROOT_SYSTEM_ERROR, answer identity lookups
+ * from the local files without NSS or helper threads, and make
+ * root_prefetch and root_prefetch_command do nothing.
+ */
+void root_set_low_memory(struct root_ctx *ctx);
+
+/*
+ * Start what a run will need before it needs it, in the background: the
+ * syslog connection, and the passwd entry and groups of the user called
+ * name (as for root_find_user), or of root if name is NULL.
+ *
+ * Nothing is decided or logged.  root_find_user and root_become use the
+ * answers if they match, waiting for them only as long as for a lookup of
+ * their own (see root_set_nss_timeout), so this is safe to call before
+ * root_permitted.
+ */
+void root_prefetch(struct root_ctx *ctx, const char *name);
+
+/*
+ * Start reading absolute_command (as returned by root_resolve), and the
+ * interpreter it names, into the page cache in the background, so that
+ * executing it needn't wait for the disk.
+ */
+void root_prefetch_command(struct root_ctx *ctx, const char *absolute_command);
+
+/*
+ * Log argv to syslog as root does after its Running record: escaped, and
+ * cut down to its start and end, with its size and digest, if it is long
+ * (see root(1)).
+ */
+void root_log_args(struct root_ctx *ctx, const char *const *argv);
+
+/*
+ * Log record, e.g. "Running /bin/ls", then argv, as root does, with us
+ * being how long the caller took to decide to run it: once in full, and
+ * then only counted while the same run repeats, if coalescing is on (see
+ * root(1)).
+ */
+void root_log_running(struct root_ctx *ctx,
+                      const char *record,
+                      const char *const *argv,
+                      unsigned long us);
+
+/*
+ * Use the compiled policy at path instead of the default (see root(1)).
+ *
+ * path must outlive ctx.
+ */
+void root_set_policy(struct root_ctx *ctx, const char *path);
+
+/*
+ * Keep the host-wide budget for refusal records at path instead of the
+ * default (see root(1)), or have no budget if path is NULL.
+ *
+ * path must outlive ctx.
+ */
+void root_set_ratelimit(struct root_ctx *ctx, const char *path);
+
+/*
+ * Coalesce Running records with the table at path instead of the default
+ * (see root(1)), or never if path is NULL.
+ *
+ * path must outlive ctx.
+ */
+void root_set_coalesce(struct root_ctx *ctx, const char *path);
+
+/*
+ * Whether the policy lets the caller run absolute_command (as returned by
+ * root_resolve) with the arguments argv[1]...
+ *
+ * Returns 0 if so, or if no usable policy is installed, which is logged
+ * as a warning unless there is simply no table.  Otherwise returns
+ * ROOT_PERMISSION_DENIED or ROOT_SYSTEM_ERROR.
+ */
+int root_check_policy(struct root_ctx *ctx,
+                      const char *absolute_command,
+                      const char *const *argv);
+
+/*
+ * Use the digest manifest at path instead of the default (see root(1)).
+ *
+ * path must outlive ctx.
+ */
+void root_set_manifest(struct root_ctx *ctx, const char *path);
+
+/*
+ * Remember digests between runs at path instead of the default (see
+ * root(1)), or not at all if path is NULL.
+ *
+ * path must outlive ctx.
+ */
+void root_set_digest_cache(struct root_ctx *ctx, const char *path);
+
+/*
+ * Open absolute_command (as returned by root_resolve) and check its content
+ * against the manifest, if one is installed.
+ *
+ * Returns 0 with *fdp set to a close-on-exec descriptor of the file that
+ * was checked, which the caller must execute (with root_exec_fd, or
+ * root_spawn's exec_fd) rather than the path, so that what runs is what
+ * was checked.  If no usable manifest is installed, *fdp is -1 and the
+ * path may be executed as usual; a manifest that can't be used is logged
+ * as a warning unless there is simply none.
+ *
+ * Otherwise returns ROOT_PERMISSION_DENIED if the file is not listed or
+ * its digest differs, ROOT_ERROR_EXECUTING_COMMAND if it can't be read,
+ * or ROOT_SYSTEM_ERROR, having logged why.
+ */
+int root_verify(struct root_ctx *ctx, const char *absolute_command, int *fdp);
+
+/*
+ * Resolve command to the absolute path root would run, following the PATH
+ * safety rules described in root(1).
+ *
+ * Returns res->status: 0 if command may be run as res->absolute_command.
+ * Otherwise it is ROOT_COMMAND_NOT_FOUND, either because the PATH search
+ * found nothing (res->path_command is "") or because realpath failed
+ * (res->realpath_errno is set), ROOT_RELATIVE_PATH_DISALLOWED because it
+ * was found via a relative PATH entry (res->path_command), or
+ * ROOT_SYSTEM_ERROR.
+ *
+ * Only the failures that are not about command itself are logged.
+ */
+int root_resolve(struct root_ctx *ctx,
+                 const char *command,
+                 struct root_resolution *res);
+
+/*
+ * Look up the user called name, to become with root_become or root_spawn,
+ * storing their uid in *uidp.
+ *
+ * Returns 0, ROOT_INVALID_USAGE if there is no such user, or
+ * ROOT_SYSTEM_ERROR.
+ */
+int root_find_user(struct root_ctx *ctx, const char *name, uid_t *uidp);
+
+/*
+ * Look up uid's passwd entry and supplementary groups now, as root_become
+ * would, so that root_become itself only switches.
+ *
+ * Returns 0 or ROOT_SYSTEM_ERROR.
+ */
+int root_hold_user(struct root_ctx *ctx, uid_t uid);
+
+/*
+ * Switch this process to uid, its primary group and its supplementary
+ * groups, optionally setting HOME.  Unless uid is 0, the process can't
+ * switch back.
+ *
+ * Returns 0 or ROOT_SYSTEM_ERROR.  On failure the process may be partly
+ * switched and must not carry on.
+ */
+int root_become(struct root_ctx *ctx, uid_t uid, int set_home);
+
+/*
+ * Carry on in a child that is in the namespaces of process pid (such as a
+ * container's), in its root directory, with its PATH, so that
+ * root_resolve, root_verify and root_exec see what that process sees.
+ *
+ * Everything else ctx reads from this host is opened or looked up first,
+ * and used from then on: the syslog connection and the budget for
+ * refusals, the caller's name and groups, the policy, the manifest and
+ * digest cache, and the passwd entry and groups of uid, for root_become.
+ * In the target's user namespace, if it has its own, root_become gives
+ * uid no supplementary groups.
+ *
+ * Returns 0 in both processes, with *childp set to the child's process ID
+ * in the parent, which should wait for it and exit as it did, and to 0 in
+ * the child.  Otherwise returns ROOT_INVALID_USAGE if there is no such
+ * process or this system can't enter namespaces, or ROOT_SYSTEM_ERROR,
+ * having logged why; in the child, which must then exit, *childp is 0.
+ */
+int root_enter(struct root_ctx *ctx, pid_t pid, uid_t uid, pid_t *childp);
+
+/*
+ * Replace this process with absolute_command.
+ *
+ * Only returns on failure, with ROOT_ERROR_EXECUTING_COMMAND.
+ */
+int root_exec(struct root_ctx *ctx,
+              const char *absolute_command,
+              const char *const *argv);
+
+/*
+ * Replace this process with the open file fd, as returned by root_verify.
+ * absolute_command is used only for messages.
+ *
+ * Only returns on failure, with ROOT_ERROR_EXECUTING_COMMAND.
+ */
+int root_exec_fd(struct root_ctx *ctx,
+                 int fd,
+                 const char *absolute_command,
+                 const char *const *argv);
+
+void root_spawn_opts_init(struct root_spawn_opts *opts);
+
+/*
+ * Start absolute_command as a child running as opts->uid, storing its
+ * process ID in *pidp.
+ *
+ * Returns 0, or ROOT_SYSTEM_ERROR if the child could not be created.
+ * If the child cannot switch user or exec, it exits with the status root
+ * would have.  Callers should log the command first, as root does.
+ */
+int root_spawn(struct root_ctx *ctx,
+               const char *absolute_command,
+               const char *const *argv,
+               const struct root_spawn_opts *opts,
+               pid_t *pidp);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,416 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), realpath(), setreuid(), vsyslog(),
+                           glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp(), realpath(), setreuid(), vsyslog() */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "digest.h"
+#include "libroot.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char prog[512];
+
+/* what was sent to syslog while capturing, one message per line */
+static char logged[4096];
+static int capturing = 0;
+
+/* in place of the C library's, which libroot.a calls */
+void vsyslog(int priority, const char *format, va_list ap)
+{
+    if (!capturing) {
+        return;
+    }
+    size_t len = strlen(logged);
+    vsnprintf(logged + len, sizeof(logged) - len, format, ap);
+    len = strlen(logged);
+    snprintf(logged + len, sizeof(logged) - len, "\n");
+}
+
+static struct root_ctx *new_ctx(void)
+{
+    struct root_ctx *ctx = root_ctx_new("libroottest");
+    assert(ctx != NULL);
+    /* failures are expected, keep them off the test output */
+    root_set_loglevel(ctx, -1);
+    return ctx;
+}
+
+void test_ctx_in_reserve(void)
+{
+    printf("Running %s\n", __func__);
+    static char reserve[ROOT_CTX_RESERVE];
+    struct root_ctx *ctx = root_ctx_new_in("libroottest", reserve, sizeof(reserve));
+    assert(ctx != NULL);
+    assert((char *)ctx >= reserve && (char *)ctx < reserve + sizeof(reserve));
+
+    size_t peak = root_ctx_peak(ctx);
+    assert(peak > 0 && peak <= sizeof(reserve));
+
+    struct root_resolution res;
+    assert(root_set_path(ctx, base) == 0);
+    peak = root_ctx_peak(ctx);
+    /* resolving allocates nothing once PATH is set */
+    for (int i = 0; i < 100; i++) {
+        assert(root_resolve(ctx, "prog", &res) == 0);
+    }
+    assert(root_ctx_peak(ctx) == peak);
+
+    root_ctx_free(ctx);
+}
+
+void test_low_memory(void)
+{
+    printf("Running %s\n", __func__);
+    static char reserve[ROOT_CTX_RESERVE];
+    struct root_ctx *ctx = root_ctx_new_in("libroottest", reserve, sizeof(reserve));
+    assert(ctx != NULL);
+    root_set_loglevel(ctx, -1);
+    root_set_low_memory(ctx);
+
+    /* the files answer */
+    uid_t uid = 1;
+    assert(root_find_user(ctx, "root", &uid) == 0);
+    assert(uid == 0);
+
+    /* a PATH that fits, and one that doesn't */
+    assert(root_set_path(ctx, base) == 0);
+    static char huge[2 * ROOT_CTX_RESERVE];
+    memset(huge, 'x', sizeof(huge) - 1);
+    assert(root_set_path(ctx, huge) == ROOT_SYSTEM_ERROR);
+    assert(root_ctx_alloc(ctx, 64) != NULL);
+    assert(root_ctx_alloc(ctx, sizeof(huge)) == NULL);
+    assert(root_ctx_peak(ctx) <= sizeof(reserve));
+
+    root_ctx_free(ctx);
+}
+
+void test_resolve_found(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    struct root_resolution res;
+    char expected[PATH_MAX];
+
+    assert(realpath(prog, expected) != NULL);
+    assert(root_set_path(ctx, base) == 0);
+    assert(root_resolve(ctx, "prog", &res) == 0);
+    assert(res.status == 0);
+    assert(strcmp(res.path_command, prog) == 0);
+    assert(strcmp(res.absolute_command, expected) == 0);
+
+    /* the same context answers again without re-reading PATH */
+    assert(root_resolve(ctx, "prog", &res) == 0);
+
+    root_ctx_free(ctx);
+}
+
+void test_resolve_not_found(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    struct root_resolution res;
+
+    assert(root_set_path(ctx, base) == 0);
+    assert(root_resolve(ctx, "nosuchprog", &res) == ROOT_COMMAND_NOT_FOUND);
+    assert(res.path_command[0] == '\0');
+    assert(res.realpath_errno == 0);
+
+    root_ctx_free(ctx);
+}
+
+void test_resolve_relative_path_entry(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    struct root_resolution res;
+    char cwd[PATH_MAX];
+
+    assert(getcwd(cwd, sizeof(cwd)) != NULL);
+    assert(chdir(base) == 0);
+    assert(root_set_path(ctx, ".") == 0);
+    assert(root_resolve(ctx, "prog", &res) == ROOT_RELATIVE_PATH_DISALLOWED);
+    assert(strcmp(res.path_command, "./prog") == 0);
+    assert(chdir(cwd) == 0);
+
+    root_ctx_free(ctx);
+}
+
+void test_resolve_realpath_fails(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    struct root_resolution res;
+
+    assert(root_resolve(ctx, "/nonexistent/prog", &res) == ROOT_COMMAND_NOT_FOUND);
+    assert(res.path_command[0] == '\0');
+    assert(res.absolute_command[0] == '\0');
+    assert(res.realpath_errno == ENOENT);
+
+    root_ctx_free(ctx);
+}
+
+void test_permitted_is_stable(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+
+    int first = root_permitted(ctx);
+    assert(first == 0 || first == ROOT_PERMISSION_DENIED);
+    assert(root_permitted(ctx) == first);
+
+    root_ctx_free(ctx);
+}
+
+void test_find_user(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    uid_t uid = 1;
+
+    assert(root_find_user(ctx, "root", &uid) == 0);
+    assert(uid == 0);
+    assert(root_find_user(ctx, "no such user", &uid) == ROOT_INVALID_USAGE);
+
+    root_ctx_free(ctx);
+}
+
+void test_become_other_user(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    uid_t uid;
+    if (geteuid() != 0 || root_find_user(ctx, "nobody", &uid) != 0) {
+        printf("Skipping %s (needs root and a nobody user)\n", __func__);
+        root_ctx_free(ctx);
+        return;
+    }
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        if (root_become(ctx, uid, 1) != 0) {
+            _exit(1);
+        }
+        /* all the way, and for good */
+        if (getuid() != uid || geteuid() != uid || setuid(0) != -1) {
+            _exit(2);
+        }
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    root_ctx_free(ctx);
+}
+
+void test_records_name_caller(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    uid_t uid;
+    if (geteuid() != 0 || root_find_user(ctx, "nobody", &uid) != 0) {
+        printf("Skipping %s (needs root and a nobody user)\n", __func__);
+        root_ctx_free(ctx);
+        return;
+    }
+    root_ctx_free(ctx);
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        /* as if nobody had run root installed setuid */
+        if (setreuid(uid, 0) == -1) {
+            _exit(1);
+        }
+        ctx = new_ctx();
+        root_set_coalesce(ctx, NULL);
+        if (root_become(ctx, 0, 0) != 0) {
+            _exit(2);
+        }
+        /* e.g. the records --timeout logs once the command is running */
+        const char *const args[] = { "true", NULL };
+        capturing = 1;
+        root_log_running(ctx, "Running /bin/true", args, 0);
+        capturing = 0;
+        if (strncmp(logged, "nobody: Running /bin/true\nnobody: Arguments ", 44) != 0) {
+            fprintf(stderr, "%s", logged);
+            _exit(3);
+        }
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_spawn(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    struct root_spawn_opts opts;
+    const char *argv[] = {"sh", "-c", "echo hello; exit 7", NULL};
+    int fds[2];
+    char output[64];
+    pid_t pid;
+    int status;
+
+    assert(pipe(fds) == 0);
+    root_spawn_opts_init(&opts);
+    /* already the user we'd become, so this works without privileges */
+    opts.become = 0;
+    opts.fds[1] = fds[1];
+    assert(root_spawn(ctx, "/bin/sh", argv, &opts, &pid) == 0);
+    close(fds[1]);
+
+    ssize_t n = read(fds[0], output, sizeof(output) - 1);
+    assert(n >= 0);
+    output[n] = '\0';
+    close(fds[0]);
+    assert(strcmp(output, "hello\n") == 0);
+
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 7);
+
+    root_ctx_free(ctx);
+}
+
+void test_spawn_exec_fails(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx();
+    struct root_spawn_opts opts;
+    const char *argv[] = {"nosuchprog", NULL};
+    pid_t pid;
+    int status;
+
+    root_spawn_opts_init(&opts);
+    opts.become = 0;
+    assert(root_spawn(ctx, "/nonexistent/prog", argv, &opts, &pid) == 0);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status));
+    assert(WEXITSTATUS(status) == ROOT_ERROR_EXECUTING_COMMAND);
+
+    root_ctx_free(ctx);
+}
+
+static void write_file(const char *path, const char *text, mode_t mode)
+{
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, mode);
+    assert(fd != -1);
+    assert(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+    close(fd);
+}
+
+void test_verify(void)
+{
+    printf("Running %s\n", __func__);
+    if (geteuid() != 0) {
+        printf("Skipping %s (manifests must be owned by root)\n", __func__);
+        return;
+    }
+    struct root_ctx *ctx = new_ctx();
+    struct root_spawn_opts opts;
+    char script[600], manifest[600], cache[600], line[1400];
+    char hex[DIGEST_HEX_SIZE];
+    unsigned char digest[DIGEST_SIZE];
+    const char *argv[] = {"script", NULL};
+    int fds[2], fd;
+    char output[64];
+    pid_t pid;
+    int status;
+
+    snprintf(script, sizeof(script), "%s/script", base);
+    snprintf(manifest, sizeof(manifest), "%s/manifest", base);
+    snprintf(cache, sizeof(cache), "%s/digests", base);
+    write_file(script, "#!/bin/sh\necho verified\n", 0755);
+    fd = open(script, O_RDONLY);
+    assert(fd != -1);
+    assert(digest_fd(fd, digest) == 0);
+    close(fd);
+    digest_to_hex(digest, hex);
+    snprintf(line, sizeof(line), "%s  %s\n", hex, script);
+    write_file(manifest, line, 0644);
+
+    /* without a manifest, nothing is checked */
+    root_set_manifest(ctx, "/nonexistent/manifest");
+    assert(root_verify(ctx, script, &fd) == 0);
+    assert(fd == -1);
+
+    root_set_manifest(ctx, manifest);
+    root_set_digest_cache(ctx, cache);
+    assert(root_verify(ctx, script, &fd) == 0);
+    assert(fd != -1);
+    assert(fcntl(fd, F_GETFD) & FD_CLOEXEC);
+
+    /* what runs is the file that was checked, even a script */
+    assert(pipe(fds) == 0);
+    root_spawn_opts_init(&opts);
+    opts.become = 0;
+    opts.fds[1] = fds[1];
+    opts.exec_fd = fd;
+    assert(root_spawn(ctx, script, argv, &opts, &pid) == 0);
+    close(fds[1]);
+    ssize_t n = read(fds[0], output, sizeof(output) - 1);
+    assert(n >= 0);
+    output[n] = '\0';
+    close(fds[0]);
+    assert(strcmp(output, "verified\n") == 0);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(fd);
+
+    /* unlisted */
+    assert(root_verify(ctx, prog, &fd) == ROOT_PERMISSION_DENIED);
+    assert(fd == -1);
+
+    /* changed since it was listed */
+    write_file(script, "#!/bin/sh\necho changed\n", 0755);
+    assert(root_verify(ctx, script, &fd) == ROOT_PERMISSION_DENIED);
+    assert(fd == -1);
+
+    root_ctx_free(ctx);
+    unlink(script);
+    unlink(manifest);
+    unlink(cache);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(prog, sizeof(prog), "%s/prog", base);
+    int fd = open(prog, O_WRONLY|O_CREAT|O_EXCL, 0755);
+    assert(fd != -1);
+    close(fd);
+
+    test_ctx_in_reserve();
+    test_low_memory();
+    test_resolve_found();
+    test_resolve_not_found();
+    test_resolve_relative_path_entry();
+    test_resolve_realpath_fails();
+    test_permitted_is_stable();
+    test_find_user();
+    test_become_other_user();
+    test_records_name_caller();
+    test_spawn();
+    test_spawn_exec_fails();
+    test_verify();
+
+    unlink(prog);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
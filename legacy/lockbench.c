@@ -0,0 +1,238 @@
+/*
+ * lockbench
+ *
+ * have processes contend for a named lock and report how long they waited
+ *
+ * Usage: lockbench [-m futex|flock|poll] [-p processes] [-n rounds]
+ *                  [-s slots] [-t hold-us]
+ *
+ * Each of the processes (default 8) takes a slot, holds it for hold-us
+ * microseconds (default 1000), and gives it up, rounds times (default 100).
+ * The lock is one of:
+ *   futex  the host-wide locks behind --lock and --slots (see locks.h)
+ *   flock  a blocking flock(2) on one of slots files, chosen by process
+ *   poll   flock(2) with LOCK_NB on each of slots files in turn, sleeping
+ *          10ms when none is free, as lock-retry loops in scripts do
+ * in a temporary directory.
+ *
+ * Prints one line of key=value pairs:
+ *   mode, processes, slots, rounds   as given
+ *   wall_ms       how long it all took
+ *   per_second    slots taken per second
+ *   wait_us_*     how long each take waited (median, p99, max)
+ *   cpu_ms        CPU time the processes used, holding included
+ */
+
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS, mkdtemp(), usleep(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for MAP_ANONYMOUS, mkdtemp(), usleep() */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "locks.h"
+
+#define MAX_PROCESSES 256
+#define MAX_ROUNDS 100000
+
+static char dir[] = "/tmp/lockbenchXXXXXX";
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: lockbench [-m futex|flock|poll] [-p processes] [-n rounds]\n"
+                    "                 [-s slots] [-t hold-us]\n");
+    exit(2);
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* hold for us microseconds without giving up the CPU, as a busy command would */
+static void hold(long us)
+{
+    long long until = now_ns() + us * 1000LL;
+    while (now_ns() < until) {
+    }
+}
+
+static int open_slot(int i)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "%s/slot%d", dir, i);
+    int fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+    if (fd == -1) {
+        perror(path);
+        _exit(1);
+    }
+    return fd;
+}
+
+/*
+ * Run one process's rounds, storing how long each take waited in waits.
+ */
+static void worker(const char *mode, int me, int rounds, int slots, long hold_us,
+                   long long *waits)
+{
+    struct locks l;
+    int fds[LOCK_MAX_SLOTS];
+    char path[64];
+
+    if (strcmp(mode, "futex") == 0) {
+        snprintf(path, sizeof(path), "%s/locks", dir);
+        if (locks_open(&l, path) == -1) {
+            perror(path);
+            _exit(1);
+        }
+    }
+    else {
+        for (int i = 0; i < slots; i++) {
+            fds[i] = open_slot(i);
+        }
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        long long start = now_ns();
+        int held = -1;
+        if (strcmp(mode, "futex") == 0) {
+            held = locks_take(&l, "bench", slots);
+        }
+        else if (strcmp(mode, "flock") == 0) {
+            held = me % slots;
+            while (flock(fds[held], LOCK_EX) == -1 && errno == EINTR) {
+            }
+        }
+        else {
+            while (held == -1) {
+                for (int i = 0; i < slots && held == -1; i++) {
+                    if (flock(fds[i], LOCK_EX|LOCK_NB) == 0) {
+                        held = i;
+                    }
+                }
+                if (held == -1) {
+                    usleep(10 * 1000);
+                }
+            }
+        }
+        if (held == -1) {
+            perror("lockbench");
+            _exit(1);
+        }
+        waits[r] = (now_ns() - start) / 1000;
+
+        hold(hold_us);
+
+        if (strcmp(mode, "futex") == 0) {
+            locks_release(&l);
+        }
+        else {
+            flock(fds[held], LOCK_UN);
+        }
+    }
+    _exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = "futex";
+    int processes = 8;
+    int rounds = 100;
+    int slots = 1;
+    long hold_us = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:p:n:s:t:")) != -1) {
+        switch (opt) {
+        case 'm': mode = optarg; break;
+        case 'p': processes = atoi(optarg); break;
+        case 'n': rounds = atoi(optarg); break;
+        case 's': slots = atoi(optarg); break;
+        case 't': hold_us = atol(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc
+        || (strcmp(mode, "futex") != 0 && strcmp(mode, "flock") != 0
+            && strcmp(mode, "poll") != 0)
+        || processes < 1 || processes > MAX_PROCESSES
+        || rounds < 1 || rounds > MAX_ROUNDS
+        || slots < 1 || slots > LOCK_MAX_SLOTS || hold_us < 0) {
+        usage();
+    }
+
+    if (mkdtemp(dir) == NULL) {
+        perror("lockbench: mkdtemp");
+        return 1;
+    }
+
+    size_t nwaits = (size_t)processes * rounds;
+    long long *waits = mmap(NULL, nwaits * sizeof(*waits), PROT_READ|PROT_WRITE,
+                            MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (waits == MAP_FAILED) {
+        perror("lockbench: mmap");
+        return 1;
+    }
+
+    long long start = now_ns();
+    for (int i = 0; i < processes; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("lockbench: fork");
+            return 1;
+        }
+        if (pid == 0) {
+            worker(mode, i, rounds, slots, hold_us, waits + (size_t)i * rounds);
+        }
+    }
+    int failed = 0;
+    for (int i = 0; i < processes; i++) {
+        int status;
+        if (wait(&status) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
+    }
+    long long wall_ns = now_ns() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    long cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+                + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+
+    qsort(waits, nwaits, sizeof(*waits), compare_ll);
+    printf("mode=%s processes=%d slots=%d rounds=%d wall_ms=%lld per_second=%.0f"
+           " wait_us_median=%lld wait_us_p99=%lld wait_us_max=%lld cpu_ms=%ld\n",
+           mode, processes, slots, rounds, wall_ns / 1000000,
+           nwaits / (wall_ns / 1e9),
+           waits[nwaits / 2], waits[nwaits * 99 / 100], waits[nwaits - 1], cpu_ms);
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/locks", dir);
+    unlink(path);
+    for (int i = 0; i < slots; i++) {
+        snprintf(path, sizeof(path), "%s/slot%d", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+    return failed;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
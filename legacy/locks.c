@@ -0,0 +1,369 @@
+#define _DEFAULT_SOURCE /* for syscall(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for syscall() */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "locks.h"
+#include "statefile.h"
+
+/*
+ * The waiting is done by the kernel, so this needs futexes and the robust
+ * futex list; and the table is shared between processes, so it needs
+ * atomic operations, which C99 doesn't have.
+ */
+#if defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_LOCKS 1
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define CAS(p, expectedp, v) \
+    __atomic_compare_exchange_n((p), (expectedp), (v), 0, \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define SWAP(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#endif
+
+/*
+ * A futex word, with the link that puts it on its holder's robust list.
+ * The word is the holder's thread ID, plus FUTEX_WAITERS if anyone needs
+ * waking when it's released, or FUTEX_OWNER_DIED if the kernel released it.
+ */
+struct lock_word {
+    struct robust_list link;
+    uint32_t word;
+    uint32_t unused;
+};
+
+struct lock_entry {
+    uint64_t key;               /* hash of the name, or 0 if unused */
+    char name[LOCK_NAME_MAX];   /* for whoever looks at the file */
+    struct lock_word gate;      /* a PI futex: who's next */
+    struct lock_word slots[LOCK_MAX_SLOTS];
+};
+
+struct lock_table {
+    struct lock_entry entries[LOCK_NAMES];
+};
+
+int locks_valid_name(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len >= LOCK_NAME_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+              || (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int locks_open(struct locks *l, const char *path)
+{
+    l->table = NULL;
+    l->entry = -1;
+    l->slot = -1;
+
+#ifndef HAVE_LOCKS
+    errno = ENOSYS;
+    return -1;
+#else
+    l->saved = NULL;
+    void *table = statefile_map(path, sizeof(struct lock_table));
+    if (table == NULL) {
+        return -1;
+    }
+    l->table = table;
+    return 0;
+#endif
+}
+
+void locks_close(struct locks *l)
+{
+    locks_release(l);
+    if (l->table != NULL) {
+        munmap(l->table, sizeof(*l->table));
+        l->table = NULL;
+    }
+}
+
+#ifdef HAVE_LOCKS
+/* which robust list entries are PI futexes, in the link that points to them */
+#define PI_ENTRY 1
+
+static long futex(uint32_t *word, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+static uint32_t thread_id(void)
+{
+    return (uint32_t)syscall(SYS_gettid);
+}
+
+/*
+ * name's entry, giving it an unused one if need be, or NULL if there are
+ * none left.  Names are compared by a 64-bit hash, so that an entry is
+ * claimed with one compare-and-swap; two names with the same hash would
+ * merely share their slots.
+ */
+static struct lock_entry *find_entry(struct lock_table *table, const char *name)
+{
+    /* FNV-1a */
+    uint64_t key = 14695981039346656037u;
+    for (const char *p = name; *p != '\0'; p++) {
+        key = (key ^ (unsigned char)*p) * 1099511628211u;
+    }
+    if (key == 0) {
+        key = 1;
+    }
+
+    for (uint32_t i = 0; i < LOCK_NAMES; i++) {
+        struct lock_entry *entry = &table->entries[(key + i) % LOCK_NAMES];
+        uint64_t found = LOAD(&entry->key);
+        if (found == 0) {
+            if (CAS(&entry->key, &found, key)) {
+                strcpy(entry->name, name);
+                return entry;
+            }
+            /* somebody else got there first; found is now theirs */
+        }
+        if (found == key) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Our robust list, replacing the C library's while we hold anything.
+ * Links to PI futexes are tagged with PI_ENTRY.
+ */
+static void robust_begin(struct locks *l)
+{
+    syscall(SYS_get_robust_list, 0, &l->saved, &l->saved_len);
+    l->robust.list.next = &l->robust.list;
+    l->robust.futex_offset = offsetof(struct lock_word, word)
+                           - offsetof(struct lock_word, link);
+    l->robust.list_op_pending = NULL;
+    syscall(SYS_set_robust_list, &l->robust, sizeof(l->robust));
+}
+
+static void robust_end(struct locks *l)
+{
+    if (l->saved != NULL) {
+        syscall(SYS_set_robust_list, l->saved, l->saved_len);
+    }
+    l->saved = NULL;
+}
+
+static struct robust_list *link_to(struct lock_word *w, int pi)
+{
+    return (struct robust_list *)((uintptr_t)&w->link | (pi ? PI_ENTRY : 0));
+}
+
+static struct lock_word *linked(struct robust_list *link)
+{
+    return (struct lock_word *)((uintptr_t)link & ~(uintptr_t)PI_ENTRY);
+}
+
+/* the kernel releases w if we die before robust_add or robust_remove is done */
+static void robust_pending(struct locks *l, struct lock_word *w, int pi)
+{
+    STORE(&l->robust.list_op_pending, w == NULL ? NULL : link_to(w, pi));
+}
+
+static void robust_add(struct locks *l, struct lock_word *w, int pi)
+{
+    w->link.next = l->robust.list.next;
+    STORE(&l->robust.list.next, link_to(w, pi));
+}
+
+static void robust_remove(struct locks *l, struct lock_word *w)
+{
+    struct robust_list **link = &l->robust.list.next;
+    while (*link != &l->robust.list) {
+        struct lock_word *found = linked(*link);
+        if (found == w) {
+            STORE(link, w->link.next);
+            return;
+        }
+        link = &found->link.next;
+    }
+}
+
+/*
+ * Take our turn: lock the gate, a PI futex, whose waiters the kernel
+ * queues in order, and which it hands straight to the next of them.
+ */
+static int gate_lock(struct locks *l, struct lock_word *gate, uint32_t tid)
+{
+    robust_pending(l, gate, 1);
+    uint32_t expected = 0;
+    if (!CAS(&gate->word, &expected, tid)) {
+        while (futex(&gate->word, FUTEX_LOCK_PI, 0, NULL) == -1) {
+            if (errno != EINTR) {
+                int saved_errno = errno;
+                robust_pending(l, NULL, 0);
+                errno = saved_errno;
+                return -1;
+            }
+        }
+    }
+    robust_add(l, gate, 1);
+    robust_pending(l, NULL, 0);
+    return 0;
+}
+
+static void gate_unlock(struct locks *l, struct lock_word *gate, uint32_t tid)
+{
+    robust_pending(l, gate, 1);
+    robust_remove(l, gate);
+    uint32_t expected = tid;
+    /* if anyone is waiting, or the last holder died, the kernel decides */
+    if (!CAS(&gate->word, &expected, 0)) {
+        futex(&gate->word, FUTEX_UNLOCK_PI, 0, NULL);
+    }
+    robust_pending(l, NULL, 0);
+}
+
+/*
+ * Wait until one of the nslots words in waiters changes.
+ */
+static void wait_any(struct futex_waitv *waiters, int nslots)
+{
+    if (nslots == 1) {
+        futex((uint32_t *)(uintptr_t)waiters[0].uaddr, FUTEX_WAIT, (uint32_t)waiters[0].val, NULL);
+        return;
+    }
+#ifdef SYS_futex_waitv
+    if (syscall(SYS_futex_waitv, waiters, nslots, 0, NULL, 0) != -1 || errno != ENOSYS) {
+        return;
+    }
+#endif
+    /* before Linux 5.16, watch the first slot, and look at the others now and then */
+    struct timespec timeout = { 0, 50 * 1000 * 1000 };
+    futex((uint32_t *)(uintptr_t)waiters[0].uaddr, FUTEX_WAIT, (uint32_t)waiters[0].val, &timeout);
+}
+
+/*
+ * With the gate locked, take the first free slot of the first nslots,
+ * waiting for one if need be.
+ */
+static int take_slot(struct locks *l, struct lock_entry *entry, int nslots, uint32_t tid)
+{
+    struct futex_waitv waiters[LOCK_MAX_SLOTS];
+
+    for (;;) {
+        int busy = 0;
+        for (int i = 0; i < nslots; i++) {
+            struct lock_word *slot = &entry->slots[i];
+            uint32_t word = LOAD(&slot->word);
+            /* free, or freed by the kernel when its holder died */
+            if ((word & FUTEX_TID_MASK) == 0) {
+                robust_pending(l, slot, 0);
+                if (CAS(&slot->word, &word, tid)) {
+                    robust_add(l, slot, 0);
+                    robust_pending(l, NULL, 0);
+                    return i;
+                }
+                robust_pending(l, NULL, 0);
+                break;
+            }
+            /* so the holder wakes us, or the kernel if it dies */
+            if (!(word & FUTEX_WAITERS)) {
+                uint32_t waiting = word | FUTEX_WAITERS;
+                if (!CAS(&slot->word, &word, waiting)) {
+                    break;
+                }
+                word = waiting;
+            }
+            memset(&waiters[busy], 0, sizeof(waiters[busy]));
+            waiters[busy].uaddr = (uintptr_t)&slot->word;
+            waiters[busy].val = word;
+            waiters[busy].flags = FUTEX_32;
+            busy++;
+        }
+        /* if one changed as we looked, look again */
+        if (busy == nslots) {
+            wait_any(waiters, nslots);
+        }
+    }
+}
+#endif
+
+int locks_take(struct locks *l, const char *name, int nslots)
+{
+#ifndef HAVE_LOCKS
+    errno = ENOSYS;
+    return -1;
+#else
+    if (l->table == NULL || !locks_valid_name(name)
+        || nslots < 1 || nslots > LOCK_MAX_SLOTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (l->slot != -1) {
+        errno = EBUSY;
+        return -1;
+    }
+    struct lock_entry *entry = find_entry(l->table, name);
+    if (entry == NULL) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    uint32_t tid = thread_id();
+    robust_begin(l);
+    if (gate_lock(l, &entry->gate, tid) == -1) {
+        int saved_errno = errno;
+        robust_end(l);
+        errno = saved_errno;
+        return -1;
+    }
+    int slot = take_slot(l, entry, nslots, tid);
+    gate_unlock(l, &entry->gate, tid);
+
+    l->entry = (int)(entry - l->table->entries);
+    l->slot = slot;
+    return slot;
+#endif
+}
+
+void locks_release(struct locks *l)
+{
+#ifdef HAVE_LOCKS
+    if (l->table == NULL || l->slot == -1) {
+        return;
+    }
+    struct lock_word *slot = &l->table->entries[l->entry].slots[l->slot];
+    l->entry = -1;
+    l->slot = -1;
+
+    /* e.g. a child that inherited our struct locks */
+    uint32_t tid = thread_id();
+    if ((LOAD(&slot->word) & FUTEX_TID_MASK) != tid) {
+        return;
+    }
+    robust_pending(l, slot, 0);
+    robust_remove(l, slot);
+    uint32_t word = SWAP(&slot->word, 0);
+    if (word & FUTEX_WAITERS) {
+        futex(&slot->word, FUTEX_WAKE, 1, NULL);
+    }
+    robust_pending(l, NULL, 0);
+    robust_end(l);
+#endif
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
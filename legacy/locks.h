@@ -0,0 +1,92 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <stddef.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
+/*
+ * where the host-wide locks are kept
+ *
+ * created by root if need be; override at build time, e.g.
+ * make CFLAGS+=-DLOCKS_PATH='"/var/run/root.locks"'
+ */
+#ifndef LOCKS_PATH
+#define LOCKS_PATH "/run/root/locks"
+#endif
+
+/* the longest lock name, plus one */
+#define LOCK_NAME_MAX 48
+
+/* the most slots a lock can have */
+#define LOCK_MAX_SLOTS 64
+
+/*
+ * how many different lock names the host can use; names are never
+ * forgotten until the file is removed, e.g. at boot
+ */
+#ifndef LOCK_NAMES
+#define LOCK_NAMES 128
+#endif
+
+/*
+ * Host-wide named counting locks, for --lock and --slots.
+ *
+ * Every name has LOCK_MAX_SLOTS slots, and a caller asking for n of them
+ * takes whichever of the first n is free.  Callers take turns in the
+ * order they arrived: each waits on a robust priority-inheritance futex
+ * (the kernel queues its waiters in order), and only the one at the front
+ * looks for a free slot, waiting on all n slot words at once
+ * (futex_waitv, Linux 5.16) until one is released.
+ *
+ * Holders are tracked by the kernel's robust futex list, so whatever a
+ * process holds or is queued for is given up when it dies, however it
+ * dies, and whoever is waiting is woken.  Nothing polls.
+ *
+ * Only on Linux; elsewhere locks_open fails with ENOSYS.
+ */
+struct locks {
+    struct lock_table *table;
+    int entry;                  /* the name held, or -1 */
+    int slot;                   /* the slot held, or -1 */
+#ifdef __linux__
+    struct robust_list_head robust;     /* what the kernel releases for us */
+    struct robust_list_head *saved;     /* the C library's list, restored */
+    size_t saved_len;                   /* once nothing is held */
+#endif
+};
+
+/*
+ * Map the locks at path, creating them (and their directory) if need be.
+ *
+ * Returns 0 on success, or -1 with errno set.  EPERM means the file is not
+ * a regular file owned by us and inaccessible to anyone else, EINVAL that
+ * it is the wrong size, and ENOSYS that locks aren't supported here.
+ */
+int locks_open(struct locks *l, const char *path);
+void locks_close(struct locks *l);
+
+/*
+ * Whether name is a usable lock name: 1 to LOCK_NAME_MAX - 1 letters,
+ * digits, dots, dashes or underscores.
+ */
+int locks_valid_name(const char *name);
+
+/*
+ * Wait for one of the first nslots (1 to LOCK_MAX_SLOTS) slots of name,
+ * in turn, and hold it until locks_release, or until this process exits.
+ * Only the thread that calls this may release it.
+ *
+ * Returns the slot taken, from 0, or -1 with errno set: ENOSPC if there
+ * are already LOCK_NAMES other names, EBUSY if one is already held.
+ */
+int locks_take(struct locks *l, const char *name, int nslots);
+
+/*
+ * Give up the slot held, if any, waking whoever is waiting for it.
+ */
+void locks_release(struct locks *l);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,295 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), usleep(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp(), usleep() */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "locks.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char path[512];
+
+static void open_fresh(struct locks *l)
+{
+    unlink(path);
+    assert(locks_open(l, path) == 0);
+}
+
+/*
+ * Start a process that takes nslots of name, writes the slot it got (as a
+ * letter, from 'a') to report, then holds it until it's killed.
+ */
+static pid_t start_holder(const char *name, int nslots, int report)
+{
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        struct locks l;
+        char c;
+        if (locks_open(&l, path) == -1) {
+            _exit(1);
+        }
+        int slot = locks_take(&l, name, nslots);
+        if (slot == -1) {
+            _exit(1);
+        }
+        c = (char)('a' + slot);
+        if (write(report, &c, 1) != 1) {
+            _exit(1);
+        }
+        for (;;) {
+            pause();
+        }
+    }
+    return pid;
+}
+
+/* what fd says within ms, or 0 if it says nothing */
+static char heard(int fd, int ms)
+{
+    struct pollfd p = { fd, POLLIN, 0 };
+    char c;
+    if (poll(&p, 1, ms) != 1 || read(fd, &c, 1) != 1) {
+        return 0;
+    }
+    return c;
+}
+
+static void reap(pid_t pid)
+{
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+}
+
+void test_names(void)
+{
+    printf("Running %s\n", __func__);
+    assert(locks_valid_name("apt"));
+    assert(locks_valid_name("backup.nightly-2_a"));
+    assert(!locks_valid_name(""));
+    assert(!locks_valid_name("a/b"));
+    assert(!locks_valid_name("a b"));
+    assert(!locks_valid_name("a:1"));
+
+    char name[LOCK_NAME_MAX + 1];
+    memset(name, 'x', LOCK_NAME_MAX - 1);
+    name[LOCK_NAME_MAX - 1] = '\0';
+    assert(locks_valid_name(name));
+    name[LOCK_NAME_MAX - 1] = 'x';
+    name[LOCK_NAME_MAX] = '\0';
+    assert(!locks_valid_name(name));
+}
+
+void test_take_and_release(void)
+{
+    printf("Running %s\n", __func__);
+    struct locks l;
+    open_fresh(&l);
+
+    assert(locks_take(&l, "apt", 1) == 0);
+    errno = 0;
+    assert(locks_take(&l, "other", 1) == -1);
+    assert(errno == EBUSY);
+    locks_release(&l);
+    locks_release(&l);
+    assert(locks_take(&l, "apt", 1) == 0);
+    locks_release(&l);
+
+    errno = 0;
+    assert(locks_take(&l, "apt", 0) == -1);
+    assert(errno == EINVAL);
+    assert(locks_take(&l, "apt", LOCK_MAX_SLOTS + 1) == -1);
+    assert(locks_take(&l, "a/b", 1) == -1);
+    assert(locks_take(&l, "apt", LOCK_MAX_SLOTS) == 0);
+    locks_close(&l);
+}
+
+void test_exclusive(void)
+{
+    printf("Running %s\n", __func__);
+    struct locks l;
+    int report[2];
+    open_fresh(&l);
+    assert(pipe(report) == 0);
+
+    assert(locks_take(&l, "apt", 1) == 0);
+    pid_t pid = start_holder("apt", 1, report[1]);
+    assert(heard(report[0], 200) == 0);
+    /* another name is another lock */
+    pid_t other = start_holder("dpkg", 1, report[1]);
+    assert(heard(report[0], 1000) == 'a');
+
+    locks_release(&l);
+    assert(heard(report[0], 1000) == 'a');
+
+    kill(pid, SIGKILL);
+    kill(other, SIGKILL);
+    reap(pid);
+    reap(other);
+    close(report[0]);
+    close(report[1]);
+    locks_close(&l);
+}
+
+void test_slots(void)
+{
+    printf("Running %s\n", __func__);
+    struct locks l;
+    int report[2];
+    open_fresh(&l);
+    assert(pipe(report) == 0);
+
+    assert(locks_take(&l, "builds", 2) == 0);
+    pid_t second = start_holder("builds", 2, report[1]);
+    assert(heard(report[0], 1000) == 'b');
+    pid_t third = start_holder("builds", 2, report[1]);
+    assert(heard(report[0], 200) == 0);
+
+    /* the second goes, so the third gets its slot */
+    kill(second, SIGTERM);
+    assert(heard(report[0], 1000) == 'b');
+    reap(second);
+
+    /* asking for fewer slots only looks at the first ones */
+    pid_t fourth = start_holder("builds", 1, report[1]);
+    assert(heard(report[0], 200) == 0);
+    locks_release(&l);
+    assert(heard(report[0], 1000) == 'a');
+
+    kill(third, SIGKILL);
+    kill(fourth, SIGKILL);
+    reap(third);
+    reap(fourth);
+    close(report[0]);
+    close(report[1]);
+    locks_close(&l);
+}
+
+void test_holder_dies(void)
+{
+    printf("Running %s\n", __func__);
+    struct locks l;
+    int report[2];
+    open_fresh(&l);
+    assert(pipe(report) == 0);
+
+    /* killed while holding it */
+    pid_t holder = start_holder("apt", 1, report[1]);
+    assert(heard(report[0], 1000) == 'a');
+    pid_t waiter = start_holder("apt", 1, report[1]);
+    assert(heard(report[0], 200) == 0);
+    kill(holder, SIGKILL);
+    reap(holder);
+    assert(heard(report[0], 1000) == 'a');
+    kill(waiter, SIGKILL);
+    reap(waiter);
+    assert(locks_take(&l, "apt", 1) == 0);
+
+    /* killed while first in line, and while second */
+    pid_t first = start_holder("apt", 1, report[1]);
+    usleep(100 * 1000);
+    pid_t second = start_holder("apt", 1, report[1]);
+    usleep(100 * 1000);
+    pid_t third = start_holder("apt", 1, report[1]);
+    usleep(100 * 1000);
+    kill(first, SIGKILL);
+    kill(second, SIGKILL);
+    reap(first);
+    reap(second);
+    assert(heard(report[0], 200) == 0);
+    locks_release(&l);
+    assert(heard(report[0], 1000) == 'a');
+
+    kill(third, SIGKILL);
+    reap(third);
+    close(report[0]);
+    close(report[1]);
+    locks_close(&l);
+}
+
+void test_in_order(void)
+{
+    printf("Running %s\n", __func__);
+    struct locks l;
+    int report[2];
+    pid_t pids[5];
+    open_fresh(&l);
+    assert(pipe(report) == 0);
+
+    /* each waiter says who it is, then lets the next one in */
+    assert(locks_take(&l, "apt", 1) == 0);
+    for (int i = 0; i < 5; i++) {
+        pids[i] = fork();
+        assert(pids[i] != -1);
+        if (pids[i] == 0) {
+            struct locks mine;
+            char c = (char)('0' + i);
+            if (locks_open(&mine, path) == -1 || locks_take(&mine, "apt", 1) == -1
+                || write(report[1], &c, 1) != 1) {
+                _exit(1);
+            }
+            usleep(10 * 1000);
+            locks_release(&mine);
+            _exit(0);
+        }
+        /* so they line up in this order */
+        usleep(50 * 1000);
+    }
+    locks_release(&l);
+    for (int i = 0; i < 5; i++) {
+        assert(heard(report[0], 1000) == '0' + i);
+        reap(pids[i]);
+    }
+
+    close(report[0]);
+    close(report[1]);
+    locks_close(&l);
+}
+
+void test_too_many_names(void)
+{
+    printf("Running %s\n", __func__);
+    struct locks l;
+    char name[32];
+    open_fresh(&l);
+
+    for (int i = 0; i < LOCK_NAMES; i++) {
+        snprintf(name, sizeof(name), "name%d", i);
+        assert(locks_take(&l, name, 1) == 0);
+        locks_release(&l);
+    }
+    errno = 0;
+    assert(locks_take(&l, "onemore", 1) == -1);
+    assert(errno == ENOSPC);
+    /* the ones it has still work */
+    assert(locks_take(&l, "name7", 1) == 0);
+    locks_close(&l);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(path, sizeof(path), "%s/locks", base);
+
+    test_names();
+    test_take_and_release();
+    test_exclusive();
+    test_slots();
+    test_holder_dies();
+    test_in_order();
+    test_too_many_names();
+
+    unlink(path);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -1,46 +1,93 @@
-#define _DEFAULT_SOURCE         /* for strdup(), glibc >= 2.20 */
-#define _BSD_SOURCE             /* for strdup() */
+#define _DEFAULT_SOURCE         /* for vsyslog(), glibc >= 2.20 */
+#define _BSD_SOURCE             /* for vsyslog() */
 
 #include <sys/types.h>
 #include <errno.h>
 #include <pwd.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "coalesce.h"
+#include "context.h"
+#include "digest.h"
 #include "logging.h"
+#include "nss.h"
+#include "prefetch.h"
+#include "ratelimit.h"
+#include "root.h"
 
-int loglevel = LOG_ERR;           /* only print ERROR, CRIT, ... */
-static const char *g_progname;    /* XXX? maybe share this with root.o */
+/* how syslog is opened, see initlog */
+#define SYSLOG_OPTION (LOG_CONS|LOG_PID)
+#define SYSLOG_FACILITY LOG_AUTHPRIV
 
-void setloglevel(int level)
+void setloglevel(struct root_ctx *ctx, int level)
 {
-    loglevel = level;
+    ctx->loglevel = level;
 }
 
-void initlog(const char *name)
+/*
+ * syslog itself is per process, so the last context to call this
+ * decides the identity used there
+ */
+int initlog(struct root_ctx *ctx, const char *name)
 {
-    openlog(name, LOG_CONS|LOG_PID, LOG_AUTHPRIV);
-    g_progname = strdup(name);
-    if (g_progname == NULL) {
+    ctx->loglevel = LOG_ERR;    /* only print ERROR, CRIT, ... */
+    /* still the caller's after root_become, e.g. for --timeout's records */
+    ctx->caller_uid = getuid();
+    ctx->username = NULL;
+    ctx->ratelimit_path = RATELIMIT_PATH;
+    ctx->ratelimit_state = -1;
+    ctx->coalesce_path = COALESCE_PATH;
+    ctx->coalesce_state = -1;
+    ctx->progname = arena_strdup(&ctx->arena, name);
+    if (ctx->progname == NULL) {
         fprintf(stderr, "root: Cannot allocate memory for program name\n");
+        return -1;
     }
+    openlog(ctx->progname, SYSLOG_OPTION, SYSLOG_FACILITY);
+    return 0;
+}
+
+void connectlog(struct root_ctx *ctx)
+{
+    prefetch_syslog(ctx->progname, SYSLOG_OPTION, SYSLOG_FACILITY);
+}
+
+void freelog(struct root_ctx *ctx)
+{
+    /* the strings belong to the arena */
+    ctx->progname = NULL;
+    ctx->username = NULL;
+    if (ctx->ratelimit_state == 1) {
+        ratelimit_close(&ctx->ratelimit);
+    }
+    ctx->ratelimit_state = -1;
+    if (ctx->coalesce_state == 1) {
+        coalesce_close(&ctx->coalesce);
+    }
+    ctx->coalesce_state = -1;
 }
 
 /*
- * Return a string in the format "<tag>: <format><suffix>".
- *
- * Caller must free returned string.
+ * Return a string in the format "<tag>: <format><suffix>",
+ * allocated from arena.
  */
-static char *makeformat(const char *tag, const char *format, const char *suffix)
+static char *makeformat(struct arena *arena,
+                        const char *tag,
+                        const char *format,
+                        const char *suffix)
 {
     char *fmt = NULL; size_t fmtmax, fmtlen;
 
     fmtmax = strlen(tag) + strlen(": ") + strlen(format) + strlen(suffix) + 1;
-    fmt = malloc(fmtmax);
+    fmt = arena_alloc(arena, fmtmax);
     if (fmt == NULL) {
         return NULL;
     }
@@ -50,104 +97,242 @@ static char *makeformat(const char *tag, const char *format, const char *suffix)
         /* Don't call writescreen or writelog, since that's how we got here. */
         fprintf(stderr, "root: Unable to make log format\n");
         syslog(LOG_CRIT, "root: Unable to make log format");
-        exit(1);
+        return NULL;
     }
 
     return fmt;
 }
 
-void writelog(int priority, const char *format, va_list ap)
+void writelog(struct root_ctx *ctx, int priority, const char *format, va_list ap)
 {
     char *logformat = NULL;
     char *escapedusername = NULL;
-    uid_t ruid;
+    const char *username;
 
-    ruid = getuid();
-    escapedusername = escape_percents(get_username(ruid));
-    if (escapedusername == NULL) {
-        vsyslog(priority, format, ap);
-        return;
+    /* looked up first, the name is kept after we rewind */
+    username = get_username(ctx, ctx->caller_uid);
+
+    size_t mark = arena_mark(&ctx->arena);
+    escapedusername = escape_percents(&ctx->arena, username);
+    if (escapedusername != NULL) {
+        logformat = makeformat(&ctx->arena, escapedusername, format, "");
+    }
+    if (logformat != NULL) {
+        vsyslog(priority, logformat, ap);
     }
-    logformat = makeformat(escapedusername, format, "");
-    if (logformat == NULL) {
-        free(escapedusername);
+    else {
         vsyslog(priority, format, ap);
-        return;
     }
-
-    vsyslog(priority, logformat, ap);
-
-    free(escapedusername);
-    free(logformat);
+    arena_rewind(&ctx->arena, mark);
 }
 
-void writescreen(int priority, const char *format, va_list ap)
+void writescreen(struct root_ctx *ctx, int priority, const char *format, va_list ap)
 {
     char *screenformat = NULL;
     char *escapedprogname = NULL;
 
     /* only print messages at loglevel or "lower" priority */
     /* with syslog, lowest means most important */
-    if (priority > loglevel) {
+    if (priority > ctx->loglevel) {
         return;
     }
 
-    escapedprogname = escape_percents(g_progname);
-    if (escapedprogname == NULL) {
-        vfprintf(stderr, format, ap);
-        fprintf(stderr, "\n");
-        return;
+    size_t mark = arena_mark(&ctx->arena);
+    escapedprogname = escape_percents(&ctx->arena, ctx->progname);
+    if (escapedprogname != NULL) {
+        screenformat = makeformat(&ctx->arena, escapedprogname, format, "\n");
     }
-    screenformat = makeformat(escapedprogname, format, "\n");
-    if (screenformat == NULL) {
-        free(escapedprogname);
+    if (screenformat != NULL) {
+        vfprintf(stderr, screenformat, ap);
+    }
+    else {
         vfprintf(stderr, format, ap);
         fprintf(stderr, "\n");
-        return;
     }
-    vfprintf(stderr, screenformat, ap);
+    arena_rewind(&ctx->arena, mark);
+}
 
-    free(escapedprogname);
-    free(screenformat);
+void debug(struct root_ctx *ctx, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    writelog(ctx, LOG_DEBUG, format, ap);
+    va_end(ap);
+    va_start(ap, format);
+    writescreen(ctx, LOG_DEBUG, format, ap);
+    va_end(ap);
 }
 
-void debug(const char *format, ...)
+void error(struct root_ctx *ctx, const char *format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    writelog(LOG_DEBUG, format, ap);
+    writelog(ctx, LOG_ERR, format, ap);
     va_end(ap);
     va_start(ap, format);
-    writescreen(LOG_DEBUG, format, ap);
+    writescreen(ctx, LOG_ERR, format, ap);
     va_end(ap);
 }
 
-void error(const char *format, ...)
+void warning(struct root_ctx *ctx, const char *format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    writelog(LOG_ERR, format, ap);
+    writelog(ctx, LOG_WARNING, format, ap);
     va_end(ap);
     va_start(ap, format);
-    writescreen(LOG_ERR, format, ap);
+    writescreen(ctx, LOG_WARNING, format, ap);
+    va_end(ap);
+}
+
+/*
+ * only send the message to syslog
+ */
+static void logonly(struct root_ctx *ctx, int priority, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    writelog(ctx, priority, format, ap);
+    va_end(ap);
+}
+
+/*
+ * only print the message on the screen, if the log level allows
+ */
+static void print_info(struct root_ctx *ctx, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    writescreen(ctx, LOG_INFO, format, ap);
+    va_end(ap);
+}
+
+/* the budget, opened the first time it's needed */
+static void open_ratelimit(struct root_ctx *ctx)
+{
+    if (ctx->ratelimit_state == -1) {
+        ctx->ratelimit_state = ctx->ratelimit_path != NULL
+            && ratelimit_open(&ctx->ratelimit, ctx->ratelimit_path) == 0;
+    }
+}
+
+/* the counts for audit, opened the first time they're needed */
+static void open_coalesce(struct root_ctx *ctx)
+{
+    if (ctx->coalesce_state == -1) {
+        ctx->coalesce_state = ctx->coalesce_path != NULL
+            && coalesce_open(&ctx->coalesce, ctx->coalesce_path) == 0;
+    }
+}
+
+void holdlog(struct root_ctx *ctx)
+{
+    openlog(ctx->progname, SYSLOG_OPTION|LOG_NDELAY, SYSLOG_FACILITY);
+    get_username(ctx, ctx->caller_uid);
+    open_ratelimit(ctx);
+    open_coalesce(ctx);
+}
+
+/*
+ * whether the budget allows another limited record; without a usable
+ * budget, everything is allowed, as it always was
+ */
+static int admit(struct root_ctx *ctx, unsigned long *suppressedp)
+{
+    *suppressedp = 0;
+    open_ratelimit(ctx);
+    if (ctx->ratelimit_state != 1) {
+        return 1;
+    }
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        return 1;
+    }
+    uint64_t now_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    return ratelimit_admit(&ctx->ratelimit, ctx->caller_uid, now_ms, suppressedp);
+}
+
+void refuse(struct root_ctx *ctx, int status, const char *format, ...)
+{
+    unsigned long suppressed = 0;
+    int admitted = 1;
+    if (status == ROOT_PERMISSION_DENIED
+        || status == ROOT_COMMAND_NOT_FOUND
+        || status == ROOT_RELATIVE_PATH_DISALLOWED) {
+        admitted = admit(ctx, &suppressed);
+    }
+
+    va_list ap;
+    if (suppressed > 0) {
+        logonly(ctx, LOG_ERR, "%lu similar messages suppressed", suppressed);
+    }
+    if (admitted) {
+        va_start(ap, format);
+        writelog(ctx, LOG_ERR, format, ap);
+        va_end(ap);
+    }
+    va_start(ap, format);
+    writescreen(ctx, LOG_ERR, format, ap);
     va_end(ap);
 }
 
 /*
- * XXX how to escape control characters,
- *     e.g. what if command name contains backspaces?
+ * The message is not escaped; use log_args for what the caller typed.
  */
-void info(const char *format, ...)
+void info(struct root_ctx *ctx, const char *format, ...)
 {
     va_list ap;
     va_start(ap, format);
-    writelog(LOG_INFO, format, ap);
+    writelog(ctx, LOG_INFO, format, ap);
     va_end(ap);
     va_start(ap, format);
-    writescreen(LOG_INFO, format, ap);
+    writescreen(ctx, LOG_INFO, format, ap);
     va_end(ap);
 }
 
+void audit(struct root_ctx *ctx,
+           const char *record,
+           const char *const *args,
+           unsigned long us)
+{
+    char formatted[LOG_ARGS_MAX];
+    int full = 1;
+
+    open_coalesce(ctx);
+    if (ctx->coalesce_state == 1) {
+        struct coalesce_summary summaries[COALESCE_WAYS];
+        int nsummaries;
+        unsigned char key[DIGEST_SIZE];
+        struct timespec now;
+
+        coalesce_key(record, args, key);
+        format_args(formatted, COALESCE_TEXT_MAX, args);
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+            uint64_t now_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+            full = coalesce_admit(&ctx->coalesce, ctx->caller_uid, key, record, formatted,
+                                  now_ms, us, summaries, &nsummaries);
+            for (int i = 0; i < nsummaries; i++) {
+                struct coalesce_summary *s = &summaries[i];
+                logonly(ctx, LOG_INFO,
+                        "Repeated %lu times by uid %lu within %lus of being logged: "
+                        "%s, arguments %s; root took %luus min, %luus mean, %luus max",
+                        s->count, (unsigned long)s->uid,
+                        (unsigned long)COALESCE_WINDOW_MS / 1000,
+                        s->record, s->args, s->min_us, s->mean_us, s->max_us);
+            }
+        }
+    }
+
+    if (full) {
+        info(ctx, "%s", record);
+        log_args(ctx, args);
+    }
+    else {
+        print_info(ctx, "%s", record);
+    }
+}
+
 /*
  * Print the given message on stderr.
  *
@@ -163,18 +348,29 @@ void print(const char *format, ...)
     va_end(ap);
 }
 
-const char *get_username(uid_t uid)
+/*
+ * the name of uid, for log messages
+ *
+ * the name is looked up once and cached in ctx while uid stays the same
+ */
+const char *get_username(struct root_ctx *ctx, uid_t uid)
 {
-    struct passwd *ppw = getpwuid(uid);
-    if (ppw == NULL) {
-        return "Unknown user";
+    if (ctx->username != NULL && ctx->username_uid == uid) {
+        return ctx->username;
     }
 
-    return ppw->pw_name;
+    /* a different uid's name is left in the arena */
+    struct target_user user;
+    if (nss_user_by_uid(ctx, uid, &user) == -1) {
+        return "Unknown user";
+    }
+    ctx->username = user.name;
+    ctx->username_uid = uid;
+    return user.name;
 }
 
-/* caller must free returned string */
-char *escape_percents(const char *string)
+/* the returned string is allocated from arena */
+char *escape_percents(struct arena *arena, const char *string)
 {
     char *escaped;
     size_t length;
@@ -185,7 +381,7 @@ char *escape_percents(const char *string)
     }
 
     length = strlen(string);
-    escaped = malloc(length * 2 + 1);
+    escaped = arena_alloc(arena, length * 2 + 1);
 
     if (escaped == NULL) {
         return NULL;
@@ -205,4 +401,370 @@ char *escape_percents(const char *string)
     return escaped;
 }
 
+/*
+ * Arguments records
+ *
+ * Every byte is escaped on its own, apart from UTF-8 sequences, so the
+ * record can be cut between any two escapes and the pieces still read the
+ * same.  That is what lets format_args write just the head and the tail of
+ * a long argv, and only look at the rest to measure and digest it.
+ */
+
+/* the longest escape, \xHH */
+#define ESCAPE_MAX 4
+
+/* what stands for the arguments left out */
+#define ELLIPSIS " ... "
+
+/* " (truncated, N arguments, N bytes, blake3 HEX)" at its longest */
+#define SUFFIX_MAX (13 + 20 + 12 + 20 + 15 + 2 * DIGEST_SIZE + 1)
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* whether any byte of w is less than n, which is at most 0x80 */
+#define HAS_LESS(w, n) (((w) - ONES * (n)) & ~(w) & HIGHS)
+
+/* whether any byte of w is c */
+#define HAS_BYTE(w, c) HAS_LESS((w) ^ (ONES * (c)), 1)
+
+/* whether c is written as is */
+static int plain(unsigned char c)
+{
+    return c > ' ' && c < 0x7f && c != '\\' && c != '"';
+}
+
+/*
+ * How many of the len bytes at p are plain, looking at eight at a time
+ * while none of them needs escaping.
+ */
+static size_t plain_span(const unsigned char *p, size_t len)
+{
+    size_t n = 0;
+    for (; n + 8 <= len; n += 8) {
+        uint64_t w;
+        memcpy(&w, p + n, sizeof(w));
+        if ((w & HIGHS) != 0
+            || HAS_LESS(w, ' ' + 1)
+            || HAS_BYTE(w, 0x7f)
+            || HAS_BYTE(w, '\\')
+            || HAS_BYTE(w, '"')) {
+            break;
+        }
+    }
+    while (n < len && plain(p[n])) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * The length of the UTF-8 sequence at p, which has len bytes, or 0 if it
+ * isn't a valid one, or is a C1 control character.
+ */
+static size_t utf8_length(const unsigned char *p, size_t len)
+{
+    unsigned char lo = 0x80, hi = 0xbf;
+    size_t n;
+
+    if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+        n = 2;
+        if (p[0] == 0xc2) {
+            lo = 0xa0;          /* not U+0080 to U+009F */
+        }
+    }
+    else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+        n = 3;
+        if (p[0] == 0xe0) {
+            lo = 0xa0;          /* not overlong */
+        }
+        else if (p[0] == 0xed) {
+            hi = 0x9f;          /* not a surrogate */
+        }
+    }
+    else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+        n = 4;
+        if (p[0] == 0xf0) {
+            lo = 0x90;          /* not overlong */
+        }
+        else if (p[0] == 0xf4) {
+            hi = 0x8f;          /* not past U+10FFFF */
+        }
+    }
+    else {
+        return 0;
+    }
+
+    if (len < n || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * Escape the first character of the len (> 0) bytes at p into out, which
+ * holds ESCAPE_MAX bytes, setting *usedp to how many bytes it was.
+ *
+ * Returns how many bytes were written.
+ */
+static size_t escape_one(const unsigned char *p, size_t len, char *out, size_t *usedp)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char c = p[0];
+    size_t n;
+
+    *usedp = 1;
+    if (c >= 0x80 && (n = utf8_length(p, len)) > 0) {
+        memcpy(out, p, n);
+        *usedp = n;
+        return n;
+    }
+    if (plain(c)) {
+        out[0] = c;
+        return 1;
+    }
+
+    out[0] = '\\';
+    switch (c) {
+    case '\\':
+    case '"':
+    case ' ':
+        out[1] = c;
+        return 2;
+    case '\t':
+        out[1] = 't';
+        return 2;
+    case '\n':
+        out[1] = 'n';
+        return 2;
+    case '\r':
+        out[1] = 'r';
+        return 2;
+    }
+    out[1] = 'x';
+    out[2] = hex[c >> 4];
+    out[3] = hex[c & 0xf];
+    return 4;
+}
+
+/* a place in the arguments being escaped */
+struct args_cursor {
+    const char *const *args;
+    size_t arg;                 /* the argument, args[arg] */
+    size_t off;                 /* the next byte of it */
+    size_t len;                 /* its length */
+    int sep;                    /* whether the space before it is still to come */
+};
+
+static void cursor_at(struct args_cursor *c,
+                      const char *const *args,
+                      size_t arg,
+                      size_t off)
+{
+    c->args = args;
+    c->arg = arg;
+    c->off = off;
+    c->len = args[arg] != NULL ? strlen(args[arg]) : 0;
+    c->sep = 0;
+}
+
+static void next_arg(struct args_cursor *c)
+{
+    cursor_at(c, c->args, c->arg + 1, 0);
+    c->sep = c->args[c->arg] != NULL;
+}
+
+/*
+ * Escape the next character (or space, or empty argument) at c into out,
+ * which holds ESCAPE_MAX bytes, and move past it.
+ *
+ * Returns how many bytes were written, or 0 at the end of the arguments.
+ */
+static size_t next_unit(struct args_cursor *c, char *out)
+{
+    const char *arg = c->args[c->arg];
+    size_t used, n;
+
+    if (arg == NULL) {
+        return 0;
+    }
+    if (c->sep) {
+        c->sep = 0;
+        out[0] = ' ';
+        return 1;
+    }
+    if (c->len == 0) {
+        out[0] = '"';
+        out[1] = '"';
+        next_arg(c);
+        return 2;
+    }
+
+    n = escape_one((const unsigned char *)arg + c->off, c->len - c->off, out, &used);
+    c->off += used;
+    if (c->off == c->len) {
+        next_arg(c);
+    }
+    return n;
+}
+
+/* where escaped arguments go, or just how long they'd be if buf is NULL */
+struct args_writer {
+    char *buf;
+    size_t len;
+    size_t max;
+};
+
+/*
+ * Escape the arguments from c onwards into w, up to the end or the first
+ * character that doesn't fit.
+ *
+ * Returns 1 if it got to the end.
+ */
+static int escape_into(struct args_cursor *c, struct args_writer *w)
+{
+    char unit[ESCAPE_MAX];
+
+    for (;;) {
+        const char *arg = c->args[c->arg];
+        if (arg == NULL) {
+            return 1;
+        }
+
+        if (!c->sep && c->off < c->len) {
+            size_t n = plain_span((const unsigned char *)arg + c->off, c->len - c->off);
+            size_t room = w->max - w->len;
+            int full = n > room;
+            if (full) {
+                n = room;
+            }
+            if (w->buf != NULL) {
+                memcpy(w->buf + w->len, arg + c->off, n);
+            }
+            w->len += n;
+            c->off += n;
+            if (full) {
+                return 0;
+            }
+            if (c->off == c->len) {
+                next_arg(c);
+                continue;
+            }
+        }
+
+        struct args_cursor next = *c;
+        size_t n = next_unit(&next, unit);
+        if (n > w->max - w->len) {
+            return 0;
+        }
+        if (w->buf != NULL) {
+            memcpy(w->buf + w->len, unit, n);
+        }
+        w->len += n;
+        *c = next;
+    }
+}
+
+/*
+ * Point c at the start of the last (about) want bytes of the argc
+ * arguments, counting the spaces between them.
+ */
+static void cursor_at_tail(struct args_cursor *c,
+                           const char *const *args,
+                           size_t argc,
+                           size_t want)
+{
+    size_t arg = argc, off = 0;
+
+    while (arg > 0 && want > 0) {
+        size_t len = strlen(args[arg - 1]);
+        arg--;
+        if (len >= want) {
+            off = len - want;
+            /* not in the middle of a UTF-8 sequence */
+            for (int i = 0; i < 3 && off + 1 < len
+                            && (args[arg][off] & 0xc0) == 0x80; i++) {
+                off++;
+            }
+            break;
+        }
+        want -= len + 1;
+    }
+    cursor_at(c, args, arg, off);
+}
+
+size_t format_args(char *buf, size_t size, const char *const *args)
+{
+    struct args_cursor c;
+    struct args_writer w = { buf, 0, (size - 1 - strlen(ELLIPSIS) - SUFFIX_MAX) / 2 };
+
+    /* as much as fits, remembering where the head would end */
+    cursor_at(&c, args, 0, 0);
+    int done = escape_into(&c, &w);
+    size_t head = w.len;
+    if (!done) {
+        w.max = size - 1;
+        done = escape_into(&c, &w);
+    }
+    if (done) {
+        buf[w.len] = '\0';
+        return w.len;
+    }
+
+    /* too long: say what was cut, as b3sum would see it from printf '%s\0' */
+    struct digest d;
+    unsigned char sum[DIGEST_SIZE];
+    char hex[DIGEST_HEX_SIZE];
+    char suffix[SUFFIX_MAX + 1];
+    size_t argc, total = 0;
+    digest_init(&d);
+    for (argc = 0; args[argc] != NULL; argc++) {
+        size_t len = strlen(args[argc]) + 1;
+        digest_update(&d, args[argc], len);
+        total += len;
+    }
+    digest_final(&d, sum);
+    digest_to_hex(sum, hex);
+    snprintf(suffix, sizeof(suffix), " (truncated, %zu arguments, %zu bytes, blake3 %s)",
+             argc, total, hex);
+
+    /* the tail gets what's left, ending where the arguments do */
+    size_t tail_max = size - 1 - head - strlen(ELLIPSIS) - strlen(suffix);
+    struct args_cursor measure;
+    struct args_writer counter = { NULL, 0, SIZE_MAX };
+    char unit[ESCAPE_MAX];
+    cursor_at_tail(&c, args, argc, tail_max);
+    measure = c;
+    escape_into(&measure, &counter);
+    size_t tail = counter.len;
+    while (tail > tail_max) {
+        tail -= next_unit(&c, unit);
+    }
+    if (c.sep) {
+        c.sep = 0;
+        tail--;
+    }
+
+    size_t len = head;
+    memcpy(buf + len, ELLIPSIS, strlen(ELLIPSIS));
+    len += strlen(ELLIPSIS);
+    struct args_writer rest = { buf + len, 0, tail_max };
+    escape_into(&c, &rest);
+    len += rest.len;
+    memcpy(buf + len, suffix, strlen(suffix) + 1);
+    return len + strlen(suffix);
+}
+
+void log_args(struct root_ctx *ctx, const char *const *args)
+{
+    char formatted[LOG_ARGS_MAX];
+    format_args(formatted, sizeof(formatted), args);
+    logonly(ctx, LOG_INFO, "Arguments %s", formatted);
+}
+
 /* vim: set ts=4 sw=4 tw=0 et:*/
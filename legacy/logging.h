@@ -1,40 +1,115 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
-extern int loglevel;
-
 #include <sys/types.h>
 #include <stdarg.h>
 #include <pwd.h>
 
+struct arena;
+struct root_ctx;
+
 /*
  * call this before using logging
+ *
+ * returns 0 on success, -1 if memory could not be allocated
  */
-void initlog(const char *name);
-void setloglevel(int level);
+int initlog(struct root_ctx *ctx, const char *name);
+void setloglevel(struct root_ctx *ctx, int level);
+void freelog(struct root_ctx *ctx);
+
+/*
+ * start connecting to syslog in the background, rather than when the first
+ * message is logged
+ */
+void connectlog(struct root_ctx *ctx);
+
+/*
+ * connect to syslog, look up the caller's name and open the budget for
+ * refusals (see refuse) now, so that logging needn't open anything later
+ */
+void holdlog(struct root_ctx *ctx);
 
 /*
  * print messages when various types of events happen.
  * call it like printf(), do not use a trailing newline.
  */
-void debug(const char *format, ...);
-void error(const char *format, ...);
-void info(const char *format, ...);
+void debug(struct root_ctx *ctx, const char *format, ...);
+void error(struct root_ctx *ctx, const char *format, ...);
+void warning(struct root_ctx *ctx, const char *format, ...);
+void info(struct root_ctx *ctx, const char *format, ...);
+
+/*
+ * like error, but for why root refuses to run a command, status being the
+ * exit status it is about to refuse with
+ *
+ * the records a caller can provoke at will (ROOT_PERMISSION_DENIED,
+ * ROOT_COMMAND_NOT_FOUND and ROOT_RELATIVE_PATH_DISALLOWED) share a
+ * host-wide budget (see ratelimit.h); past it they still reach the screen,
+ * but syslog only gets an occasional "N similar messages suppressed"
+ */
+void refuse(struct root_ctx *ctx, int status, const char *format, ...);
+
+/*
+ * log the audit record for running a command, record (e.g. "Running
+ * /bin/ls"), as info does, then log_args for its args; us is how long root
+ * took to get there
+ *
+ * if coalescing is on (see coalesce.h), a run the same as one the caller
+ * logged in full within COALESCE_WINDOW_MS is counted instead, and only
+ * reaches the screen; the counts go to syslog in a summary later
+ */
+void audit(struct root_ctx *ctx,
+           const char *record,
+           const char *const *args,
+           unsigned long us);
 
 /*
  * helpers for above
  */
-void writelog(int priority, const char *format, va_list ap);
-void writescreen(int priority, const char *format, va_list ap);
+void writelog(struct root_ctx *ctx, int priority, const char *format, va_list ap);
+void writescreen(struct root_ctx *ctx, int priority, const char *format, va_list ap);
 
 /*
  * similar to info, error, etc., but only print to the screen
  */
 void print(const char *format, ...);
 
-const char *get_username(uid_t uid);
+const char *get_username(struct root_ctx *ctx, uid_t uid);
+
+char *escape_percents(struct arena *arena, const char *string);
+
+/*
+ * how long an Arguments record's list of arguments may be, including the
+ * terminating NUL; override at build time, e.g.
+ * make CFLAGS+=-DLOG_ARGS_MAX=4096
+ */
+#ifndef LOG_ARGS_MAX
+#define LOG_ARGS_MAX 1024
+#endif
+
+/* the smallest buffer format_args can cut the arguments down to fit */
+#define LOG_ARGS_MIN 256
+
+/*
+ * Write the NULL-terminated args into buf, which holds size (at least
+ * LOG_ARGS_MIN) bytes, separated by spaces, for a log message.
+ *
+ * Control characters, spaces, backslashes, double quotes and bytes that
+ * aren't valid UTF-8 are escaped with backslashes (\t, \ , \x7f), and an
+ * empty argument is written "".  If that doesn't fit, it is cut down to
+ * its start and its end, then " ... " between them, then the number of
+ * arguments, their size and the BLAKE3 digest of each followed by a NUL
+ * byte, in parentheses.  Only what is written is escaped, so this takes
+ * the same time as a digest however long the arguments are.
+ *
+ * Returns the length of the string written.
+ */
+size_t format_args(char *buf, size_t size, const char *const *args);
 
-char *escape_percents(const char *string);
+/*
+ * send "Arguments <args>", formatted by format_args, to syslog only
+ */
+void log_args(struct root_ctx *ctx, const char *const *args);
 
 #endif
 /* vim: set ts=4 sw=4 tw=0 et:*/
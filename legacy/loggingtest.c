@@ -4,12 +4,19 @@
 #include <stdio.h>
 #include <syslog.h>
 
+#include "arena.h"
+#include "context.h"
+#include "digest.h"
+#include "libroot.h"
 #include "logging.h"
 
 void testescape1(void);
 void testescape2(void);
 void testescape3(void);
 void testsetloglevel(void);
+void testformatargs1(void);
+void testformatargs2(void);
+void testformatargs3(void);
 
 int main(int argc, const char *argv[])
 {
@@ -17,6 +24,9 @@ int main(int argc, const char *argv[])
     testescape2();
     testescape3();
     testsetloglevel();
+    testformatargs1();
+    testformatargs2();
+    testformatargs3();
 
     return 0;
 }
@@ -26,23 +36,28 @@ void testescape1(void)
     char *input = "mikel";
     char *expected = "mikel";
     char *actual;
+    struct arena arena;
     
     printf("Running %s\n", __func__);
-    actual = escape_percents(input);
+    arena_init(&arena, NULL, 0);
+    actual = escape_percents(&arena, input);
 
     assert(strcmp(actual, expected) == 0);
-    free(actual);
+    arena_release(&arena);
 }
 
 void testescape2(void)
 {
     char *input = NULL;
     char *actual;
+    struct arena arena;
     
     printf("Running %s\n", __func__);
-    actual = escape_percents(input);
+    arena_init(&arena, NULL, 0);
+    actual = escape_percents(&arena, input);
 
     assert(actual == NULL);
+    arena_release(&arena);
 }
 
 void testescape3(void)
@@ -50,27 +65,143 @@ void testescape3(void)
     char *input = "%sally";
     char *expected = "%%sally";
     char *actual;
+    struct arena arena;
     
     printf("Running %s\n", __func__);
-    actual = escape_percents(input);
+    arena_init(&arena, NULL, 0);
+    actual = escape_percents(&arena, input);
 
     assert(strcmp(actual, expected) == 0);
-    free(actual);
+    arena_release(&arena);
 }
 
 void testsetloglevel(void)
 {
     printf("Running %s\n", __func__);
 
+    struct root_ctx *ctx = root_ctx_new("loggingtest");
+    assert(ctx != NULL);
+
     /* default level is LOG_ERR */
-    assert(loglevel == LOG_ERR);
+    assert(ctx->loglevel == LOG_ERR);
+
+    setloglevel(ctx, LOG_DEBUG);
+    assert(ctx->loglevel == LOG_DEBUG);
+
+    /* levels belong to the context, not the process */
+    struct root_ctx *other = root_ctx_new("loggingtest");
+    assert(other != NULL);
+    assert(other->loglevel == LOG_ERR);
+
+    root_ctx_free(other);
+    root_ctx_free(ctx);
+}
+
+static void checkformat(const char *const *args, const char *expected)
+{
+    char actual[LOG_ARGS_MAX];
+    size_t len = format_args(actual, sizeof(actual), args);
+    assert(strcmp(actual, expected) == 0);
+    assert(len == strlen(expected));
+}
+
+void testformatargs1(void)
+{
+    printf("Running %s\n", __func__);
+
+    const char *none[] = { NULL };
+    checkformat(none, "");
+
+    const char *plain[] = { "ls", "-l", "/tmp/some-longer-file-name.txt", NULL };
+    checkformat(plain, "ls -l /tmp/some-longer-file-name.txt");
+
+    /* so an argument's boundaries can always be told */
+    const char *spaces[] = { "sh", "-c", "echo \"a\\b\"", "", NULL };
+    checkformat(spaces, "sh -c echo\\ \\\"a\\\\b\\\" \"\"");
+}
+
+void testformatargs2(void)
+{
+    printf("Running %s\n", __func__);
+
+    const char *controls[] = { "a\tb\nc\rd\be\x7f\x1b[2J", NULL };
+    checkformat(controls, "a\\tb\\nc\\rd\\x08e\\x7f\\x1b[2J");
+
+    /* valid UTF-8 is kept, but not C1 controls or anything malformed */
+    const char *utf8[] = { "caf\xc3\xa9", "\xe2\x82\xac\xf0\x9f\x98\x80", NULL };
+    checkformat(utf8, "caf\xc3\xa9 \xe2\x82\xac\xf0\x9f\x98\x80");
+    const char *c1[] = { "\xc2\x85", NULL };
+    checkformat(c1, "\\xc2\\x85");
+    const char *overlong[] = { "\xc0\xaf\xe0\x80\xaf", NULL };
+    checkformat(overlong, "\\xc0\\xaf\\xe0\\x80\\xaf");
+    const char *surrogate[] = { "\xed\xa0\x80", NULL };
+    checkformat(surrogate, "\\xed\\xa0\\x80");
+    const char *cut[] = { "\xe2\x82", "\xff", NULL };
+    checkformat(cut, "\\xe2\\x82 \\xff");
+}
+
+void testformatargs3(void)
+{
+    printf("Running %s\n", __func__);
+
+    /* one huge argument between two small ones */
+    size_t biglen = 1 << 20;
+    char *big = malloc(biglen + 1);
+    assert(big != NULL);
+    for (size_t i = 0; i < biglen; i++) {
+        big[i] = "ab\n"[i % 3];
+    }
+    big[biglen] = '\0';
+    const char *args[] = { "printf", big, "tail-end", NULL };
+
+    char expected_hex[DIGEST_HEX_SIZE];
+    unsigned char sum[DIGEST_SIZE];
+    struct digest d;
+    digest_init(&d);
+    for (int i = 0; args[i] != NULL; i++) {
+        digest_update(&d, args[i], strlen(args[i]) + 1);
+    }
+    digest_final(&d, sum);
+    digest_to_hex(sum, expected_hex);
+
+    char actual[LOG_ARGS_MAX];
+    size_t len = format_args(actual, sizeof(actual), args);
+    assert(len == strlen(actual));
+    assert(len < sizeof(actual));
+    assert(strncmp(actual, "printf ab\\nab\\n", 15) == 0);
+    assert(strstr(actual, " ... ") != NULL);
+    char suffix[256];
+    snprintf(suffix, sizeof(suffix), "\\nab\\nab\\na tail-end (truncated, 3 arguments, %zu bytes, blake3 %s)",
+             strlen("printf") + 1 + biglen + 1 + strlen("tail-end") + 1, expected_hex);
+    assert(len > strlen(suffix));
+    assert(strcmp(actual + len - strlen(suffix), suffix) == 0);
+
+    /* the same every time, and never more than it is given */
+    char again[LOG_ARGS_MAX];
+    format_args(again, sizeof(again), args);
+    assert(strcmp(actual, again) == 0);
+    for (size_t size = LOG_ARGS_MIN; size < 400; size++) {
+        assert(format_args(again, size, args) < size);
+        assert(strstr(again, expected_hex) != NULL);
+    }
 
-    setloglevel(LOG_DEBUG);
-    assert(loglevel == LOG_DEBUG);
+    /* many arguments, and a cut that can land inside a UTF-8 sequence */
+    size_t nmany = 100000;
+    const char **many = malloc((nmany + 1) * sizeof(*many));
+    assert(many != NULL);
+    for (size_t i = 0; i < nmany; i++) {
+        many[i] = i % 2 ? "caf\xc3\xa9" : "";
+    }
+    many[nmany] = NULL;
+    for (size_t size = LOG_ARGS_MIN; size < LOG_ARGS_MIN + 8; size++) {
+        len = format_args(actual, size, many);
+        assert(len < size);
+        assert(strstr(actual, "(truncated, 100000 arguments, 350000 bytes, blake3 ") != NULL);
+        assert(strstr(actual, "\\x") == NULL);
+    }
 
-    /* restore default */
-    setloglevel(LOG_ERR);
-    assert(loglevel == LOG_ERR);
+    free(many);
+    free(big);
 }
 
 /* vim: set ts=4 sw=4 tw=0 et:*/
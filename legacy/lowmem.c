@@ -0,0 +1,114 @@
+#define _DEFAULT_SOURCE /* for mlockall() and O_CLOEXEC with -std=c99, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mlockall() and O_CLOEXEC with -std=c99 */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "lowmem.h"
+
+int lowmem_reserve_heap(size_t size)
+{
+    if (size == 0 || size > INT_MAX / 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef M_TRIM_THRESHOLD
+    /* from the heap rather than a mapping of its own, and kept once freed */
+    if (mallopt(M_MMAP_THRESHOLD, (int)(2 * size)) == 0
+        || mallopt(M_TRIM_THRESHOLD, -1) == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+#endif
+
+    char *heap = malloc(size);
+    if (heap == NULL) {
+        return -1;
+    }
+    /* malloc only maps the pages, so fault them in now */
+    memset(heap, 0, size);
+    free(heap);
+    return 0;
+}
+
+/*
+ * Grow the stack by size bytes.  Linux never shrinks it again.
+ */
+static void grow_stack(size_t size)
+{
+    char stack[size];
+    volatile char *p = stack;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0) {
+        pagesize = 4096;
+    }
+    for (size_t i = 0; i < size; i += (size_t)pagesize) {
+        p[i] = 0;
+    }
+}
+
+int lowmem_lock(size_t stack)
+{
+    if (stack > 0) {
+        grow_stack(stack);
+    }
+    return mlockall(MCL_CURRENT);
+}
+
+int lowmem_set_oom_score_adj(const char *path, int value, int *oldp)
+{
+    if (oldp != NULL) {
+        int fd = open(path, O_RDONLY|O_CLOEXEC);
+        if (fd == -1) {
+            return -1;
+        }
+        char buf[16];
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        int saved_errno = errno;
+        close(fd);
+        if (n == -1) {
+            errno = saved_errno;
+            return -1;
+        }
+        buf[n] = '\0';
+
+        char *end;
+        errno = 0;
+        long old = strtol(buf, &end, 10);
+        if (errno != 0 || end == buf || (*end != '\0' && *end != '\n')
+            || old < -1000 || old > 1000) {
+            errno = EINVAL;
+            return -1;
+        }
+        *oldp = (int)old;
+    }
+
+    /* as "echo <value> > <path>" does */
+    int fd = open(path, O_WRONLY|O_TRUNC|O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char text[16];
+    int len = snprintf(text, sizeof(text), "%d\n", value);
+    ssize_t written = write(fd, text, (size_t)len);
+    int saved_errno = errno;
+    close(fd);
+    if (written != len) {
+        errno = written == -1 ? saved_errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
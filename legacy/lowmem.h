@@ -0,0 +1,73 @@
+#ifndef LOWMEM_H
+#define LOWMEM_H
+
+#include <stddef.h>
+
+/*
+ * The emergency low-memory mode, --low-memory, for fixing a host that has
+ * run out of memory.
+ *
+ * Everything root allocates itself comes from one arena (see arena.h),
+ * which in this mode is held to its static reserve (see
+ * root_set_low_memory).  This covers the rest of the process: what the C
+ * library allocates (to format syslog messages, read files and set HOME)
+ * comes from heap taken once at startup, every page root has is locked in
+ * memory so that nothing it does later waits for the disk, and the kernel
+ * is asked to kill other processes before this one.
+ */
+
+/*
+ * how much heap to take for the C library, see lowmem_reserve_heap
+ */
+#ifndef LOWMEM_HEAP
+#define LOWMEM_HEAP (128 * 1024)
+#endif
+
+/*
+ * how much stack to lock, see lowmem_lock
+ */
+#ifndef LOWMEM_STACK
+#define LOWMEM_STACK (64 * 1024)
+#endif
+
+/*
+ * root's oom_score_adj while it decides what to run: the OOM killer never
+ * picks it
+ */
+#ifndef LOWMEM_OOM_SCORE_ADJ
+#define LOWMEM_OOM_SCORE_ADJ (-1000)
+#endif
+#ifndef LOWMEM_OOM_PATH
+#define LOWMEM_OOM_PATH "/proc/self/oom_score_adj"
+#endif
+
+/*
+ * Grow the C library's heap by size bytes, touching every page, and have
+ * it keep them once they are free, so that later allocations of less than
+ * that in all are made from memory the process already has.
+ *
+ * Returns 0, or -1 with errno set.  With a C library that can't be told to
+ * keep freed memory (only glibc can), it may give the pages back.
+ */
+int lowmem_reserve_heap(size_t size);
+
+/*
+ * Lock every page the process has mapped into memory, after growing the
+ * stack by stack bytes so that they are locked too.
+ *
+ * Returns 0, or -1 with errno set.  The locks last until the process execs
+ * or exits, and a child it forks has none.
+ */
+int lowmem_lock(size_t stack);
+
+/*
+ * Write value to the oom_score_adj file at path, after reading what it
+ * was into *oldp, unless oldp is NULL.
+ *
+ * Returns 0, or -1 with errno set.  Lowering the value needs privilege
+ * (CAP_SYS_RESOURCE); raising it again doesn't.
+ */
+int lowmem_set_oom_score_adj(const char *path, int value, int *oldp);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,187 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lowmem.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char file[512];
+
+static void write_file(const char *text)
+{
+    int fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    assert(fd != -1);
+    assert(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+    close(fd);
+}
+
+static void read_file(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    ssize_t n = read(fd, buf, size - 1);
+    assert(n >= 0);
+    buf[n] = '\0';
+    close(fd);
+}
+
+/*
+ * The value of field (e.g. "VmData:") in /proc/self/status, in kB, read
+ * without allocating.
+ */
+static long status_kb(const char *field)
+{
+    static char status[8192];
+    read_file("/proc/self/status", status, sizeof(status));
+    char *p = strstr(status, field);
+    assert(p != NULL);
+    return strtol(p + strlen(field), NULL, 10);
+}
+
+/* run fn in a child, since it changes the whole process */
+static void in_child(void (*fn)(void))
+{
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        fn();
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_set_oom_score_adj(void)
+{
+    printf("Running %s\n", __func__);
+    char buf[32];
+    int old = 1;
+
+    write_file("0\n");
+    assert(lowmem_set_oom_score_adj(file, -1000, &old) == 0);
+    assert(old == 0);
+    read_file(file, buf, sizeof(buf));
+    assert(strcmp(buf, "-1000\n") == 0);
+
+    /* and back */
+    assert(lowmem_set_oom_score_adj(file, old, NULL) == 0);
+    read_file(file, buf, sizeof(buf));
+    assert(strcmp(buf, "0\n") == 0);
+
+    /* not a score */
+    write_file("lots\n");
+    errno = 0;
+    assert(lowmem_set_oom_score_adj(file, 0, &old) == -1);
+    assert(errno == EINVAL);
+    write_file("2000\n");
+    assert(lowmem_set_oom_score_adj(file, 0, &old) == -1);
+    unlink(file);
+
+    errno = 0;
+    assert(lowmem_set_oom_score_adj(file, 0, &old) == -1);
+    assert(errno == ENOENT);
+}
+
+static void raise_own_score(void)
+{
+    char buf[32];
+    int old;
+    assert(lowmem_set_oom_score_adj(LOWMEM_OOM_PATH, 500, &old) == 0);
+    read_file(LOWMEM_OOM_PATH, buf, sizeof(buf));
+    assert(strcmp(buf, "500\n") == 0);
+    /* raising it needs no privilege, so neither does putting it back */
+    if (old >= 500) {
+        assert(lowmem_set_oom_score_adj(LOWMEM_OOM_PATH, old, NULL) == 0);
+    }
+}
+
+void test_own_oom_score_adj(void)
+{
+    printf("Running %s\n", __func__);
+    in_child(raise_own_score);
+}
+
+static void allocate_within_reserve(void)
+{
+    assert(lowmem_reserve_heap(LOWMEM_HEAP) == 0);
+
+    /* no more data than the process has now */
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = (rlim_t)status_kb("VmData:") * 1024;
+    assert(setrlimit(RLIMIT_DATA, &limit) == 0);
+
+    /* up to the reserve, in pieces, as the C library's own would be */
+    void *pieces[LOWMEM_HEAP / 2 / 1024];
+    size_t n = sizeof(pieces) / sizeof(pieces[0]);
+    for (size_t i = 0; i < n; i++) {
+        pieces[i] = malloc(1024);
+        assert(pieces[i] != NULL);
+        memset(pieces[i], 'x', 1024);
+    }
+    for (size_t i = 0; i < n; i++) {
+        free(pieces[i]);
+    }
+    /* and what's freed is reused */
+    for (int i = 0; i < 100; i++) {
+        void *again = malloc(LOWMEM_HEAP / 2);
+        assert(again != NULL);
+        free(again);
+    }
+
+    /* beyond it, the limit holds */
+    assert(malloc(4 * LOWMEM_HEAP) == NULL);
+}
+
+void test_reserve_heap(void)
+{
+    printf("Running %s\n", __func__);
+    in_child(allocate_within_reserve);
+
+    errno = 0;
+    assert(lowmem_reserve_heap(0) == -1);
+    assert(errno == EINVAL);
+}
+
+static void lock_self(void)
+{
+    if (lowmem_lock(LOWMEM_STACK) == -1) {
+        /* without privilege, the footprint may be over RLIMIT_MEMLOCK */
+        assert(errno == ENOMEM || errno == EPERM || errno == EAGAIN);
+        return;
+    }
+    assert(status_kb("VmLck:") >= LOWMEM_STACK / 1024);
+}
+
+void test_lock(void)
+{
+    printf("Running %s\n", __func__);
+    in_child(lock_self);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(file, sizeof(file), "%s/oom_score_adj", base);
+
+    test_set_oom_score_adj();
+    test_own_oom_score_adj();
+    test_reserve_heap();
+    test_lock();
+
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
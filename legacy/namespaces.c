@@ -0,0 +1,229 @@
+#define _GNU_SOURCE     /* for setns(), the CLONE_NEW* flags and getdelim() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "namespaces.h"
+
+#if defined(__linux__) && defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+#define HAVE_PIDFD 1
+#endif
+
+#ifdef HAVE_PIDFD
+
+/* older C libraries don't know about time namespaces (Linux 5.6) */
+#ifndef CLONE_NEWTIME
+#define CLONE_NEWTIME 0x00000080
+#endif
+
+/*
+ * Each kind of namespace, by its name in /proc/<pid>/ns.  Kinds this
+ * kernel doesn't have are missing from our own /proc/self/ns as well, and
+ * left alone.
+ */
+static const struct {
+    const char *name;
+    int flag;
+} kinds[] = {
+    { "user", CLONE_NEWUSER },
+    { "mnt", CLONE_NEWNS },
+    { "uts", CLONE_NEWUTS },
+    { "ipc", CLONE_NEWIPC },
+    { "net", CLONE_NEWNET },
+    { "pid", CLONE_NEWPID },
+    { "cgroup", CLONE_NEWCGROUP },
+    { "time", CLONE_NEWTIME },
+};
+
+/*
+ * Returns 0 if the process is still running (or is a zombie), or -1 with
+ * errno set to ESRCH if it is gone, in which case anything read from
+ * /proc/<pid> since namespaces_open may have been about another process.
+ */
+static int still_there(const struct namespaces *ns)
+{
+    return (int)syscall(SYS_pidfd_send_signal, ns->pidfd, 0, NULL, 0);
+}
+
+int namespaces_open(struct namespaces *ns, pid_t pid)
+{
+    ns->pid = pid;
+    ns->flags = 0;
+    ns->rootfd = -1;
+    /* pidfds are always close-on-exec */
+    ns->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (ns->pidfd == -1) {
+        return -1;
+    }
+
+    char path[64];
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        struct stat ours, theirs;
+        snprintf(path, sizeof(path), "/proc/self/ns/%s", kinds[i].name);
+        if (stat(path, &ours) == -1) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%ld/ns/%s", (long)pid, kinds[i].name);
+        if (stat(path, &theirs) == -1) {
+            /* most likely because it has just exited */
+            int saved_errno = errno;
+            if (still_there(ns) == 0) {
+                errno = saved_errno;
+            }
+            namespaces_close(ns);
+            return -1;
+        }
+        if (theirs.st_ino != ours.st_ino || theirs.st_dev != ours.st_dev) {
+            ns->flags |= kinds[i].flag;
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/%ld/root", (long)pid);
+    ns->rootfd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (ns->rootfd == -1 || still_there(ns) == -1) {
+        int saved_errno = errno == ENOENT ? ESRCH : errno;
+        namespaces_close(ns);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+void namespaces_close(struct namespaces *ns)
+{
+    if (ns->rootfd != -1) {
+        close(ns->rootfd);
+        ns->rootfd = -1;
+    }
+    if (ns->pidfd != -1) {
+        close(ns->pidfd);
+        ns->pidfd = -1;
+    }
+}
+
+int namespaces_enter_pid(struct namespaces *ns)
+{
+    if ((ns->flags & CLONE_NEWPID) && setns(ns->pidfd, CLONE_NEWPID) == -1) {
+        return -1;
+    }
+    ns->flags &= ~CLONE_NEWPID;
+    return 0;
+}
+
+int namespaces_enter(struct namespaces *ns)
+{
+    /* all at once, with the user namespace first, whatever the order */
+    if (ns->flags != 0 && setns(ns->pidfd, ns->flags) == -1) {
+        return -1;
+    }
+    ns->flags = 0;
+
+    /* as nsenter --root --wd would, but to the root */
+    if (fchdir(ns->rootfd) == -1 || chroot(".") == -1 || chdir("/") == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int namespaces_have_user(const struct namespaces *ns)
+{
+    return (ns->flags & CLONE_NEWUSER) != 0;
+}
+
+int namespaces_getenv(const struct namespaces *ns, const char *name,
+                      char *value, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/environ", (long)ns->pid);
+    FILE *f = fopen(path, "re");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            errno = ESRCH;
+        }
+        return -1;
+    }
+
+    size_t namelen = strlen(name);
+    char *entry = NULL;
+    size_t entrymax = 0;
+    ssize_t len;
+    int result = -1;
+    errno = 0;
+    /* getdelim terminates the last entry even if the process didn't */
+    while ((len = getdelim(&entry, &entrymax, '\0', f)) != -1) {
+        if ((size_t)len > namelen && memcmp(entry, name, namelen) == 0
+            && entry[namelen] == '=') {
+            size_t valuelen = strlen(entry + namelen + 1);
+            if (valuelen >= size) {
+                errno = ERANGE;
+                break;
+            }
+            memcpy(value, entry + namelen + 1, valuelen + 1);
+            result = 0;
+            break;
+        }
+    }
+    int saved_errno = errno != 0 ? errno : ENOENT;
+    free(entry);
+    fclose(f);
+
+    if (still_there(ns) == -1) {
+        return -1;
+    }
+    errno = saved_errno;
+    return result;
+}
+
+#else
+
+int namespaces_open(struct namespaces *ns, pid_t pid)
+{
+    ns->pid = pid;
+    ns->pidfd = -1;
+    ns->flags = 0;
+    ns->rootfd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+void namespaces_close(struct namespaces *ns)
+{
+}
+
+int namespaces_enter_pid(struct namespaces *ns)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int namespaces_enter(struct namespaces *ns)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int namespaces_have_user(const struct namespaces *ns)
+{
+    return 0;
+}
+
+int namespaces_getenv(const struct namespaces *ns, const char *name,
+                      char *value, size_t size)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
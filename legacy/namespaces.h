@@ -0,0 +1,77 @@
+#ifndef NAMESPACES_H
+#define NAMESPACES_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/*
+ * Entering the namespaces of another process, such as a container's,
+ * for --ns.
+ *
+ * The process is held by a pidfd from the start, so it can't exit and
+ * have its ID reused by another while its namespaces are being looked at,
+ * and every namespace it doesn't share with us is entered with one
+ * setns(2) call (Linux 5.8).
+ *
+ * Only on Linux; elsewhere namespaces_open fails with ENOSYS.
+ */
+struct namespaces {
+    pid_t pid;
+    int pidfd;                  /* the same process, for as long as it runs */
+    int flags;                  /* CLONE_NEW* for each namespace that
+                                   differs from ours */
+    int rootfd;                 /* its root directory */
+};
+
+/*
+ * Open the namespaces of process pid.
+ *
+ * Returns 0 on success, or -1 with errno set.  ESRCH means there is no
+ * such process (or it exited while it was being looked at), and ENOSYS
+ * that this system doesn't have pidfds.
+ */
+int namespaces_open(struct namespaces *ns, pid_t pid);
+void namespaces_close(struct namespaces *ns);
+
+/*
+ * Move this process into the namespaces in ns->flags that are left,
+ * and into the process's root directory, which becomes the working
+ * directory too.
+ *
+ * Entering a user namespace requires that this process has only one
+ * thread, and a mount namespace that it shares its filesystem information
+ * with no other process, so this is usually done in a child just forked.
+ * The PID namespace is only entered by later children, so it may be
+ * entered first by the parent (see namespaces_enter_pid).
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int namespaces_enter(struct namespaces *ns);
+
+/*
+ * Have this process's children start in the PID namespace of ns, if it
+ * differs, and take it out of ns->flags.  Unlike the others, this can be
+ * done with more than one thread.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+int namespaces_enter_pid(struct namespaces *ns);
+
+/*
+ * Whether ns->flags includes a user namespace, in which this process's
+ * user and group IDs will be seen differently once it is entered.
+ */
+int namespaces_have_user(const struct namespaces *ns);
+
+/*
+ * Copy the value of the environment variable name, as the process was
+ * started with, into value, which holds size bytes.
+ *
+ * Returns 0 on success, or -1 with errno set: ENOENT if it wasn't set,
+ * ERANGE if it doesn't fit, and ESRCH if the process has exited.
+ */
+int namespaces_getenv(const struct namespaces *ns, const char *name,
+                      char *value, size_t size);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE     /* for unshare(), sethostname() and the CLONE_NEW* flags */
+
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "namespaces.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+
+static void write_file(const char *path, const char *text)
+{
+    int fd = open(path, O_WRONLY);
+    assert(fd != -1);
+    assert(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+    close(fd);
+}
+
+/*
+ * Start a stand-in for a container: a process in new namespaces of the
+ * kinds in flags (always including a user namespace, so no privilege is
+ * needed), as root in there, with its own host name and a file of its
+ * own in base, running sleep with PATH=/container/bin.
+ *
+ * With CLONE_NEWPID the stand-in is the first process in the new PID
+ * namespace.  Returns its process ID, or -1 if this system doesn't let
+ * unprivileged users create namespaces.
+ */
+static pid_t start_container(int flags)
+{
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    int ready[2];
+    assert(pipe(ready) == 0);
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        close(ready[0]);
+        if (unshare(CLONE_NEWUSER | flags) == -1) {
+            _exit(2);
+        }
+        char map[64];
+        snprintf(map, sizeof(map), "0 %lu 1", (unsigned long)uid);
+        write_file("/proc/self/uid_map", map);
+        write_file("/proc/self/setgroups", "deny");
+        snprintf(map, sizeof(map), "0 %lu 1", (unsigned long)gid);
+        write_file("/proc/self/gid_map", map);
+
+        if (flags & CLONE_NEWPID) {
+            /* this one stays outside, and the next is the first inside */
+            pid_t inner = fork();
+            assert(inner != -1);
+            if (inner != 0) {
+                assert(write(ready[1], &inner, sizeof(inner)) == sizeof(inner));
+                close(ready[1]);
+                waitpid(inner, NULL, 0);
+                _exit(0);
+            }
+        }
+        else {
+            pid_t self = getpid();
+            assert(write(ready[1], &self, sizeof(self)) == sizeof(self));
+        }
+
+        if (flags & CLONE_NEWUTS) {
+            assert(sethostname("roottest", 8) == 0);
+        }
+        if (flags & CLONE_NEWNS) {
+            assert(mount("none", base, "tmpfs", 0, NULL) == 0);
+            char path[64];
+            snprintf(path, sizeof(path), "%s/inside", base);
+            assert(close(open(path, O_WRONLY|O_CREAT, 0600)) == 0);
+        }
+
+        /* the ready pipe closes once sleep is running */
+        fcntl(ready[1], F_SETFD, FD_CLOEXEC);
+        char *argv[] = { "sleep", "60", NULL };
+        char *envp[] = { "HOME=/", "PATH=/container/bin", NULL };
+        execve("/bin/sleep", argv, envp);
+        _exit(127);
+    }
+
+    close(ready[1]);
+    pid_t target;
+    if (read(ready[0], &target, sizeof(target)) != sizeof(target)) {
+        int status;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 2);
+        close(ready[0]);
+        return -1;
+    }
+    char c;
+    assert(read(ready[0], &c, 1) == 0);
+    close(ready[0]);
+    return target;
+}
+
+static void stop_container(pid_t pid)
+{
+    kill(pid, SIGKILL);
+    /* or its parent, with a PID namespace */
+    while (wait(NULL) != -1) {
+    }
+}
+
+void test_self(void)
+{
+    printf("Running %s\n", __func__);
+    struct namespaces ns;
+    assert(namespaces_open(&ns, getpid()) == 0);
+    assert(ns.flags == 0);
+    assert(ns.rootfd != -1);
+
+    char value[16];
+    errno = 0;
+    assert(namespaces_getenv(&ns, "ROOT_TEST_NOT_SET", value, sizeof(value)) == -1);
+    assert(errno == ENOENT);
+    namespaces_close(&ns);
+}
+
+void test_missing(void)
+{
+    printf("Running %s\n", __func__);
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        _exit(0);
+    }
+    assert(waitpid(pid, NULL, 0) == pid);
+
+    struct namespaces ns;
+    errno = 0;
+    assert(namespaces_open(&ns, pid) == -1);
+    assert(errno == ESRCH);
+}
+
+void test_enter(void)
+{
+    printf("Running %s\n", __func__);
+    pid_t target = start_container(CLONE_NEWUTS | CLONE_NEWNS);
+    if (target == -1) {
+        printf("Skipping %s (needs unprivileged user namespaces)\n", __func__);
+        return;
+    }
+
+    struct namespaces ns;
+    assert(namespaces_open(&ns, target) == 0);
+    assert(ns.flags == (CLONE_NEWUSER | CLONE_NEWUTS | CLONE_NEWNS));
+
+    /* its environment, not ours */
+    char value[32];
+    assert(namespaces_getenv(&ns, "PATH", value, sizeof(value)) == 0);
+    assert(strcmp(value, "/container/bin") == 0);
+    assert(namespaces_getenv(&ns, "HOME", value, sizeof(value)) == 0);
+    assert(strcmp(value, "/") == 0);
+    errno = 0;
+    assert(namespaces_getenv(&ns, "PATH", value, 8) == -1);
+    assert(errno == ERANGE);
+    errno = 0;
+    assert(namespaces_getenv(&ns, "PAT", value, sizeof(value)) == -1);
+    assert(errno == ENOENT);
+
+    /* its files aren't ours */
+    char inside[64];
+    snprintf(inside, sizeof(inside), "%s/inside", base);
+    assert(access(inside, F_OK) == -1);
+
+    /* a process can enter a user namespace only with one thread */
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        char host[64];
+        if (namespaces_enter(&ns) == -1
+            || gethostname(host, sizeof(host)) == -1
+            || strcmp(host, "roottest") != 0
+            || access(inside, F_OK) == -1
+            || getuid() != 0
+            || ns.flags != 0) {
+            _exit(1);
+        }
+        /* and in its root directory */
+        char cwd[64];
+        _exit(getcwd(cwd, sizeof(cwd)) == NULL || strcmp(cwd, "/") != 0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    namespaces_close(&ns);
+    stop_container(target);
+
+    /* gone, and found to be gone even though its ID was known */
+    errno = 0;
+    assert(namespaces_open(&ns, target) == -1);
+    assert(errno == ESRCH);
+}
+
+void test_enter_pid(void)
+{
+    printf("Running %s\n", __func__);
+    if (geteuid() != 0) {
+        printf("Skipping %s (needs root)\n", __func__);
+        return;
+    }
+    pid_t target = start_container(CLONE_NEWPID);
+    if (target == -1) {
+        printf("Skipping %s (needs user namespaces)\n", __func__);
+        return;
+    }
+
+    struct namespaces ns;
+    assert(namespaces_open(&ns, target) == 0);
+    assert(ns.flags == (CLONE_NEWUSER | CLONE_NEWPID));
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        /* only this one's children, which can then enter the rest */
+        if (namespaces_enter_pid(&ns) == -1 || ns.flags != CLONE_NEWUSER) {
+            _exit(1);
+        }
+        pid_t inner = fork();
+        if (inner == 0) {
+            /* the second process there, after the container's own */
+            _exit(namespaces_enter(&ns) == -1 || getpid() != 2);
+        }
+        int status;
+        _exit(inner == -1 || waitpid(inner, &status, 0) != inner
+              || !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    namespaces_close(&ns);
+    stop_container(target);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+
+    test_self();
+    test_missing();
+    test_enter();
+    test_enter_pid();
+
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
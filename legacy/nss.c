@@ -0,0 +1,724 @@
+#define _DEFAULT_SOURCE /* for getgrouplist(), getline(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for getgrouplist(), getline() */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "context.h"
+#include "logging.h"
+#include "nss.h"
+
+enum lookup_kind {
+    USER_BY_UID,
+    USER_BY_NAME,
+    GROUP_BY_GID,
+    GROUP_LIST,
+};
+
+/*
+ * One lookup, shared by the caller and the helper thread.
+ *
+ * It is allocated with malloc rather than from the arena because the
+ * helper may outlive the caller's interest in it, and even the context:
+ * whichever of them is last to let go of it frees it.
+ */
+struct nss_request {
+    enum lookup_kind kind;
+    uid_t uid;
+    gid_t gid;
+    char *name;
+
+    int want_groups;            /* and the user's groups, see nss_prefetch */
+    struct timespec due;        /* when to stop waiting */
+
+    /* the answer, written only by whoever does the lookup */
+    int found;
+    int err;
+    struct passwd pw;
+    struct group gr;
+    char *buf;
+    gid_t *groups;
+    int ngroups;                /* -1 until looked up */
+    int groups_err;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int answered;               /* the passwd entry is in, see want_groups */
+    int done;
+    int abandoned;
+};
+
+static void free_request(struct nss_request *req)
+{
+    pthread_mutex_destroy(&req->lock);
+    pthread_cond_destroy(&req->cond);
+    free(req->name);
+    free(req->buf);
+    free(req->groups);
+    free(req);
+}
+
+static struct nss_request *new_request(enum lookup_kind kind)
+{
+    struct nss_request *req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+        return NULL;
+    }
+    req->kind = kind;
+    req->ngroups = -1;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    /* the deadline mustn't move if somebody sets the clock */
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&req->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&req->lock, NULL);
+    return req;
+}
+
+/*
+ * The groups of name, whose primary group is gid, into req->groups.
+ */
+static void lookup_groups(struct nss_request *req, const char *name, gid_t gid)
+{
+    int max = 32;
+
+    for (;;) {
+        gid_t *groups = realloc(req->groups, max * sizeof(gid_t));
+        if (groups == NULL) {
+            req->groups_err = ENOMEM;
+            return;
+        }
+        req->groups = groups;
+
+        int n = max;
+        if (getgrouplist(name, gid, groups, &n) != -1) {
+            req->ngroups = n;
+            return;
+        }
+        /* glibc says how many there are, others don't */
+        max = n > max ? n : 2 * max;
+        if (max > 65536) {
+            req->groups_err = ERANGE;
+            return;
+        }
+    }
+}
+
+/*
+ * Ask NSS, which may take forever.
+ *
+ * Only the reentrant functions are used, and nothing here changes the
+ * process, so an abandoned lookup can finish (or not) harmlessly.
+ */
+static void lookup(struct nss_request *req)
+{
+    size_t size = 1024;
+
+    if (req->kind == GROUP_LIST) {
+        lookup_groups(req, req->name, req->gid);
+        return;
+    }
+
+    for (;;) {
+        char *buf = realloc(req->buf, size);
+        if (buf == NULL) {
+            req->err = ENOMEM;
+            return;
+        }
+        req->buf = buf;
+
+        int rc;
+        if (req->kind == USER_BY_UID) {
+            struct passwd *result;
+            rc = getpwuid_r(req->uid, &req->pw, req->buf, size, &result);
+            req->found = rc == 0 && result != NULL;
+        }
+        else if (req->kind == USER_BY_NAME) {
+            struct passwd *result;
+            rc = getpwnam_r(req->name, &req->pw, req->buf, size, &result);
+            req->found = rc == 0 && result != NULL;
+        }
+        else {
+            struct group *result;
+            rc = getgrgid_r(req->gid, &req->gr, req->buf, size, &result);
+            req->found = rc == 0 && result != NULL;
+        }
+
+        if (rc != ERANGE) {
+            req->err = rc;
+            break;
+        }
+        size *= 2;
+    }
+
+}
+
+static void *helper(void *arg)
+{
+    struct nss_request *req = arg;
+    lookup(req);
+
+    if (req->want_groups && req->found) {
+        /* whoever only wants the passwd entry needn't wait for the groups */
+        pthread_mutex_lock(&req->lock);
+        req->answered = 1;
+        pthread_cond_broadcast(&req->cond);
+        pthread_mutex_unlock(&req->lock);
+
+        lookup_groups(req, req->pw.pw_name, req->pw.pw_gid);
+    }
+
+    pthread_mutex_lock(&req->lock);
+    req->done = 1;
+    int abandoned = req->abandoned;
+    pthread_cond_signal(&req->cond);
+    pthread_mutex_unlock(&req->lock);
+
+    if (abandoned) {
+        free_request(req);
+    }
+    return NULL;
+}
+
+/*
+ * Start the lookup on a helper thread, due to finish by ctx's deadline.
+ *
+ * Returns 0, or -1 if the thread couldn't be created.
+ */
+static int start(struct root_ctx *ctx, struct nss_request *req)
+{
+    clock_gettime(CLOCK_MONOTONIC, &req->due);
+    req->due.tv_sec += ctx->nss_timeout_ms / 1000;
+    req->due.tv_nsec += (ctx->nss_timeout_ms % 1000) * 1000000;
+    if (req->due.tv_nsec >= 1000000000) {
+        req->due.tv_sec++;
+        req->due.tv_nsec -= 1000000000;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, helper, req);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+/*
+ * Wait for a started lookup, until it is due, or for as long as it takes
+ * if ctx has no deadline.  Unless whole, the passwd entry of a lookup that
+ * wants groups too will do.
+ *
+ * Returns 0 if it finished, leaving req to the caller, or -1 if it timed
+ * out, leaving req to the helper.
+ */
+static int finish(struct root_ctx *ctx, struct nss_request *req, int whole)
+{
+    pthread_mutex_lock(&req->lock);
+    while (!req->done && (whole || !req->answered)) {
+        if (ctx->nss_timeout_ms <= 0) {
+            pthread_cond_wait(&req->cond, &req->lock);
+        }
+        else if (pthread_cond_timedwait(&req->cond, &req->lock, &req->due) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int done = req->done || (!whole && req->answered);
+    if (!done) {
+        req->abandoned = 1;
+    }
+    pthread_mutex_unlock(&req->lock);
+    return done ? 0 : -1;
+}
+
+/*
+ * Do the lookup on a helper thread, waiting until ctx's deadline.
+ *
+ * Returns as finish.
+ */
+static int run(struct root_ctx *ctx, struct nss_request *req)
+{
+    if (ctx->nss_timeout_ms <= 0 || start(ctx, req) == -1) {
+        /* no deadline, then, but still an answer */
+        lookup(req);
+        return 0;
+    }
+    return finish(ctx, req, 1);
+}
+
+static void degrade(struct root_ctx *ctx, const char *what)
+{
+    /* first, because logging looks up the user too */
+    ctx->nss_degraded = 1;
+    warning(ctx, "Timed out after %ldms looking up %s, using %s and %s instead",
+            ctx->nss_timeout_ms, what, ctx->passwd_path, ctx->group_path);
+}
+
+/*
+ * Split line, a line of a colon-separated file without its newline, into
+ * at most max fields.  Returns the number of fields.
+ */
+static int split_fields(char *line, char **fields, int max)
+{
+    int n = 0;
+    fields[n++] = line;
+    for (char *p = line; *p != '\0' && n < max; p++) {
+        if (*p == ':') {
+            *p = '\0';
+            fields[n++] = p + 1;
+        }
+    }
+    return n;
+}
+
+/*
+ * Call fn on each entry of the colon-separated file at path until it
+ * returns non-zero, and return that, or 0, or -1 with errno set if path
+ * can't be read.
+ */
+static int each_entry(const char *path,
+                      int nfields,
+                      int (*fn)(char **fields, void *arg),
+                      void *arg)
+{
+    FILE *f = fopen(path, "re");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len;
+    int result = 0;
+    while (result == 0 && (len = getline(&line, &linesize, f)) != -1) {
+        char *fields[8];
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (split_fields(line, fields, nfields) == nfields) {
+            result = fn(fields, arg);
+        }
+    }
+    free(line);
+    fclose(f);
+    return result;
+}
+
+static int parse_id(const char *s, unsigned long *idp)
+{
+    char *end;
+    errno = 0;
+    *idp = strtoul(s, &end, 10);
+    return *s != '\0' && *end == '\0' && errno == 0;
+}
+
+struct user_match {
+    uid_t uid;
+    const char *name;           /* or NULL to match by uid */
+    struct arena *arena;
+    struct target_user *user;
+};
+
+/* name:password:uid:gid:gecos:dir:shell */
+static int match_user(char **fields, void *arg)
+{
+    struct user_match *m = arg;
+    unsigned long uid, gid;
+    if (m->name != NULL && strcmp(fields[0], m->name) != 0) {
+        return 0;
+    }
+    if (!parse_id(fields[2], &uid) || !parse_id(fields[3], &gid)) {
+        return 0;
+    }
+    if (m->name == NULL && uid != m->uid) {
+        return 0;
+    }
+    m->user->uid = uid;
+    m->user->gid = gid;
+    m->user->name = arena_strdup(m->arena, fields[0]);
+    m->user->dir = arena_strdup(m->arena, fields[5]);
+    return m->user->name != NULL && m->user->dir != NULL ? 1 : -1;
+}
+
+static int files_user(struct root_ctx *ctx,
+                      uid_t uid,
+                      const char *name,
+                      struct target_user *user)
+{
+    struct user_match m = { uid, name, &ctx->arena, user };
+    int result = each_entry(ctx->passwd_path, 7, match_user, &m);
+    if (result == 1) {
+        return 0;
+    }
+    if (result == 0) {
+        errno = 0;
+    }
+    else if (errno == 0) {
+        errno = ENOMEM;
+    }
+    return -1;
+}
+
+struct group_match {
+    gid_t gid;
+    const char *member;         /* or NULL to match by gid */
+    struct arena *arena;
+    char *name;
+    gid_t *groups;
+    int ngroups;
+    int maxgroups;
+};
+
+/* name:password:gid:member,member,... */
+static int match_group_name(char **fields, void *arg)
+{
+    struct group_match *m = arg;
+    unsigned long gid;
+    if (!parse_id(fields[2], &gid) || gid != m->gid) {
+        return 0;
+    }
+    m->name = arena_strdup(m->arena, fields[0]);
+    return m->name != NULL ? 1 : -1;
+}
+
+static int match_member(char **fields, void *arg)
+{
+    struct group_match *m = arg;
+    unsigned long gid;
+    if (!parse_id(fields[2], &gid) || gid == m->gid) {
+        return 0;
+    }
+
+    size_t len = strlen(m->member);
+    for (const char *p = fields[3]; *p != '\0'; ) {
+        const char *comma = strchr(p, ',');
+        size_t n = comma == NULL ? strlen(p) : (size_t)(comma - p);
+        if (n == len && memcmp(p, m->member, len) == 0) {
+            if (m->ngroups == m->maxgroups) {
+                /* the arena can't grow an allocation, so copy it */
+                int max = 2 * m->maxgroups;
+                gid_t *groups = arena_alloc(m->arena, max * sizeof(gid_t));
+                if (groups == NULL) {
+                    return -1;
+                }
+                memcpy(groups, m->groups, m->ngroups * sizeof(gid_t));
+                m->groups = groups;
+                m->maxgroups = max;
+            }
+            m->groups[m->ngroups++] = gid;
+            break;
+        }
+        p += n + (comma != NULL);
+    }
+    return 0;
+}
+
+static char *files_group_name(struct root_ctx *ctx, gid_t gid)
+{
+    struct group_match m;
+    memset(&m, 0, sizeof(m));
+    m.gid = gid;
+    m.arena = &ctx->arena;
+    return each_entry(ctx->group_path, 4, match_group_name, &m) == 1 ? m.name : NULL;
+}
+
+static int files_group_list(struct root_ctx *ctx,
+                            const char *name,
+                            gid_t gid,
+                            gid_t **groupsp)
+{
+    struct group_match m;
+    memset(&m, 0, sizeof(m));
+    m.gid = gid;
+    m.member = name;
+    m.arena = &ctx->arena;
+    m.maxgroups = 16;
+    m.groups = arena_alloc(&ctx->arena, m.maxgroups * sizeof(gid_t));
+    if (m.groups == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    m.groups[m.ngroups++] = gid;
+
+    int result = each_entry(ctx->group_path, 4, match_member, &m);
+    if (result == -1) {
+        if (errno == 0) {
+            errno = ENOMEM;
+        }
+        return -1;
+    }
+    *groupsp = m.groups;
+    return m.ngroups;
+}
+
+/*
+ * Copy the passwd entry req found into *user.
+ */
+static int copy_user(struct root_ctx *ctx,
+                     const struct nss_request *req,
+                     struct target_user *user)
+{
+    errno = req->err;
+    if (!req->found) {
+        return -1;
+    }
+    user->uid = req->pw.pw_uid;
+    user->gid = req->pw.pw_gid;
+    user->name = arena_strdup(&ctx->arena, req->pw.pw_name);
+    user->dir = arena_strdup(&ctx->arena, req->pw.pw_dir);
+    if (user->name == NULL || user->dir == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Copy the passwd entry req found into *user, and free req.
+ */
+static int user_answer(struct root_ctx *ctx,
+                       struct nss_request *req,
+                       struct target_user *user)
+{
+    int result = copy_user(ctx, req, user);
+    int saved_errno = errno;
+    free_request(req);
+    errno = saved_errno;
+    return result;
+}
+
+/*
+ * Copy the groups req found into *groupsp.
+ */
+static int copy_groups(struct root_ctx *ctx,
+                       const struct nss_request *req,
+                       gid_t **groupsp)
+{
+    errno = req->groups_err;
+    if (req->ngroups < 0) {
+        return -1;
+    }
+    gid_t *groups = arena_alloc(&ctx->arena, req->ngroups * sizeof(gid_t));
+    if (groups == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(groups, req->groups, req->ngroups * sizeof(gid_t));
+    *groupsp = groups;
+    return req->ngroups;
+}
+
+void nss_prefetch(struct root_ctx *ctx, uid_t uid, const char *name)
+{
+    if (ctx->nss_prefetch != NULL || ctx->nss_degraded) {
+        return;
+    }
+
+    struct nss_request *req = new_request(name != NULL ? USER_BY_NAME : USER_BY_UID);
+    if (req == NULL) {
+        return;
+    }
+    req->uid = uid;
+    req->want_groups = 1;
+    if (name != NULL && (req->name = strdup(name)) == NULL) {
+        free_request(req);
+        return;
+    }
+    if (start(ctx, req) == -1) {
+        /* it will be looked up when it's needed instead */
+        free_request(req);
+        return;
+    }
+    ctx->nss_prefetch = req;
+}
+
+/*
+ * The prefetched lookup, once it has finished (or, unless whole, once it
+ * has the passwd entry), or NULL if it timed out, in which case ctx is now
+ * degraded.
+ */
+static struct nss_request *prefetched(struct root_ctx *ctx, int whole)
+{
+    struct nss_request *req = ctx->nss_prefetch;
+
+    /* once abandoned it's the helper's, so say what it was first */
+    char what[300];
+    if (req->kind == USER_BY_NAME) {
+        snprintf(what, sizeof(what), "user %s", req->name);
+    }
+    else {
+        snprintf(what, sizeof(what), "uid %lu", (unsigned long)req->uid);
+    }
+
+    if (finish(ctx, req, whole) == -1) {
+        ctx->nss_prefetch = NULL;
+        degrade(ctx, what);
+        return NULL;
+    }
+    return req;
+}
+
+void nss_close(struct root_ctx *ctx)
+{
+    struct nss_request *req = ctx->nss_prefetch;
+    if (req == NULL) {
+        return;
+    }
+    ctx->nss_prefetch = NULL;
+
+    pthread_mutex_lock(&req->lock);
+    int done = req->done;
+    if (!done) {
+        req->abandoned = 1;
+    }
+    pthread_mutex_unlock(&req->lock);
+    if (done) {
+        free_request(req);
+    }
+}
+
+int nss_user_by_uid(struct root_ctx *ctx, uid_t uid, struct target_user *user)
+{
+    if (ctx->nss_degraded) {
+        return files_user(ctx, uid, NULL, user);
+    }
+
+    const struct nss_request *pre = ctx->nss_prefetch;
+    if (pre != NULL && pre->kind == USER_BY_UID && pre->uid == uid) {
+        pre = prefetched(ctx, 0);
+        return pre != NULL ? copy_user(ctx, pre, user)
+                           : files_user(ctx, uid, NULL, user);
+    }
+
+    struct nss_request *req = new_request(USER_BY_UID);
+    if (req == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    req->uid = uid;
+    if (run(ctx, req) == -1) {
+        char what[64];
+        snprintf(what, sizeof(what), "uid %lu", (unsigned long)uid);
+        degrade(ctx, what);
+        return files_user(ctx, uid, NULL, user);
+    }
+
+    return user_answer(ctx, req, user);
+}
+
+int nss_user_by_name(struct root_ctx *ctx, const char *name, struct target_user *user)
+{
+    if (ctx->nss_degraded) {
+        return files_user(ctx, 0, name, user);
+    }
+
+    const struct nss_request *pre = ctx->nss_prefetch;
+    if (pre != NULL && pre->kind == USER_BY_NAME && strcmp(pre->name, name) == 0) {
+        pre = prefetched(ctx, 0);
+        return pre != NULL ? copy_user(ctx, pre, user)
+                           : files_user(ctx, 0, name, user);
+    }
+
+    struct nss_request *req = new_request(USER_BY_NAME);
+    if (req == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    req->name = strdup(name);
+    if (req->name == NULL) {
+        free_request(req);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (run(ctx, req) == -1) {
+        char what[300];
+        snprintf(what, sizeof(what), "user %s", name);
+        degrade(ctx, what);
+        return files_user(ctx, 0, name, user);
+    }
+    return user_answer(ctx, req, user);
+}
+
+char *nss_group_name(struct root_ctx *ctx, gid_t gid)
+{
+    if (ctx->nss_degraded) {
+        return files_group_name(ctx, gid);
+    }
+
+    struct nss_request *req = new_request(GROUP_BY_GID);
+    if (req == NULL) {
+        return NULL;
+    }
+    req->gid = gid;
+    if (run(ctx, req) == -1) {
+        char what[64];
+        snprintf(what, sizeof(what), "gid %lu", (unsigned long)gid);
+        degrade(ctx, what);
+        return files_group_name(ctx, gid);
+    }
+
+    char *name = NULL;
+    if (req->found && req->gr.gr_name != NULL) {
+        name = arena_strdup(&ctx->arena, req->gr.gr_name);
+    }
+    free_request(req);
+    return name;
+}
+
+int nss_group_list(struct root_ctx *ctx,
+                   const char *name,
+                   gid_t gid,
+                   gid_t **groupsp)
+{
+    if (ctx->nss_degraded) {
+        return files_group_list(ctx, name, gid, groupsp);
+    }
+
+    const struct nss_request *pre = ctx->nss_prefetch;
+    if (pre != NULL) {
+        pre = prefetched(ctx, 1);
+        if (pre == NULL) {
+            return files_group_list(ctx, name, gid, groupsp);
+        }
+        if (pre->found && strcmp(pre->pw.pw_name, name) == 0 && pre->pw.pw_gid == gid) {
+            return copy_groups(ctx, pre, groupsp);
+        }
+    }
+
+    struct nss_request *req = new_request(GROUP_LIST);
+    if (req == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    req->name = strdup(name);
+    if (req->name == NULL) {
+        free_request(req);
+        errno = ENOMEM;
+        return -1;
+    }
+    req->gid = gid;
+    if (run(ctx, req) == -1) {
+        char what[300];
+        snprintf(what, sizeof(what), "the groups of %s", name);
+        degrade(ctx, what);
+        return files_group_list(ctx, name, gid, groupsp);
+    }
+
+    int ngroups = copy_groups(ctx, req, groupsp);
+    int saved_errno = errno;
+    free_request(req);
+    errno = saved_errno;
+    return ngroups;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,89 @@
+#ifndef NSS_H
+#define NSS_H
+
+#include <sys/types.h>
+
+struct root_ctx;
+struct target_user;
+
+/*
+ * how long one identity lookup may take before root stops waiting for the
+ * name service switch, in milliseconds, or 0 to wait for as long as it takes
+ *
+ * override at build time, e.g. make CFLAGS+=-DNSS_TIMEOUT_MS=1000, or for
+ * one context with root_set_nss_timeout
+ */
+#ifndef NSS_TIMEOUT_MS
+#define NSS_TIMEOUT_MS 3000
+#endif
+
+/*
+ * where the answers come from instead, once NSS has timed out
+ */
+#ifndef NSS_PASSWD_PATH
+#define NSS_PASSWD_PATH "/etc/passwd"
+#endif
+#ifndef NSS_GROUP_PATH
+#define NSS_GROUP_PATH "/etc/group"
+#endif
+
+/*
+ * Identity lookups, each bounded by ctx's deadline.
+ *
+ * NSS may be backed by a directory service (sssd, LDAP) that has stopped
+ * answering, and the C library has no way to give up on it.  So each lookup
+ * runs on a helper thread, and if that hasn't answered by the deadline it
+ * is abandoned and the answer is read from the local files instead.  The
+ * context is then degraded: that is logged once, as a warning, and every
+ * later lookup goes straight to the files.
+ *
+ * Everything returned is allocated from ctx's arena.
+ */
+
+/*
+ * the passwd entry for uid, in *user
+ *
+ * returns 0, or -1 with errno set, or 0 if there is no such user
+ */
+int nss_user_by_uid(struct root_ctx *ctx, uid_t uid, struct target_user *user);
+
+/*
+ * the passwd entry for the user called name, in *user
+ *
+ * returns as nss_user_by_uid
+ */
+int nss_user_by_name(struct root_ctx *ctx, const char *name, struct target_user *user);
+
+/*
+ * the name of gid, or NULL if it has none (or it couldn't be found)
+ */
+char *nss_group_name(struct root_ctx *ctx, gid_t gid);
+
+/*
+ * the groups user name belongs to, gid (their primary group) first, in
+ * *groupsp, as initgroups would set them
+ *
+ * returns the number of groups, or -1 with errno set
+ */
+int nss_group_list(struct root_ctx *ctx,
+                   const char *name,
+                   gid_t gid,
+                   gid_t **groupsp);
+
+/*
+ * Start looking up the user called name, or uid if name is NULL, and their
+ * groups, in the background, for the nss_user_by_uid, nss_user_by_name and
+ * nss_group_list calls that will want them later.
+ *
+ * Those wait for it only until its own deadline, counted from now, and do
+ * the lookup as usual if it couldn't be started.
+ */
+void nss_prefetch(struct root_ctx *ctx, uid_t uid, const char *name);
+
+/*
+ * Let go of a prefetched lookup, which may still be running.
+ */
+void nss_close(struct root_ctx *ctx);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
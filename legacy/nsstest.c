@@ -0,0 +1,316 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), setenv(), usleep(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp(), setenv(), usleep() */
+
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "libroot.h"
+#include "nss.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char passwd[512];
+static char group[512];
+static char syslog_path[512];
+
+static void write_file(const char *path, const char *text)
+{
+    FILE *f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+static struct root_ctx *new_ctx(long timeout_ms)
+{
+    struct root_ctx *ctx = root_ctx_new("nsstest");
+    assert(ctx != NULL);
+    root_set_loglevel(ctx, -1);
+    root_set_nss_timeout(ctx, timeout_ms);
+    /* so it's clear where an answer came from */
+    ctx->passwd_path = passwd;
+    ctx->group_path = group;
+    return ctx;
+}
+
+static long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000
+         + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* whether the shim can make NSS slow for us */
+static int have_shim(void)
+{
+    const char *preload = getenv("LD_PRELOAD");
+    return preload != NULL && strstr(preload, "testshim.so") != NULL;
+}
+
+void test_files(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx(NSS_TIMEOUT_MS);
+    struct target_user user;
+    gid_t *groups;
+
+    ctx->nss_degraded = 1;
+
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(strcmp(user.name, "fixroot") == 0);
+    assert(strcmp(user.dir, "/fixture/root") == 0);
+    assert(user.gid == 0);
+
+    assert(nss_user_by_uid(ctx, 4242, &user) == 0);
+    assert(strcmp(user.name, "alice") == 0);
+    assert(user.gid == 4242);
+
+    errno = -1;
+    assert(nss_user_by_uid(ctx, 9999, &user) == -1);
+    assert(errno == 0);
+
+    assert(nss_user_by_name(ctx, "alice", &user) == 0);
+    assert(user.uid == 4242);
+    assert(strcmp(user.dir, "/home/alice") == 0);
+    errno = -1;
+    assert(nss_user_by_name(ctx, "alic", &user) == -1);
+    assert(errno == 0);
+
+    assert(strcmp(nss_group_name(ctx, 0), "fixwheel") == 0);
+    assert(nss_group_name(ctx, 9999) == NULL);
+
+    /* primary group first, then every group naming alice exactly */
+    assert(nss_group_list(ctx, "alice", 4242, &groups) == 3);
+    assert(groups[0] == 4242);
+    assert(groups[1] == 10);
+    assert(groups[2] == 20);
+
+    root_ctx_free(ctx);
+}
+
+void test_prompt_answer(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx(5000);
+    struct target_user user;
+    gid_t *groups;
+
+    unsetenv("ROOT_SHIM_NSS_DELAY_MS");
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    /* from NSS, not the fixture */
+    assert(strcmp(user.name, "fixroot") != 0);
+    assert(user.uid == 0);
+    assert(nss_group_list(ctx, user.name, user.gid, &groups) >= 1);
+    assert(groups[0] == user.gid);
+    assert(!ctx->nss_degraded);
+
+    root_ctx_free(ctx);
+}
+
+void test_slow_nss_falls_back(void)
+{
+    printf("Running %s\n", __func__);
+    if (!have_shim()) {
+        printf("Skipping %s (needs LD_PRELOAD=./testshim.so)\n", __func__);
+        return;
+    }
+    struct root_ctx *ctx = new_ctx(100);
+    struct target_user user;
+    struct timespec start;
+    gid_t *groups;
+
+    setenv("ROOT_SHIM_NSS_DELAY_MS", "3000", 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(elapsed_ms(&start) < 1000);
+    assert(strcmp(user.name, "fixroot") == 0);
+    assert(ctx->nss_degraded);
+
+    /* and NSS isn't waited for again */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(nss_group_list(ctx, "alice", 4242, &groups) == 3);
+    assert(strcmp(nss_group_name(ctx, 0), "fixwheel") == 0);
+    assert(elapsed_ms(&start) < 100);
+
+    /* said once, in the log */
+    char logged[1024];
+    FILE *f = fopen(syslog_path, "r");
+    assert(f != NULL);
+    size_t n = fread(logged, 1, sizeof(logged) - 1, f);
+    logged[n] = '\0';
+    fclose(f);
+    assert(strncmp(logged, "warning ", 8) == 0);
+    assert(strstr(logged, "Timed out after 100ms looking up uid 0") != NULL);
+    assert(strstr(logged, passwd) != NULL);
+    assert(strstr(strstr(logged, "Timed out") + 1, "Timed out") == NULL);
+
+    unsetenv("ROOT_SHIM_NSS_DELAY_MS");
+    root_ctx_free(ctx);
+}
+
+void test_no_deadline(void)
+{
+    printf("Running %s\n", __func__);
+    if (!have_shim()) {
+        printf("Skipping %s (needs LD_PRELOAD=./testshim.so)\n", __func__);
+        return;
+    }
+    struct root_ctx *ctx = new_ctx(0);
+    struct target_user user;
+    struct timespec start;
+
+    setenv("ROOT_SHIM_NSS_DELAY_MS", "200", 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(elapsed_ms(&start) >= 200);
+    assert(strcmp(user.name, "fixroot") != 0);
+    assert(!ctx->nss_degraded);
+
+    unsetenv("ROOT_SHIM_NSS_DELAY_MS");
+    root_ctx_free(ctx);
+}
+
+void test_prefetch(void)
+{
+    printf("Running %s\n", __func__);
+    struct root_ctx *ctx = new_ctx(5000);
+    struct target_user user;
+    gid_t *groups;
+
+    unsetenv("ROOT_SHIM_NSS_DELAY_MS");
+    nss_prefetch(ctx, 0, NULL);
+    assert(ctx->nss_prefetch != NULL);
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(user.uid == 0);
+    assert(strcmp(user.name, "fixroot") != 0);
+    assert(nss_group_list(ctx, user.name, user.gid, &groups) >= 1);
+    assert(groups[0] == user.gid);
+    /* and again, from the same answer */
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(!ctx->nss_degraded);
+    root_ctx_free(ctx);
+
+    /* by name, including no such user */
+    ctx = new_ctx(5000);
+    nss_prefetch(ctx, 0, "root");
+    assert(nss_user_by_name(ctx, "root", &user) == 0);
+    assert(user.uid == 0);
+    root_ctx_free(ctx);
+
+    ctx = new_ctx(5000);
+    nss_prefetch(ctx, 0, "no such user");
+    errno = -1;
+    assert(nss_user_by_name(ctx, "no such user", &user) == -1);
+    assert(errno == 0);
+    root_ctx_free(ctx);
+}
+
+void test_prefetch_overlaps(void)
+{
+    printf("Running %s\n", __func__);
+    if (!have_shim()) {
+        printf("Skipping %s (needs LD_PRELOAD=./testshim.so)\n", __func__);
+        return;
+    }
+    struct root_ctx *ctx = new_ctx(5000);
+    struct target_user user;
+    struct timespec start;
+    gid_t *groups;
+
+    /* the passwd entry and the groups take 300ms each */
+    setenv("ROOT_SHIM_NSS_DELAY_MS", "300", 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nss_prefetch(ctx, 0, NULL);
+
+    /* as if root were busy with something else meanwhile */
+    usleep(300 * 1000);
+
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(nss_group_list(ctx, user.name, user.gid, &groups) >= 1);
+    long elapsed = elapsed_ms(&start);
+    /* not 300 + 300 + 300 */
+    assert(elapsed >= 600 && elapsed < 850);
+    assert(!ctx->nss_degraded);
+
+    /* let go of one that's still running */
+    nss_close(ctx);
+    nss_prefetch(ctx, 0, NULL);
+    root_ctx_free(ctx);
+    usleep(700 * 1000);
+
+    unsetenv("ROOT_SHIM_NSS_DELAY_MS");
+}
+
+void test_prefetch_times_out(void)
+{
+    printf("Running %s\n", __func__);
+    if (!have_shim()) {
+        printf("Skipping %s (needs LD_PRELOAD=./testshim.so)\n", __func__);
+        return;
+    }
+    struct root_ctx *ctx = new_ctx(200);
+    struct target_user user;
+    struct timespec start;
+    gid_t *groups;
+
+    setenv("ROOT_SHIM_NSS_DELAY_MS", "3000", 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nss_prefetch(ctx, 0, NULL);
+
+    /* the deadline counts from the prefetch */
+    usleep(150 * 1000);
+    assert(nss_user_by_uid(ctx, 0, &user) == 0);
+    assert(elapsed_ms(&start) < 400);
+    assert(strcmp(user.name, "fixroot") == 0);
+    assert(ctx->nss_degraded);
+    assert(ctx->nss_prefetch == NULL);
+    assert(nss_group_list(ctx, "alice", 4242, &groups) == 3);
+
+    unsetenv("ROOT_SHIM_NSS_DELAY_MS");
+    root_ctx_free(ctx);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(passwd, sizeof(passwd), "%s/passwd", base);
+    snprintf(group, sizeof(group), "%s/group", base);
+    snprintf(syslog_path, sizeof(syslog_path), "%s/syslog", base);
+    setenv("ROOT_SHIM_SYSLOG", syslog_path, 1);
+
+    write_file(passwd,
+               "# a comment\n"
+               "fixroot:x:0:0:root:/fixture/root:/bin/sh\n"
+               "+::::::\n"
+               "alice:x:4242:4242::/home/alice:/bin/sh\n");
+    write_file(group,
+               "fixwheel:x:0:\n"
+               "staff:x:10:bob,alice\n"
+               "users:x:20:alice\n"
+               "other:x:30:alicex,xalice\n"
+               "alice:x:4242:alice\n");
+
+    test_files();
+    test_prompt_answer();
+    test_slow_nss_falls_back();
+    test_no_deadline();
+    test_prefetch();
+    test_prefetch_overlaps();
+    test_prefetch_times_out();
+
+    unlink(passwd);
+    unlink(group);
+    unlink(syslog_path);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -1,58 +1,76 @@
-#define _DEFAULT_SOURCE /* for strdup(), glibc >= 2.20 */
-#define _BSD_SOURCE     /* for strdup() */
+#define _GNU_SOURCE     /* for O_PATH */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include "root.h"
+#include "arena.h"
 #include "path.h"
-#include "logging.h"
 
 /*
- * Return the full path to command found by searching for it in pathenv,
- * returning the first PATH entry that contains a matching executable
- * regular file. Directories (and other non-regular files) are skipped
- * even when they are executable.
+ * the flags used to open PATH directories for searching
  *
- * If command is found via a relative path in PATH (e.g. "" or "."),
- * the relative path is still returned. The caller is responsible for
- * checking whether the result is safe (e.g. via is_absolute_path()).
+ * O_PATH (Linux) and O_SEARCH (POSIX) need only search permission,
+ * like the path-based lookup they replace.
+ */
+#if defined(O_PATH)
+#define PATHDIR_FLAGS (O_PATH|O_DIRECTORY|O_CLOEXEC)
+#elif defined(O_SEARCH)
+#define PATHDIR_FLAGS (O_SEARCH|O_DIRECTORY|O_CLOEXEC)
+#else
+#define PATHDIR_FLAGS (O_RDONLY|O_DIRECTORY|O_CLOEXEC)
+#endif
+
+/*
+ * Split pathenv into its entries, allocated from arena.
  *
- * If the string returned is not NULL, it must be freed by the caller.
+ * The directories are not opened; see pathlist_open.
+ * Close any opened directories with pathlist_close.
+ *
+ * Returns 0 on success, -1 with errno set on failure.
  */
-char *get_command_path(const char *command, const char *pathenv)
+int pathlist_init(struct pathlist *pathlist,
+                  struct arena *arena,
+                  const char *pathenv)
 {
-    if (command == NULL) {
-        error("get_command_path: command is NULL");
-        exit(ROOT_PROGRAMMER_ERROR);
+    if (pathlist == NULL || arena == NULL || pathenv == NULL) {
+        errno = EINVAL;
+        return -1;
     }
-    if (pathenv == NULL) {
-        error("get_command_path: pathenv is NULL");
-        exit(ROOT_PROGRAMMER_ERROR);
+
+    pathlist->count = 0;
+    pathlist->entries = NULL;
+    pathlist->pathenvcopy = arena_strdup(arena, pathenv);
+    if (pathlist->pathenvcopy == NULL) {
+        return -1;
     }
 
-    size_t commandlen = strlen(command);
-    char *pathenvcopy = strdup(pathenv);
-    if (pathenvcopy == NULL) {
-        error("Cannot allocate memory to hold pathenv");
-        exit(ROOT_SYSTEM_ERROR);
+    size_t count = 1;
+    for (const char *p = pathenv; *p != '\0'; p++) {
+        if (*p == PATHENVSEP[0]) {
+            count++;
+        }
+    }
+    pathlist->entries = arena_alloc(arena, count * sizeof(*pathlist->entries));
+    if (pathlist->entries == NULL) {
+        return -1;
     }
 
-    char *remaining = pathenvcopy;
+    size_t i = 0;
+    char *remaining = pathlist->pathenvcopy;
     while (remaining != NULL) {
         char *sep = strchr(remaining, PATHENVSEP[0]);
-        char *dir;
+        char *dir = remaining;
         if (sep != NULL) {
             *sep = '\0';
-            dir = remaining;
             remaining = sep + 1;
         }
         else {
-            dir = remaining;
             remaining = NULL;
         }
 
@@ -61,49 +79,160 @@ char *get_command_path(const char *command, const char *pathenv)
             dir = ".";
         }
 
-        size_t dirlen = strlen(dir);
-        char *path = malloc(dirlen + 1 + commandlen + 1);
-        if (path == NULL) {
-            error("Cannot allocate memory to hold path");
-            free(pathenvcopy);
-            exit(ROOT_SYSTEM_ERROR);
+        pathlist->entries[i].dir = dir;
+        pathlist->entries[i].fd = -1;
+        i++;
+    }
+    pathlist->count = i;
+    return 0;
+}
+
+/*
+ * Open a handle on every directory in pathlist.
+ *
+ * Worth doing when pathlist will be searched for many commands: each
+ * lookup then resolves only the command's name rather than the whole path.
+ * Entries that cannot be opened are searched by name as before.
+ */
+void pathlist_open(struct pathlist *pathlist)
+{
+    for (size_t i = 0; i < pathlist->count; i++) {
+        if (pathlist->entries[i].fd == -1) {
+            pathlist->entries[i].fd = open(pathlist->entries[i].dir, PATHDIR_FLAGS);
         }
-        strcpy(path, dir);
+    }
+}
+
+/*
+ * Whether command in entry is an executable regular file.
+ *
+ * path may be NULL if entry has an open handle.
+ */
+static int is_executable_file(const struct pathentry *entry,
+                              const char *command,
+                              const char *path)
+{
+    struct stat st;
+
+    /*
+     * Require a regular, executable file. Skipping directories (and
+     * other non-regular files) means an executable directory whose
+     * name matches the command does not shadow the real executable in
+     * a later PATH entry, which would otherwise make execv() fail.
+     */
+    if (entry->fd != -1) {
+        return faccessat(entry->fd, command, X_OK, 0) == 0
+            && fstatat(entry->fd, command, &st, 0) == 0
+            && S_ISREG(st.st_mode);
+    }
+    return access(path, X_OK) == 0 && stat(path, &st) == 0
+        && S_ISREG(st.st_mode);
+}
 
-        /*debug("Looking in %s", path);*/
+/*
+ * Return the full path to command found by searching pathlist,
+ * returning the first PATH entry that contains a matching executable
+ * regular file. Directories (and other non-regular files) are skipped
+ * even when they are executable.
+ *
+ * If indexp is not NULL, the index of the matching entry is stored there.
+ *
+ * If command is found via a relative path in PATH (e.g. "" or "."),
+ * the relative path is still returned. The caller is responsible for
+ * checking whether the result is safe (e.g. via is_absolute_path()).
+ *
+ * The path is built in buf, which is returned.  Otherwise NULL is returned
+ * and errno is ENOENT if command was not found, ENAMETOOLONG if it was
+ * found but its path does not fit in bufsize, or says why the search failed.
+ */
+char *pathlist_find(const struct pathlist *pathlist,
+                    const char *command,
+                    char *buf,
+                    size_t bufsize,
+                    size_t *indexp)
+{
+    if (pathlist == NULL || command == NULL || buf == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
 
-        if (path[dirlen - 1] != DIRSEP) {
-            char dirsepstr[2];
-            sprintf(dirsepstr, "%c", DIRSEP);
-            strcat(path, dirsepstr);
+    size_t commandlen = strlen(command);
+    for (size_t i = 0; i < pathlist->count; i++) {
+        const struct pathentry *entry = &pathlist->entries[i];
+        size_t dirlen = strlen(entry->dir);
+        int fits = dirlen + 1 + commandlen + 1 <= bufsize;
+        if (fits) {
+            memcpy(buf, entry->dir, dirlen);
+            if (entry->dir[dirlen - 1] != DIRSEP) {
+                buf[dirlen++] = DIRSEP;
+            }
+            memcpy(buf + dirlen, command, commandlen + 1);
         }
-        strcat(path, command);
-
-        /*
-         * Require a regular, executable file. Skipping directories (and
-         * other non-regular files) means an executable directory whose
-         * name matches the command does not shadow the real executable in
-         * a later PATH entry, which would otherwise make execv() fail.
-         */
-        struct stat st;
-        if (access(path, X_OK) == 0 && stat(path, &st) == 0
-            && S_ISREG(st.st_mode)) {
-            /*debug("%s is %s", command, path);*/
-
-            free(pathenvcopy);
-            return path;
+        else if (entry->fd == -1) {
+            /* too long to look up by name, as access(2) would say */
+            continue;
         }
-        else {
-            free(path);
-            path = NULL;
+
+        /*debug("Looking in %s", buf);*/
+
+        if (is_executable_file(entry, command, fits ? buf : NULL)) {
+            /*debug("%s is %s", command, buf);*/
+            if (!fits) {
+                errno = ENAMETOOLONG;
+                return NULL;
+            }
+            if (indexp != NULL) {
+                *indexp = i;
+            }
+            return buf;
         }
     }
 
-    debug("%s not found in PATH", command);
-    free(pathenvcopy);
+    errno = ENOENT;
     return NULL;
 }
 
+/*
+ * Close the handles opened by pathlist_open.
+ *
+ * The entries themselves belong to the arena pathlist_init used.
+ */
+void pathlist_close(struct pathlist *pathlist)
+{
+    for (size_t i = 0; i < pathlist->count; i++) {
+        if (pathlist->entries[i].fd != -1) {
+            close(pathlist->entries[i].fd);
+            pathlist->entries[i].fd = -1;
+        }
+    }
+}
+
+/*
+ * Return the full path to command found by searching for it in pathenv.
+ *
+ * The same as pathlist_find on a pathlist made from pathenv, for when only
+ * one command needs to be found.
+ */
+char *get_command_path(const char *command,
+                       const char *pathenv,
+                       char *buf,
+                       size_t bufsize)
+{
+    char reserve[PATHENV_RESERVE];
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+
+    struct pathlist pathlist;
+    char *path = NULL;
+    if (pathlist_init(&pathlist, &arena, pathenv) == 0) {
+        path = pathlist_find(&pathlist, command, buf, bufsize, NULL);
+    }
+    int saved_errno = errno;
+    arena_release(&arena);
+    errno = saved_errno;
+    return path;
+}
+
 /**
  * Returns non-zero (true) if path does not contain a slash.
  *
@@ -139,18 +268,17 @@ int is_absolute_path(const char *path)
  */
 void pathenv_each(const char *pathenv, void (*func)(const char *pathentry))
 {
-    if (pathenv == NULL) {
-        error("pathenv_each: pathenv is NULL");
-        return;
-    }
-    if (func == NULL) {
-        error("pathenv_each: func is NULL");
+    /* fail safely rather than crash on invalid arguments */
+    if (pathenv == NULL || func == NULL) {
         return;
     }
 
-    char *pathenvcopy = strdup(pathenv);
+    char reserve[PATHENV_RESERVE];
+    struct arena arena;
+    arena_init(&arena, reserve, sizeof(reserve));
+
+    char *pathenvcopy = arena_strdup(&arena, pathenv);
     if (pathenvcopy == NULL) {
-        error("Cannot allocate memory to hold pathenv");
         return;
     }
 
@@ -176,7 +304,7 @@ void pathenv_each(const char *pathenv, void (*func)(const char *pathentry))
         (*func)(dir);
     }
 
-    free(pathenvcopy);
+    arena_release(&arena);
 }
 
 
@@ -1,10 +1,52 @@
 #ifndef PATH_H
 #define PATH_H
 
+#include <stddef.h>
+
 #define PATHENVSEP ":"
 #define DIRSEP '/'
 
-char *get_command_path(const char *command, const char *pathenv);
+/*
+ * stack space for copying PATH when no arena is supplied;
+ * longer values are copied into mapped memory instead
+ */
+#define PATHENV_RESERVE 1024
+
+struct arena;
+
+/*
+ * One entry of PATH.
+ */
+struct pathentry {
+    const char *dir;    /* "." for an empty entry */
+    int fd;             /* open handle on dir, or -1 if not opened */
+};
+
+/*
+ * PATH split into its entries, so it can be searched many times but only
+ * parsed once.
+ */
+struct pathlist {
+    char *pathenvcopy;
+    size_t count;
+    struct pathentry *entries;
+};
+
+int pathlist_init(struct pathlist *pathlist,
+                  struct arena *arena,
+                  const char *pathenv);
+void pathlist_open(struct pathlist *pathlist);
+char *pathlist_find(const struct pathlist *pathlist,
+                    const char *command,
+                    char *buf,
+                    size_t bufsize,
+                    size_t *indexp);
+void pathlist_close(struct pathlist *pathlist);
+
+char *get_command_path(const char *command,
+                       const char *pathenv,
+                       char *buf,
+                       size_t bufsize);
 int is_absolute_path(const char *path);
 int is_qualified_path(const char *path);
 int is_unqualified_path(const char *path);
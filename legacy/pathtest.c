@@ -2,12 +2,15 @@
 #define _BSD_SOURCE     /* for strdup() */
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "arena.h"
 #include "path.h"
 
 /*
@@ -179,15 +182,15 @@ void test_get_command_path_skips_directories(void)
     char pathenv[600];
     snprintf(pathenv, sizeof(pathenv), "%s:%s", dira, dirb);
 
-    char *result = get_command_path("cmd", pathenv);
-    assert(result != NULL);
+    char buf[PATH_MAX];
+    char *result = get_command_path("cmd", pathenv, buf, sizeof(buf));
+    assert(result == buf);
     assert(strcmp(result, filecmd) == 0);
-    free(result);
 
     /* If only the directory matches, nothing is found */
     char patha[300];
     snprintf(patha, sizeof(patha), "%s", dira);
-    char *only_dir = get_command_path("cmd", patha);
+    char *only_dir = get_command_path("cmd", patha, buf, sizeof(buf));
     assert(only_dir == NULL);
 
     unlink(filecmd);
@@ -197,6 +200,80 @@ void test_get_command_path_skips_directories(void)
     rmdir(base);
 }
 
+/*
+ * pathlist tests
+ */
+void test_pathlist_init(void)
+{
+    printf("Running %s\n", __func__);
+    struct arena arena;
+    arena_init(&arena, NULL, 0);
+    struct pathlist pathlist;
+    assert(pathlist_init(&pathlist, &arena, "/usr/bin::bin:") == 0);
+    assert(pathlist.count == 4);
+    assert(strcmp(pathlist.entries[0].dir, "/usr/bin") == 0);
+    assert(strcmp(pathlist.entries[1].dir, ".") == 0);
+    assert(strcmp(pathlist.entries[2].dir, "bin") == 0);
+    assert(strcmp(pathlist.entries[3].dir, ".") == 0);
+    for (size_t i = 0; i < pathlist.count; i++) {
+        assert(pathlist.entries[i].fd == -1);
+    }
+    pathlist_close(&pathlist);
+    arena_release(&arena);
+}
+
+void test_pathlist_find_reuses_handles(void)
+{
+    printf("Running %s\n", __func__);
+
+    char tmpl[] = "/tmp/roottestXXXXXX";
+    char *base = mkdtemp(tmpl);
+    assert(base != NULL);
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "%s/cmd", base);
+    FILE *f = fopen(cmd, "w");
+    assert(f != NULL);
+    fclose(f);
+    assert(chmod(cmd, 0755) == 0);
+
+    char pathenv[600];
+    snprintf(pathenv, sizeof(pathenv), "/nonexistent:%s/:%s", base, base);
+
+    struct arena arena;
+    arena_init(&arena, NULL, 0);
+    struct pathlist pathlist;
+    assert(pathlist_init(&pathlist, &arena, pathenv) == 0);
+    pathlist_open(&pathlist);
+    assert(pathlist.entries[0].fd == -1);
+    assert(pathlist.entries[1].fd != -1);
+
+    /* the same handles serve every lookup */
+    char buf[PATH_MAX];
+    for (int i = 0; i < 3; i++) {
+        size_t index = 99;
+        char *result = pathlist_find(&pathlist, "cmd", buf, sizeof(buf), &index);
+        assert(result == buf);
+        assert(strcmp(result, cmd) == 0);
+        assert(index == 1);
+
+        assert(pathlist_find(&pathlist, "missing", buf, sizeof(buf), &index) == NULL);
+        assert(errno == ENOENT);
+    }
+
+    /* found, but the caller's buffer is too small to say where */
+    char small[8];
+    assert(pathlist_find(&pathlist, "cmd", small, sizeof(small), NULL) == NULL);
+    assert(errno == ENAMETOOLONG);
+
+    pathlist_close(&pathlist);
+    assert(pathlist.entries[1].fd == -1);
+    arena_release(&arena);
+
+    unlink(cmd);
+    rmdir(base);
+}
+
 int main(int argc, const char *argv[])
 {
     test_pathenv_each_basic();
@@ -210,6 +287,8 @@ int main(int argc, const char *argv[])
     test_is_qualified_path();
     test_is_unqualified_path();
     test_get_command_path_skips_directories();
+    test_pathlist_init();
+    test_pathlist_find_reuses_handles();
 
     return 0;
 }
@@ -0,0 +1,266 @@
+#define _DEFAULT_SOURCE /* for O_NOFOLLOW, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for O_NOFOLLOW */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "policy.h"
+
+uint32_t policy_hash(const char *string, size_t len, uint32_t seed)
+{
+    /* FNV-1a, seeded, with a final mix so nearby seeds scatter */
+    uint64_t h = 0xcbf29ce484222325ULL ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ULL);
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)string[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+/*
+ * Whether the array of count elements of size bytes at off lies inside
+ * the table.
+ */
+static int section_fits(size_t tablesize, uint32_t off, uint32_t count, size_t size)
+{
+    if (off % sizeof(uint32_t) != 0 || off > tablesize) {
+        return 0;
+    }
+    return count <= (tablesize - off) / size;
+}
+
+static int header_is_valid(const struct policy_header *h, size_t size)
+{
+    if (memcmp(h->magic, POLICY_MAGIC, sizeof(h->magic)) != 0
+        || h->byteorder != POLICY_BYTEORDER
+        || h->size != size) {
+        return 0;
+    }
+    if ((h->nslots == 0) != (h->nbuckets == 0)) {
+        return 0;
+    }
+    if (h->any_command == POLICY_NONE ? h->ncommands != h->nslots
+                                      : h->ncommands != h->nslots + 1
+                                        || h->any_command != h->nslots) {
+        return 0;
+    }
+    return section_fits(size, h->seeds_off, h->nbuckets, sizeof(uint32_t))
+        && section_fits(size, h->commands_off, h->ncommands, sizeof(struct policy_command))
+        && section_fits(size, h->rules_off, h->nrules, sizeof(struct policy_rule))
+        && section_fits(size, h->nodes_off, h->nnodes, sizeof(struct policy_node))
+        && section_fits(size, h->strings_off, h->strings_size, 1);
+}
+
+int policy_open(struct policy *policy, const char *path)
+{
+    policy->base = NULL;
+    policy->size = 0;
+    policy->header = NULL;
+
+    int fd = open(path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_uid != 0 || (st.st_mode & (S_IWGRP|S_IWOTH))) {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct policy_header)
+        || (uintmax_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    if (!header_is_valid(base, st.st_size)) {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    policy->base = base;
+    policy->size = st.st_size;
+    policy->header = base;
+    return 0;
+}
+
+void policy_close(struct policy *policy)
+{
+    if (policy->base != NULL) {
+        munmap((void *)policy->base, policy->size);
+    }
+    policy->base = NULL;
+    policy->size = 0;
+    policy->header = NULL;
+}
+
+/*
+ * the string at off, or NULL if it isn't inside the table
+ */
+static const char *policy_string(const struct policy *policy, uint32_t off, uint32_t len)
+{
+    const struct policy_header *h = policy->header;
+    if (off > h->strings_size || len > h->strings_size - off) {
+        return NULL;
+    }
+    return (const char *)policy->base + h->strings_off + off;
+}
+
+static const struct policy_command *find_command(const struct policy *policy,
+                                                 const char *command)
+{
+    const struct policy_header *h = policy->header;
+    if (h->nslots == 0) {
+        return NULL;
+    }
+
+    const uint32_t *seeds = (const uint32_t *)(policy->base + h->seeds_off);
+    const struct policy_command *commands =
+        (const struct policy_command *)(policy->base + h->commands_off);
+
+    size_t len = strlen(command);
+    uint32_t seed = seeds[policy_hash(command, len, 0) % h->nbuckets];
+    const struct policy_command *c = &commands[policy_hash(command, len, seed) % h->nslots];
+
+    /* a perfect hash only places known keys; anything else must be compared */
+    const char *path = policy_string(policy, c->path, c->pathlen);
+    if (path == NULL || c->pathlen != len || memcmp(path, command, len) != 0) {
+        return NULL;
+    }
+    return c;
+}
+
+/*
+ * the child of node whose word is arg, or NULL
+ */
+static const struct policy_node *find_child(const struct policy *policy,
+                                            const struct policy_node *node,
+                                            const char *arg)
+{
+    const struct policy_header *h = policy->header;
+    const struct policy_node *nodes =
+        (const struct policy_node *)(policy->base + h->nodes_off);
+
+    if (node->first_child > h->nnodes || node->nchildren > h->nnodes - node->first_child) {
+        return NULL;
+    }
+
+    size_t arglen = strlen(arg);
+    size_t lo = node->first_child, hi = lo + node->nchildren;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *word = policy_string(policy, nodes[mid].word, nodes[mid].wordlen);
+        if (word == NULL) {
+            return NULL;
+        }
+        /* the order strcmp gives, which is how rootpolicy sorted them */
+        size_t n = arglen < nodes[mid].wordlen ? arglen : nodes[mid].wordlen;
+        int cmp = memcmp(arg, word, n);
+        if (cmp == 0) {
+            cmp = (arglen > nodes[mid].wordlen) - (arglen < nodes[mid].wordlen);
+        }
+        if (cmp == 0) {
+            return &nodes[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+static int args_match(const struct policy *policy,
+                      uint32_t root,
+                      const char *const *argv)
+{
+    const struct policy_header *h = policy->header;
+    const struct policy_node *nodes =
+        (const struct policy_node *)(policy->base + h->nodes_off);
+
+    if (root >= h->nnodes) {
+        return 0;
+    }
+    const struct policy_node *node = &nodes[root];
+    for (const char *const *arg = argv + 1; ; arg++) {
+        if (node->terminal) {
+            return 1;
+        }
+        if (*arg == NULL) {
+            return 0;
+        }
+        node = find_child(policy, node, *arg);
+        if (node == NULL) {
+            return 0;
+        }
+    }
+}
+
+static int command_permits(const struct policy *policy,
+                           const struct policy_command *c,
+                           const gid_t *groups,
+                           size_t ngroups,
+                           const char *const *argv)
+{
+    const struct policy_header *h = policy->header;
+    const struct policy_rule *rules =
+        (const struct policy_rule *)(policy->base + h->rules_off);
+
+    if (c->first_rule > h->nrules || c->nrules > h->nrules - c->first_rule) {
+        return 0;
+    }
+    for (uint32_t r = c->first_rule; r < c->first_rule + c->nrules; r++) {
+        for (size_t g = 0; g < ngroups; g++) {
+            if (rules[r].gid == groups[g] && args_match(policy, rules[r].root, argv)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int policy_permits(const struct policy *policy,
+                   const gid_t *groups,
+                   size_t ngroups,
+                   const char *command,
+                   const char *const *argv)
+{
+    const struct policy_header *h = policy->header;
+
+    const struct policy_command *c = find_command(policy, command);
+    if (c != NULL && command_permits(policy, c, groups, ngroups, argv)) {
+        return 1;
+    }
+
+    if (h->any_command != POLICY_NONE) {
+        const struct policy_command *commands =
+            (const struct policy_command *)(policy->base + h->commands_off);
+        return command_permits(policy, &commands[h->any_command], groups, ngroups, argv);
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,125 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * where root looks for a compiled policy
+ *
+ * override at build time, e.g. make CFLAGS+=-DPOLICY_PATH='"/srv/root.db"'
+ */
+#ifndef POLICY_PATH
+#define POLICY_PATH "/etc/root/policy.db"
+#endif
+
+/*
+ * A compiled command allowlist.
+ *
+ * The source is a text file of rules, one per line:
+ *   <group> <command> [<argument>]...
+ * meaning members of <group> (a name or a number) may run <command> (an
+ * absolute path, or * for any command) with arguments that start with the
+ * given ones.  <command> may also be one of the file operations root does
+ * itself, --write, --append, --copy or --read, whose arguments are the
+ * real paths of their files.  rootpolicy compiles it into the table
+ * described below, which root maps read-only and consults with a few
+ * memory reads.
+ *
+ * The table is, in order, a header, then arrays of seeds, commands, rules
+ * and trie nodes, then the strings they refer to.  Every number is a
+ * uint32_t in the byte order of the machine that compiled it, and every
+ * reference is an index or a byte offset into the relevant section.
+ *
+ * Commands are found with a perfect hash: the command's bucket (its hash
+ * with seed 0) gives a seed, and its hash with that seed gives its slot.
+ * Each command has a run of rules, one per group, and each rule is the root
+ * of a trie over argument words whose children are sorted, so they can be
+ * binary searched.  A terminal node means "any further arguments".
+ */
+#define POLICY_MAGIC "ROOTPOL1"
+#define POLICY_BYTEORDER 0x01020304
+#define POLICY_NONE UINT32_MAX
+
+struct policy_header {
+    char magic[8];
+    uint32_t byteorder;
+    uint32_t size;              /* of the whole table */
+    uint32_t nbuckets;
+    uint32_t nslots;            /* commands reachable by hash */
+    uint32_t ncommands;         /* nslots, plus one if there's an any entry */
+    uint32_t any_command;       /* the "*" command's index, or POLICY_NONE */
+    uint32_t nrules;
+    uint32_t nnodes;
+    uint32_t strings_size;
+    uint32_t seeds_off;
+    uint32_t commands_off;
+    uint32_t rules_off;
+    uint32_t nodes_off;
+    uint32_t strings_off;
+};
+
+struct policy_command {
+    uint32_t path;              /* offset into strings */
+    uint32_t pathlen;
+    uint32_t first_rule;
+    uint32_t nrules;
+};
+
+struct policy_rule {
+    uint32_t gid;
+    uint32_t root;              /* trie node */
+};
+
+struct policy_node {
+    uint32_t word;              /* offset into strings, unused for a root */
+    uint32_t wordlen;
+    uint32_t first_child;
+    uint32_t nchildren;
+    uint32_t terminal;
+};
+
+/*
+ * An open table.
+ */
+struct policy {
+    const unsigned char *base;
+    size_t size;
+    const struct policy_header *header;
+};
+
+uint32_t policy_hash(const char *string, size_t len, uint32_t seed);
+
+/*
+ * Map the table at path.
+ *
+ * The table must be a regular file owned by root and not writable by
+ * anyone else, and structurally sound.  Returns 0, or -1 with errno set:
+ * ENOENT if there is no table, EPERM if it is not safely owned, or EINVAL
+ * if it is damaged or from another machine.
+ */
+int policy_open(struct policy *policy, const char *path);
+void policy_close(struct policy *policy);
+
+/*
+ * Whether a member of groups may run command with the arguments argv[1]...
+ *
+ * Returns 1 if so, 0 if not.
+ */
+int policy_permits(const struct policy *policy,
+                   const gid_t *groups,
+                   size_t ngroups,
+                   const char *command,
+                   const char *const *argv);
+
+/*
+ * Compile the rules in source into a table at output, replacing it
+ * atomically.  Used by rootpolicy; root itself only reads tables.
+ *
+ * Returns 0, or -1 having said why on stderr.
+ */
+int policy_compile(const char *source, const char *output);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
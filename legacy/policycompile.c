@@ -0,0 +1,534 @@
+#define _DEFAULT_SOURCE /* for getline(), realpath(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for realpath() */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "policy.h"
+
+/* how hard to look for one bucket's seed before making the table bigger */
+#define SEED_TRIES (1 << 20)
+
+/*
+ * The policy as parsed, before it is laid out as a table.
+ */
+struct bnode {
+    const char *word;
+    int terminal;
+    struct bnode *children;     /* sorted by word */
+    struct bnode *next;
+};
+
+struct brule {
+    gid_t gid;
+    struct bnode root;
+    struct brule *next;
+};
+
+struct bcommand {
+    const char *path;
+    struct brule *rules;
+    struct bcommand *next;
+    uint32_t bucket;
+};
+
+struct compiler {
+    struct arena arena;
+    const char *sourcename;
+    unsigned long line;
+    struct bcommand *commands;
+    struct bcommand *any;
+    uint32_t ncommands;         /* not counting any */
+    uint32_t nrules;
+    uint32_t nnodes;
+    size_t strings_size;
+};
+
+static void syntax_error(struct compiler *c, const char *message, const char *detail)
+{
+    fprintf(stderr, "rootpolicy: %s:%lu: %s%s%s\n",
+            c->sourcename, c->line, message,
+            detail != NULL ? ": " : "", detail != NULL ? detail : "");
+}
+
+static int parse_group(struct compiler *c, const char *token, gid_t *gidp)
+{
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(token, &end, 10);
+    if (isdigit((unsigned char)token[0]) && *end == '\0') {
+        if (errno != 0 || n >= POLICY_NONE) {
+            syntax_error(c, "Group number out of range", token);
+            return -1;
+        }
+        *gidp = (gid_t)n;
+        return 0;
+    }
+
+    struct group *gr = getgrnam(token);
+    if (gr == NULL) {
+        syntax_error(c, "Unknown group", token);
+        return -1;
+    }
+    *gidp = gr->gr_gid;
+    return 0;
+}
+
+static struct bcommand *get_command(struct compiler *c, const char *token)
+{
+    if (strcmp(token, "*") == 0) {
+        if (c->any == NULL) {
+            c->any = arena_alloc(&c->arena, sizeof(*c->any));
+            if (c->any == NULL) {
+                return NULL;
+            }
+            memset(c->any, 0, sizeof(*c->any));
+            c->any->path = "*";
+        }
+        return c->any;
+    }
+
+    /* the file operations root does itself, see fileops.h */
+    int builtin = strcmp(token, "--write") == 0 || strcmp(token, "--append") == 0
+                  || strcmp(token, "--copy") == 0 || strcmp(token, "--read") == 0;
+    if (token[0] != '/' && !builtin) {
+        syntax_error(c, "Command must be an absolute path, *, --write, --append, "
+                        "--copy or --read", token);
+        return NULL;
+    }
+
+    /* root checks the command's real path, so the rule must name it too */
+    char resolved[PATH_MAX];
+    const char *path = token;
+    if (builtin) {
+        /* as it is */
+    }
+    else if (realpath(token, resolved) != NULL) {
+        path = resolved;
+    }
+    else {
+        fprintf(stderr, "rootpolicy: %s:%lu: warning: Cannot resolve %s: %s\n",
+                c->sourcename, c->line, token, strerror(errno));
+    }
+
+    for (struct bcommand *cmd = c->commands; cmd != NULL; cmd = cmd->next) {
+        if (strcmp(cmd->path, path) == 0) {
+            return cmd;
+        }
+    }
+
+    struct bcommand *cmd = arena_alloc(&c->arena, sizeof(*cmd));
+    if (cmd == NULL) {
+        return NULL;
+    }
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->path = arena_strdup(&c->arena, path);
+    if (cmd->path == NULL) {
+        return NULL;
+    }
+    cmd->next = c->commands;
+    c->commands = cmd;
+    c->ncommands++;
+    c->strings_size += strlen(path) + 1;
+    return cmd;
+}
+
+static struct brule *get_rule(struct compiler *c, struct bcommand *cmd, gid_t gid)
+{
+    for (struct brule *rule = cmd->rules; rule != NULL; rule = rule->next) {
+        if (rule->gid == gid) {
+            return rule;
+        }
+    }
+
+    struct brule *rule = arena_alloc(&c->arena, sizeof(*rule));
+    if (rule == NULL) {
+        return NULL;
+    }
+    memset(rule, 0, sizeof(*rule));
+    rule->gid = gid;
+    rule->next = cmd->rules;
+    cmd->rules = rule;
+    c->nrules++;
+    c->nnodes++;
+    return rule;
+}
+
+static struct bnode *get_child(struct compiler *c, struct bnode *node, const char *word)
+{
+    struct bnode **link = &node->children;
+    while (*link != NULL) {
+        int cmp = strcmp(word, (*link)->word);
+        if (cmp == 0) {
+            return *link;
+        }
+        if (cmp < 0) {
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    struct bnode *child = arena_alloc(&c->arena, sizeof(*child));
+    if (child == NULL) {
+        return NULL;
+    }
+    memset(child, 0, sizeof(*child));
+    child->word = arena_strdup(&c->arena, word);
+    if (child->word == NULL) {
+        return NULL;
+    }
+    child->next = *link;
+    *link = child;
+    c->nnodes++;
+    c->strings_size += strlen(word) + 1;
+    return child;
+}
+
+static int parse_line(struct compiler *c, char *line)
+{
+    const char *seps = " \t\r\n";
+    char *token = strtok(line, seps);
+    if (token == NULL || token[0] == '#') {
+        return 0;
+    }
+
+    gid_t gid;
+    if (parse_group(c, token, &gid) == -1) {
+        return -1;
+    }
+
+    token = strtok(NULL, seps);
+    if (token == NULL) {
+        syntax_error(c, "Missing command", NULL);
+        return -1;
+    }
+    struct bcommand *cmd = get_command(c, token);
+    if (cmd == NULL) {
+        return -1;
+    }
+    struct brule *rule = get_rule(c, cmd, gid);
+    if (rule == NULL) {
+        return -1;
+    }
+
+    struct bnode *node = &rule->root;
+    while ((token = strtok(NULL, seps)) != NULL) {
+        node = get_child(c, node, token);
+        if (node == NULL) {
+            return -1;
+        }
+    }
+    node->terminal = 1;
+    return 0;
+}
+
+/*
+ * Choose a seed for every bucket so that each command lands in its own
+ * slot, trying nslots slots.  Returns 0, or -1 if some bucket had no seed.
+ */
+static int place_commands(struct compiler *c,
+                          struct bcommand **slots,
+                          uint32_t *seeds,
+                          uint32_t nbuckets,
+                          uint32_t nslots)
+{
+    memset(slots, 0, nslots * sizeof(*slots));
+    memset(seeds, 0, nbuckets * sizeof(*seeds));
+
+    uint32_t *sizes = arena_alloc(&c->arena, nbuckets * sizeof(*sizes));
+    if (sizes == NULL) {
+        return -1;
+    }
+    memset(sizes, 0, nbuckets * sizeof(*sizes));
+    for (struct bcommand *cmd = c->commands; cmd != NULL; cmd = cmd->next) {
+        cmd->bucket = policy_hash(cmd->path, strlen(cmd->path), 0) % nbuckets;
+        sizes[cmd->bucket]++;
+    }
+
+    /* the fullest buckets first, while there is the most room */
+    uint32_t maxsize = 0;
+    for (uint32_t b = 0; b < nbuckets; b++) {
+        if (sizes[b] > maxsize) {
+            maxsize = sizes[b];
+        }
+    }
+    uint32_t chosen[maxsize > 0 ? maxsize : 1];
+    for (uint32_t size = maxsize; size > 0; size--) {
+        for (uint32_t b = 0; b < nbuckets; b++) {
+            if (sizes[b] != size) {
+                continue;
+            }
+            uint32_t seed;
+            for (seed = 1; seed < SEED_TRIES; seed++) {
+                uint32_t n = 0;
+                struct bcommand *cmd;
+                for (cmd = c->commands; cmd != NULL; cmd = cmd->next) {
+                    if (cmd->bucket != b) {
+                        continue;
+                    }
+                    uint32_t slot = policy_hash(cmd->path, strlen(cmd->path), seed) % nslots;
+                    int clash = slots[slot] != NULL;
+                    for (uint32_t i = 0; i < n && !clash; i++) {
+                        clash = chosen[i] == slot;
+                    }
+                    if (clash) {
+                        break;
+                    }
+                    chosen[n++] = slot;
+                }
+                if (cmd == NULL) {
+                    break;
+                }
+            }
+            if (seed == SEED_TRIES) {
+                return -1;
+            }
+
+            seeds[b] = seed;
+            uint32_t n = 0;
+            for (struct bcommand *cmd = c->commands; cmd != NULL; cmd = cmd->next) {
+                if (cmd->bucket == b) {
+                    slots[chosen[n++]] = cmd;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * The table being written, and how far each section has been filled.
+ */
+struct layout {
+    unsigned char *base;
+    struct policy_header *header;
+    struct policy_command *commands;
+    struct policy_rule *rules;
+    struct policy_node *nodes;
+    char *strings;
+    uint32_t nrules;
+    uint32_t nnodes;
+    uint32_t strings_size;
+};
+
+static uint32_t add_string(struct layout *t, const char *string)
+{
+    uint32_t off = t->strings_size;
+    size_t len = strlen(string) + 1;
+    memcpy(t->strings + off, string, len);
+    t->strings_size += len;
+    return off;
+}
+
+/*
+ * Write node at index, then its children as one sorted run, then theirs.
+ */
+static void add_node(struct layout *t, const struct bnode *node, uint32_t index)
+{
+    struct policy_node *out = &t->nodes[index];
+    out->word = node->word != NULL ? add_string(t, node->word) : 0;
+    out->wordlen = node->word != NULL ? strlen(node->word) : 0;
+    out->terminal = node->terminal;
+
+    uint32_t count = 0;
+    for (const struct bnode *child = node->children; child != NULL; child = child->next) {
+        count++;
+    }
+    out->first_child = t->nnodes;
+    out->nchildren = count;
+    t->nnodes += count;
+
+    uint32_t i = out->first_child;
+    for (const struct bnode *child = node->children; child != NULL; child = child->next) {
+        add_node(t, child, i++);
+    }
+}
+
+static void add_command(struct layout *t, const struct bcommand *cmd, uint32_t index)
+{
+    struct policy_command *out = &t->commands[index];
+    out->first_rule = t->nrules;
+    if (cmd == NULL) {
+        return;
+    }
+    out->path = add_string(t, cmd->path);
+    out->pathlen = strlen(cmd->path);
+    for (const struct brule *rule = cmd->rules; rule != NULL; rule = rule->next) {
+        struct policy_rule *r = &t->rules[t->nrules++];
+        r->gid = rule->gid;
+        r->root = t->nnodes++;
+        add_node(t, &rule->root, r->root);
+        out->nrules++;
+    }
+}
+
+static size_t align4(size_t n)
+{
+    return (n + 3) & ~(size_t)3;
+}
+
+static int write_table(const char *output, const void *table, size_t size)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", output) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    const char *p = table;
+    size_t left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        p += n;
+        left -= n;
+    }
+    if (fsync(fd) == -1 || close(fd) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+
+    /* root never sees a half-written table */
+    if (rename(tmp, output) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static int build_table(struct compiler *c, const char *output)
+{
+    uint32_t nslots = c->ncommands;
+    uint32_t nbuckets = (nslots + 3) / 4;
+    struct bcommand **slots = NULL;
+    uint32_t *seeds = NULL;
+
+    for (;;) {
+        slots = arena_alloc(&c->arena, (nslots ? nslots : 1) * sizeof(*slots));
+        seeds = arena_alloc(&c->arena, (nbuckets ? nbuckets : 1) * sizeof(*seeds));
+        if (slots == NULL || seeds == NULL) {
+            return -1;
+        }
+        if (nslots == 0 || place_commands(c, slots, seeds, nbuckets, nslots) == 0) {
+            break;
+        }
+        /* no luck at this size, leave a few slots empty */
+        nslots += nslots / 8 + 1;
+    }
+
+    uint32_t ncommands = nslots + (c->any != NULL);
+    if (c->any != NULL) {
+        c->strings_size += 2;
+    }
+    size_t seeds_off = align4(sizeof(struct policy_header));
+    size_t commands_off = seeds_off + nbuckets * sizeof(uint32_t);
+    size_t rules_off = commands_off + ncommands * sizeof(struct policy_command);
+    size_t nodes_off = rules_off + c->nrules * sizeof(struct policy_rule);
+    size_t strings_off = nodes_off + c->nnodes * sizeof(struct policy_node);
+    size_t size = strings_off + c->strings_size;
+    if (size > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    struct layout t;
+    t.base = arena_alloc(&c->arena, size);
+    if (t.base == NULL) {
+        return -1;
+    }
+    memset(t.base, 0, size);
+    t.header = (struct policy_header *)t.base;
+    t.commands = (struct policy_command *)(t.base + commands_off);
+    t.rules = (struct policy_rule *)(t.base + rules_off);
+    t.nodes = (struct policy_node *)(t.base + nodes_off);
+    t.strings = (char *)(t.base + strings_off);
+    t.nrules = 0;
+    t.nnodes = 0;
+    t.strings_size = 0;
+
+    memcpy(t.base + seeds_off, seeds, nbuckets * sizeof(uint32_t));
+    for (uint32_t i = 0; i < nslots; i++) {
+        add_command(&t, slots[i], i);
+    }
+    if (c->any != NULL) {
+        add_command(&t, c->any, nslots);
+    }
+
+    struct policy_header *h = t.header;
+    memcpy(h->magic, POLICY_MAGIC, sizeof(h->magic));
+    h->byteorder = POLICY_BYTEORDER;
+    h->size = size;
+    h->nbuckets = nbuckets;
+    h->nslots = nslots;
+    h->ncommands = ncommands;
+    h->any_command = c->any != NULL ? nslots : POLICY_NONE;
+    h->nrules = t.nrules;
+    h->nnodes = t.nnodes;
+    h->strings_size = t.strings_size;
+    h->seeds_off = seeds_off;
+    h->commands_off = commands_off;
+    h->rules_off = rules_off;
+    h->nodes_off = nodes_off;
+    h->strings_off = strings_off;
+
+    return write_table(output, t.base, size);
+}
+
+int policy_compile(const char *source, const char *output)
+{
+    struct compiler c;
+    memset(&c, 0, sizeof(c));
+    arena_init(&c.arena, NULL, 0);
+    c.sourcename = source;
+
+    FILE *in = fopen(source, "r");
+    if (in == NULL) {
+        fprintf(stderr, "rootpolicy: Cannot open %s: %s\n", source, strerror(errno));
+        arena_release(&c.arena);
+        return -1;
+    }
+
+    int status = 0;
+    char *line = NULL;
+    size_t linemax = 0;
+    while (status == 0 && getline(&line, &linemax, in) != -1) {
+        c.line++;
+        status = parse_line(&c, line);
+    }
+    if (status == 0 && ferror(in)) {
+        fprintf(stderr, "rootpolicy: Cannot read %s: %s\n", source, strerror(errno));
+        status = -1;
+    }
+    free(line);
+    fclose(in);
+
+    if (status == 0 && build_table(&c, output) == -1) {
+        fprintf(stderr, "rootpolicy: Cannot write %s: %s\n", output, strerror(errno));
+        status = -1;
+    }
+
+    arena_release(&c.arena);
+    return status;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "policy.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char source[512];
+static char table[512];
+
+static void write_source(const char *text)
+{
+    FILE *f = fopen(source, "w");
+    assert(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+static int permits(const struct policy *policy, gid_t gid, const char *command, ...)
+{
+    const char *argv[16];
+    int argc = 0;
+    argv[argc++] = command;
+
+    va_list ap;
+    va_start(ap, command);
+    const char *arg;
+    while ((arg = va_arg(ap, const char *)) != NULL) {
+        argv[argc++] = arg;
+    }
+    va_end(ap);
+    argv[argc] = NULL;
+
+    return policy_permits(policy, &gid, 1, command, argv);
+}
+
+void test_hash_is_seeded(void)
+{
+    printf("Running %s\n", __func__);
+    assert(policy_hash("/bin/ls", 7, 0) == policy_hash("/bin/ls", 7, 0));
+    assert(policy_hash("/bin/ls", 7, 0) != policy_hash("/bin/ls", 7, 1));
+}
+
+void test_compile_and_lookup(void)
+{
+    printf("Running %s\n", __func__);
+    if (geteuid() != 0) {
+        printf("Skipping %s (tables must be owned by root)\n", __func__);
+        return;
+    }
+
+    write_source("# group command arguments\n"
+                 "\n"
+                 "10 /nonexistent/ls\n"
+                 "10 /nonexistent/systemctl restart nginx\n"
+                 "10 /nonexistent/systemctl status\n"
+                 "11 /nonexistent/apt update\n"
+                 "12 *\n"
+                 "13 * --version\n"
+                 "14 --write /etc/motd\n"
+                 "14 --copy /srv/app.conf /etc/app.conf\n");
+    assert(policy_compile(source, table) == 0);
+
+    struct policy policy;
+    assert(policy_open(&policy, table) == 0);
+
+    /* no arguments in the rule allows any */
+    assert(permits(&policy, 10, "/nonexistent/ls", NULL));
+    assert(permits(&policy, 10, "/nonexistent/ls", "-l", "/", NULL));
+
+    /* arguments in the rule are a prefix */
+    assert(permits(&policy, 10, "/nonexistent/systemctl", "restart", "nginx", NULL));
+    assert(permits(&policy, 10, "/nonexistent/systemctl", "status", "sshd", NULL));
+    assert(!permits(&policy, 10, "/nonexistent/systemctl", "restart", NULL));
+    assert(!permits(&policy, 10, "/nonexistent/systemctl", "restart", "sshd", NULL));
+    assert(!permits(&policy, 10, "/nonexistent/systemctl", "stop", "nginx", NULL));
+    assert(!permits(&policy, 10, "/nonexistent/systemctl", NULL));
+
+    /* rules belong to groups */
+    assert(!permits(&policy, 11, "/nonexistent/ls", NULL));
+    assert(permits(&policy, 11, "/nonexistent/apt", "update", NULL));
+
+    /* commands not in the table */
+    assert(!permits(&policy, 10, "/nonexistent/sh", NULL));
+    assert(!permits(&policy, 10, "/nonexistent/l", NULL));
+
+    /* * means any command */
+    assert(permits(&policy, 12, "/nonexistent/sh", "-c", "id", NULL));
+    assert(permits(&policy, 13, "/nonexistent/sh", "--version", NULL));
+    assert(!permits(&policy, 13, "/nonexistent/sh", NULL));
+
+    /* the file operations root does itself */
+    assert(permits(&policy, 14, "--write", "/etc/motd", NULL));
+    assert(!permits(&policy, 14, "--write", "/etc/shadow", NULL));
+    assert(!permits(&policy, 14, "--append", "/etc/motd", NULL));
+    assert(permits(&policy, 14, "--copy", "/srv/app.conf", "/etc/app.conf", NULL));
+    assert(!permits(&policy, 14, "--copy", "/srv/app.conf", "/etc/passwd", NULL));
+    assert(permits(&policy, 12, "--read", "/etc/shadow", NULL));
+
+    policy_close(&policy);
+    unlink(table);
+}
+
+void test_many_commands(void)
+{
+    printf("Running %s\n", __func__);
+    if (geteuid() != 0) {
+        printf("Skipping %s (tables must be owned by root)\n", __func__);
+        return;
+    }
+
+    FILE *f = fopen(source, "w");
+    assert(f != NULL);
+    for (int i = 0; i < 1000; i++) {
+        fprintf(f, "7 /nonexistent/cmd%d\n", i);
+    }
+    fclose(f);
+    assert(policy_compile(source, table) == 0);
+
+    struct policy policy;
+    assert(policy_open(&policy, table) == 0);
+    char command[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(command, sizeof(command), "/nonexistent/cmd%d", i);
+        assert(permits(&policy, 7, command, NULL));
+    }
+    assert(!permits(&policy, 7, "/nonexistent/cmd1000", NULL));
+    policy_close(&policy);
+    unlink(table);
+}
+
+void test_syntax_errors(void)
+{
+    printf("Running %s\n", __func__);
+    write_source("10 relative/path\n");
+    assert(policy_compile(source, table) == -1);
+    write_source("10 --delete /etc/motd\n");
+    assert(policy_compile(source, table) == -1);
+    write_source("10\n");
+    assert(policy_compile(source, table) == -1);
+    write_source("nosuchgroupforroottest /bin/ls\n");
+    assert(policy_compile(source, table) == -1);
+    assert(access(table, F_OK) == -1);
+}
+
+void test_open_rejects_bad_tables(void)
+{
+    printf("Running %s\n", __func__);
+    struct policy policy;
+
+    errno = 0;
+    assert(policy_open(&policy, table) == -1);
+    assert(errno == ENOENT);
+
+    if (geteuid() != 0) {
+        printf("Skipping the rest of %s (tables must be owned by root)\n", __func__);
+        return;
+    }
+
+    /* truncated */
+    write_source("10 /nonexistent/ls\n");
+    assert(policy_compile(source, table) == 0);
+    assert(truncate(table, sizeof(struct policy_header) + 4) == 0);
+    errno = 0;
+    assert(policy_open(&policy, table) == -1);
+    assert(errno == EINVAL);
+
+    /* writable by others */
+    assert(policy_compile(source, table) == 0);
+    assert(chmod(table, 0666) == 0);
+    errno = 0;
+    assert(policy_open(&policy, table) == -1);
+    assert(errno == EPERM);
+
+    /* not a table at all */
+    assert(chmod(table, 0644) == 0);
+    int fd = open(table, O_WRONLY|O_TRUNC);
+    assert(fd != -1);
+    char junk[256];
+    memset(junk, 'x', sizeof(junk));
+    assert(write(fd, junk, sizeof(junk)) == sizeof(junk));
+    close(fd);
+    errno = 0;
+    assert(policy_open(&policy, table) == -1);
+    assert(errno == EINVAL);
+
+    unlink(table);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(source, sizeof(source), "%s/policy", base);
+    snprintf(table, sizeof(table), "%s/policy.db", base);
+
+    /* keep expected compile errors off the test output */
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    assert(saved != -1 && devnull != -1);
+    dup2(devnull, STDERR_FILENO);
+    close(devnull);
+
+    test_hash_is_seeded();
+    test_compile_and_lookup();
+    test_many_commands();
+    test_syntax_errors();
+    test_open_rejects_bad_tables();
+
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    unlink(source);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,182 @@
+#define _DEFAULT_SOURCE /* for posix_fadvise(), pread(), strdup(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for posix_fadvise(), pread(), strdup() */
+
+#include <sys/types.h>
+#ifdef __linux__
+#include <elf.h>
+#endif
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "prefetch.h"
+
+/* how many interpreters to follow, e.g. a script's, then its ELF loader's */
+#define MAX_INTERPRETERS 2
+
+struct job {
+    const char *ident;
+    int option;
+    int facility;
+    char *path;
+};
+
+/*
+ * Run fn(job) on a detached thread, which must free job.
+ */
+static void start(void *(*fn)(void *), struct job *job)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, fn, job) != 0) {
+        /* it's only an optimization */
+        free(job->path);
+        free(job);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void *connect_syslog(void *arg)
+{
+    struct job *job = arg;
+    openlog(job->ident, job->option|LOG_NDELAY, job->facility);
+    free(job);
+    return NULL;
+}
+
+void prefetch_syslog(const char *ident, int option, int facility)
+{
+    struct job *job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        return;
+    }
+    job->ident = ident;
+    job->option = option;
+    job->facility = facility;
+    start(connect_syslog, job);
+}
+
+#ifdef __linux__
+/*
+ * The program interpreter (PT_INTERP) of the ELF executable fd, in interp.
+ *
+ * Returns 0, or -1 if it isn't one, or has none.
+ */
+static int elf_interpreter(int fd, char *interp, size_t size)
+{
+    union {
+        Elf32_Ehdr e32;
+        Elf64_Ehdr e64;
+    } h;
+    if (pread(fd, &h, sizeof(h), 0) < (ssize_t)sizeof(h.e32)
+        || memcmp(h.e32.e_ident, ELFMAG, SELFMAG) != 0) {
+        return -1;
+    }
+
+    int is64 = h.e32.e_ident[EI_CLASS] == ELFCLASS64;
+    off_t phoff = is64 ? (off_t)h.e64.e_phoff : (off_t)h.e32.e_phoff;
+    int phnum = is64 ? h.e64.e_phnum : h.e32.e_phnum;
+    int phentsize = is64 ? h.e64.e_phentsize : h.e32.e_phentsize;
+
+    for (int i = 0; i < phnum && i < 64; i++) {
+        union {
+            Elf32_Phdr p32;
+            Elf64_Phdr p64;
+        } ph;
+        if (pread(fd, &ph, sizeof(ph), phoff + (off_t)i * phentsize) < (ssize_t)sizeof(ph.p32)) {
+            return -1;
+        }
+        unsigned long type = is64 ? ph.p64.p_type : ph.p32.p_type;
+        if (type != PT_INTERP) {
+            continue;
+        }
+        off_t offset = is64 ? (off_t)ph.p64.p_offset : (off_t)ph.p32.p_offset;
+        size_t len = is64 ? ph.p64.p_filesz : ph.p32.p_filesz;
+        if (len == 0 || len >= size || pread(fd, interp, len, offset) != (ssize_t)len) {
+            return -1;
+        }
+        interp[len] = '\0';
+        return 0;
+    }
+    return -1;
+}
+#endif
+
+/*
+ * The interpreter named by the script fd's #! line, in interp.
+ *
+ * Returns 0, or -1 if it isn't a script.
+ */
+static int script_interpreter(int fd, char *interp, size_t size)
+{
+    ssize_t n = pread(fd, interp, size - 1, 0);
+    if (n < 3 || interp[0] != '#' || interp[1] != '!') {
+        return -1;
+    }
+    interp[n] = '\0';
+
+    char *p = interp + 2;
+    p += strspn(p, " \t");
+    size_t len = strcspn(p, " \t\n");
+    if (len == 0 || p[len] == '\0') {
+        /* no interpreter, or it didn't fit */
+        return -1;
+    }
+    memmove(interp, p, len);
+    interp[len] = '\0';
+    return 0;
+}
+
+static void *read_ahead(void *arg)
+{
+    struct job *job = arg;
+    char interp[PATH_MAX];
+    const char *path = job->path;
+
+    for (int i = 0; i <= MAX_INTERPRETERS; i++) {
+        int fd = open(path, O_RDONLY|O_CLOEXEC);
+        if (fd == -1) {
+            break;
+        }
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+        int found = script_interpreter(fd, interp, sizeof(interp)) == 0;
+#ifdef __linux__
+        if (!found) {
+            found = elf_interpreter(fd, interp, sizeof(interp)) == 0;
+        }
+#endif
+        close(fd);
+        if (!found) {
+            break;
+        }
+        path = interp;
+    }
+
+    free(job->path);
+    free(job);
+    return NULL;
+}
+
+void prefetch_exec(const char *path)
+{
+    struct job *job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        return;
+    }
+    job->path = strdup(path);
+    if (job->path == NULL) {
+        free(job);
+        return;
+    }
+    start(read_ahead, job);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
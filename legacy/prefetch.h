@@ -0,0 +1,28 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/*
+ * Startup work that only warms things up, done on a helper thread so that
+ * root needn't wait for it.
+ *
+ * None of it changes what root decides or does.  Each job brings something
+ * root is about to use anyway into memory early, and if it fails, or isn't
+ * finished when root gets there, root simply does the work itself.  The
+ * helpers are detached, and end when root execs or exits.
+ */
+
+/*
+ * Start connecting to syslog, with arguments as for openlog, so that the
+ * first message needn't wait for the connection.  ident must outlive the
+ * process's use of syslog, as it must for openlog.
+ */
+void prefetch_syslog(const char *ident, int option, int facility);
+
+/*
+ * Start reading path into the page cache, along with the program
+ * interpreter it names if it is a dynamically linked ELF executable.
+ */
+void prefetch_exec(const char *path);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,140 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "ratelimit.h"
+#include "statefile.h"
+
+/*
+ * The state is shared between processes, so it needs atomic operations,
+ * which C99 doesn't have.  Compilers that can't do them go without.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define HAVE_ATOMICS 1
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define CAS(p, expectedp, v) \
+    __atomic_compare_exchange_n((p), (expectedp), (v), 0, \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define SWAP(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#endif
+
+int ratelimit_open(struct ratelimit *rl, const char *path)
+{
+    rl->table = NULL;
+
+#ifndef HAVE_ATOMICS
+    errno = ENOSYS;
+    return -1;
+#else
+    void *table = statefile_map(path, sizeof(struct ratelimit_table));
+    if (table == NULL) {
+        return -1;
+    }
+    rl->table = table;
+    return 0;
+#endif
+}
+
+void ratelimit_close(struct ratelimit *rl)
+{
+    if (rl->table != NULL) {
+        munmap(rl->table, sizeof(*rl->table));
+        rl->table = NULL;
+    }
+}
+
+#ifdef HAVE_ATOMICS
+/*
+ * uid's slot, claiming a free one if need be, or NULL if they're all taken
+ */
+static struct ratelimit_slot *find_slot(struct ratelimit_table *table,
+                                        uid_t uid,
+                                        uint64_t now_ms)
+{
+    uint32_t key = (uint32_t)uid + 1;
+    uint32_t start = (uint32_t)(key * 2654435761u) % RATELIMIT_SLOTS;
+
+    for (uint32_t i = 0; i < RATELIMIT_SLOTS; i++) {
+        struct ratelimit_slot *slot = &table->slots[(start + i) % RATELIMIT_SLOTS];
+        uint32_t found = LOAD(&slot->uid_plus1);
+        if (found == 0) {
+            if (CAS(&slot->uid_plus1, &found, key)) {
+                STORE(&slot->last_summary_ms, now_ms);
+                return slot;
+            }
+            /* somebody else got there first; found is now theirs */
+        }
+        if (found == key) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * take one record from the budget, if there is one
+ */
+static int take(struct ratelimit_table *table, uint64_t now_ms)
+{
+    const uint64_t limit = (uint64_t)RATELIMIT_BURST * RATELIMIT_INTERVAL_MS;
+    uint64_t tat = LOAD(&table->tat_ms);
+
+    for (;;) {
+        uint64_t from = tat;
+        /* behind us means the budget is full; too far ahead, a reboot */
+        if (from < now_ms || from > now_ms + limit) {
+            from = now_ms;
+        }
+        uint64_t next = from + RATELIMIT_INTERVAL_MS;
+        if (next - now_ms > limit) {
+            return 0;
+        }
+        if (CAS(&table->tat_ms, &tat, next)) {
+            return 1;
+        }
+    }
+}
+#endif
+
+int ratelimit_admit(struct ratelimit *rl,
+                    uid_t uid,
+                    uint64_t now_ms,
+                    unsigned long *suppressedp)
+{
+    *suppressedp = 0;
+
+#ifndef HAVE_ATOMICS
+    return 1;
+#else
+    if (rl->table == NULL) {
+        return 1;
+    }
+
+    int admitted = take(rl->table, now_ms);
+    struct ratelimit_slot *slot = find_slot(rl->table, uid, now_ms);
+    if (slot == NULL) {
+        /* too many users to keep count of, but the budget still holds */
+        return admitted;
+    }
+
+    if (admitted) {
+        if (LOAD(&slot->suppressed) > 0) {
+            *suppressedp = SWAP(&slot->suppressed, 0);
+            STORE(&slot->last_summary_ms, now_ms);
+        }
+        return 1;
+    }
+
+    ADD(&slot->suppressed, 1);
+    uint64_t last = LOAD(&slot->last_summary_ms);
+    if ((now_ms >= last + RATELIMIT_SUMMARY_MS || last > now_ms)
+        && CAS(&slot->last_summary_ms, &last, now_ms)) {
+        *suppressedp = SWAP(&slot->suppressed, 0);
+    }
+    return 0;
+#endif
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,91 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * where the host-wide logging budget is kept
+ *
+ * created by root if need be; override at build time, e.g.
+ * make CFLAGS+=-DRATELIMIT_PATH='"/var/run/root.ratelimit"'
+ */
+#ifndef RATELIMIT_PATH
+#define RATELIMIT_PATH "/run/root/ratelimit"
+#endif
+
+/*
+ * the budget: a burst of RATELIMIT_BURST records, refilled at one record
+ * every RATELIMIT_INTERVAL_MS, shared by every user on the host
+ */
+#ifndef RATELIMIT_BURST
+#define RATELIMIT_BURST 20
+#endif
+#ifndef RATELIMIT_INTERVAL_MS
+#define RATELIMIT_INTERVAL_MS 200
+#endif
+
+/*
+ * how often each user's dropped records are summarized while they are
+ * over the budget
+ */
+#ifndef RATELIMIT_SUMMARY_MS
+#define RATELIMIT_SUMMARY_MS 60000
+#endif
+
+/* the most users whose dropped records are counted */
+#define RATELIMIT_SLOTS 64
+
+struct ratelimit_slot {
+    uint32_t uid_plus1;         /* 0 if the slot is free */
+    uint32_t suppressed;        /* dropped since the last summary */
+    uint64_t last_summary_ms;
+};
+
+/*
+ * The shared state, exactly as it is in the file.
+ *
+ * Every process maps the same page, and changes it only with atomic
+ * operations, so there are no locks for a stuck or killed root to hold.
+ * A file of zeros is the initial state.
+ */
+struct ratelimit_table {
+    uint64_t tat_ms;            /* when the budget would be full again, in
+                                   ms of CLOCK_MONOTONIC (the "theoretical
+                                   arrival time" of the generic cell rate
+                                   algorithm) */
+    struct ratelimit_slot slots[RATELIMIT_SLOTS];
+};
+
+struct ratelimit {
+    struct ratelimit_table *table;
+};
+
+/*
+ * Map the state at path, creating it (and its directory) if need be.
+ *
+ * Returns 0 on success, or -1 with errno set.  EPERM means the file is not
+ * a regular file owned by us and inaccessible to anyone else, EINVAL that
+ * it is the wrong size, and ENOSYS that this compiler can't do the atomic
+ * operations.
+ */
+int ratelimit_open(struct ratelimit *rl, const char *path);
+void ratelimit_close(struct ratelimit *rl);
+
+/*
+ * Whether uid may log one more limited record at now_ms (CLOCK_MONOTONIC).
+ *
+ * Returns 1 if so, taking it from the budget, or 0 if the record should be
+ * dropped, counting it against uid.
+ *
+ * *suppressedp is set to the number of uid's records dropped since it was
+ * last told, if it should be told now, otherwise 0: whenever a record is
+ * let through, and every RATELIMIT_SUMMARY_MS while records are dropped.
+ */
+int ratelimit_admit(struct ratelimit *rl,
+                    uid_t uid,
+                    uint64_t now_ms,
+                    unsigned long *suppressedp);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
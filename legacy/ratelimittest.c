@@ -0,0 +1,226 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ratelimit.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char path[512];
+
+/* an arbitrary time well after boot */
+#define START_MS 1000000
+
+static void open_fresh(struct ratelimit *rl)
+{
+    unlink(path);
+    assert(ratelimit_open(rl, path) == 0);
+}
+
+void test_burst_then_drop(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit rl;
+    unsigned long suppressed;
+    open_fresh(&rl);
+
+    for (int i = 0; i < RATELIMIT_BURST; i++) {
+        assert(ratelimit_admit(&rl, 1000, START_MS, &suppressed) == 1);
+        assert(suppressed == 0);
+    }
+    assert(ratelimit_admit(&rl, 1000, START_MS, &suppressed) == 0);
+    assert(ratelimit_admit(&rl, 1000, START_MS, &suppressed) == 0);
+    assert(suppressed == 0);
+
+    /* refills at one per interval, and tells of what was dropped */
+    uint64_t later = START_MS + RATELIMIT_INTERVAL_MS;
+    assert(ratelimit_admit(&rl, 1000, later, &suppressed) == 1);
+    assert(suppressed == 2);
+    assert(ratelimit_admit(&rl, 1000, later, &suppressed) == 0);
+
+    ratelimit_close(&rl);
+}
+
+void test_budget_is_shared(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit a, b;
+    unsigned long suppressed;
+    open_fresh(&a);
+    assert(ratelimit_open(&b, path) == 0);
+
+    /* one user spends the budget through one mapping */
+    for (int i = 0; i < RATELIMIT_BURST; i++) {
+        assert(ratelimit_admit(&a, 1000, START_MS, &suppressed) == 1);
+    }
+    /* another is limited through the other, and counted separately */
+    assert(ratelimit_admit(&b, 2000, START_MS, &suppressed) == 0);
+    assert(ratelimit_admit(&a, 1000, START_MS, &suppressed) == 0);
+    assert(ratelimit_admit(&a, 1000, START_MS, &suppressed) == 0);
+
+    uint64_t later = START_MS + RATELIMIT_INTERVAL_MS;
+    assert(ratelimit_admit(&b, 2000, later, &suppressed) == 1);
+    assert(suppressed == 1);
+
+    ratelimit_close(&a);
+    ratelimit_close(&b);
+}
+
+void test_periodic_summary(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit rl;
+    unsigned long suppressed;
+    unsigned long total = 0;
+    int summaries = 0;
+    open_fresh(&rl);
+
+    uint64_t now = START_MS;
+    for (int i = 0; i < RATELIMIT_BURST; i++) {
+        assert(ratelimit_admit(&rl, 1000, now, &suppressed) == 1);
+    }
+
+    /* keep the budget empty by spending each refill as another user */
+    for (int i = 0; i < 1000; i++) {
+        now += RATELIMIT_SUMMARY_MS / 500;
+        while (ratelimit_admit(&rl, 2000, now, &suppressed) == 1) {
+        }
+        assert(ratelimit_admit(&rl, 1000, now, &suppressed) == 0);
+        if (suppressed > 0) {
+            summaries++;
+            total += suppressed;
+        }
+    }
+    /* one summary per RATELIMIT_SUMMARY_MS, and nothing lost */
+    assert(summaries == 2);
+    assert(total == 1000);
+
+    ratelimit_close(&rl);
+}
+
+void test_concurrent_processes(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit rl;
+    unsigned long suppressed;
+    unsigned long total = 0;
+    int admitted = 0;
+    open_fresh(&rl);
+
+    /* each child reports how many it got through in its exit status */
+    for (int i = 0; i < 8; i++) {
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            int mine = 0;
+            for (int j = 0; j < 1000; j++) {
+                mine += ratelimit_admit(&rl, 1000 + i % 2, START_MS, &suppressed);
+            }
+            _exit(mine);
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        int status;
+        assert(wait(&status) != -1);
+        assert(WIFEXITED(status));
+        admitted += WEXITSTATUS(status);
+    }
+    assert(admitted == RATELIMIT_BURST);
+
+    /* and every record dropped was counted */
+    uint64_t later = START_MS + RATELIMIT_INTERVAL_MS;
+    assert(ratelimit_admit(&rl, 1000, later, &suppressed) == 1);
+    total += suppressed;
+    assert(ratelimit_admit(&rl, 1001, later + RATELIMIT_INTERVAL_MS, &suppressed) == 1);
+    total += suppressed;
+    assert(total == 8 * 1000 - RATELIMIT_BURST);
+
+    ratelimit_close(&rl);
+}
+
+void test_clock_reset(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit rl;
+    unsigned long suppressed;
+    open_fresh(&rl);
+
+    for (int i = 0; i < RATELIMIT_BURST; i++) {
+        assert(ratelimit_admit(&rl, 1000, START_MS, &suppressed) == 1);
+    }
+    /* the state outlived a reboot, so the clock went backwards */
+    assert(ratelimit_admit(&rl, 1000, 10, &suppressed) == 1);
+
+    ratelimit_close(&rl);
+}
+
+void test_rejects_unsafe_state(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit rl;
+
+    unlink(path);
+    int fd = open(path, O_WRONLY|O_CREAT, 0600);
+    assert(fd != -1);
+    assert(write(fd, "junk", 4) == 4);
+    close(fd);
+    errno = 0;
+    assert(ratelimit_open(&rl, path) == -1);
+    assert(errno == EINVAL);
+
+    assert(chmod(path, 0666) == 0);
+    errno = 0;
+    assert(ratelimit_open(&rl, path) == -1);
+    assert(errno == EPERM);
+
+    unlink(path);
+    char link[600];
+    snprintf(link, sizeof(link), "%s.target", path);
+    assert(symlink(link, path) == 0);
+    assert(ratelimit_open(&rl, path) == -1);
+    assert(access(link, F_OK) == -1);
+    unlink(path);
+}
+
+void test_makes_directory(void)
+{
+    printf("Running %s\n", __func__);
+    struct ratelimit rl;
+    char nested[600];
+    char dir[560];
+
+    snprintf(dir, sizeof(dir), "%s/run", base);
+    snprintf(nested, sizeof(nested), "%s/ratelimit", dir);
+    assert(ratelimit_open(&rl, nested) == 0);
+    ratelimit_close(&rl);
+    unlink(nested);
+    rmdir(dir);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(path, sizeof(path), "%s/ratelimit", base);
+
+    test_burst_then_drop();
+    test_budget_is_shared();
+    test_periodic_summary();
+    test_concurrent_processes();
+    test_clock_reset();
+    test_rejects_unsafe_state();
+    test_makes_directory();
+
+    unlink(path);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
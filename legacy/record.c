@@ -0,0 +1,319 @@
+#define _GNU_SOURCE     /* for splice() and tee() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record.h"
+
+static const char *stream_name(enum record_stream stream)
+{
+    return stream == RECORD_STDERR ? "stderr" : "stdout";
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_header(struct recording *rec, const char *kind, size_t len)
+{
+    struct timespec now;
+    char header[128];
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    int headerlen = snprintf(header, sizeof(header), "%lld.%09ld %s %zu\n",
+                             (long long)now.tv_sec, now.tv_nsec, kind, len);
+    return write_all(rec->fd, header, headerlen);
+}
+
+static int write_frame(struct recording *rec,
+                       const char *kind,
+                       const char *payload,
+                       size_t len)
+{
+    if (write_header(rec, kind, len) == -1) {
+        return -1;
+    }
+    return write_all(rec->fd, payload, len);
+}
+
+static int set_cloexec(int fd)
+{
+    int flags = fcntl(fd, F_GETFD);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+void record_session_id(char *session, size_t sessionlen)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    char stamp[32];
+
+    if (gmtime_r(&now, &tm) == NULL
+        || strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm) == 0) {
+        snprintf(stamp, sizeof(stamp), "%lld", (long long)now);
+    }
+    snprintf(session, sessionlen, "%s-%ld", stamp, (long)getpid());
+}
+
+int record_open(struct recording *rec,
+                const char *dir,
+                const char *session,
+                off_t limit,
+                const char *command)
+{
+    char path[PATH_MAX];
+
+    rec->fd = -1;
+    rec->scratch[0] = rec->scratch[1] = -1;
+    rec->written = 0;
+    rec->limit = limit;
+    rec->truncated = 0;
+    snprintf(rec->session, sizeof(rec->session), "%s", session);
+
+    if (snprintf(path, sizeof(path), "%s/%s.rec", dir, session)
+        >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    rec->fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW, 0600);
+    if (rec->fd == -1 || set_cloexec(rec->fd) == -1) {
+        return -1;
+    }
+
+#ifdef __linux__
+    /* without the scratch pipe we fall back to copying through user space */
+    if (pipe(rec->scratch) == 0) {
+        set_cloexec(rec->scratch[0]);
+        set_cloexec(rec->scratch[1]);
+    }
+    else {
+        rec->scratch[0] = rec->scratch[1] = -1;
+    }
+#endif
+
+    char start[PATH_MAX + 128];
+    int startlen = snprintf(start, sizeof(start), "session=%s uid=%lu command=%s",
+                            session, (unsigned long)getuid(), command);
+    if (startlen >= (int)sizeof(start)) {
+        startlen = sizeof(start) - 1;
+    }
+    return write_frame(rec, "start", start, startlen);
+}
+
+/*
+ * Record the truncation once, the first time the limit is reached.
+ */
+static void mark_truncated(struct recording *rec)
+{
+    if (!rec->truncated) {
+        char limit[32];
+        int limitlen = snprintf(limit, sizeof(limit), "%lld",
+                                (long long)rec->limit);
+        write_frame(rec, "truncated", limit, limitlen);
+        rec->truncated = 1;
+    }
+}
+
+/*
+ * How much of the next len bytes of output may still be recorded.
+ */
+static size_t record_allowance(struct recording *rec, size_t len)
+{
+    off_t remaining = rec->limit - rec->written;
+    if (remaining <= 0) {
+        return 0;
+    }
+    return (off_t)len > remaining ? (size_t)remaining : len;
+}
+
+/*
+ * Copy up to len bytes from from to to through a user-space buffer,
+ * recording them in rec if record is set.
+ */
+static ssize_t copy_bytes(struct recording *rec,
+                          enum record_stream stream,
+                          int from,
+                          int to,
+                          size_t len,
+                          int record)
+{
+    char buf[RECORD_FRAME_MAX];
+    if (len > sizeof(buf)) {
+        len = sizeof(buf);
+    }
+
+    ssize_t n;
+    do {
+        n = read(from, buf, len);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        return n;
+    }
+
+    if (record) {
+        size_t keep = record_allowance(rec, n);
+        if (keep > 0) {
+            write_frame(rec, stream_name(stream), buf, keep);
+            rec->written += keep;
+        }
+        if (keep < (size_t)n) {
+            mark_truncated(rec);
+        }
+    }
+
+    if (write_all(to, buf, n) == -1) {
+        return -1;
+    }
+    return n;
+}
+
+#ifdef __linux__
+/*
+ * Move exactly len bytes from the pipe from to to.
+ *
+ * Not every file type can be spliced into (terminals can't), so that case
+ * falls back to copying.
+ */
+static int splice_all(int from, int to, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL) {
+                char buf[RECORD_FRAME_MAX];
+                size_t chunk = len > sizeof(buf) ? sizeof(buf) : len;
+                n = read(from, buf, chunk);
+                if (n <= 0 || write_all(to, buf, n) == -1) {
+                    return -1;
+                }
+            }
+            else {
+                return -1;
+            }
+        }
+        else if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Throw away len bytes from the pipe from.
+ */
+static void drain(int from, size_t len)
+{
+    char buf[4096];
+    while (len > 0) {
+        ssize_t n = read(from, buf, len > sizeof(buf) ? sizeof(buf) : len);
+        if (n <= 0) {
+            return;
+        }
+        len -= n;
+    }
+}
+#endif
+
+ssize_t record_pump(struct recording *rec,
+                    enum record_stream stream,
+                    int from,
+                    int to)
+{
+    int record = !rec->truncated;
+
+#ifdef __linux__
+    if (rec->scratch[0] != -1) {
+        ssize_t n;
+
+        if (!record) {
+            do {
+                n = splice(from, NULL, to, NULL, RECORD_FRAME_MAX, SPLICE_F_MOVE);
+            } while (n == -1 && errno == EINTR);
+            if (n == -1 && errno == EINVAL) {
+                return copy_bytes(rec, stream, from, to, RECORD_FRAME_MAX, 0);
+            }
+            return n;
+        }
+
+        /*
+         * Duplicate the pending output into the scratch pipe without
+         * consuming it, record the duplicate, then pass the original on.
+         */
+        do {
+            n = tee(from, rec->scratch[1], RECORD_FRAME_MAX, 0);
+        } while (n == -1 && errno == EINTR);
+        if (n <= 0) {
+            return n;
+        }
+
+        size_t keep = record_allowance(rec, n);
+        if (keep > 0) {
+            if (write_header(rec, stream_name(stream), keep) == -1
+                || splice_all(rec->scratch[0], rec->fd, keep) == -1) {
+                /* a failing recording must not hold up the command's output */
+                rec->truncated = 1;
+            }
+            rec->written += keep;
+        }
+        if (keep < (size_t)n) {
+            drain(rec->scratch[0], n - keep);
+            mark_truncated(rec);
+        }
+
+        if (splice_all(from, to, n) == -1) {
+            return -1;
+        }
+        return n;
+    }
+#endif
+
+    return copy_bytes(rec, stream, from, to, RECORD_FRAME_MAX, record);
+}
+
+void record_close(struct recording *rec, int exitstatus)
+{
+    char status[32];
+    int len = snprintf(status, sizeof(status), "%d", exitstatus);
+
+    if (rec->fd != -1) {
+        write_frame(rec, "exit", status, len);
+        close(rec->fd);
+        rec->fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (rec->scratch[i] != -1) {
+            close(rec->scratch[i]);
+            rec->scratch[i] = -1;
+        }
+    }
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,95 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <sys/types.h>
+
+/*
+ * where session recordings are written
+ *
+ * override at build time, e.g. make CFLAGS+=-DRECORD_DIR='"/srv/rec"'
+ */
+#ifndef RECORD_DIR
+#define RECORD_DIR "/var/log/root"
+#endif
+
+/*
+ * the most command output a single recording will hold
+ *
+ * output past this point still reaches the caller, it just isn't recorded
+ */
+#ifndef RECORD_MAX_BYTES
+#define RECORD_MAX_BYTES (64L * 1024 * 1024)
+#endif
+
+/* the largest payload carried by one frame */
+#define RECORD_FRAME_MAX (64 * 1024)
+
+#define RECORD_SESSION_MAX 64
+
+/*
+ * An open session recording.
+ *
+ * The file is a sequence of frames.  Each frame is a text header line
+ *   <seconds>.<nanoseconds> <kind> <length>\n
+ * followed by exactly <length> bytes of payload.  <kind> is "stdout" or
+ * "stderr" for command output, or "start", "truncated" or "exit" for the
+ * frames root writes itself.
+ */
+struct recording {
+    int fd;
+    int scratch[2];         /* pipe used to tee(2) output, -1 if unused */
+    off_t written;          /* payload bytes recorded so far */
+    off_t limit;
+    int truncated;
+    char session[RECORD_SESSION_MAX];
+};
+
+enum record_stream {
+    RECORD_STDOUT = 1,
+    RECORD_STDERR = 2,
+};
+
+/*
+ * Store a session identifier unique to this invocation in session.
+ *
+ * The identifier is also the recording's file name, and is included in
+ * the audit record so the two can be tied together.
+ */
+void record_session_id(char *session, size_t sessionlen);
+
+/*
+ * Create the recording for session in dir and write its "start" frame.
+ *
+ * The file is created exclusively, so an existing file (or symlink) with
+ * the same name is never overwritten.
+ *
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int record_open(struct recording *rec,
+                const char *dir,
+                const char *session,
+                off_t limit,
+                const char *command);
+
+/*
+ * Move whatever output is available from the pipe from to the file
+ * descriptor to, recording a copy in rec.
+ *
+ * Where the kernel supports it the copy is made with tee(2) and splice(2),
+ * so the data never passes through user space.
+ *
+ * Returns the number of bytes moved, 0 at end of file, or -1 with errno set
+ * on failure.  EPIPE means the reader of to has gone away.
+ */
+ssize_t record_pump(struct recording *rec,
+                    enum record_stream stream,
+                    int from,
+                    int to);
+
+/*
+ * Write the "exit" frame with the command's exit status and close rec.
+ */
+void record_close(struct recording *rec, int exitstatus);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,131 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "record.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+
+/*
+ * Feed input through record_pump and return what came out the other side.
+ */
+static void pump(struct recording *rec, const char *input, char *output, size_t outputlen)
+{
+    int from[2], to[2];
+    assert(pipe(from) == 0);
+    assert(pipe(to) == 0);
+    assert(write(from[1], input, strlen(input)) == (ssize_t)strlen(input));
+    close(from[1]);
+
+    while (record_pump(rec, RECORD_STDOUT, from[0], to[1]) > 0) {
+    }
+    close(from[0]);
+    close(to[1]);
+
+    ssize_t n = read(to[0], output, outputlen - 1);
+    assert(n >= 0);
+    output[n] = '\0';
+    close(to[0]);
+}
+
+static void read_recording(const char *session, char *contents, size_t contentslen)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.rec", base, session);
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    ssize_t n = read(fd, contents, contentslen - 1);
+    assert(n >= 0);
+    contents[n] = '\0';
+    close(fd);
+    unlink(path);
+}
+
+void test_session_id(void)
+{
+    printf("Running %s\n", __func__);
+    char session[RECORD_SESSION_MAX];
+    char pid[32];
+    record_session_id(session, sizeof(session));
+    snprintf(pid, sizeof(pid), "-%ld", (long)getpid());
+    assert(strstr(session, pid) != NULL);
+    assert(strchr(session, '/') == NULL);
+}
+
+void test_records_and_passes_through(void)
+{
+    printf("Running %s\n", __func__);
+    struct recording rec;
+    char output[256], contents[1024];
+
+    assert(record_open(&rec, base, "s1", 1024, "/bin/echo") == 0);
+    pump(&rec, "hello\n", output, sizeof(output));
+    record_close(&rec, 0);
+
+    assert(strcmp(output, "hello\n") == 0);
+
+    read_recording("s1", contents, sizeof(contents));
+    assert(strstr(contents, " start ") != NULL);
+    assert(strstr(contents, "session=s1 ") != NULL);
+    assert(strstr(contents, "command=/bin/echo") != NULL);
+    assert(strstr(contents, " stdout 6\nhello\n") != NULL);
+    assert(strstr(contents, " exit 1\n0") != NULL);
+    assert(strstr(contents, "truncated") == NULL);
+}
+
+void test_limit_truncates_recording_only(void)
+{
+    printf("Running %s\n", __func__);
+    struct recording rec;
+    char output[256], contents[1024];
+
+    assert(record_open(&rec, base, "s2", 3, "/bin/echo") == 0);
+    pump(&rec, "hello\n", output, sizeof(output));
+    record_close(&rec, 0);
+
+    /* the caller still sees everything */
+    assert(strcmp(output, "hello\n") == 0);
+
+    read_recording("s2", contents, sizeof(contents));
+    assert(strstr(contents, " stdout 3\nhel") != NULL);
+    assert(strstr(contents, "hello") == NULL);
+    assert(strstr(contents, " truncated 1\n3") != NULL);
+}
+
+void test_open_is_exclusive(void)
+{
+    printf("Running %s\n", __func__);
+    struct recording rec;
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/s3.rec", base);
+    assert(symlink("/dev/null", path) == 0);
+
+    errno = 0;
+    assert(record_open(&rec, base, "s3", 1024, "/bin/echo") == -1);
+    assert(errno == EEXIST);
+
+    unlink(path);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+
+    test_session_id();
+    test_records_and_passes_through();
+    test_limit_truncates_recording_only();
+    test_open_is_exclusive();
+
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
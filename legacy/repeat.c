@@ -0,0 +1,280 @@
+#define _DEFAULT_SOURCE /* for struct timespec in timerfd.h, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for struct timespec in timerfd.h */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#endif
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "repeat.h"
+
+/* what changing a path looks like, watched from the path or its directory */
+#define WATCH_MASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE|IN_ATTRIB)
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Note that something made a run due, or add it to the one already due.
+ */
+static void fall_due(struct repeat *r,
+                     enum repeat_cause cause,
+                     const char *path,
+                     long long since_ns,
+                     unsigned long count)
+{
+    if (r->due) {
+        r->coalesced += count;
+        return;
+    }
+    r->due = 1;
+    r->cause = cause;
+    r->path = path;
+    r->since_ns = since_ns;
+    r->coalesced = count - 1;
+}
+
+#ifdef __linux__
+static int watch(struct repeat *r, const char *path)
+{
+    struct stat st;
+    char dir[PATH_MAX];
+    const char *name = NULL;
+    const char *target = path;
+
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        /* watch its directory, so it can be replaced or created */
+        const char *slash = strrchr(path, '/');
+        if (slash == NULL) {
+            strcpy(dir, ".");
+            name = path;
+        }
+        else if ((size_t)(slash - path) >= sizeof(dir)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        else if (slash == path) {
+            strcpy(dir, "/");
+            name = slash + 1;
+        }
+        else {
+            memcpy(dir, path, slash - path);
+            dir[slash - path] = '\0';
+            name = slash + 1;
+        }
+        if (*name == '\0') {
+            errno = ENOENT;
+            return -1;
+        }
+        target = dir;
+    }
+
+    int wd = inotify_add_watch(r->inotifyfd, target, WATCH_MASK|IN_ONLYDIR);
+    if (wd == -1) {
+        return -1;
+    }
+    r->watches[r->nwatches].wd = wd;
+    r->watches[r->nwatches].path = path;
+    r->watches[r->nwatches].name = name;
+    r->nwatches++;
+    return 0;
+}
+#endif
+
+int repeat_start(struct repeat *r, long every_ms,
+                 const char *const *paths, int npaths)
+{
+    memset(r, 0, sizeof(*r));
+    r->every_ms = every_ms;
+    r->timerfd = -1;
+    r->inotifyfd = -1;
+
+#ifndef __linux__
+    errno = ENOSYS;
+    return -1;
+#else
+    if (npaths < 0 || npaths > REPEAT_MAX_PATHS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    long long start = now_ns();
+    if (every_ms > 0) {
+        r->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+        if (r->timerfd == -1) {
+            return -1;
+        }
+        /* absolute, so that each tick is due a whole interval after the last */
+        r->first_ns = start + every_ms * 1000000LL;
+        struct itimerspec its;
+        its.it_value.tv_sec = r->first_ns / 1000000000LL;
+        its.it_value.tv_nsec = r->first_ns % 1000000000LL;
+        its.it_interval.tv_sec = every_ms / 1000;
+        its.it_interval.tv_nsec = (every_ms % 1000) * 1000000L;
+        if (timerfd_settime(r->timerfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+            goto fail;
+        }
+    }
+
+    if (npaths > 0) {
+        r->inotifyfd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+        if (r->inotifyfd == -1) {
+            goto fail;
+        }
+        for (int i = 0; i < npaths; i++) {
+            if (watch(r, paths[i]) == -1) {
+                r->failed = paths[i];
+                goto fail;
+            }
+        }
+    }
+
+    fall_due(r, REPEAT_FIRST, NULL, start, 1);
+    return 0;
+
+fail:
+    {
+        int saved_errno = errno;
+        const char *failed = r->failed;
+        repeat_close(r);
+        r->failed = failed;
+        errno = saved_errno;
+    }
+    return -1;
+#endif
+}
+
+int repeat_fds(const struct repeat *r, struct pollfd *fds)
+{
+    int n = 0;
+    if (r->timerfd != -1) {
+        fds[n].fd = r->timerfd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        n++;
+    }
+    if (r->inotifyfd != -1) {
+        fds[n].fd = r->inotifyfd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        n++;
+    }
+    return n;
+}
+
+#ifdef __linux__
+static void read_timer(struct repeat *r)
+{
+    uint64_t ticks;
+    if (read(r->timerfd, &ticks, sizeof(ticks)) != sizeof(ticks) || ticks == 0) {
+        return;
+    }
+    r->ticks += ticks;
+    /* when the latest of them was due, which is what the run is late for */
+    long long due = r->first_ns + (long long)(r->ticks - 1) * r->every_ms * 1000000LL;
+    fall_due(r, REPEAT_TIMER, NULL, due, (unsigned long)ticks);
+}
+
+/*
+ * the path that event is about, or NULL if it's none of ours
+ */
+static const char *changed(const struct repeat *r, const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW) {
+        /* something changed, but we lost track of what */
+        return r->watches[0].path;
+    }
+    for (int i = 0; i < r->nwatches; i++) {
+        if (r->watches[i].wd != event->wd) {
+            continue;
+        }
+        if (r->watches[i].name == NULL
+            || (event->len > 0 && strcmp(event->name, r->watches[i].name) == 0)) {
+            return r->watches[i].path;
+        }
+    }
+    return NULL;
+}
+
+static void read_changes(struct repeat *r)
+{
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buf;
+    long long now = now_ns();
+
+    for (;;) {
+        ssize_t n = read(r->inotifyfd, &buf, sizeof(buf));
+        if (n <= 0) {
+            return;
+        }
+        for (char *p = buf.bytes; p < buf.bytes + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            const char *path = changed(r, event);
+            if (path != NULL) {
+                fall_due(r, REPEAT_CHANGE, path, now, 1);
+            }
+            p += sizeof(*event) + event->len;
+        }
+    }
+}
+#endif
+
+void repeat_check(struct repeat *r, const struct pollfd *fds, int nfds)
+{
+#ifdef __linux__
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        if (fds[i].fd == r->timerfd) {
+            read_timer(r);
+        }
+        else if (fds[i].fd == r->inotifyfd) {
+            read_changes(r);
+        }
+    }
+#endif
+}
+
+int repeat_next(struct repeat *r, struct repeat_run *run)
+{
+    if (!r->due) {
+        return 0;
+    }
+    run->cause = r->cause;
+    run->path = r->path;
+    run->late_ns = now_ns() - r->since_ns;
+    run->coalesced = r->coalesced;
+    r->due = 0;
+    return 1;
+}
+
+void repeat_close(struct repeat *r)
+{
+    if (r->timerfd != -1) {
+        close(r->timerfd);
+        r->timerfd = -1;
+    }
+    if (r->inotifyfd != -1) {
+        close(r->inotifyfd);
+        r->inotifyfd = -1;
+    }
+    r->nwatches = 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
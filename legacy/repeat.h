@@ -0,0 +1,100 @@
+#ifndef REPEAT_H
+#define REPEAT_H
+
+#include <poll.h>
+
+/* the most paths --on-change can watch */
+#define REPEAT_MAX_PATHS 16
+
+/* the most file descriptors repeat_fds fills in */
+#define REPEAT_MAX_FDS 2
+
+enum repeat_cause {
+    REPEAT_FIRST,           /* the first run, straight away */
+    REPEAT_TIMER,           /* the interval came round */
+    REPEAT_CHANGE,          /* a watched path changed */
+};
+
+/*
+ * What starts each run of a repeated command: a timer, a change to one of
+ * a set of paths, or either.
+ *
+ * The timer is a timerfd that ticks every every_ms from the start, so runs
+ * don't drift; the paths are watched with inotify.  Both are only
+ * supported on Linux.  The caller polls them (see repeat_fds) together
+ * with whatever else it is waiting for, and passes what poll said to
+ * repeat_check.
+ *
+ * Everything that happens while a run is due but hasn't started, e.g.
+ * while the last run is still going, is coalesced into that one run.
+ */
+struct repeat {
+    long every_ms;          /* 0 for no timer */
+    int timerfd;            /* or -1 */
+    int inotifyfd;          /* or -1 */
+    long long first_ns;     /* when the timer first ticks (CLOCK_MONOTONIC) */
+    unsigned long long ticks;
+    int nwatches;
+    struct {
+        int wd;
+        const char *path;   /* as given */
+        const char *name;   /* its last component, or NULL if a directory */
+    } watches[REPEAT_MAX_PATHS];
+
+    /* the next run */
+    int due;                /* a run is due */
+    enum repeat_cause cause;
+    const char *path;       /* with REPEAT_CHANGE, the path that changed */
+    long long since_ns;     /* when it fell due */
+    unsigned long coalesced;    /* more ticks and changes since */
+
+    const char *failed;     /* the path repeat_start couldn't watch */
+};
+
+/*
+ * The next run, as taken by repeat_next.
+ */
+struct repeat_run {
+    enum repeat_cause cause;
+    const char *path;
+    long long late_ns;      /* from when it fell due until now */
+    unsigned long coalesced;
+};
+
+/*
+ * Start the timer, if every_ms is more than 0, and watch the npaths paths.
+ * The first run is due straight away.
+ *
+ * A path that is a directory is watched for changes to anything in it;
+ * anything else, for it being written and closed, created, replaced,
+ * removed or having its attributes changed, so editors that write a new
+ * file and rename it over the old one are noticed.  Its directory must
+ * exist.
+ *
+ * Returns 0 on success, or -1 with errno set, and r->failed set to the path
+ * if a path could not be watched.  ENOSYS means this isn't Linux.
+ */
+int repeat_start(struct repeat *r, long every_ms,
+                 const char *const *paths, int npaths);
+
+/*
+ * Fill in fds with what to poll for, returning how many (at most
+ * REPEAT_MAX_FDS).
+ */
+int repeat_fds(const struct repeat *r, struct pollfd *fds);
+
+/*
+ * Take in whatever poll found on the nfds fds filled in by repeat_fds.
+ */
+void repeat_check(struct repeat *r, const struct pollfd *fds, int nfds);
+
+/*
+ * If a run is due, describe it in *run, and return 1; it is then no longer
+ * due.  Otherwise return 0.
+ */
+int repeat_next(struct repeat *r, struct repeat_run *run);
+
+void repeat_close(struct repeat *r);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
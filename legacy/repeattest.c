@@ -0,0 +1,226 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), usleep(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp(), usleep() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "repeat.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char file[512];
+static char other[512];
+static char replacement[512];
+static char subdir[512];
+static char inside[512];
+
+static void write_file(const char *path, const char *text)
+{
+    FILE *f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+/*
+ * Wait up to ms for a run to fall due, as root does, and take it.
+ */
+static int next_within(struct repeat *r, int ms, struct repeat_run *run)
+{
+    struct pollfd fds[REPEAT_MAX_FDS];
+    int nfds = repeat_fds(r, fds);
+    if (poll(fds, nfds, ms) > 0) {
+        repeat_check(r, fds, nfds);
+    }
+    return repeat_next(r, run);
+}
+
+void test_first_run(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    struct repeat_run run;
+
+    assert(repeat_start(&r, 0, NULL, 0) == 0);
+    assert(repeat_next(&r, &run) == 1);
+    assert(run.cause == REPEAT_FIRST);
+    assert(run.coalesced == 0);
+    assert(run.late_ns >= 0 && run.late_ns < 50 * 1000000LL);
+    assert(repeat_next(&r, &run) == 0);
+    assert(repeat_fds(&r, NULL) == 0);
+    repeat_close(&r);
+}
+
+void test_timer(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    struct repeat_run run;
+
+    assert(repeat_start(&r, 100, NULL, 0) == 0);
+    assert(repeat_next(&r, &run) == 1);
+    assert(next_within(&r, 50, &run) == 0);
+    for (int i = 0; i < 3; i++) {
+        assert(next_within(&r, 200, &run) == 1);
+        assert(run.cause == REPEAT_TIMER);
+        assert(run.coalesced == 0);
+        assert(run.late_ns >= 0 && run.late_ns < 50 * 1000000LL);
+    }
+    repeat_close(&r);
+}
+
+void test_timer_coalesces(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    struct repeat_run run;
+
+    assert(repeat_start(&r, 50, NULL, 0) == 0);
+    assert(repeat_next(&r, &run) == 1);
+
+    /* as if the first run took 230ms: ticks at 50, 100, 150 and 200 */
+    usleep(230 * 1000);
+    assert(next_within(&r, 0, &run) == 1);
+    assert(run.cause == REPEAT_TIMER);
+    assert(run.coalesced == 3);
+    /* late for the last tick, not the first */
+    assert(run.late_ns >= 30 * 1000000LL && run.late_ns < 80 * 1000000LL);
+
+    /* and the next tick is still on the original schedule */
+    assert(next_within(&r, 100, &run) == 1);
+    assert(run.coalesced == 0);
+    assert(run.late_ns < 30 * 1000000LL);
+    repeat_close(&r);
+}
+
+void test_file_changes(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    struct repeat_run run;
+    const char *paths[] = { file };
+
+    write_file(file, "one");
+    assert(repeat_start(&r, 0, paths, 1) == 0);
+    assert(repeat_next(&r, &run) == 1);
+    assert(next_within(&r, 50, &run) == 0);
+
+    /* written */
+    write_file(file, "two");
+    assert(next_within(&r, 1000, &run) == 1);
+    assert(run.cause == REPEAT_CHANGE);
+    assert(strcmp(run.path, file) == 0);
+
+    /* something else in the same directory */
+    write_file(other, "other");
+    assert(next_within(&r, 100, &run) == 0);
+
+    /* replaced, as editors and package managers do */
+    write_file(replacement, "three");
+    assert(rename(replacement, file) == 0);
+    assert(next_within(&r, 1000, &run) == 1);
+    assert(strcmp(run.path, file) == 0);
+
+    /* and again after that, then removed, then created */
+    write_file(file, "four");
+    assert(next_within(&r, 1000, &run) == 1);
+    unlink(file);
+    assert(next_within(&r, 1000, &run) == 1);
+    write_file(file, "five");
+    /* created, then written and closed, as one run */
+    assert(next_within(&r, 1000, &run) == 1);
+    assert(run.coalesced >= 1);
+    assert(next_within(&r, 100, &run) == 0);
+
+    unlink(other);
+    repeat_close(&r);
+}
+
+void test_directory(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    struct repeat_run run;
+    const char *paths[] = { file, subdir };
+
+    assert(repeat_start(&r, 0, paths, 2) == 0);
+    assert(repeat_next(&r, &run) == 1);
+
+    write_file(inside, "x");
+    assert(next_within(&r, 1000, &run) == 1);
+    assert(strcmp(run.path, subdir) == 0);
+
+    /* several changes while a run is going are one more run */
+    write_file(inside, "y");
+    write_file(file, "z");
+    unlink(inside);
+    usleep(50 * 1000);
+    assert(next_within(&r, 1000, &run) == 1);
+    assert(run.coalesced >= 2);
+    assert(next_within(&r, 100, &run) == 0);
+    repeat_close(&r);
+}
+
+void test_timer_and_changes(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    struct repeat_run run;
+    const char *paths[] = { file };
+
+    assert(repeat_start(&r, 200, paths, 1) == 0);
+    assert(repeat_next(&r, &run) == 1);
+    write_file(file, "six");
+    assert(next_within(&r, 100, &run) == 1);
+    assert(run.cause == REPEAT_CHANGE);
+    assert(next_within(&r, 300, &run) == 1);
+    assert(run.cause == REPEAT_TIMER);
+    repeat_close(&r);
+}
+
+void test_cannot_watch(void)
+{
+    printf("Running %s\n", __func__);
+    struct repeat r;
+    char missing[600];
+    const char *paths[] = { file, missing };
+
+    snprintf(missing, sizeof(missing), "%s/nonexistent/file", base);
+    errno = 0;
+    assert(repeat_start(&r, 1000, paths, 2) == -1);
+    assert(errno == ENOENT);
+    assert(r.failed == missing);
+    assert(r.timerfd == -1 && r.inotifyfd == -1);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(file, sizeof(file), "%s/config", base);
+    snprintf(other, sizeof(other), "%s/other", base);
+    snprintf(replacement, sizeof(replacement), "%s/config.new", base);
+    snprintf(subdir, sizeof(subdir), "%s/conf.d", base);
+    snprintf(inside, sizeof(inside), "%s/conf.d/a.conf", base);
+    assert(mkdir(subdir, 0755) == 0);
+
+    test_first_run();
+    test_timer();
+    test_timer_coalesces();
+    test_file_changes();
+    test_directory();
+    test_timer_and_changes();
+    test_cannot_watch();
+
+    unlink(file);
+    rmdir(subdir);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -10,45 +10,161 @@
 #define _BSD_SOURCE     /* strdup(), etc. */
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "args.h"
+#include "deadline.h"
+#include "fileops.h"
+#include "flight.h"
+#include "libroot.h"
+#include "locks.h"
 #include "logging.h"
+#include "lowmem.h"
 #include "path.h"
+#include "record.h"
+#include "repeat.h"
 #include "root.h"
+#include "trace.h"
 #include "user.h"
 
+extern char **environ;
+
+/* the most log_running says about the stage of a pipeline or repeated run */
+#define STAGE_TEXT_MAX (ROOT_PATH_MAX + 128)
+
+/* the longest a path can be once format_args has escaped it */
+#define ESCAPED_PATH_MAX (4 * PATH_MAX)
+
+/*
+ * the whole run normally allocates from here, see root_ctx_new_in, with
+ * room to spare for --low-memory, which can't allocate anything more
+ */
+static char ctx_reserve[4 * ROOT_CTX_RESERVE];
+static struct root_ctx *ctx;
 static int set_home = 1;
+static int record = 0;
+static int resolve = 0;
+static long timeout_ms = 0;
+static long kill_after_ms = DEFAULT_KILL_AFTER_MS;
+static char timeout_text[32];
+static int pipeline = 0;
+static const char *pipeline_delimiter = DEFAULT_PIPELINE_DELIMITER;
+static const char *target_name = NULL;  /* -u, or NULL for root */
+static uid_t target_uid = ROOT_UID;
+static char as_text[300];
+static int exec_fd = -1;        /* the verified command, see ensure_verified */
+static char lock_name[LOCK_NAME_MAX];   /* --lock or --slots, or "" */
+static int lock_slots = 0;
+static struct locks locks;
+static char lock_text[LOCK_NAME_MAX + 64];
+static long every_ms = 0;               /* --every, or 0 */
+static const char *watch_paths[REPEAT_MAX_PATHS];   /* --on-change */
+static int nwatch = 0;
+static enum fileop fileop = FILEOP_NONE;    /* --write, --append, --copy, --read */
+static const char *fileop_files[2];
+static long ns_pid = 0;                 /* --ns, or 0 */
+static char ns_text[48];
+static int trace_fd = -1;               /* TRACE_PATH, if it exists */
+static struct trace_record trace;
+static struct timespec trace_start;
+static int trace_shaped = 0;            /* trace has the PATH shape */
+static int low_memory = 0;              /* --low-memory */
+static int saved_oom_score_adj;         /* to put back, see hold_memory */
+static int oom_score_adjusted = 0;
+static struct flight flight;
+static int flight_state = -1;           /* -1 until opened, 0 if none, 1 if open */
+static struct flight_record flight_rec;
+static uint64_t flight_seq = 0;         /* the record claimed, if any */
+static int flight_written = 0;
+static struct timespec phase_start;
 
 static void setup_logging(void);
+static void start_trace(int argc, const char *const *argv);
+static void trace_options(const struct options *opts);
+static void trace_outcome(const char *outcome);
+static long elapsed_us(void);
+static void write_trace(void);
+static void forget_trace(void);
+static void start_flight(void);
+static void open_flight(void);
+static void begin_phase(void);
+static void end_phase(enum flight_phase phase);
+static void write_flight(const char *outcome, int status);
+static void write_flight_at_exit(void);
+static void forget_flight(void);
 static void process_args(int argc,
                          const char *const *argv,
                          const char *const **argsp);
-static void get_command_to_run(const char *command, char **absolute_commandp);
-static void find_and_verify_command(const char *command, char **path_commandp);
-static void get_absolute_command(const char *qualified_command,
-                                 char **absolute_commandp);
-static int command_is_safe(const char *path_command);
+static void get_command_to_run(const char *command, struct root_resolution *res);
+static void resolve_only(const char *const *names);
 static void print_unsafe_path_entries(const char *pathenv);
 static void ensure_permitted(void);
-static void become_root(void);
+static void reserve_memory(void);
+static void hold_memory(void);
+static void lock_memory(void);
+static void release_oom_score(void);
+static void ensure_allowed(const char *absolute_command, const char *const *args);
+static int ensure_verified(const char *absolute_command);
+static void find_target(void);
+static void open_locks(void);
+static void take_lock(void);
+static void log_running(const char *absolute_command,
+                        const char *const *args,
+                        const char *stage,
+                        const char *session);
+static void log_record(const char *what,
+                       const char *const *args,
+                       const char *stage,
+                       const char *session);
+static void open_recording(struct recording *rec,
+                           const char *absolute_command,
+                           const char *session);
+static void hold_target(void);
+static void become_target(void);
+static void enter_target(void);
 static void run_command(const char *absolute_command, const char *const *args);
+static void run_recorded(const char *absolute_command,
+                         const char *const *args,
+                         struct recording *rec);
+static void run_with_timeout(const char *absolute_command,
+                             const char *const *args);
+static void run_pipeline(const char *const *args);
+static void run_repeatedly(struct root_resolution *res, const char *const *args);
+static void run_fileop(void);
+static void format_duration(char *buf, size_t bufsize, long ms);
+static void report_memory(void);
 static void usage(void);
 
 int main(int argc, const char *const *argv)
 {
-    char *absolute_command = NULL;
+    static struct root_resolution resolution;
+    const char *absolute_command = resolution.absolute_command;
     const char *const *args = NULL;
+    char session[RECORD_SESSION_MAX];
+    struct recording rec;
+
+    start_trace(argc, argv);
+    start_flight();
 
+    begin_phase();
     setup_logging();
+    end_phase(FLIGHT_LOGGING);
 
     process_args(argc, argv, &args);
+    /* unless a check says otherwise */
+    trace_outcome("failed");
 
     /*
      * Check permission before resolving the command. Resolution runs with
@@ -56,19 +172,68 @@ int main(int argc, const char *const *argv)
      * euid 0), so doing it first would let unauthorized users probe for
      * the existence of files in directories they cannot read.
      */
+    begin_phase();
     ensure_permitted();
+    end_phase(FLIGHT_PERMISSION);
 
-    get_command_to_run(args[0], &absolute_command);
+    if (low_memory) {
+        hold_memory();
+    }
+    /* after hold_memory, which needn't lock it, and before --ns */
+    open_flight();
 
-    /*
-     * Do this before become_root so we can log the calling username/uid.
-     *
-     * XXX log the command arguments too?
-     */
-    info("Running %s", absolute_command);
+    if (resolve) {
+        resolve_only(args);
+    }
+
+    find_target();
+
+    /* from here on, in the target's namespaces */
+    if (ns_pid > 0) {
+        enter_target();
+    }
+
+    if (fileop != FILEOP_NONE) {
+        run_fileop();
+    }
+
+    if (pipeline) {
+        run_pipeline(args);
+    }
+
+    get_command_to_run(args[0], &resolution);
+    root_prefetch_command(ctx, absolute_command);
+
+    ensure_allowed(absolute_command, args);
+
+    exec_fd = ensure_verified(absolute_command);
+
+    take_lock();
+
+    if (every_ms > 0 || nwatch > 0) {
+        run_repeatedly(&resolution, args);
+    }
+
+    /* Do this before become_target so we can log the calling username/uid. */
+    if (record) {
+        record_session_id(session, sizeof(session));
+    }
+    log_running(absolute_command, args, NULL, session);
+
+    /* while we can still write to the recordings directory */
+    if (record) {
+        open_recording(&rec, absolute_command, session);
+    }
 
-    become_root();
+    become_target();
 
+    if (record) {
+        run_recorded(absolute_command, args, &rec);
+    }
+    /* a lock is held by this process, so it must outlive the command */
+    if (timeout_ms > 0 || lock_slots > 0) {
+        run_with_timeout(absolute_command, args);
+    }
     run_command(absolute_command, args);
 
     /* NOT REACHED */
@@ -77,7 +242,11 @@ int main(int argc, const char *const *argv)
 
 void setup_logging(void)
 {
-    initlog(PROGNAME);
+    ctx = root_ctx_new_in(PROGNAME, ctx_reserve, sizeof(ctx_reserve));
+    if (ctx == NULL) {
+        fprintf(stderr, "%s: Cannot allocate memory\n", PROGNAME);
+        exit(ROOT_SYSTEM_ERROR);
+    }
 }
 
 /**
@@ -100,7 +269,7 @@ void process_args(int argc,
                   const char *const **argsp)
 {
     if (argsp == NULL) {
-        error("process_args: argsp is NULL");
+        error(ctx, "process_args: argsp is NULL");
         exit(ROOT_PROGRAMMER_ERROR);
     }
 
@@ -112,9 +281,85 @@ void process_args(int argc,
     }
 
     if (opts.debug) {
-        setloglevel(LOG_DEBUG);
+        root_set_loglevel(ctx, LOG_DEBUG);
     }
     set_home = opts.set_home;
+    record = opts.record;
+    resolve = opts.resolve;
+    timeout_ms = opts.timeout_ms;
+    kill_after_ms = opts.kill_after_ms;
+    format_duration(timeout_text, sizeof(timeout_text), timeout_ms);
+    pipeline = opts.pipeline;
+    pipeline_delimiter = opts.delimiter;
+    target_name = opts.user;
+    strcpy(lock_name, opts.lock);
+    lock_slots = opts.slots;
+    every_ms = opts.every_ms;
+    nwatch = opts.nwatch;
+    memcpy(watch_paths, opts.watch, nwatch * sizeof(watch_paths[0]));
+    fileop = opts.fileop;
+    fileop_files[0] = opts.files[0];
+    fileop_files[1] = opts.files[1];
+    ns_pid = opts.ns_pid;
+    snprintf(ns_text, sizeof(ns_text), "namespaces of process %ld", ns_pid);
+    low_memory = opts.low_memory;
+    trace_options(&opts);
+
+    /* before anything else takes memory */
+    if (low_memory) {
+        reserve_memory();
+    }
+
+    /*
+     * Before anything is logged, which looks up the caller.  It only warms
+     * things up, so it can start before the permission check: see
+     * root_prefetch.
+     */
+    if (!resolve) {
+        root_prefetch(ctx, target_name);
+    }
+
+    if (pipeline && (record || resolve || timeout_ms > 0)) {
+        error(ctx, "--pipeline cannot be combined with --record, --resolve or --timeout");
+        exit(ROOT_INVALID_USAGE);
+    }
+    if (resolve && lock_slots > 0) {
+        error(ctx, "--resolve cannot be combined with --lock or --slots");
+        exit(ROOT_INVALID_USAGE);
+    }
+    if ((every_ms > 0 || nwatch > 0) && (pipeline || record || resolve)) {
+        error(ctx, "--every and --on-change cannot be combined with --pipeline, --record or --resolve");
+        exit(ROOT_INVALID_USAGE);
+    }
+    if (fileop != FILEOP_NONE
+        && (pipeline || record || resolve || timeout_ms > 0 || every_ms > 0 || nwatch > 0)) {
+        error(ctx, "%s cannot be combined with --pipeline, --record, --resolve, --timeout, "
+                   "--every or --on-change", fileops_name(fileop));
+        exit(ROOT_INVALID_USAGE);
+    }
+
+    if (ns_pid > 0 && (pipeline || record || resolve || target_name != NULL
+                       || every_ms > 0 || nwatch > 0 || fileop != FILEOP_NONE)) {
+        error(ctx, "--ns cannot be combined with --pipeline, --record, --resolve, --user, "
+                   "--every, --on-change or a file operation");
+        exit(ROOT_INVALID_USAGE);
+    }
+
+    /* root is the command */
+    if (fileop != FILEOP_NONE) {
+        if (args[0] != NULL) {
+            error(ctx, "%s does not take a command", fileops_name(fileop));
+            exit(ROOT_INVALID_USAGE);
+        }
+        *argsp = args;
+        return;
+    }
+
+    /* with --resolve, the names to resolve may come from stdin instead */
+    if (resolve) {
+        *argsp = args;
+        return;
+    }
 
     const char *command = args[0];
     if (command == NULL) {
@@ -122,11 +367,11 @@ void process_args(int argc,
         exit(ROOT_INVALID_USAGE);
     }
     if (*command == '\0') {
-        error("Command is empty");
+        error(ctx, "Command is empty");
         exit(ROOT_INVALID_USAGE);
     }
 
-    debug("Command to run is %s", command);
+    debug(ctx, "Command to run is %s", command);
 
     *argsp = args;
 }
@@ -135,7 +380,7 @@ void process_args(int argc,
  * Determine what command to run and do some safety checks.
  *
  * On success, the absolute path of the command to run is stored
- * in *absolute_commandp.
+ * in res->absolute_command.
  *
  * On failure, this function calls exit().
  *
@@ -166,143 +411,182 @@ void process_args(int argc,
  *  - "ls" is prohibited if PATH=".:/bin" and "./ls" exists
  *  - "sl" is prohibited if PATH="/bin:." and "./sl" exists
  *
+ * The rules themselves live in libroot (see root_resolve); this decides
+ * what to tell the user about them.
  */
-void get_command_to_run(const char *command, char **absolute_commandp)
+void get_command_to_run(const char *command, struct root_resolution *res)
 {
     if (command == NULL) {
-        error("get_command_to_run: command is NULL");
-        exit(ROOT_PROGRAMMER_ERROR);
-    }
-    if (absolute_commandp == NULL) {
-        error("get_command_to_run: absolute_commandp is NULL");
-        exit(ROOT_PROGRAMMER_ERROR);
-    }
-
-    char *absolute_command = NULL;
-
-    if (is_qualified_path(command)) {
-        /*
-         * path contained a slash,
-         * don't need to look it up in PATH
-         */
-        get_absolute_command(command, &absolute_command);
-    }
-    else {
-        /*
-         * path didn't contain a slash,
-         * look it up in PATH and make sure it's safe
-         */
-        char *path_command = NULL;
-        find_and_verify_command(command, &path_command);
-
-        get_absolute_command(path_command, &absolute_command);
-        free(path_command);
-    }
-    *absolute_commandp = absolute_command;
-}
-
-void get_absolute_command(const char *qualified_command,
-                          char **absolute_commandp)
-{
-    if (qualified_command == NULL) {
-        error("get_absolute_command: qualified_command is NULL");
+        error(ctx, "get_command_to_run: command is NULL");
         exit(ROOT_PROGRAMMER_ERROR);
     }
-    if (absolute_commandp == NULL) {
-        error("get_absolute_command: absolute_commandp is NULL");
+    if (res == NULL) {
+        error(ctx, "get_command_to_run: res is NULL");
         exit(ROOT_PROGRAMMER_ERROR);
     }
 
-    char resolved[PATH_MAX];
-    errno = 0;
-    if (realpath(qualified_command, resolved) == NULL) {
-        error("Cannot determine real path to %s: %s", qualified_command, strerror(errno));
-        exit(ROOT_COMMAND_NOT_FOUND);
-    }
-
-    char *absolute_command = strdup(resolved);
-    if (absolute_command == NULL) {
-        error("Cannot allocate memory for resolved path");
-        exit(ROOT_SYSTEM_ERROR);
-    }
-
-    *absolute_commandp = absolute_command;
-}
+    begin_phase();
+    int status = root_resolve(ctx, command, res);
+    end_phase(FLIGHT_RESOLUTION);
 
-void find_and_verify_command(const char *command, char **path_commandp)
-{
-    if (command == NULL) {
-        error("find_and_verify_command: command is NULL");
-        exit(ROOT_PROGRAMMER_ERROR);
-    }
-    if (path_commandp == NULL) {
-        error("find_and_verify_command: path_commandp is NULL");
-        exit(ROOT_PROGRAMMER_ERROR);
+    if (status == ROOT_SYSTEM_ERROR || status == ROOT_PROGRAMMER_ERROR) {
+        /* already logged */
+        exit(status);
     }
 
-    const char *pathenv = getenv("PATH");
-    if (pathenv == NULL) {
-        error("Cannot get PATH environment variable");
-        exit(ROOT_SYSTEM_ERROR);
+    /* of the first command, for a pipeline */
+    if (!trace_shaped) {
+        trace.qualified = is_qualified_path(command);
+        trace_path_shape(&trace, getenv("PATH"), command,
+                         trace.qualified || res->path_command[0] == '\0'
+                         ? NULL : res->path_command);
+        trace_shaped = 1;
     }
 
-    debug("Searching for command in PATH=%s", pathenv);
-    char *path_command = get_command_path(command, pathenv);
-    if (path_command == NULL) {
-        error("Cannot find %s in PATH", command);
+    if (status == ROOT_COMMAND_NOT_FOUND && res->path_command[0] == '\0'
+        && res->realpath_errno == 0) {
+        refuse(ctx, ROOT_COMMAND_NOT_FOUND, "Cannot find %s in PATH", command);
+        trace_outcome("not-found");
         exit(ROOT_COMMAND_NOT_FOUND);
     }
 
     /*
      * ensure the command is safe
      */
-    if (!command_is_safe(path_command)) {
+    if (status == ROOT_RELATIVE_PATH_DISALLOWED) {
         /*
          * XXX
          * this should only go to the log file
          */
-        error("Attempt to run relative PATH command %s", path_command);
-        char *absolute_command;
-        get_absolute_command(path_command, &absolute_command);
+        refuse(ctx, status, "Attempt to run relative PATH command %s", res->path_command);
+    }
+
+    if (res->absolute_command[0] == '\0') {
+        refuse(ctx, ROOT_COMMAND_NOT_FOUND, "Cannot determine real path to %s: %s",
+               res->path_command[0] != '\0' ? res->path_command : command,
+               strerror(res->realpath_errno));
+        trace_outcome("realpath");
+        exit(ROOT_COMMAND_NOT_FOUND);
+    }
+
+    if (status == ROOT_RELATIVE_PATH_DISALLOWED) {
         print("You tried to run %s, but this would run %s\n",
               command,
-              absolute_command);
+              res->absolute_command);
         print("This has been prevented because it is potentially unsafe\n");
         print("Consider removing the following entries from your PATH:");
-        print_unsafe_path_entries(pathenv);
+        print_unsafe_path_entries(getenv("PATH"));
         print("Or run the command using an absolute path\n");
         print("Run \"man root\" for more details\n");
-        free(absolute_command);
-        free(path_command);
+        trace_outcome("relative");
         exit(ROOT_RELATIVE_PATH_DISALLOWED);
     }
+}
+
+/*
+ * Resolve name and print one line describing the outcome:
+ *   ok<TAB>name<TAB>absolute path
+ *   not-found<TAB>name<TAB>
+ *   relative<TAB>name<TAB>what the relative PATH entry matched
+ *   realpath<TAB>name<TAB>path: why realpath failed
+ *   invalid<TAB><TAB>           (an empty name)
+ *
+ * Returns 0 if name resolved, otherwise the exit status root would have
+ * used for it.
+ */
+static int report_resolution(const char *name)
+{
+    if (*name == '\0') {
+        printf("invalid\t\t\n");
+        return ROOT_INVALID_USAGE;
+    }
+
+    static struct root_resolution res;
+    int status = root_resolve(ctx, name, &res);
+
+    if (status == ROOT_SYSTEM_ERROR) {
+        /* already logged, and not about this name */
+        exit(status);
+    }
+    else if (status == 0) {
+        printf("ok\t%s\t%s\n", name, res.absolute_command);
+    }
+    else if (status == ROOT_RELATIVE_PATH_DISALLOWED) {
+        printf("relative\t%s\t%s\n", name, res.path_command);
+    }
+    else if (res.realpath_errno != 0) {
+        printf("realpath\t%s\t%s: %s\n",
+               name,
+               res.path_command[0] != '\0' ? res.path_command : name,
+               strerror(res.realpath_errno));
+    }
+    else {
+        printf("not-found\t%s\t\n", name);
+    }
 
-    *path_commandp = path_command;
+    return status;
 }
 
 /**
- * Returns 1 (true) if command is regarded as safe.
- * Returns 0 (false) otherwise.
+ * Report what each of names would resolve to, without running anything.
+ *
+ * If names is empty, NUL-terminated names are read from stdin instead.
+ * PATH is parsed and its directories are opened once for all of them.
+ *
+ * Does not return: exits with 0 if every name resolved, otherwise with the
+ * exit status root would have used for the first one that didn't.
  */
-int command_is_safe(const char *path_command)
+void resolve_only(const char *const *names)
 {
-    /*
-     * Ensure the path is an absolute PATH to prevent running
-     * a malicious program installed by a rogue user in the current
-     * directory (or any relative entry in PATH).
-     *
-     * We could just check for a command starting with a dot, but I also
-     * want to handle the case where somebody puts something strange like
-     * "bin" in PATH (as opposed to "/bin"), which could also result in
-     * running an unintended command.  Ensuring the resultant path is
-     * absolute handles both cases.
-     */
-    return is_absolute_path(path_command);
+    const char *pathenv = getenv("PATH");
+    if (pathenv == NULL) {
+        error(ctx, "Cannot get PATH environment variable");
+        exit(ROOT_SYSTEM_ERROR);
+    }
+
+    info(ctx, "Resolving commands without running them");
+    trace_outcome("ran");
+    trace_path_shape(&trace, pathenv, NULL, NULL);
+    debug(ctx, "Searching for commands in PATH=%s", pathenv);
+
+    int status = root_set_path(ctx, pathenv);
+    if (status != 0) {
+        exit(status);
+    }
+
+    int exitstatus = 0;
+    if (names[0] != NULL) {
+        for (const char *const *name = names; *name != NULL; name++) {
+            status = report_resolution(*name);
+            if (exitstatus == 0) {
+                exitstatus = status;
+            }
+        }
+    }
+    else {
+        char *name = NULL;
+        size_t namemax = 0;
+        /* getdelim terminates the last name even if stdin didn't */
+        while (getdelim(&name, &namemax, '\0', stdin) != -1) {
+            status = report_resolution(name);
+            if (exitstatus == 0) {
+                exitstatus = status;
+            }
+        }
+        free(name);
+    }
+
+    if (fflush(stdout) == EOF) {
+        error(ctx, "Cannot write results: %s", strerror(errno));
+        exit(ROOT_SYSTEM_ERROR);
+    }
+    write_flight("ran", exitstatus);
+    exit(exitstatus);
 }
 
 static void print_if_unsafe(const char *dir)
 {
-    if (!command_is_safe(dir)) {
+    if (!is_absolute_path(dir)) {
         print(" \"%s\"", dir);
     }
 }
@@ -315,62 +599,1396 @@ void print_unsafe_path_entries(const char *pathenv)
 
 void ensure_permitted(void)
 {
-    if (!in_group(ROOT_GID)) {
-        const char *groupname = get_group_name(ROOT_GID);
+    int status = root_permitted(ctx);
+    if (status == ROOT_PERMISSION_DENIED) {
+        const char *groupname = get_group_name(ctx, ROOT_GID);
         if (groupname != NULL) {
-            error("You must be in the %s group to run root", groupname);
+            refuse(ctx, status, "You must be in the %s group to run root", groupname);
         }
         else {
-            error("You must be in group %lu to run root", (unsigned long)ROOT_GID);
+            refuse(ctx, status, "You must be in group %lu to run root", (unsigned long)ROOT_GID);
         }
-        exit(ROOT_PERMISSION_DENIED);
+        trace_outcome("denied");
+    }
+    if (status != 0) {
+        exit(status);
     }
 }
 
-void become_root(void)
+/*
+ * Check the command against the allowlist policy, if there is one.
+ */
+void ensure_allowed(const char *absolute_command, const char *const *args)
 {
-    if (set_home) {
-        if (!set_home_dir(ROOT_UID)) {
-            error("Cannot set HOME directory");
-            exit(ROOT_SYSTEM_ERROR);
+    int status = root_check_policy(ctx, absolute_command, args);
+    if (status == ROOT_PERMISSION_DENIED) {
+        refuse(ctx, status, "You are not permitted to run %s", absolute_command);
+        trace_outcome("disallowed");
+    }
+    if (status != 0) {
+        exit(status);
+    }
+}
+
+/*
+ * Check the command's content against the manifest, if there is one.
+ *
+ * Returns the open file that was checked, which is what must be executed,
+ * or -1 if there is no manifest and the path can be executed as usual.
+ */
+int ensure_verified(const char *absolute_command)
+{
+    int fd;
+    int status = root_verify(ctx, absolute_command, &fd);
+    if (status == ROOT_PERMISSION_DENIED) {
+        trace_outcome("unverified");
+    }
+    if (status != 0) {
+        exit(status);
+    }
+    return fd;
+}
+
+/*
+ * Look up the user given with -u, if any, to run commands as instead of
+ * root.
+ */
+void find_target(void)
+{
+    if (target_name == NULL) {
+        return;
+    }
+    begin_phase();
+    int status = root_find_user(ctx, target_name, &target_uid);
+    end_phase(FLIGHT_NSS);
+    if (status != 0) {
+        exit(status);
+    }
+    snprintf(as_text, sizeof(as_text), "as %s", target_name);
+}
+
+/*
+ * Log the audit record for running absolute_command, with what else was
+ * asked for in parentheses, e.g. "Running /bin/ls (timeout 5s, as svc)",
+ * then its args in an Arguments record.
+ *
+ * stage is the first of those, or NULL, and session is only used with
+ * --record.
+ */
+void log_running(const char *absolute_command,
+                 const char *const *args,
+                 const char *stage,
+                 const char *session)
+{
+    /* escaped as the arguments are, so a file's name can't forge a record */
+    static char what[ESCAPED_PATH_MAX];
+    const char *const words[] = { absolute_command, NULL };
+    format_args(what, sizeof(what), words);
+    log_record(what, args, stage, session);
+}
+
+/*
+ * The same for what, which is already escaped, e.g. "--write /etc/motd".
+ */
+void log_record(const char *what,
+                const char *const *args,
+                const char *stage,
+                const char *session)
+{
+    char recording_text[RECORD_SESSION_MAX + 16];
+    char timeout_detail[sizeof(timeout_text) + 16];
+    const char *details[6];
+    int ndetails = 0;
+
+    trace_outcome("ran");
+    write_trace();
+
+    if (stage != NULL) {
+        details[ndetails++] = stage;
+    }
+    if (record) {
+        snprintf(recording_text, sizeof(recording_text), "recording %s", session);
+        details[ndetails++] = recording_text;
+    }
+    if (timeout_ms > 0) {
+        snprintf(timeout_detail, sizeof(timeout_detail), "timeout %s", timeout_text);
+        details[ndetails++] = timeout_detail;
+    }
+    if (lock_slots > 0) {
+        details[ndetails++] = lock_text;
+    }
+    if (target_name != NULL) {
+        details[ndetails++] = as_text;
+    }
+    if (ns_pid > 0) {
+        details[ndetails++] = ns_text;
+    }
+
+    static char record[2 * ESCAPED_PATH_MAX + STAGE_TEXT_MAX + sizeof(recording_text)
+                       + sizeof(timeout_detail) + sizeof(lock_text) + sizeof(as_text)
+                       + sizeof(ns_text) + 64];
+    size_t len = snprintf(record, sizeof(record), "Running %s", what);
+    for (int i = 0; i < ndetails && len < sizeof(record); i++) {
+        len += snprintf(record + len, sizeof(record) - len, "%s%s%s",
+                        i == 0 ? " (" : ", ", details[i], i == ndetails - 1 ? ")" : "");
+    }
+    root_log_running(ctx, record, args, elapsed_us());
+}
+
+/*
+ * With --lock or --slots, open the host's locks, if they aren't already.
+ *
+ * On failure, this function calls exit().
+ */
+void open_locks(void)
+{
+    static int opened = 0;
+    if (lock_slots == 0 || opened) {
+        return;
+    }
+
+    if (locks_open(&locks, LOCKS_PATH) == -1) {
+        if (errno == ENOSYS) {
+            error(ctx, "--lock and --slots are not supported on this system");
+            exit(ROOT_INVALID_USAGE);
         }
+        error(ctx, "Cannot open locks %s: %s", LOCKS_PATH, strerror(errno));
+        exit(ROOT_SYSTEM_ERROR);
+    }
+    opened = 1;
+}
+
+/*
+ * With --lock or --slots, wait for a slot, and describe it and how long it
+ * took in lock_text for log_running.  The slot is held by this process
+ * until it exits, so the caller must stay behind until the command exits.
+ *
+ * On failure, this function calls exit().
+ */
+void take_lock(void)
+{
+    if (lock_slots == 0) {
+        return;
+    }
+
+    open_locks();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    debug(ctx, "Waiting for %s", lock_name);
+    int slot = locks_take(&locks, lock_name, lock_slots);
+    if (slot == -1) {
+        error(ctx, "Cannot take lock %s: %s", lock_name,
+              errno == ENOSPC ? "Too many lock names" : strerror(errno));
+        exit(ROOT_SYSTEM_ERROR);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    char waited[32];
+    format_duration(waited, sizeof(waited),
+                    (end.tv_sec - start.tv_sec) * 1000
+                    + (end.tv_nsec - start.tv_nsec) / 1000000);
+    if (lock_slots == 1) {
+        snprintf(lock_text, sizeof(lock_text), "lock %s, waited %s", lock_name, waited);
+    }
+    else {
+        snprintf(lock_text, sizeof(lock_text), "slot %d of %s:%d, waited %s",
+                 slot + 1, lock_name, lock_slots, waited);
+    }
+}
+
+/*
+ * Create the recording for session, which is owned by root.
+ *
+ * On failure, this function calls exit().
+ */
+void open_recording(struct recording *rec,
+                    const char *absolute_command,
+                    const char *session)
+{
+    if (record_open(rec, RECORD_DIR, session, RECORD_MAX_BYTES,
+                    absolute_command) == -1) {
+        error(ctx, "Cannot create recording %s in %s: %s",
+              session, RECORD_DIR, strerror(errno));
+        exit(ROOT_SYSTEM_ERROR);
     }
-    if (!setup_groups(ROOT_UID)) {
-        error("Cannot set up groups");
+}
+
+/*
+ * For --low-memory, hold root to the memory it already has (see
+ * root_set_low_memory), and take the C library's share of it now (see
+ * lowmem_reserve_heap).
+ *
+ * On failure, this function calls exit().
+ */
+void reserve_memory(void)
+{
+    root_set_low_memory(ctx);
+    if (lowmem_reserve_heap(LOWMEM_HEAP) == -1) {
+        error(ctx, "Cannot reserve memory: %s", strerror(errno));
         exit(ROOT_SYSTEM_ERROR);
     }
+}
+
+/*
+ * For --low-memory, once the caller is known to be permitted, keep root
+ * out of the OOM killer's way until it becomes the target (see
+ * release_oom_score), and lock it in memory.  Neither is essential, so
+ * failures are only warned about.
+ */
+void hold_memory(void)
+{
+    if (lowmem_set_oom_score_adj(LOWMEM_OOM_PATH, LOWMEM_OOM_SCORE_ADJ,
+                                 &saved_oom_score_adj) == -1) {
+        warning(ctx, "Cannot set %s: %s", LOWMEM_OOM_PATH, strerror(errno));
+    }
+    else {
+        oom_score_adjusted = 1;
+    }
+    lock_memory();
+}
+
+void lock_memory(void)
+{
+    if (lowmem_lock(LOWMEM_STACK) == -1) {
+        warning(ctx, "Cannot lock root in memory: %s", strerror(errno));
+    }
+}
 
-    if (!become_user(ROOT_UID)) {
-        error("Cannot become root");
-        /* system error because if this program is installed setuid,
-         * then become_user should always succeed */
+/*
+ * Put back the oom_score_adj hold_memory changed, so that neither the
+ * command nor root waiting for it keeps it.
+ */
+void release_oom_score(void)
+{
+    if (!oom_score_adjusted) {
+        return;
+    }
+    oom_score_adjusted = 0;
+    if (lowmem_set_oom_score_adj(LOWMEM_OOM_PATH, saved_oom_score_adj, NULL) == -1) {
+        error(ctx, "Cannot restore %s: %s", LOWMEM_OOM_PATH, strerror(errno));
         exit(ROOT_SYSTEM_ERROR);
     }
 }
 
+/*
+ * Get everything ready for becoming the target user, so that becoming it,
+ * here or in a child, only switches.
+ *
+ * On failure, this function calls exit().
+ */
+void hold_target(void)
+{
+    release_oom_score();
+
+    begin_phase();
+    int status = root_hold_user(ctx, target_uid);
+    end_phase(FLIGHT_NSS);
+    if (status != 0) {
+        exit(status);
+    }
+}
+
+void become_target(void)
+{
+    hold_target();
+
+    begin_phase();
+    int status = root_become(ctx, target_uid, set_home);
+    end_phase(FLIGHT_SETUID);
+    if (status != 0) {
+        exit(status);
+    }
+    write_flight("ran", FLIGHT_RAN);
+}
+
 void run_command(const char *absolute_command, const char *const *args)
 {
-    /*
-     * IMPORTANT
-     * This must stay as execv, never execvp.
-     *
-     * The cast is required because execve doesn't enforce const'ness
-     * for backwards compatibility.
-     *
-     * See
-     * http://pubs.opengroup.org/onlinepubs/009695399/functions/exec.html
-     * http://stackoverflow.com/questions/190184/execv-and-const-ness
-     */
-    if (execv(absolute_command, (char *const *)args) == -1) {
-        error("Cannot exec '%s': %s", absolute_command, strerror(errno));
-        exit(ROOT_ERROR_EXECUTING_COMMAND);
+    report_memory();
+    if (exec_fd != -1) {
+        exit(root_exec_fd(ctx, exec_fd, absolute_command, args));
+    }
+    exit(root_exec(ctx, absolute_command, args));
+}
+
+/* the command root is waiting for, see supervise */
+static pid_t child = -1;
+static int child_group = 0;     /* it leads its own process group */
+static int gave_terminal = 0;
+
+/* or the stages of the pipeline, see run_pipeline */
+static pid_t *stage_pids;
+static int nstage_pids;
+
+static void forward_signal(int sig)
+{
+    if (child > 0) {
+        kill(child_group ? -child : child, sig);
+    }
+    for (int i = 0; i < nstage_pids; i++) {
+        kill(stage_pids[i], sig);
+    }
+}
+
+static int wait_status_to_exit(int status)
+{
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
     }
-    /* execv does not return on success */
+    return ROOT_SYSTEM_ERROR;
+}
+
+void format_duration(char *buf, size_t bufsize, long ms)
+{
+    if (ms % 1000 == 0) {
+        snprintf(buf, bufsize, "%lds", ms / 1000);
+    }
+    else {
+        snprintf(buf, bufsize, "%ld.%03lds", ms / 1000, ms % 1000);
+    }
+}
+
+/*
+ * Stay behind as the parent of the command, which is running as pid.
+ *
+ * If the command leads a process group of its own and we have the
+ * terminal, hand the terminal over, so that the terminal's signals reach
+ * everything the command started and it can still read from the terminal.
+ *
+ * On failure, this function calls exit().
+ */
+static void supervise(const char *absolute_command,
+                      pid_t pid,
+                      int group,
+                      struct deadline *d)
+{
+    child = pid;
+    child_group = group;
+
+    if (deadline_start(d, pid, group ? timeout_ms : 0, kill_after_ms) == -1) {
+        error(ctx, "Cannot watch %s: %s", absolute_command, strerror(errno));
+        kill(group ? -pid : pid, SIGKILL);
+        exit(ROOT_SYSTEM_ERROR);
+    }
+
+    if (group && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp()) {
+        /* we are about to be in the background, and must not stop */
+        signal(SIGTTOU, SIG_IGN);
+        if (tcsetpgrp(STDIN_FILENO, pid) == 0) {
+            gave_terminal = 1;
+            /* in case it already tried to use the terminal */
+            kill(-pid, SIGCONT);
+        }
+    }
+
+    /*
+     * The terminal sends SIGINT and SIGQUIT to the command as well,
+     * so let the command decide what to do and keep going.
+     */
+    if (group && !gave_terminal) {
+        signal(SIGINT, forward_signal);
+        signal(SIGQUIT, forward_signal);
+    }
+    else {
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, forward_signal);
+    signal(SIGHUP, forward_signal);
+}
+
+/*
+ * deadline_poll, logging each signal the deadline sends to the audit log
+ */
+static int wait_for(const char *absolute_command,
+                    struct deadline *d,
+                    struct pollfd *fds,
+                    nfds_t nfds)
+{
+    enum deadline_stage before = d->stage;
+    int ready = deadline_poll(d, fds, nfds);
+
+    if (before == DEADLINE_RUNNING && d->stage != DEADLINE_RUNNING) {
+        warning(ctx, "Timed out after %s running %s, sending SIGTERM",
+                timeout_text, absolute_command);
+    }
+    if (before != DEADLINE_KILLED && d->stage == DEADLINE_KILLED) {
+        warning(ctx, "Sending SIGKILL to %s", absolute_command);
+    }
+    return ready;
+}
+
+/*
+ * Reap the command once it has exited, and return the status root
+ * should exit with.
+ *
+ * On failure, this function calls exit().
+ */
+static int finish(const char *absolute_command, struct deadline *d)
+{
+    int status;
+
+    deadline_finish(d);
+    while (waitpid(child, &status, 0) == -1) {
+        if (errno != EINTR) {
+            error(ctx, "Cannot wait for %s: %s", absolute_command, strerror(errno));
+            exit(ROOT_SYSTEM_ERROR);
+        }
+    }
+    deadline_close(d);
+
+    if (gave_terminal) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+
+    int exitstatus = wait_status_to_exit(status);
+    if (d->stage != DEADLINE_RUNNING
+        && !(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)) {
+        /* like timeout(1), whatever the command made of SIGTERM */
+        exitstatus = ROOT_TIMED_OUT;
+    }
+    return exitstatus;
+}
+
+/**
+ * Run the command as a child, recording its stdout and stderr.
+ *
+ * root stays behind as a thin parent that moves the child's output through
+ * pipes to our own stdout and stderr, keeping a copy in rec, the root-owned
+ * recording opened by open_recording (see record.h).  stdin is inherited
+ * unchanged.  With --timeout, the deadline applies as in run_with_timeout.
+ *
+ * Does not return: exits with the command's exit status, or 128 plus the
+ * signal number if the command was killed, like the shell.
+ */
+void run_recorded(const char *absolute_command,
+                  const char *const *args,
+                  struct recording *rec)
+{
+    int outpipe[2], errpipe[2];
+    if (pipe(outpipe) == -1 || pipe(errpipe) == -1) {
+        error(ctx, "Cannot create pipe for recording: %s", strerror(errno));
+        exit(ROOT_SYSTEM_ERROR);
+    }
+
+    /* our ends of the pipes must not leak into the command */
+    fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(errpipe[0], F_SETFD, FD_CLOEXEC);
+
+    /* we have already become the target user */
+    struct root_spawn_opts spawn;
+    root_spawn_opts_init(&spawn);
+    spawn.fds[STDOUT_FILENO] = outpipe[1];
+    spawn.fds[STDERR_FILENO] = errpipe[1];
+    spawn.become = 0;
+    spawn.new_group = timeout_ms > 0;
+    spawn.exec_fd = exec_fd;
+
+    report_memory();
+
+    pid_t pid;
+    int status = root_spawn(ctx, absolute_command, args, &spawn, &pid);
+    if (status != 0) {
+        exit(status);
+    }
+    close(outpipe[1]);
+    close(errpipe[1]);
+
+    struct deadline deadline;
+    supervise(absolute_command, pid, spawn.new_group, &deadline);
+
+    struct pollfd fds[2] = {
+        { .fd = outpipe[0], .events = POLLIN },
+        { .fd = errpipe[0], .events = POLLIN },
+    };
+    const int destinations[2] = { STDOUT_FILENO, STDERR_FILENO };
+    const enum record_stream streams[2] = { RECORD_STDOUT, RECORD_STDERR };
+    int open_streams = 2;
+
+    while (open_streams > 0 || !deadline.exited) {
+        if (wait_for(absolute_command, &deadline, fds, 2) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error(ctx, "Cannot poll command output: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd == -1 || fds[i].revents == 0) {
+                continue;
+            }
+            if (record_pump(rec, streams[i], fds[i].fd, destinations[i]) <= 0) {
+                /*
+                 * End of output, or our reader went away, in which case
+                 * closing our end passes the SIGPIPE on to the command.
+                 */
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_streams--;
+            }
+        }
+    }
+
+    int exitstatus = finish(absolute_command, &deadline);
+    record_close(rec, exitstatus);
+    exit(exitstatus);
+}
+
+/**
+ * Run the command as a child that leads its own process group, and stop
+ * the whole group if the command is still running when the timeout passes:
+ * SIGTERM first, then SIGKILL kill_after_ms later.
+ *
+ * root stays behind as a minimal parent, waiting in a single poll for the
+ * command to exit or the deadline to pass (see deadline.h).  With --lock or
+ * --slots and no timeout, it stays behind only to hold the lock.
+ *
+ * Does not return: exits like run_recorded, except that if the deadline
+ * passed it exits with ROOT_TIMED_OUT, or 128 plus SIGKILL if the command
+ * had to be killed, following timeout(1).
+ */
+void run_with_timeout(const char *absolute_command, const char *const *args)
+{
+    /* we have already become the target user */
+    struct root_spawn_opts spawn;
+    root_spawn_opts_init(&spawn);
+    spawn.become = 0;
+    spawn.new_group = 1;
+    spawn.exec_fd = exec_fd;
+
+    report_memory();
+
+    pid_t pid;
+    int status = root_spawn(ctx, absolute_command, args, &spawn, &pid);
+    if (status != 0) {
+        exit(status);
+    }
+
+    struct deadline deadline;
+    supervise(absolute_command, pid, 1, &deadline);
+
+    while (!deadline.exited) {
+        if (wait_for(absolute_command, &deadline, NULL, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error(ctx, "Cannot wait for %s: %s", absolute_command, strerror(errno));
+            break;
+        }
+    }
+
+    exit(finish(absolute_command, &deadline));
+}
+
+/*
+ * With --ns, carry on as a child in the namespaces of process ns_pid (see
+ * root_enter), staying behind only to wait for it and exit as it does.
+ * The locks are on this host, so they are opened first.
+ *
+ * Returns only in the child.  On failure, this function calls exit().
+ */
+void enter_target(void)
+{
+    open_locks();
+    /* while this process's oom_score_adj is the one in our /proc */
+    release_oom_score();
+
+    pid_t pid;
+    int status = root_enter(ctx, (pid_t)ns_pid, target_uid, &pid);
+    if (status != 0) {
+        exit(status);
+    }
+    if (pid == 0) {
+        /* locks aren't inherited */
+        if (low_memory) {
+            lock_memory();
+        }
+        return;
+    }
+    /* the child traces and records this run */
+    forget_trace();
+    forget_flight();
+
+    char what[sizeof(ns_text) + 16];
+    snprintf(what, sizeof(what), "root in the %s", ns_text);
+    struct deadline deadline;
+    supervise(what, pid, 0, &deadline);
+    while (!deadline.exited) {
+        if (wait_for(what, &deadline, NULL, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error(ctx, "Cannot wait for %s: %s", what, strerror(errno));
+            break;
+        }
+    }
+    exit(finish(what, &deadline));
+}
+
+/* set when root is asked to stop repeating, see run_repeatedly */
+static volatile sig_atomic_t stopping = 0;
+static int stop_pipe[2] = { -1, -1 };
+
+static void stop_repeating(int sig)
+{
+    int saved_errno = errno;
+    stopping = 1;
+    /* wake the poll, even if the signal came just before it */
+    if (write(stop_pipe[1], "", 1) == -1) {
+        /* it is already awake */
+    }
+    forward_signal(sig);
+    errno = saved_errno;
+}
+
+/* what identifies the version of a command that was checked */
+struct binary {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+static int stat_binary(const char *absolute_command, struct binary *b)
+{
+    struct stat st;
+    memset(b, 0, sizeof(*b));
+    if (stat(absolute_command, &st) == -1) {
+        return -1;
+    }
+    b->dev = st.st_dev;
+    b->ino = st.st_ino;
+    b->size = st.st_size;
+    b->mtime = st.st_mtim;
+    b->ctime = st.st_ctim;
+    return 0;
+}
+
+static int same_binary(const struct binary *a, const struct binary *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size
+        && a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec
+        && a->ctime.tv_sec == b->ctime.tv_sec && a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+/* ns as milliseconds to the microsecond, e.g. "0.412ms" */
+static void format_late(char *buf, size_t bufsize, long long ns)
+{
+    long long us = ns / 1000;
+    snprintf(buf, bufsize, "%lld.%03lldms", us / 1000, us % 1000);
+}
+
+/**
+ * With --every or --on-change, run the command each time the interval
+ * comes round or one of the paths changes, until root is told to stop.
+ *
+ * Everything up to becoming the target user has been done once already,
+ * and is not done again for each run (see repeat.h for what starts them).
+ * root stays itself, as the parent of each run, and only the child
+ * becomes the target user, so each run is logged by the caller and only
+ * costs a fork, the switch and an exec.  The command is only resolved,
+ * checked against the policy and verified again if the file it resolved
+ * to changes, and that happens with root's own privileges, as it did the
+ * first time.  Triggers that arrive while a run is going make one more
+ * run when it finishes.
+ *
+ * Each run is logged like any other command, with its number, what
+ * started it, and how late it started, and --timeout applies to each run.
+ * SIGTERM, SIGHUP and SIGINT are passed on to a run that is going, and
+ * stop root once it finishes; so does a run being interrupted.
+ *
+ * Does not return: exits with the status of the last run, as run_with_timeout
+ * would.
+ */
+void run_repeatedly(struct root_resolution *res, const char *const *args)
+{
+    const char *absolute_command = res->absolute_command;
+    struct repeat repeat;
+
+    if (repeat_start(&repeat, every_ms, watch_paths, nwatch) == -1) {
+        if (errno == ENOSYS) {
+            error(ctx, "--every and --on-change are not supported on this system");
+            exit(ROOT_INVALID_USAGE);
+        }
+        if (repeat.failed != NULL) {
+            error(ctx, "Cannot watch %s: %s", repeat.failed, strerror(errno));
+        }
+        else {
+            error(ctx, "Cannot start repeating %s: %s", absolute_command, strerror(errno));
+        }
+        exit(ROOT_SYSTEM_ERROR);
+    }
+    if (pipe(stop_pipe) == -1) {
+        error(ctx, "Cannot create pipe: %s", strerror(errno));
+        exit(ROOT_SYSTEM_ERROR);
+    }
+    fcntl(stop_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(stop_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(stop_pipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGTERM, stop_repeating);
+    signal(SIGHUP, stop_repeating);
+    signal(SIGINT, stop_repeating);
+    signal(SIGPIPE, SIG_IGN);
+
+    hold_target();
+    write_flight("ran", FLIGHT_RAN);
+
+    struct binary checked;
+    stat_binary(absolute_command, &checked);
+
+    char every_text[32];
+    format_duration(every_text, sizeof(every_text), every_ms);
+
+    struct pollfd fds[REPEAT_MAX_FDS + 1];
+    int nfds = repeat_fds(&repeat, fds);
+    fds[nfds].fd = stop_pipe[0];
+    fds[nfds].events = POLLIN;
+    nfds++;
+
+    unsigned long runs = 0;
+    long long late_total = 0, late_max = 0;
+    int exitstatus = 0;
+    struct repeat_run run;
+
+    while (!stopping) {
+        if (!repeat_next(&repeat, &run)) {
+            for (int i = 0; i < nfds; i++) {
+                fds[i].revents = 0;
+            }
+            if (poll(fds, nfds, -1) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error(ctx, "Cannot wait to repeat %s: %s", absolute_command, strerror(errno));
+                exit(ROOT_SYSTEM_ERROR);
+            }
+            repeat_check(&repeat, fds, nfds - 1);
+            continue;
+        }
+
+        struct binary now;
+        if (stat_binary(absolute_command, &now) == -1 || !same_binary(&now, &checked)) {
+            info(ctx, "%s has changed, checking it again", absolute_command);
+            get_command_to_run(args[0], res);
+            ensure_allowed(absolute_command, args);
+            if (exec_fd != -1) {
+                close(exec_fd);
+            }
+            exec_fd = ensure_verified(absolute_command);
+            stat_binary(absolute_command, &checked);
+        }
+
+        runs++;
+        late_total += run.late_ns;
+        if (run.late_ns > late_max) {
+            late_max = run.late_ns;
+        }
+
+        char late[32], coalesced[48], stage[STAGE_TEXT_MAX];
+        format_late(late, sizeof(late), run.late_ns);
+        coalesced[0] = '\0';
+        if (run.coalesced > 0) {
+            snprintf(coalesced, sizeof(coalesced), ", %lu more coalesced", run.coalesced);
+        }
+        if (run.cause == REPEAT_TIMER) {
+            snprintf(stage, sizeof(stage), "run %lu, every %s, late %s%s",
+                     runs, every_text, late, coalesced);
+        }
+        else if (run.cause == REPEAT_CHANGE) {
+            snprintf(stage, sizeof(stage), "run %lu, on change to %.*s, late %s%s",
+                     runs, ROOT_PATH_MAX, run.path, late, coalesced);
+        }
+        else {
+            snprintf(stage, sizeof(stage), "run %lu, late %s", runs, late);
+        }
+        log_running(absolute_command, args, stage, NULL);
+
+        /* logged as the caller, so only the child becomes the target */
+        struct root_spawn_opts spawn;
+        root_spawn_opts_init(&spawn);
+        spawn.uid = target_uid;
+        spawn.set_home = set_home;
+        spawn.new_group = 1;
+        spawn.exec_fd = exec_fd;
+
+        report_memory();
+
+        pid_t pid;
+        int status = root_spawn(ctx, absolute_command, args, &spawn, &pid);
+        if (status != 0) {
+            exit(status);
+        }
+
+        struct deadline deadline;
+        supervise(absolute_command, pid, 1, &deadline);
+        /* as supervise does, but also stopping */
+        signal(SIGTERM, stop_repeating);
+        signal(SIGHUP, stop_repeating);
+        if (!gave_terminal) {
+            signal(SIGINT, stop_repeating);
+        }
+
+        /* keep taking in triggers, so the next run is on time */
+        while (!deadline.exited) {
+            if (wait_for(absolute_command, &deadline, fds, nfds) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error(ctx, "Cannot wait for %s: %s", absolute_command, strerror(errno));
+                break;
+            }
+            repeat_check(&repeat, fds, nfds - 1);
+        }
+
+        exitstatus = finish(absolute_command, &deadline);
+        child = -1;
+        gave_terminal = 0;
+        signal(SIGINT, stop_repeating);
+        if (exitstatus == 128 + SIGINT) {
+            /* the terminal interrupted it, so the user wants to stop */
+            stopping = 1;
+        }
+    }
+
+    char late_mean[32], late_most[32];
+    format_late(late_mean, sizeof(late_mean), runs > 0 ? late_total / (long long)runs : 0);
+    format_late(late_most, sizeof(late_most), late_max);
+    info(ctx, "Stopped repeating %s after %lu runs (late %s on average, %s at most)",
+         absolute_command, runs, late_mean, late_most);
+    repeat_close(&repeat);
+    exit(exitstatus);
+}
+
+/**
+ * Do --write, --append, --copy or --read, instead of running tee, cp or cat
+ * as another command.
+ *
+ * The files are resolved as realpath(3) would (see fileops_resolve), and
+ * the operation is checked against the policy as if it were a command
+ * called "--write" (etc.) with the resolved files as its arguments, and
+ * logged the same way, e.g. "Running --write /etc/motd".  Then root becomes
+ * the target user and does it in-process (see fileops.h).
+ *
+ * Does not return: exits with 0, or 1 if the operation fails, as tee, cp
+ * and cat would.
+ */
+void run_fileop(void)
+{
+    static char files[2][PATH_MAX];
+    const char *name = fileops_name(fileop);
+    int nfiles = fileop == FILEOP_COPY ? 2 : 1;
+
+    for (int i = 0; i < nfiles; i++) {
+        int reading = fileop == FILEOP_READ || (fileop == FILEOP_COPY && i == 0);
+        if (fileops_resolve(fileop_files[i], !reading, i == 1 ? fileop_files[0] : NULL,
+                            files[i]) == -1) {
+            error(ctx, "Cannot %s %s: %s", reading ? "read" : "write",
+                  fileop_files[i], strerror(errno));
+            trace_outcome("not-found");
+            exit(1);
+        }
+    }
+
+    const char *argv[] = { name, files[0], nfiles == 2 ? files[1] : NULL, NULL };
+    static char text[2 * ESCAPED_PATH_MAX + 16];
+    format_args(text, sizeof(text), argv);
+
+    int status = root_check_policy(ctx, name, argv);
+    if (status == ROOT_PERMISSION_DENIED) {
+        refuse(ctx, status, "You are not permitted to run %s", text);
+        trace_outcome("disallowed");
+    }
+    if (status != 0) {
+        exit(status);
+    }
+
+    take_lock();
+    log_record(text, argv, NULL, NULL);
+    become_target();
+    report_memory();
+
+    long long bytes = 0;
+    const char *failed = NULL;
+    int result;
+    switch (fileop) {
+    case FILEOP_WRITE:
+        result = fileops_write(files[0], STDIN_FILENO, &bytes, &failed);
+        break;
+    case FILEOP_APPEND:
+        result = fileops_append(files[0], STDIN_FILENO, &bytes, &failed);
+        break;
+    case FILEOP_COPY:
+        result = fileops_copy(files[0], files[1], &bytes, &failed);
+        break;
+    default:
+        result = fileops_read(files[0], STDOUT_FILENO, &bytes, &failed);
+        break;
+    }
+    if (result == -1) {
+        if (failed == NULL) {
+            error(ctx, "Cannot %s: %s",
+                  fileop == FILEOP_READ ? "write standard output" : "read standard input",
+                  strerror(errno));
+        }
+        else {
+            error(ctx, "Cannot %s %s: %s",
+                  failed == files[0] && (fileop == FILEOP_READ || fileop == FILEOP_COPY)
+                  ? "read" : "write",
+                  failed, strerror(errno));
+        }
+        exit(1);
+    }
+    debug(ctx, "Moved %lld bytes", bytes);
+    exit(0);
+}
+
+/**
+ * Run a pipeline, with one permission check and one switch to root (or
+ * the -u user) for all of its stages.
+ *
+ * args is split into stages at each pipeline_delimiter.  Every stage is
+ * resolved and checked exactly as a single command would be (see
+ * get_command_to_run), and logged, before any of them is started.  The
+ * stages are then connected with pipes and started directly, never by a
+ * shell.
+ *
+ * Does not return: exits with the status of the last stage that failed
+ * (128 plus the signal number if it was killed), or 0 if none did, like a
+ * shell with pipefail set.
+ */
+void run_pipeline(const char *const *args)
+{
+    size_t nargs = 0;
+    while (args[nargs] != NULL) {
+        nargs++;
+    }
+
+    const char **split = root_ctx_alloc(ctx, (nargs + 1) * sizeof(*split));
+    if (split == NULL) {
+        error(ctx, "Cannot allocate memory for pipeline");
+        exit(ROOT_SYSTEM_ERROR);
+    }
+    memcpy(split, args, (nargs + 1) * sizeof(*split));
+
+    const char **stages[PIPELINE_MAX_STAGES];
+    int nstages = split_pipeline(split, pipeline_delimiter, stages, PIPELINE_MAX_STAGES);
+    if (nstages == -1) {
+        error(ctx, "A pipeline needs 1 to %d commands separated by %s",
+              PIPELINE_MAX_STAGES, pipeline_delimiter);
+        trace_outcome("usage");
+        exit(ROOT_INVALID_USAGE);
+    }
+    trace.stages = nstages;
+
+    static struct root_resolution resolution;
+    char *commands[PIPELINE_MAX_STAGES];
+    int exec_fds[PIPELINE_MAX_STAGES];
+    for (int i = 0; i < nstages; i++) {
+        if (*stages[i][0] == '\0') {
+            error(ctx, "Command is empty");
+            trace_outcome("usage");
+            exit(ROOT_INVALID_USAGE);
+        }
+        get_command_to_run(stages[i][0], &resolution);
+        root_prefetch_command(ctx, resolution.absolute_command);
+        ensure_allowed(resolution.absolute_command, stages[i]);
+        exec_fds[i] = ensure_verified(resolution.absolute_command);
+        commands[i] = root_ctx_strdup(ctx, resolution.absolute_command);
+        if (commands[i] == NULL) {
+            error(ctx, "Cannot allocate memory for pipeline");
+            exit(ROOT_SYSTEM_ERROR);
+        }
+    }
+
+    /* held until the last stage exits, since we wait for them all */
+    take_lock();
+
+    /* Do this before become_target so we can log the calling username/uid. */
+    for (int i = 0; i < nstages; i++) {
+        char stage[64];
+        snprintf(stage, sizeof(stage), "pipeline stage %d of %d", i + 1, nstages);
+        log_running(commands[i], stages[i], stage, NULL);
+    }
+
+    become_target();
+
+    report_memory();
+
+    /*
+     * Each stage reads from the pipe the last one writes to.  Our copies of
+     * the pipes are close-on-exec, and closed as soon as they're handed on,
+     * so each stage sees end of file (or SIGPIPE) when its neighbour exits.
+     * If a stage can't be started, the ones already running find out the
+     * same way when we exit.
+     */
+    static pid_t pids[PIPELINE_MAX_STAGES];
+    int input = -1;
+    for (int i = 0; i < nstages; i++) {
+        int fds[2] = { -1, -1 };
+        if (i < nstages - 1) {
+            if (pipe(fds) == -1) {
+                error(ctx, "Cannot create pipe for pipeline: %s", strerror(errno));
+                exit(ROOT_SYSTEM_ERROR);
+            }
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        }
+
+        /* we have already become the target user */
+        struct root_spawn_opts spawn;
+        root_spawn_opts_init(&spawn);
+        spawn.fds[STDIN_FILENO] = input;
+        spawn.fds[STDOUT_FILENO] = fds[1];
+        spawn.become = 0;
+        spawn.exec_fd = exec_fds[i];
+
+        int status = root_spawn(ctx, commands[i], stages[i], &spawn, &pids[i]);
+        if (status != 0) {
+            exit(status);
+        }
+        if (input != -1) {
+            close(input);
+        }
+        if (fds[1] != -1) {
+            close(fds[1]);
+        }
+        input = fds[0];
+    }
+
+    /* as for a single command, see supervise */
+    stage_pids = pids;
+    nstage_pids = nstages;
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, forward_signal);
+    signal(SIGHUP, forward_signal);
+
+    int statuses[PIPELINE_MAX_STAGES];
+    int running = nstages;
+    while (running > 0) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error(ctx, "Cannot wait for pipeline: %s", strerror(errno));
+            exit(ROOT_SYSTEM_ERROR);
+        }
+        for (int i = 0; i < nstages; i++) {
+            if (pids[i] == pid) {
+                statuses[i] = wait_status_to_exit(status);
+                running--;
+            }
+        }
+    }
+
+    int exitstatus = 0;
+    for (int i = 0; i < nstages; i++) {
+        if (statuses[i] != 0) {
+            exitstatus = statuses[i];
+        }
+    }
+    exit(exitstatus);
+}
+
+/*
+ * Tell a benchmark how much memory root allocated.
+ *
+ * If ROOT_BENCH_FD names a file descriptor the caller gave us, write
+ * "arena_bytes=<peak>" to it.  Used by rootbench -m.  Only root-bench,
+ * which make builds with -DROOT_BENCH and never installs, does this: the
+ * caller chooses the descriptor, which root writes to and closes with its
+ * own privileges.
+ */
+void report_memory(void)
+{
+#ifdef ROOT_BENCH
+    const char *fdenv = getenv("ROOT_BENCH_FD");
+    if (fdenv == NULL) {
+        return;
+    }
+
+    char *end;
+    errno = 0;
+    long fd = strtol(fdenv, &end, 10);
+    if (errno != 0 || end == fdenv || *end != '\0' || fd < 0 || fd > INT_MAX) {
+        return;
+    }
+    dprintf((int)fd, "arena_bytes=%lu\n", (unsigned long)root_ctx_peak(ctx));
+    close((int)fd);
+#endif
+}
+
+/*
+ * Trace this invocation, if TRACE_PATH exists (see trace.h).
+ *
+ * Counts its arguments and environment now, before anything changes them.
+ * The record is written once, by log_running or, if root stops before
+ * that, when it exits, with the outcome last given to trace_outcome.
+ */
+void start_trace(int argc, const char *const *argv)
+{
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    strcpy(trace.outcome, "usage");
+
+    trace_fd = trace_open(TRACE_PATH);
+    if (trace_fd == -1) {
+        return;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        trace.argc++;
+        trace.argv_bytes += strlen(argv[i]) + 1;
+    }
+    for (char **var = environ; *var != NULL; var++) {
+        trace.envc++;
+        trace.env_bytes += strlen(*var) + 1;
+    }
+    atexit(write_trace);
+}
+
+/*
+ * Name the options in opts, without their values, for the trace.
+ */
+void trace_options(const struct options *opts)
+{
+    const char *names[16];
+    int n = 0;
+
+    if (opts->debug) {
+        names[n++] = "debug";
+    }
+    if (!opts->set_home) {
+        names[n++] = "nohome";
+    }
+    if (opts->user != NULL) {
+        names[n++] = "user";
+    }
+    if (opts->record) {
+        names[n++] = "record";
+    }
+    if (opts->resolve) {
+        names[n++] = "resolve";
+    }
+    if (opts->timeout_ms > 0) {
+        names[n++] = "timeout";
+    }
+    if (opts->kill_after_ms != DEFAULT_KILL_AFTER_MS) {
+        names[n++] = "kill-after";
+    }
+    if (opts->pipeline) {
+        names[n++] = "pipeline";
+    }
+    if (opts->slots == 1) {
+        names[n++] = "lock";
+    }
+    else if (opts->slots > 1) {
+        names[n++] = "slots";
+    }
+    if (opts->every_ms > 0) {
+        names[n++] = "every";
+    }
+    if (opts->nwatch > 0) {
+        names[n++] = "on-change";
+    }
+    if (opts->fileop != FILEOP_NONE) {
+        /* without the dashes */
+        names[n++] = fileops_name(opts->fileop) + 2;
+    }
+    if (opts->ns_pid > 0) {
+        names[n++] = "ns";
+    }
+    if (opts->low_memory) {
+        names[n++] = "low-memory";
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < n; i++) {
+        len += snprintf(trace.options + len, sizeof(trace.options) - len, "%s%s",
+                        i > 0 ? "," : "", names[i]);
+    }
+}
+
+/*
+ * Say why root stopped, if it stops before logging Running, e.g.
+ * "denied".
+ */
+void trace_outcome(const char *outcome)
+{
+    snprintf(trace.outcome, sizeof(trace.outcome), "%s", outcome);
+}
+
+/*
+ * How long root has taken so far, for the trace and the Running record.
+ */
+long elapsed_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - trace_start.tv_sec) * 1000000L
+           + (now.tv_nsec - trace_start.tv_nsec) / 1000;
+}
+
+void write_trace(void)
+{
+    if (trace_fd == -1) {
+        return;
+    }
+
+    trace.us = elapsed_us();
+
+    char line[TRACE_LINE_MAX];
+    int len = trace_format(&trace, line, sizeof(line));
+    /* one write, so lines from different invocations don't mix */
+    if (len != -1 && write(trace_fd, line, len) != len) {
+        debug(ctx, "Cannot write %s: %s", TRACE_PATH, strerror(errno));
+    }
+    forget_trace();
+}
+
+/*
+ * Leave the trace to another process, e.g. a child that carries on.
+ */
+void forget_trace(void)
+{
+    if (trace_fd != -1) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+}
+
+/*
+ * Start this invocation's flight record (see flight.h), which is written
+ * once: by become_target, just before the command runs, or when root
+ * exits, if it stops before that.
+ */
+void start_flight(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    flight_rec.time_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    flight_rec.pid = (uint32_t)getpid();
+    flight_rec.ruid = (uint32_t)getuid();
+    atexit(write_flight_at_exit);
+}
+
+/*
+ * Map the flight recorder and claim this invocation's record, if that
+ * hasn't been done, so that writing the record needn't.
+ */
+void open_flight(void)
+{
+    if (flight_state == -1) {
+        flight_state = flight_open(&flight, FLIGHT_PATH, 0) == 0;
+        if (!flight_state) {
+            debug(ctx, "Cannot open %s: %s", FLIGHT_PATH, strerror(errno));
+        }
+        flight_seq = flight_claim(&flight);
+    }
+}
+
+void begin_phase(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+}
+
+/*
+ * Add the time since begin_phase to phase, which may have been timed
+ * before, e.g. for each stage of a pipeline.
+ */
+void end_phase(enum flight_phase phase)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ns = (uint64_t)(now.tv_sec - phase_start.tv_sec) * 1000000000
+                  + now.tv_nsec - phase_start.tv_nsec;
+    ns += flight_rec.phase_ns[phase];
+    flight_rec.phase_ns[phase] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+/*
+ * Write the flight record, if it hasn't been, with outcome (as in the
+ * trace) and status.
+ */
+void write_flight(const char *outcome, int status)
+{
+    if (flight_written) {
+        return;
+    }
+    flight_written = 1;
+
+    open_flight();
+    if (flight_state != 1) {
+        return;
+    }
+
+    snprintf(flight_rec.outcome, sizeof(flight_rec.outcome), "%s", outcome);
+    flight_rec.status = (int16_t)status;
+    long probed = trace.qualified ? 0 : trace.path_hit > 0 ? trace.path_hit : trace.path_entries;
+    flight_rec.probed = probed > UINT16_MAX ? UINT16_MAX : (uint16_t)probed;
+    long us = elapsed_us();
+    flight_rec.total_us = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    flight_write(&flight, flight_seq, &flight_rec);
+}
+
+/*
+ * root's own status when it stopped with outcome, as far as the outcome
+ * says
+ */
+static int outcome_status(const char *outcome)
+{
+    static const struct {
+        const char *outcome;
+        int status;
+    } statuses[] = {
+        { "usage", ROOT_INVALID_USAGE },
+        { "denied", ROOT_PERMISSION_DENIED },
+        { "disallowed", ROOT_PERMISSION_DENIED },
+        { "unverified", ROOT_PERMISSION_DENIED },
+        { "not-found", ROOT_COMMAND_NOT_FOUND },
+        { "realpath", ROOT_COMMAND_NOT_FOUND },
+        { "relative", ROOT_RELATIVE_PATH_DISALLOWED },
+    };
+    for (size_t i = 0; i < sizeof(statuses) / sizeof(statuses[0]); i++) {
+        if (strcmp(outcome, statuses[i].outcome) == 0) {
+            return statuses[i].status;
+        }
+    }
+    return FLIGHT_UNKNOWN;
+}
+
+void write_flight_at_exit(void)
+{
+    write_flight(trace.outcome, outcome_status(trace.outcome));
+}
+
+/*
+ * Leave the flight record to another process, e.g. a child that carries
+ * on.
+ */
+void forget_flight(void)
+{
+    flight_written = 1;
 }
 
 void usage(void)
 {
-    print("Usage: root [-d | --debug] [-H | --nohome | --home] <command> [<argument>]...\n");
+    print("Usage: root [-d | --debug] [-H | --nohome | --home] [-u <user>] [--record]\n");
+    print("            [--timeout <duration> [--kill-after <duration>]] [--low-memory]\n");
+    print("            [--lock <name> | --slots <name>:<count>]\n");
+    print("            [--every <duration>] [--on-change <path>]... <command> [<argument>]...\n");
+    print("       root [-u <user>] [--lock <name> | --slots <name>:<count>]\n");
+    print("            (--write <file> | --append <file> | --copy <from> <to> | --read <file>)\n");
+    print("       root [--timeout <duration> [--kill-after <duration>]]\n");
+    print("            [--lock <name> | --slots <name>:<count>] --ns <pid> <command> [<argument>]...\n");
+    print("       root --pipeline[=<delimiter>] <command> [<argument>]... [:: <command> [<argument>]...]...\n");
+    print("       root --resolve [<command>]...\n");
 }
 
 /* vim: set ts=4 sw=4 tw=0 et:*/
@@ -15,6 +15,7 @@
  *     maybe it should just be one exit code
  *     so it doesn't mask the called program's exit status
  */
+#define ROOT_TIMED_OUT                  120
 #define ROOT_PROGRAMMER_ERROR           121
 #define ROOT_INVALID_USAGE              122
 #define ROOT_PERMISSION_DENIED          123
@@ -0,0 +1,331 @@
+/*
+ * rootbench
+ *
+ * run a command repeatedly and report how expensive it was to start
+ *
+ * Usage: rootbench [-n runs] [-s] [-m] [-c] [-i input] command [argument]...
+ *
+ * With -i, every run reads input from the start as its stdin; otherwise
+ * the runs share rootbench's stdin.
+ *
+ * With -c, the page cache is dropped before each run (Linux only, and only
+ * as root), so that every run reads the command, root and their libraries
+ * from disk, as the first run after boot would.
+ *
+ * Prints one line of key=value pairs:
+ *   runs        number of timed runs
+ *   exit        exit status of the last run (128 + signal if killed)
+ *   wall_us_*   wall-clock time per run in microseconds (min, median, p90)
+ *   maxrss_kb   largest peak resident set size of any run
+ *   syscalls    (with -s, Linux only) system calls made by the command
+ *               itself, up to the point it execs another program
+ *   arena_bytes (with -m) the most memory the C root allocated, as
+ *               root-bench reports through ROOT_BENCH_FD, or -1 if it
+ *               didn't (any other build, including the installed root)
+ *
+ * The command's stdout and stderr are discarded.  Used by difftest.sh.
+ */
+
+#define _DEFAULT_SOURCE /* for wait4(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for wait4() */
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RUNS 10000
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rootbench [-n runs] [-s] [-m] [-c] [-i input] command [argument]...\n");
+    exit(2);
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* see -i */
+static const char *input = NULL;
+
+static void quiet_child(void)
+{
+    if (input != NULL) {
+        int fd = open(input, O_RDONLY);
+        if (fd == -1) {
+            _exit(127);
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    int devnull = open("/dev/null", O_RDWR);
+    if (devnull != -1) {
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(devnull);
+    }
+}
+
+static int exit_status(int status)
+{
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+/*
+ * Make the next run start with nothing cached, see -c.
+ */
+static void drop_caches(void)
+{
+#ifdef __linux__
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd == -1 || write(fd, "1\n", 2) != 2) {
+        perror("rootbench: /proc/sys/vm/drop_caches");
+        exit(1);
+    }
+    close(fd);
+#else
+    fprintf(stderr, "rootbench: -c is only supported on Linux\n");
+    exit(1);
+#endif
+}
+
+/*
+ * Run argv once, storing its wall time in *nsp and peak RSS in *maxrssp.
+ * Returns the exit status.
+ */
+static int run_once(char *const *argv, long long *nsp, long *maxrssp)
+{
+    long long start = now_ns();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("rootbench: fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        quiet_child();
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) == -1) {
+        if (errno != EINTR) {
+            perror("rootbench: wait4");
+            exit(1);
+        }
+    }
+    *nsp = now_ns() - start;
+    *maxrssp = ru.ru_maxrss;
+    return exit_status(status);
+}
+
+#ifdef __linux__
+/*
+ * Count the system calls argv makes before it execs something else.
+ *
+ * Returns the count, or -1 if the command could not be traced.
+ */
+static long count_syscalls(char *const *argv)
+{
+    pid_t pid = fork();
+    if (pid == -1) {
+        return -1;
+    }
+    if (pid == 0) {
+        quiet_child();
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) {
+            _exit(127);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    /* the first stop is our own execv */
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           (void *)(long)(PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACEEXEC|PTRACE_O_EXITKILL));
+
+    long stops = 0;
+    int sig = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) == -1) {
+            break;
+        }
+        sig = 0;
+        if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+            break;
+        }
+        if (WSTOPSIG(status) == (SIGTRAP|0x80)) {
+            stops++;
+        }
+        else if (status >> 8 == (SIGTRAP|(PTRACE_EVENT_EXEC << 8))) {
+            /* the command is running now, the rest is not ours */
+            ptrace(PTRACE_DETACH, pid, NULL, NULL);
+            break;
+        }
+        else {
+            sig = WSTOPSIG(status);
+        }
+    }
+    waitpid(pid, &status, 0);
+
+    /* each call stops once on entry and once on exit, except the execve */
+    return (stops + 1) / 2;
+}
+#endif
+
+/*
+ * Ask the command how much memory it allocated.
+ *
+ * The C root built as root-bench writes "arena_bytes=<n>" to the
+ * descriptor named by ROOT_BENCH_FD just before it execs.  The figure doesn't vary between
+ * runs, so one untimed run is enough.
+ *
+ * Returns the figure, or -1 if the command didn't report one.
+ */
+static long arena_bytes(char *const *argv)
+{
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        return -1;
+    }
+    if (pid == 0) {
+        char fdenv[16];
+        close(fds[0]);
+        snprintf(fdenv, sizeof(fdenv), "%d", fds[1]);
+        setenv("ROOT_BENCH_FD", fdenv, 1);
+        quiet_child();
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    char buf[64];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(buf) - 1
+           && (n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        len += n;
+    }
+    buf[len] = '\0';
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    long bytes;
+    if (sscanf(buf, "arena_bytes=%ld", &bytes) != 1) {
+        return -1;
+    }
+    return bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 20;
+    int syscalls = 0;
+    int memory = 0;
+    int cold = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+n:smci:")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = atoi(optarg);
+            if (runs < 1 || runs > MAX_RUNS) {
+                usage();
+            }
+            break;
+        case 's':
+            syscalls = 1;
+            break;
+        case 'm':
+            memory = 1;
+            break;
+        case 'c':
+            cold = 1;
+            break;
+        case 'i':
+            input = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc) {
+        usage();
+    }
+    char *const *command = argv + optind;
+
+    static long long times[MAX_RUNS];
+    long maxrss = 0;
+    int status = 0;
+    for (int i = 0; i < runs; i++) {
+        long rss;
+        if (cold) {
+            drop_caches();
+        }
+        status = run_once(command, &times[i], &rss);
+        if (rss > maxrss) {
+            maxrss = rss;
+        }
+    }
+    qsort(times, runs, sizeof(times[0]), compare_ll);
+
+    printf("runs=%d exit=%d wall_us_min=%lld wall_us_median=%lld wall_us_p90=%lld maxrss_kb=%ld",
+           runs, status,
+           times[0] / 1000, times[runs / 2] / 1000, times[runs * 9 / 10] / 1000,
+           maxrss);
+#ifdef __linux__
+    if (syscalls) {
+        printf(" syscalls=%ld", count_syscalls(command));
+    }
+#endif
+    if (memory) {
+        printf(" arena_bytes=%ld", arena_bytes(command));
+    }
+    printf("\n");
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,138 @@
+/*
+ * rootflight
+ *
+ * print the last invocations of root from its flight recorder
+ *
+ * Usage: rootflight [-n count] [ring]
+ *
+ * ring is FLIGHT_PATH (see flight.h) by default, and count 20.  Prints one
+ * line of key=value pairs for each invocation, oldest first:
+ *   time        when root started, local time to the microsecond
+ *   pid, uid    the process and the user who ran it
+ *   status      root's exit status, "ran" if it went on to run the command,
+ *               or "-" if the outcome doesn't say
+ *   outcome     as in the trace, e.g. "ran", "denied" or "not-found"
+ *   probed      PATH entries looked in
+ *   *_ns        how long each phase took, in nanoseconds: setting up
+ *               logging, checking permission, resolving the command,
+ *               looking up the target user and groups, and switching to it
+ *   total_us    from starting to running the command, or exiting
+ * e.g.
+ *   time=2026-10-18T16:10:01.123456+0000 pid=4242 uid=1000 status=ran
+ *   outcome=ran probed=3 logging_ns=41250 permission_ns=2100
+ *   resolution_ns=18400 nss_ns=310200 setuid_ns=5200 total_us=702
+ * (on one line).
+ *
+ * Reading the ring needs the same privilege as writing it, so run this as
+ * root.  Exits 0, or 2 on error.
+ */
+
+#define _DEFAULT_SOURCE /* for localtime_r() and getopt(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for localtime_r() and getopt() */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rootflight [-n count] [ring]\n");
+    exit(2);
+}
+
+static void print_record(const struct flight_record *rec)
+{
+    char when[64] = "?";
+    time_t sec = (time_t)(rec->time_ns / 1000000000);
+    struct tm tm;
+    if (localtime_r(&sec, &tm) != NULL) {
+        char date[32], zone[8];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+        strftime(zone, sizeof(zone), "%z", &tm);
+        snprintf(when, sizeof(when), "%s.%06ld%s", date,
+                 (long)(rec->time_ns % 1000000000 / 1000), zone);
+    }
+
+    char status[16];
+    if (rec->status == FLIGHT_RAN) {
+        strcpy(status, "ran");
+    }
+    else if (rec->status == FLIGHT_UNKNOWN) {
+        strcpy(status, "-");
+    }
+    else {
+        snprintf(status, sizeof(status), "%d", rec->status);
+    }
+
+    char outcome[sizeof(rec->outcome) + 1];
+    memcpy(outcome, rec->outcome, sizeof(rec->outcome));
+    outcome[sizeof(rec->outcome)] = '\0';
+
+    printf("time=%s pid=%lu uid=%lu status=%s outcome=%s probed=%u"
+           " logging_ns=%lu permission_ns=%lu resolution_ns=%lu nss_ns=%lu"
+           " setuid_ns=%lu total_us=%lu\n",
+           when, (unsigned long)rec->pid, (unsigned long)rec->ruid, status,
+           outcome[0] != '\0' ? outcome : "-", (unsigned)rec->probed,
+           (unsigned long)rec->phase_ns[FLIGHT_LOGGING],
+           (unsigned long)rec->phase_ns[FLIGHT_PERMISSION],
+           (unsigned long)rec->phase_ns[FLIGHT_RESOLUTION],
+           (unsigned long)rec->phase_ns[FLIGHT_NSS],
+           (unsigned long)rec->phase_ns[FLIGHT_SETUID],
+           (unsigned long)rec->total_us);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            if (count <= 0) {
+                usage();
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind > 1) {
+        usage();
+    }
+    const char *path = optind < argc ? argv[optind] : FLIGHT_PATH;
+    if (count > FLIGHT_RECORDS) {
+        count = FLIGHT_RECORDS;
+    }
+
+    struct flight f;
+    if (flight_open(&f, path, 1) == -1) {
+        if (errno == ENOENT) {
+            /* root hasn't run since boot */
+            return 0;
+        }
+        fprintf(stderr, "rootflight: Cannot open %s: %s\n", path, strerror(errno));
+        return 2;
+    }
+
+    static struct flight_record records[FLIGHT_RECORDS];
+    int n = flight_read(&f, records, count);
+    for (int i = 0; i < n; i++) {
+        print_record(&records[i]);
+    }
+    flight_close(&f);
+
+    if (fflush(stdout) == EOF) {
+        fprintf(stderr, "rootflight: Cannot write: %s\n", strerror(errno));
+        return 2;
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
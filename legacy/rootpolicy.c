@@ -0,0 +1,81 @@
+/*
+ * rootpolicy
+ *
+ * compile root's command allowlist, or ask a compiled one a question
+ *
+ * Usage: rootpolicy <source> <table>
+ *        rootpolicy -c <table> <group> <command> [<argument>]...
+ *
+ * See policy.h for the source format.  With -c, prints "allowed" or
+ * "denied" for a member of <group> running <command>, exiting 0 or 1,
+ * or 2 if the table cannot be used (in which case root ignores it).
+ */
+
+#define _DEFAULT_SOURCE /* for realpath(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for realpath() */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <grp.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "policy.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rootpolicy <source> <table>\n");
+    fprintf(stderr, "       rootpolicy -c <table> <group> <command> [<argument>]...\n");
+    exit(2);
+}
+
+static int check(const char *table, const char *group, const char *const *argv)
+{
+    gid_t gid;
+    if (isdigit((unsigned char)group[0])) {
+        gid = (gid_t)strtoul(group, NULL, 10);
+    }
+    else {
+        struct group *gr = getgrnam(group);
+        if (gr == NULL) {
+            fprintf(stderr, "rootpolicy: Unknown group %s\n", group);
+            return 2;
+        }
+        gid = gr->gr_gid;
+    }
+
+    /* as root would see it */
+    char command[PATH_MAX];
+    if (realpath(argv[0], command) == NULL) {
+        snprintf(command, sizeof(command), "%s", argv[0]);
+    }
+
+    struct policy policy;
+    if (policy_open(&policy, table) == -1) {
+        fprintf(stderr, "rootpolicy: Cannot use %s: %s\n", table,
+                errno == EINVAL ? "damaged or compiled for another machine"
+                                : strerror(errno));
+        return 2;
+    }
+    int permitted = policy_permits(&policy, &gid, 1, command, argv);
+    policy_close(&policy);
+
+    printf("%s\n", permitted ? "allowed" : "denied");
+    return permitted ? 0 : 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc >= 5 && strcmp(argv[1], "-c") == 0) {
+        return check(argv[2], argv[3], argv + 4);
+    }
+    if (argc != 3 || argv[1][0] == '-') {
+        usage();
+    }
+    return policy_compile(argv[1], argv[2]) == 0 ? 0 : 1;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
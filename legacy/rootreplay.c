@@ -0,0 +1,808 @@
+/*
+ * rootreplay
+ *
+ * replay a trace of real invocations of root against one or two builds
+ *
+ * Usage: rootreplay [-n runs] [-s shim] [-u user] trace root [other-root]
+ *
+ * trace is a copy of TRACE_PATH (see trace.h): one line for each time root
+ * was run, with the counts and sizes of its arguments, environment and
+ * PATH, which options it was given, and what happened.  For each line,
+ * rootreplay builds the same shape in a temporary directory: a PATH with
+ * as many entries of about the same length, the command in the same entry
+ * (or in none, or in a relative one), and arguments and an environment of
+ * the same number and size.  It then runs each build runs times (default
+ * 1) with that PATH, arguments and environment, alternating between them,
+ * and times it.  The command is true(1), so the times are root's own.
+ *
+ * Option values are replaced: -u with user (default root), --timeout with
+ * 60s, --lock and --slots with a lock called rootreplay, file operations
+ * with files in the temporary directory, and --ns with a process started
+ * with the right PATH.  Lines with --record, --every or --on-change, or
+ * that root stopped for reasons a temporary directory can't reproduce
+ * (the allowlist, the manifest, or errors), are skipped.  Refusals are
+ * replayed as nobody, which needs rootreplay to run as root; so do -u and
+ * --ns.
+ *
+ * Each replayed run should exit as the original did; one that doesn't is
+ * counted as mismatched.
+ *
+ * Prints, for each build, one line of key=value pairs for all runs and one
+ * for each outcome:
+ *   records     lines in the trace
+ *   replayed    lines replayed, and skipped, those that weren't
+ *   mismatched  runs that exited differently from the original
+ *   wall_us_*   wall-clock time per run in microseconds (min, median, p90,
+ *               p99, max)
+ * and with two builds, how much the second's times differ from the first's.
+ *
+ * With -s, the builds run with shim (testshim.so) preloaded: syslog goes
+ * to /dev/null, and the replayed runs don't add to the trace.  Without it
+ * they log to syslog as usual.
+ *
+ * Exits 0, 1 if any run was mismatched, or 2 on error.
+ */
+
+#define _DEFAULT_SOURCE /* for mkdtemp(), setgroups(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp(), setgroups() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAX_RUNS 1000
+#define MAX_BUILDS 2
+/* the most arguments or environment variables built for one run */
+#define MAX_STRINGS 100000
+/* the longest PATH entry built */
+#define MAX_ENTRY 200
+
+#define NOBODY_UID 65534
+
+/* root's exit statuses, see root.h */
+#define EXIT_USAGE 122
+#define EXIT_DENIED 123
+#define EXIT_RELATIVE 125
+#define EXIT_NOT_FOUND 127
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rootreplay [-n runs] [-s shim] [-u user] trace root [other-root]\n");
+    exit(2);
+}
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "rootreplay: %s: %s\n", what, strerror(errno));
+    exit(2);
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Times of runs, in nanoseconds.
+ */
+struct times {
+    long long *ns;
+    size_t count;
+    size_t max;
+};
+
+static void add_time(struct times *t, long long ns)
+{
+    if (t->count == t->max) {
+        t->max = t->max == 0 ? 1024 : t->max * 2;
+        t->ns = realloc(t->ns, t->max * sizeof(t->ns[0]));
+        if (t->ns == NULL) {
+            fail("realloc");
+        }
+    }
+    t->ns[t->count++] = ns;
+}
+
+/* the percentile p of t, in microseconds, once sorted */
+static long long percentile(const struct times *t, int p)
+{
+    size_t i = t->count * p / 100;
+    return t->ns[i < t->count ? i : t->count - 1] / 1000;
+}
+
+static void print_times(struct times *t)
+{
+    qsort(t->ns, t->count, sizeof(t->ns[0]), compare_ll);
+    printf("wall_us_min=%lld wall_us_median=%lld wall_us_p90=%lld wall_us_p99=%lld "
+           "wall_us_max=%lld",
+           percentile(t, 0), percentile(t, 50), percentile(t, 90), percentile(t, 99),
+           percentile(t, 100));
+}
+
+/* the outcomes that can be replayed, and what root exits with for each */
+static const struct {
+    const char *name;
+    int status;
+} outcomes[] = {
+    { "ran", 0 },
+    { "usage", EXIT_USAGE },
+    { "denied", EXIT_DENIED },
+    { "not-found", EXIT_NOT_FOUND },
+    { "relative", EXIT_RELATIVE },
+    { "realpath", EXIT_NOT_FOUND },
+};
+#define NOUTCOMES (sizeof(outcomes) / sizeof(outcomes[0]))
+
+struct build {
+    const char *path;
+    struct times all;
+    struct times by_outcome[NOUTCOMES];
+    long mismatched;
+};
+
+/* the temporary directory, and the programs the fixtures run */
+static char work[1024];
+static char cwd[PATH_MAX];
+static const char *true_path;
+static const char *sleep_path;
+static const char *user = "root";
+static const char *shim = NULL;
+
+static const char *find_program(const char *name)
+{
+    static const char *const dirs[] = { "/bin", "/usr/bin" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s", dirs[i], name);
+        if (access(path, X_OK) == 0) {
+            char *found = strdup(path);
+            if (found == NULL) {
+                fail("strdup");
+            }
+            return found;
+        }
+    }
+    fprintf(stderr, "rootreplay: Cannot find %s\n", name);
+    exit(2);
+}
+
+/*
+ * Copy the file at from to name in the temporary directory, where nobody
+ * can run it too, and return the copy's path.
+ */
+static const char *copy_in(const char *from, const char *name)
+{
+    char to[PATH_MAX];
+    snprintf(to, sizeof(to), "%s/%s", work, name);
+    int in = open(from, O_RDONLY);
+    if (in == -1) {
+        fail(from);
+    }
+    int out = open(to, O_WRONLY|O_CREAT|O_EXCL, 0755);
+    if (out == -1) {
+        fail(to);
+    }
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, n) != n) {
+            fail(to);
+        }
+    }
+    if (n == -1 || close(out) == -1) {
+        fail(to);
+    }
+    close(in);
+    char *copy = strdup(to);
+    if (copy == NULL) {
+        fail("strdup");
+    }
+    return copy;
+}
+
+static void make_dir(const char *path)
+{
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        fail(path);
+    }
+}
+
+/* a command named cmd in dir, which runs true */
+static void make_command(const char *dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cmd", dir);
+    if (symlink(true_path, path) == -1 && errno != EEXIST) {
+        fail(path);
+    }
+}
+
+static void remove_tree(const char *path)
+{
+    struct stat st;
+    if (lstat(path, &st) == -1) {
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (dir != NULL) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                    continue;
+                }
+                char child[PATH_MAX];
+                snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+                remove_tree(child);
+            }
+            closedir(dir);
+        }
+        rmdir(path);
+    }
+    else {
+        unlink(path);
+    }
+}
+
+/*
+ * Entry i of a PATH whose entries are about len bytes long: an empty
+ * directory, or with hit, one holding cmd.
+ */
+static void path_entry(char *buf, size_t size, long i, long len, int hit)
+{
+    long width = len - (long)strlen(work) - 3;
+    if (width < 1) {
+        width = 1;
+    }
+    if (width > MAX_ENTRY) {
+        width = MAX_ENTRY;
+    }
+    char dir[sizeof(work) + 2];
+    snprintf(dir, sizeof(dir), "%s/%s", work, hit ? "h" : "p");
+    snprintf(buf, size, "%s/%0*ld", dir, (int)width, i);
+    make_dir(buf);
+    if (hit) {
+        make_command(buf);
+    }
+}
+
+/*
+ * One run's arguments or environment, in one block of memory.
+ */
+struct strings {
+    char *list[MAX_STRINGS + 1];
+    int count;
+    size_t bytes;               /* each with its NUL */
+};
+
+static void add_string(struct strings *s, const char *value)
+{
+    if (s->count == MAX_STRINGS) {
+        return;
+    }
+    s->list[s->count] = strdup(value);
+    if (s->list[s->count] == NULL) {
+        fail("strdup");
+    }
+    s->bytes += strlen(value) + 1;
+    s->list[++s->count] = NULL;
+}
+
+/* strings of about the same size, so that s has count and bytes as traced */
+static void pad_strings(struct strings *s, const char *prefix, long count, long bytes)
+{
+    long more = count - s->count;
+    if (more <= 0) {
+        return;
+    }
+    long left = bytes - (long)s->bytes;
+    char *buf = malloc(PATH_MAX * 16);
+    if (buf == NULL) {
+        fail("malloc");
+    }
+    for (long i = 0; i < more; i++) {
+        /* the remainder, shared among those left */
+        long len = left / (more - i) - 1;
+        int head = snprintf(buf, PATH_MAX * 16, "%s", prefix);
+        if (prefix[0] != '\0') {
+            head += snprintf(buf + head, PATH_MAX * 16 - head, "%ld=", i);
+        }
+        if (len > PATH_MAX * 16 - 1) {
+            len = PATH_MAX * 16 - 1;
+        }
+        if (len < head + 1) {
+            len = head + 1;
+        }
+        memset(buf + head, 'x', len - head);
+        buf[len] = '\0';
+        add_string(s, buf);
+        left -= len + 1;
+    }
+    free(buf);
+}
+
+static void free_strings(struct strings *s)
+{
+    for (int i = 0; i < s->count; i++) {
+        free(s->list[i]);
+    }
+    s->count = 0;
+    s->bytes = 0;
+    s->list[0] = NULL;
+}
+
+/* whether options, as traced, includes name */
+static int has_option(const char *options, const char *name)
+{
+    size_t len = strlen(name);
+    for (const char *p = options; *p != '\0'; p += strcspn(p, ",") + (p[strcspn(p, ",")] != '\0')) {
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * A run of one record: its arguments and environment, whether to run as
+ * nobody, and what it should exit with.
+ */
+struct replay {
+    struct strings argv;
+    struct strings envp;
+    int as_nobody;
+    int status;
+    int outcome;                /* index into outcomes */
+    pid_t target;               /* for --ns, or 0 */
+};
+
+static int find_outcome(const char *name)
+{
+    for (size_t i = 0; i < NOUTCOMES; i++) {
+        if (strcmp(outcomes[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* a process for --ns, with PATH in its environment */
+static pid_t start_target(char *const *envp)
+{
+    int ready[2];
+    if (pipe(ready) == -1) {
+        fail("pipe");
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        fail("fork");
+    }
+    if (pid == 0) {
+        close(ready[0]);
+        fcntl(ready[1], F_SETFD, FD_CLOEXEC);
+        char *argv[] = { "sleep", "1000", NULL };
+        execve(sleep_path, argv, envp);
+        _exit(127);
+    }
+    close(ready[1]);
+    /* closed once sleep is running, with its own environment */
+    char c;
+    while (read(ready[0], &c, 1) == -1 && errno == EINTR) {
+    }
+    close(ready[0]);
+    return pid;
+}
+
+/*
+ * Build the run for rec in r against root.  Returns 0, or -1 if rec can't
+ * be replayed.
+ */
+static int prepare(struct replay *r, const struct trace_record *rec, const char *root)
+{
+    r->outcome = find_outcome(rec->outcome);
+    if (r->outcome == -1) {
+        return -1;
+    }
+    r->status = outcomes[r->outcome].status;
+    r->as_nobody = strcmp(rec->outcome, "denied") == 0;
+    r->target = 0;
+    if (has_option(rec->options, "record") || has_option(rec->options, "every")
+        || has_option(rec->options, "on-change")) {
+        return -1;
+    }
+    if ((r->as_nobody || has_option(rec->options, "user") || has_option(rec->options, "ns"))
+        && geteuid() != 0) {
+        return -1;
+    }
+    int fileop = has_option(rec->options, "write") || has_option(rec->options, "append")
+                 || has_option(rec->options, "copy") || has_option(rec->options, "read");
+    int resolve = has_option(rec->options, "resolve");
+    int relative = strcmp(rec->outcome, "relative") == 0;
+    int not_found = strcmp(rec->outcome, "not-found") == 0
+                    || strcmp(rec->outcome, "realpath") == 0;
+
+    /* PATH, with the command in the same entry */
+    long hit = rec->path_hit;
+    if (resolve && rec->path_entries > 0) {
+        /* each name, found after looking everywhere */
+        hit = rec->path_entries;
+    }
+    if ((strcmp(rec->outcome, "ran") == 0 && !rec->qualified && !fileop && hit == 0)
+        || (relative && hit == 0)
+        /* a command found, whose real path couldn't be found */
+        || (strcmp(rec->outcome, "realpath") == 0 && !rec->qualified)) {
+        return -1;
+    }
+    long len = rec->path_entries > 0
+               ? (rec->path_bytes - (rec->path_entries - 1)) / rec->path_entries : 0;
+    char *pathenv = malloc(rec->path_entries * (PATH_MAX + 1) + 8);
+    if (pathenv == NULL) {
+        fail("malloc");
+    }
+    strcpy(pathenv, "PATH=");
+    size_t pathlen = 5;
+    for (long i = 1; i <= rec->path_entries; i++) {
+        char entry[PATH_MAX];
+        if (i == hit && relative) {
+            strcpy(entry, "rel");
+        }
+        else {
+            path_entry(entry, sizeof(entry), i, len, i == hit);
+        }
+        pathlen += sprintf(pathenv + pathlen, "%s%s", i > 1 ? ":" : "", entry);
+    }
+
+    /* the environment: PATH, the shim, then the rest */
+    r->envp.count = 0;
+    r->envp.bytes = 0;
+    r->envp.list[0] = NULL;
+    if (rec->path_entries > 0) {
+        add_string(&r->envp, pathenv);
+    }
+    free(pathenv);
+    if (shim != NULL) {
+        char var[PATH_MAX + 16];
+        snprintf(var, sizeof(var), "LD_PRELOAD=%s", shim);
+        add_string(&r->envp, var);
+        add_string(&r->envp, "ROOT_SHIM_SYSLOG=/dev/null");
+        add_string(&r->envp, "ROOT_SHIM_FAULTS=open@" TRACE_PATH "=fail:ENOENT");
+    }
+    pad_strings(&r->envp, "ROOT_REPLAY_", rec->envc, rec->env_bytes);
+
+    /* the arguments: root's options, then the command, then the rest */
+    char pidtext[32];
+    char file[PATH_MAX], copy[PATH_MAX], command[PATH_MAX];
+    /* one that can't be read, or written either */
+    snprintf(file, sizeof(file), "%s/%s", work, not_found ? "missing/file" : "file");
+    snprintf(copy, sizeof(copy), "%s/copy", work);
+    r->argv.count = 0;
+    r->argv.bytes = 0;
+    add_string(&r->argv, root);
+    /* root's own name isn't counted */
+    r->argv.bytes = 0;
+    if (strcmp(rec->outcome, "usage") == 0) {
+        add_string(&r->argv, "--rootreplay");
+    }
+    if (has_option(rec->options, "debug")) {
+        add_string(&r->argv, "-d");
+    }
+    if (has_option(rec->options, "nohome")) {
+        add_string(&r->argv, "-H");
+    }
+    if (has_option(rec->options, "low-memory")) {
+        add_string(&r->argv, "--low-memory");
+    }
+    if (has_option(rec->options, "user")) {
+        add_string(&r->argv, "-u");
+        add_string(&r->argv, user);
+    }
+    if (has_option(rec->options, "timeout")) {
+        add_string(&r->argv, "--timeout");
+        add_string(&r->argv, "60");
+    }
+    if (has_option(rec->options, "kill-after")) {
+        add_string(&r->argv, "--kill-after");
+        add_string(&r->argv, "10");
+    }
+    if (has_option(rec->options, "lock")) {
+        add_string(&r->argv, "--lock");
+        add_string(&r->argv, "rootreplay");
+    }
+    if (has_option(rec->options, "slots")) {
+        add_string(&r->argv, "--slots");
+        add_string(&r->argv, "rootreplay:4");
+    }
+    if (has_option(rec->options, "ns")) {
+        r->target = start_target(r->envp.list);
+        snprintf(pidtext, sizeof(pidtext), "%ld", (long)r->target);
+        add_string(&r->argv, "--ns");
+        add_string(&r->argv, pidtext);
+    }
+    if (resolve) {
+        add_string(&r->argv, "--resolve");
+    }
+    if (fileop) {
+        static const char *const ops[] = { "write", "append", "copy", "read" };
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (has_option(rec->options, ops[i])) {
+                char op[16];
+                snprintf(op, sizeof(op), "--%s", ops[i]);
+                add_string(&r->argv, op);
+                add_string(&r->argv, file);
+                if (strcmp(ops[i], "copy") == 0) {
+                    add_string(&r->argv, copy);
+                }
+            }
+        }
+        if (not_found) {
+            /* as tee, cp or cat would */
+            r->status = 1;
+        }
+    }
+    else {
+        if (rec->qualified) {
+            snprintf(command, sizeof(command), "%s/q/%s", work, not_found ? "missing" : "cmd");
+        }
+        else {
+            strcpy(command, "cmd");
+        }
+        if (has_option(rec->options, "pipeline") && rec->stages > 1) {
+            add_string(&r->argv, "--pipeline");
+            for (int i = 1; i < rec->stages; i++) {
+                add_string(&r->argv, command);
+                add_string(&r->argv, "::");
+            }
+        }
+        else if (has_option(rec->options, "pipeline")) {
+            add_string(&r->argv, "--pipeline");
+        }
+        add_string(&r->argv, command);
+    }
+    if (resolve) {
+        /* the names */
+        while (r->argv.count <= rec->argc && r->argv.count < MAX_STRINGS) {
+            add_string(&r->argv, "cmd");
+        }
+    }
+    /* the command's arguments */
+    pad_strings(&r->argv, "", rec->argc + 1, rec->argv_bytes);
+    return 0;
+}
+
+static void finish(struct replay *r)
+{
+    free_strings(&r->argv);
+    free_strings(&r->envp);
+    if (r->target != 0) {
+        kill(r->target, SIGKILL);
+        waitpid(r->target, NULL, 0);
+    }
+}
+
+static int exit_status(int status)
+{
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+/*
+ * Run r once, returning its exit status and its wall time in *nsp.
+ */
+static int run_once(const struct replay *r, long long *nsp)
+{
+    long long start = now_ns();
+    pid_t pid = fork();
+    if (pid == -1) {
+        fail("fork");
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull != -1) {
+            dup2(devnull, STDIN_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        if (chdir(cwd) == -1) {
+            _exit(126);
+        }
+        if (r->as_nobody
+            && (setgroups(0, NULL) == -1 || setgid(NOBODY_UID) == -1
+                || setuid(NOBODY_UID) == -1)) {
+            _exit(126);
+        }
+        execve(r->argv.list[0], r->argv.list, r->envp.list);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            fail("waitpid");
+        }
+    }
+    *nsp = now_ns() - start;
+    return exit_status(status);
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+n:s:u:")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = atoi(optarg);
+            if (runs < 1 || runs > MAX_RUNS) {
+                usage();
+            }
+            break;
+        case 's':
+            shim = optarg;
+            break;
+        case 'u':
+            user = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    int nbuilds = argc - optind - 1;
+    if (nbuilds < 1 || nbuilds > MAX_BUILDS) {
+        usage();
+    }
+
+    FILE *trace = fopen(argv[optind], "r");
+    if (trace == NULL) {
+        fail(argv[optind]);
+    }
+    static struct build builds[MAX_BUILDS];
+    for (int b = 0; b < nbuilds; b++) {
+        builds[b].path = argv[optind + 1 + b];
+        if (access(builds[b].path, X_OK) == -1) {
+            fail(builds[b].path);
+        }
+    }
+    true_path = find_program("true");
+    sleep_path = find_program("sleep");
+
+    /* the fixtures */
+    const char *tmpdir = getenv("TMPDIR");
+    if ((size_t)snprintf(work, sizeof(work), "%s/rootreplay.XXXXXX",
+                         tmpdir != NULL ? tmpdir : "/tmp") >= sizeof(work)) {
+        fprintf(stderr, "rootreplay: TMPDIR is too long\n");
+        exit(2);
+    }
+    if (mkdtemp(work) == NULL) {
+        fail(work);
+    }
+    /* so nobody can run the builds, to be refused */
+    chmod(work, 0755);
+    for (int b = 0; b < nbuilds; b++) {
+        char name[16];
+        snprintf(name, sizeof(name), "root-%c", 'a' + b);
+        builds[b].path = copy_in(builds[b].path, name);
+    }
+    if (shim != NULL) {
+        shim = copy_in(shim, "testshim.so");
+    }
+    const char *dirs[] = { "p", "h", "q", "cwd", "cwd/rel" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/%s", work, dirs[i]);
+        make_dir(dir);
+    }
+    snprintf(cwd, sizeof(cwd), "%s/cwd", work);
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/q", work);
+    make_command(dir);
+    snprintf(dir, sizeof(dir), "%s/cwd/rel", work);
+    make_command(dir);
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/file", work);
+    int fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd == -1 || write(fd, "rootreplay\n", 11) != 11) {
+        fail(file);
+    }
+    close(fd);
+
+    long records = 0, replayed = 0, unreadable = 0;
+    char *line = NULL;
+    size_t linemax = 0;
+    static struct replay r[MAX_BUILDS];
+    while (getline(&line, &linemax, trace) != -1) {
+        records++;
+        struct trace_record rec;
+        if (trace_parse(line, &rec) == -1) {
+            unreadable++;
+            continue;
+        }
+        int ok = 1;
+        for (int b = 0; b < nbuilds; b++) {
+            ok = ok && prepare(&r[b], &rec, builds[b].path) == 0;
+        }
+        if (ok) {
+            replayed++;
+            for (int i = 0; i < runs; i++) {
+                for (int b = 0; b < nbuilds; b++) {
+                    long long ns;
+                    if (run_once(&r[b], &ns) != r[b].status) {
+                        builds[b].mismatched++;
+                    }
+                    add_time(&builds[b].all, ns);
+                    add_time(&builds[b].by_outcome[r[b].outcome], ns);
+                }
+            }
+        }
+        for (int b = 0; b < nbuilds; b++) {
+            finish(&r[b]);
+        }
+    }
+    free(line);
+    fclose(trace);
+    remove_tree(work);
+
+    long mismatched = 0;
+    for (int b = 0; b < nbuilds; b++) {
+        struct build *build = &builds[b];
+        mismatched += build->mismatched;
+        printf("%c: records=%ld replayed=%ld skipped=%ld mismatched=%ld ",
+               'a' + b, records, replayed, records - replayed, build->mismatched);
+        if (build->all.count == 0) {
+            printf("runs=0\n");
+            continue;
+        }
+        print_times(&build->all);
+        printf("\n");
+        for (size_t i = 0; i < NOUTCOMES; i++) {
+            if (build->by_outcome[i].count > 0) {
+                printf("%c %s: runs=%zu ", 'a' + b, outcomes[i].name,
+                       build->by_outcome[i].count);
+                print_times(&build->by_outcome[i]);
+                printf("\n");
+            }
+        }
+    }
+    if (unreadable > 0) {
+        printf("unreadable=%ld\n", unreadable);
+    }
+    if (nbuilds == 2 && builds[0].all.count > 0) {
+        /* sorted by print_times */
+        static const int points[] = { 50, 90, 99 };
+        printf("b vs a:");
+        for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+            long long x = percentile(&builds[0].all, points[i]);
+            long long y = percentile(&builds[1].all, points[i]);
+            printf(" wall_us_%s=%+.1f%%", points[i] == 50 ? "median" : points[i] == 90 ? "p90" : "p99",
+                   x > 0 ? (y - x) * 100.0 / x : 0.0);
+        }
+        printf("\n");
+    }
+    return mismatched > 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,102 @@
+#define _DEFAULT_SOURCE /* for MAP_SHARED with -std=c99, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for MAP_SHARED with -std=c99 */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "statefile.h"
+
+static int open_state(const char *path)
+{
+    int fd = open(path, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0600);
+    if (fd != -1 || errno != ENOENT) {
+        return fd;
+    }
+
+    /* /run is emptied at boot, so the directory may need making too */
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL || slash == path || (size_t)(slash - path) >= sizeof(dir)) {
+        errno = ENOENT;
+        return -1;
+    }
+    memcpy(dir, path, slash - path);
+    dir[slash - path] = '\0';
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    return open(path, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0600);
+}
+
+/*
+ * Check the state file open on fd and map it.  Returns the mapping, or
+ * NULL with errno set; fd is left open either way.
+ */
+static void *map_state(int fd, size_t size)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return NULL;
+    }
+    /* anyone else who could write it could tamper with what we decide */
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IRWXG|S_IRWXO)) != 0) {
+        errno = EPERM;
+        return NULL;
+    }
+    /* whoever created it first sizes it, which is idempotent */
+    if (st.st_size == 0 && ftruncate(fd, size) == -1) {
+        return NULL;
+    }
+    else if (st.st_size != 0 && (size_t)st.st_size != size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    return addr;
+}
+
+static void close_keeping_errno(int fd)
+{
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+}
+
+void *statefile_map(const char *path, size_t size)
+{
+    int fd = open_state(path);
+    if (fd == -1) {
+        return NULL;
+    }
+    void *addr = map_state(fd, size);
+    close_keeping_errno(fd);
+    return addr;
+}
+
+void *statefile_map_existing(const char *path, size_t size, int *fdp)
+{
+    int fd = open(path, O_RDWR|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    void *addr = map_state(fd, size);
+    if (addr == NULL) {
+        close_keeping_errno(fd);
+        return NULL;
+    }
+    *fdp = fd;
+    return addr;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
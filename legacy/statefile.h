@@ -0,0 +1,28 @@
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <stddef.h>
+
+/*
+ * Map the file at path, shared and writable, creating it (and its
+ * directory) if need be.  The file is state that only we may change, e.g.
+ * under /run, which is emptied at boot.
+ *
+ * A new file is extended with zeros to size.  Returns the mapping, or NULL
+ * with errno set: EPERM if the file is not a regular file owned by us and
+ * inaccessible to anyone else, or EINVAL if it is not size bytes long.
+ * Unmap it with munmap(addr, size).
+ */
+void *statefile_map(const char *path, size_t size);
+
+/*
+ * The same for a file that must already exist, e.g. one an administrator
+ * creates to turn something on, which fails with ENOENT if it doesn't.
+ *
+ * The file is kept open, and *fdp set to its descriptor, e.g. for
+ * flock(2); close it after unmapping.
+ */
+void *statefile_map_existing(const char *path, size_t size, int *fdp);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
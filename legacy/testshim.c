@@ -0,0 +1,454 @@
+/*
+ * testshim
+ *
+ * LD_PRELOAD stand-in for the services root talks to, used by the test
+ * harnesses (see difftest.sh and faulttest.sh).  It is never linked into
+ * root itself.
+ *
+ * Environment:
+ *   ROOT_SHIM_SYSLOG   append every syslog message to this file, one per
+ *                      line as "<priority> <message>", instead of sending
+ *                      it to the system log
+ *   ROOT_SHIM_NSS_DELAY_MS
+ *                      sleep this long in every passwd and group lookup
+ *                      before answering, like a degraded directory service
+ *   ROOT_SHIM_UID      getuid returns this until the process sets its uid,
+ *                      as if this user had run root installed setuid; keep
+ *                      it from shells, which then drop privileges
+ *   ROOT_SHIM_FAULTS   make calls slow, fail or never return, as a
+ *                      comma-separated list of
+ *                      <call>[@<prefix>]=<effect>[+<effect>]..., e.g.
+ *                      "nss=delay:200,stat@/mnt/nfs=hang,syslog=fail:EIO"
+ *
+ * A <call> is one of
+ *   getpwuid getpwnam getgrgid getgrnam getgrouplist initgroups
+ *                      (and their _r variants), or nss for all of them
+ *   access stat realpath open
+ *                      (access includes faccessat, and stat lstat and
+ *                      fstatat), or fs for all of them
+ *   getgroups syslog   (syslog includes vsyslog)
+ * With @<prefix>, only calls on paths starting with <prefix> are affected;
+ * relative paths passed to the *at calls are made absolute first (Linux
+ * only).  The first entry that matches a call applies.  Its effects are
+ *   delay:<ms>         sleep this long, then make the call
+ *   fail:<errno>       fail with this error (e.g. EIO, or a number)
+ *                      instead of making the call; syslog messages are
+ *                      dropped, as they would be if the log were down
+ *   hang               never return, like a stalled NFS server
+ *
+ * All of these are read on every call, so a test can change them as it
+ * goes.
+ *
+ * Because the dynamic linker ignores LD_PRELOAD for setuid programs run by
+ * other users, use it on an unprivileged copy of root, or run as root.
+ */
+
+#define _GNU_SOURCE     /* for vdprintf(), RTLD_NEXT */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the C library's own version of name */
+#define REAL(name) ((__typeof__(&name))dlsym(RTLD_NEXT, #name))
+
+static const char *priority_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug",
+};
+
+static int capture_fd(void)
+{
+    static int fd = -2;
+    if (fd == -2) {
+        const char *path = getenv("ROOT_SHIM_SYSLOG");
+        fd = path == NULL ? -1
+                          : REAL(open)(path, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0600);
+    }
+    return fd;
+}
+
+static void capture(int priority, const char *format, va_list ap)
+{
+    char message[8192];
+    int saved_errno = errno;
+
+    /* %m is expanded by syslog, not printf */
+    vsnprintf(message, sizeof(message), format, ap);
+    dprintf(capture_fd(), "%s %s\n", priority_names[LOG_PRI(priority)], message);
+    errno = saved_errno;
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        continue;
+    }
+}
+
+static const struct {
+    const char *name;
+    int value;
+} errno_names[] = {
+    { "EACCES", EACCES }, { "EAGAIN", EAGAIN }, { "EINTR", EINTR },
+    { "EIO", EIO }, { "EMFILE", EMFILE }, { "ENFILE", ENFILE },
+    { "ENOENT", ENOENT }, { "ENOMEM", ENOMEM }, { "EPERM", EPERM },
+    { "ESTALE", ESTALE }, { "ETIMEDOUT", ETIMEDOUT },
+};
+
+static int parse_errno(const char *s, size_t len)
+{
+    for (size_t i = 0; i < sizeof(errno_names) / sizeof(errno_names[0]); i++) {
+        if (strlen(errno_names[i].name) == len
+            && strncmp(errno_names[i].name, s, len) == 0) {
+            return errno_names[i].value;
+        }
+    }
+    int n = atoi(s);
+    return n > 0 ? n : EIO;
+}
+
+/* whether the len bytes at s are word */
+static int is(const char *s, size_t len, const char *word)
+{
+    return strlen(word) == len && strncmp(s, word, len) == 0;
+}
+
+/*
+ * Apply the effects in the len bytes at s, as for ROOT_SHIM_FAULTS.
+ *
+ * Returns the errno to fail with, or 0 to make the call.
+ */
+static int apply(const char *s, size_t len)
+{
+    const char *end = s + len;
+    int err = 0;
+
+    while (s < end) {
+        size_t n = strcspn(s, "+,");
+        if (n > (size_t)(end - s)) {
+            n = end - s;
+        }
+        if (is(s, n, "hang")) {
+            for (;;) {
+                pause();
+            }
+        }
+        if (n > 6 && strncmp(s, "delay:", 6) == 0) {
+            sleep_ms(atol(s + 6));
+        }
+        else if (n > 5 && strncmp(s, "fail:", 5) == 0) {
+            err = parse_errno(s + 5, n - 5);
+        }
+        s += n + 1;
+    }
+    return err;
+}
+
+/*
+ * Inject the fault ROOT_SHIM_FAULTS gives for call, which is one of family,
+ * on path (or NULL if it isn't about a path).
+ *
+ * Returns the errno to fail with, or 0 to make the call.
+ */
+static int inject(const char *call, const char *family, const char *path)
+{
+    const char *spec = getenv("ROOT_SHIM_FAULTS");
+    int saved_errno = errno;
+    int err = 0;
+
+    if (family != NULL && strcmp(family, "nss") == 0) {
+        const char *ms = getenv("ROOT_SHIM_NSS_DELAY_MS");
+        if (ms != NULL) {
+            sleep_ms(atol(ms));
+        }
+    }
+
+    while (spec != NULL && *spec != '\0') {
+        size_t len = strcspn(spec, ",");
+        size_t namelen = strcspn(spec, "@=,");
+        const char *eq = memchr(spec, '=', len);
+        if (eq != NULL
+            && (is(spec, namelen, call) || (family != NULL && is(spec, namelen, family)))) {
+            const char *prefix = spec + namelen;
+            size_t prefixlen = 0;
+            if (*prefix == '@') {
+                prefix++;
+                prefixlen = eq - prefix;
+            }
+            if (prefixlen == 0
+                || (path != NULL && strncmp(path, prefix, prefixlen) == 0)) {
+                err = apply(eq + 1, len - (eq + 1 - spec));
+                break;
+            }
+        }
+        spec += len;
+        spec += *spec == ',';
+    }
+
+    errno = saved_errno;
+    return err;
+}
+
+/*
+ * inject, for path relative to the directory dirfd, as the *at calls take
+ */
+static int inject_at(const char *call, int dirfd, const char *path)
+{
+    char full[PATH_MAX];
+    if (path[0] != '/' && dirfd != AT_FDCWD) {
+        char link[64];
+        int saved_errno = errno;
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+        ssize_t n = readlink(link, full, sizeof(full) - 1);
+        errno = saved_errno;
+        if (n > 0 && (size_t)n + 1 + strlen(path) < sizeof(full)) {
+            full[n] = '/';
+            strcpy(full + n + 1, path);
+            path = full;
+        }
+    }
+    return inject(call, "fs", path);
+}
+
+void openlog(const char *ident, int option, int facility)
+{
+}
+
+void closelog(void)
+{
+}
+
+void vsyslog(int priority, const char *format, va_list ap)
+{
+    if (inject("syslog", NULL, NULL) != 0) {
+        return;
+    }
+    if (capture_fd() != -1) {
+        capture(priority, format, ap);
+    }
+}
+
+void syslog(int priority, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vsyslog(priority, format, ap);
+    va_end(ap);
+}
+
+/* glibc's fortified variants, used when built with _FORTIFY_SOURCE */
+void __vsyslog_chk(int priority, int flag, const char *format, va_list ap)
+{
+    vsyslog(priority, format, ap);
+}
+
+void __syslog_chk(int priority, int flag, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vsyslog(priority, format, ap);
+    va_end(ap);
+}
+
+/*
+ * Fail as the reentrant lookups do, or make the call.
+ */
+#define NSS_R(call, ...) \
+    do { \
+        int err = inject(#call, "nss", NULL); \
+        if (err != 0) { \
+            *result = NULL; \
+            return err; \
+        } \
+        return REAL(call##_r)(__VA_ARGS__); \
+    } while (0)
+
+/*
+ * Fail as the other lookups do, or make the call.
+ */
+#define NSS(call, fail, ...) \
+    do { \
+        int err = inject(#call, "nss", NULL); \
+        if (err != 0) { \
+            errno = err; \
+            return fail; \
+        } \
+        return REAL(call)(__VA_ARGS__); \
+    } while (0)
+
+struct passwd *getpwuid(uid_t uid)
+{
+    NSS(getpwuid, NULL, uid);
+}
+
+struct passwd *getpwnam(const char *name)
+{
+    NSS(getpwnam, NULL, name);
+}
+
+int getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t size,
+               struct passwd **result)
+{
+    NSS_R(getpwuid, uid, pwd, buf, size, result);
+}
+
+int getpwnam_r(const char *name, struct passwd *pwd, char *buf, size_t size,
+               struct passwd **result)
+{
+    NSS_R(getpwnam, name, pwd, buf, size, result);
+}
+
+struct group *getgrgid(gid_t gid)
+{
+    NSS(getgrgid, NULL, gid);
+}
+
+struct group *getgrnam(const char *name)
+{
+    NSS(getgrnam, NULL, name);
+}
+
+int getgrgid_r(gid_t gid, struct group *grp, char *buf, size_t size,
+               struct group **result)
+{
+    NSS_R(getgrgid, gid, grp, buf, size, result);
+}
+
+int getgrnam_r(const char *name, struct group *grp, char *buf, size_t size,
+               struct group **result)
+{
+    NSS_R(getgrnam, name, grp, buf, size, result);
+}
+
+int getgrouplist(const char *user, gid_t group, gid_t *groups, int *ngroups)
+{
+    NSS(getgrouplist, -1, user, group, groups, ngroups);
+}
+
+int initgroups(const char *user, gid_t group)
+{
+    NSS(initgroups, -1, user, group);
+}
+
+int getgroups(int size, gid_t list[])
+{
+    int err = inject("getgroups", NULL, NULL);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(getgroups)(size, list);
+}
+
+/* whether setuid has been called, after which getuid tells the truth */
+static int switched = 0;
+
+uid_t getuid(void)
+{
+    const char *uid = getenv("ROOT_SHIM_UID");
+    if (uid != NULL && *uid != '\0' && !switched) {
+        return (uid_t)strtoul(uid, NULL, 10);
+    }
+    return REAL(getuid)();
+}
+
+int setuid(uid_t uid)
+{
+    int result = REAL(setuid)(uid);
+    if (result == 0) {
+        switched = 1;
+    }
+    return result;
+}
+
+int access(const char *path, int mode)
+{
+    int err = inject("access", "fs", path);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(access)(path, mode);
+}
+
+int faccessat(int dirfd, const char *path, int mode, int flags)
+{
+    int err = inject_at("access", dirfd, path);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(faccessat)(dirfd, path, mode, flags);
+}
+
+int stat(const char *path, struct stat *st)
+{
+    int err = inject("stat", "fs", path);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(stat)(path, st);
+}
+
+int lstat(const char *path, struct stat *st)
+{
+    int err = inject("stat", "fs", path);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(lstat)(path, st);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+    int err = inject_at("stat", dirfd, path);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(fstatat)(dirfd, path, st, flags);
+}
+
+char *realpath(const char *path, char *resolved)
+{
+    int err = inject("realpath", "fs", path);
+    if (err != 0) {
+        errno = err;
+        return NULL;
+    }
+    return REAL(realpath)(path, resolved);
+}
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if (flags & (O_CREAT|O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    int err = inject("open", "fs", path);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return REAL(open)(path, flags, mode);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,205 @@
+#define _DEFAULT_SOURCE /* for O_NOFOLLOW and O_CLOEXEC with -std=c99, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for O_NOFOLLOW and O_CLOEXEC with -std=c99 */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int trace_open(const char *path)
+{
+    /* never created here: tracing is on only while the file exists */
+    int fd = open(path, O_WRONLY|O_APPEND|O_NOFOLLOW|O_NOCTTY|O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 022) != 0) {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    return fd;
+}
+
+void trace_path_shape(struct trace_record *rec,
+                      const char *pathenv,
+                      const char *command,
+                      const char *found)
+{
+    rec->path_entries = 0;
+    rec->path_bytes = 0;
+    rec->path_hit = 0;
+    if (pathenv == NULL) {
+        return;
+    }
+    rec->path_bytes = (long)strlen(pathenv);
+
+    /* the same entries, and the same paths, as pathlist_find */
+    size_t commandlen = command != NULL ? strlen(command) : 0;
+    size_t foundlen = found != NULL ? strlen(found) : 0;
+    const char *entry = pathenv;
+    for (;;) {
+        const char *sep = strchr(entry, ':');
+        size_t len = sep != NULL ? (size_t)(sep - entry) : strlen(entry);
+        rec->path_entries++;
+
+        const char *dir = len == 0 ? "." : entry;
+        size_t dirlen = len == 0 ? 1 : len;
+        size_t slash = dir[dirlen - 1] != '/';
+        if (rec->path_hit == 0 && found != NULL
+            && foundlen == dirlen + slash + commandlen
+            && memcmp(found, dir, dirlen) == 0
+            && (!slash || found[dirlen] == '/')
+            && memcmp(found + dirlen + slash, command, commandlen) == 0) {
+            rec->path_hit = rec->path_entries;
+        }
+
+        if (sep == NULL) {
+            break;
+        }
+        entry = sep + 1;
+    }
+}
+
+int trace_format(const struct trace_record *rec, char *buf, size_t size)
+{
+    int len = snprintf(buf, size,
+                       "v=1 outcome=%s options=%s argc=%ld argv_bytes=%ld envc=%ld "
+                       "env_bytes=%ld path_entries=%ld path_bytes=%ld path_hit=%ld "
+                       "qualified=%d stages=%d us=%ld\n",
+                       rec->outcome, rec->options[0] != '\0' ? rec->options : "-",
+                       rec->argc, rec->argv_bytes, rec->envc, rec->env_bytes,
+                       rec->path_entries, rec->path_bytes, rec->path_hit,
+                       rec->qualified, rec->stages, rec->us);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return len;
+}
+
+/*
+ * Copy the value in [value, end) into buf, which holds size bytes.
+ * Returns 0, or -1 if it is empty or doesn't fit.
+ */
+static int copy_word(char *buf, size_t size, const char *value, const char *end)
+{
+    size_t len = (size_t)(end - value);
+    if (len == 0 || len >= size) {
+        return -1;
+    }
+    memcpy(buf, value, len);
+    buf[len] = '\0';
+    return 0;
+}
+
+/*
+ * Parse the number in [value, end) into *np.  Returns 0, or -1 if it
+ * isn't a number from 0 up.
+ */
+static int parse_count(long *np, const char *value, const char *end)
+{
+    char *stop;
+    errno = 0;
+    long n = strtol(value, &stop, 10);
+    if (errno != 0 || stop == value || stop != end || n < 0) {
+        return -1;
+    }
+    *np = n;
+    return 0;
+}
+
+int trace_parse(const char *line, struct trace_record *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    int version = 0;
+
+    const char *p = line;
+    while (*p != '\0' && *p != '\n') {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        const char *end = p + strcspn(p, " \n");
+        const char *eq = memchr(p, '=', (size_t)(end - p));
+        if (eq == NULL) {
+            return -1;
+        }
+        size_t keylen = (size_t)(eq - p);
+        const char *value = eq + 1;
+        long n = 0;
+        int bad = 0;
+
+#define KEY(name) (keylen == sizeof(name) - 1 && memcmp(p, name, keylen) == 0)
+        if (KEY("v")) {
+            bad = parse_count(&n, value, end);
+            version = (int)n;
+        }
+        else if (KEY("outcome")) {
+            bad = copy_word(rec->outcome, sizeof(rec->outcome), value, end);
+        }
+        else if (KEY("options")) {
+            bad = copy_word(rec->options, sizeof(rec->options), value, end);
+            if (strcmp(rec->options, "-") == 0) {
+                rec->options[0] = '\0';
+            }
+        }
+        else if (KEY("argc")) {
+            bad = parse_count(&rec->argc, value, end);
+        }
+        else if (KEY("argv_bytes")) {
+            bad = parse_count(&rec->argv_bytes, value, end);
+        }
+        else if (KEY("envc")) {
+            bad = parse_count(&rec->envc, value, end);
+        }
+        else if (KEY("env_bytes")) {
+            bad = parse_count(&rec->env_bytes, value, end);
+        }
+        else if (KEY("path_entries")) {
+            bad = parse_count(&rec->path_entries, value, end);
+        }
+        else if (KEY("path_bytes")) {
+            bad = parse_count(&rec->path_bytes, value, end);
+        }
+        else if (KEY("path_hit")) {
+            bad = parse_count(&rec->path_hit, value, end);
+        }
+        else if (KEY("qualified")) {
+            bad = parse_count(&n, value, end);
+            rec->qualified = n != 0;
+        }
+        else if (KEY("stages")) {
+            bad = parse_count(&n, value, end) == -1 || n > 1000;
+            rec->stages = (int)n;
+        }
+        else if (KEY("us")) {
+            bad = parse_count(&rec->us, value, end);
+        }
+#undef KEY
+        if (bad) {
+            return -1;
+        }
+        p = end;
+    }
+
+    if (version != 1 || rec->outcome[0] == '\0' || rec->path_hit > rec->path_entries) {
+        return -1;
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+/*
+ * where invocations are traced, if it exists
+ *
+ * override at build time, e.g. make CFLAGS+=-DTRACE_PATH='"/srv/root.trace"'
+ */
+#ifndef TRACE_PATH
+#define TRACE_PATH "/var/log/root/trace"
+#endif
+
+/* the longest line trace_format writes */
+#define TRACE_LINE_MAX 512
+
+/*
+ * The shape of one invocation of root, for rootreplay to rebuild: no
+ * names, paths, arguments or environment, only their counts and sizes.
+ *
+ * In the file each is one line of key=value pairs, in this order:
+ *   v=1 outcome=ran options=debug,timeout argc=4 argv_bytes=37 envc=21
+ *   env_bytes=1412 path_entries=7 path_bytes=96 path_hit=3 qualified=0
+ *   stages=0 us=702
+ * Readers ignore keys they don't know, so keys are only ever added at the
+ * end.
+ */
+struct trace_record {
+    char outcome[16];           /* "ran", or where root stopped, e.g.
+                                   "denied" or "not-found" */
+    char options[160];          /* the options given, comma-separated,
+                                   without their values, or "-" */
+    long argc;                  /* arguments after root's own name */
+    long argv_bytes;            /* their size, each with its NUL */
+    long envc;                  /* environment variables */
+    long env_bytes;             /* their size, each with its NUL */
+    long path_entries;          /* entries in PATH, empty ones included */
+    long path_bytes;            /* the length of PATH */
+    long path_hit;              /* which entry the command was found in,
+                                   from 1, or 0 */
+    int qualified;              /* the command had a slash in it */
+    int stages;                 /* stages of a --pipeline, or 0 */
+    long us;                    /* microseconds root took to get there */
+};
+
+/*
+ * Open the trace file at path to append to.
+ *
+ * Returns the descriptor, or -1 with errno set: ENOENT if there is no
+ * such file, which means tracing is off, or EPERM if it is not a regular
+ * file owned by us that no one else can write to.
+ */
+int trace_open(const char *path);
+
+/*
+ * Fill in the PATH shape of rec: how many entries pathenv has, how long it
+ * is, and which entry found holds command (1 for the first).  found is
+ * what the PATH search found, e.g. "/usr/bin/ls" for "ls", or NULL.
+ */
+void trace_path_shape(struct trace_record *rec,
+                      const char *pathenv,
+                      const char *command,
+                      const char *found);
+
+/*
+ * Format rec as a line, with its newline, into buf, which holds size
+ * bytes.
+ *
+ * Returns the line's length, or -1 if it doesn't fit.
+ */
+int trace_format(const struct trace_record *rec, char *buf, size_t size);
+
+/*
+ * Parse line, as written by trace_format, into rec.
+ *
+ * Returns 0, or -1 if line isn't a version 1 record.
+ */
+int trace_parse(const char *line, struct trace_record *rec);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
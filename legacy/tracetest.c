@@ -0,0 +1,183 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char file[512];
+
+static void shape(struct trace_record *rec, const char *pathenv, const char *command,
+                  const char *found)
+{
+    memset(rec, 0, sizeof(*rec));
+    trace_path_shape(rec, pathenv, command, found);
+}
+
+void test_path_shape(void)
+{
+    printf("Running %s\n", __func__);
+    struct trace_record rec;
+
+    shape(&rec, "/usr/local/bin:/usr/bin:/bin", "ls", "/usr/bin/ls");
+    assert(rec.path_entries == 3);
+    assert(rec.path_bytes == 28);
+    assert(rec.path_hit == 2);
+
+    /* the first of the same directory twice, as the search would */
+    shape(&rec, "/bin:/bin", "ls", "/bin/ls");
+    assert(rec.path_entries == 2);
+    assert(rec.path_hit == 1);
+
+    /* trailing slashes, and empty entries for the current directory */
+    shape(&rec, "/sbin/::/bin/", "sl", "./sl");
+    assert(rec.path_entries == 3);
+    assert(rec.path_hit == 2);
+    shape(&rec, "/sbin/::/bin/", "ls", "/bin/ls");
+    assert(rec.path_hit == 3);
+    shape(&rec, "/usr/bin:", "sl", "./sl");
+    assert(rec.path_entries == 2);
+    assert(rec.path_hit == 2);
+
+    /* only a whole directory matches */
+    shape(&rec, "/usr/bi:/usr/bin", "ls", "/usr/bin/ls");
+    assert(rec.path_hit == 2);
+    shape(&rec, "/usr/bin", "l", "/usr/bin/ls");
+    assert(rec.path_hit == 0);
+
+    /* not found, or not searched */
+    shape(&rec, "/usr/bin:/bin", "nope", NULL);
+    assert(rec.path_entries == 2);
+    assert(rec.path_hit == 0);
+    shape(&rec, "", "ls", NULL);
+    assert(rec.path_entries == 1);
+    assert(rec.path_bytes == 0);
+    shape(&rec, NULL, "ls", NULL);
+    assert(rec.path_entries == 0);
+}
+
+void test_format_and_parse(void)
+{
+    printf("Running %s\n", __func__);
+    struct trace_record rec, back;
+    memset(&rec, 0, sizeof(rec));
+    strcpy(rec.outcome, "not-found");
+    strcpy(rec.options, "debug,timeout");
+    rec.argc = 4;
+    rec.argv_bytes = 37;
+    rec.envc = 21;
+    rec.env_bytes = 1412;
+    rec.path_entries = 7;
+    rec.path_bytes = 96;
+    rec.path_hit = 0;
+    rec.qualified = 0;
+    rec.stages = 0;
+    rec.us = 702;
+
+    char line[TRACE_LINE_MAX];
+    int len = trace_format(&rec, line, sizeof(line));
+    assert(len == (int)strlen(line));
+    assert(strcmp(line, "v=1 outcome=not-found options=debug,timeout argc=4 argv_bytes=37 "
+                        "envc=21 env_bytes=1412 path_entries=7 path_bytes=96 path_hit=0 "
+                        "qualified=0 stages=0 us=702\n") == 0);
+    assert(trace_parse(line, &back) == 0);
+    assert(memcmp(&rec, &back, sizeof(rec)) == 0);
+
+    /* no options at all */
+    rec.options[0] = '\0';
+    assert(trace_format(&rec, line, sizeof(line)) > 0);
+    assert(strstr(line, " options=- ") != NULL);
+    assert(trace_parse(line, &back) == 0);
+    assert(back.options[0] == '\0');
+
+    assert(trace_format(&rec, line, 20) == -1);
+}
+
+void test_parse(void)
+{
+    printf("Running %s\n", __func__);
+    struct trace_record rec;
+
+    /* later keys, and missing ones */
+    assert(trace_parse("v=1 outcome=ran argc=2 newer=7", &rec) == 0);
+    assert(strcmp(rec.outcome, "ran") == 0);
+    assert(rec.argc == 2);
+    assert(rec.path_entries == 0);
+
+    assert(trace_parse("", &rec) == -1);
+    assert(trace_parse("v=2 outcome=ran", &rec) == -1);
+    assert(trace_parse("outcome=ran", &rec) == -1);
+    assert(trace_parse("v=1", &rec) == -1);
+    assert(trace_parse("v=1 outcome=ran argc=-1", &rec) == -1);
+    assert(trace_parse("v=1 outcome=ran argc=1x", &rec) == -1);
+    assert(trace_parse("v=1 outcome=ran argc", &rec) == -1);
+    assert(trace_parse("v=1 outcome= argc=1", &rec) == -1);
+    assert(trace_parse("v=1 outcome=a-very-long-outcome", &rec) == -1);
+    assert(trace_parse("v=1 outcome=ran path_entries=2 path_hit=3", &rec) == -1);
+}
+
+void test_open(void)
+{
+    printf("Running %s\n", __func__);
+
+    /* off */
+    errno = 0;
+    assert(trace_open(file) == -1);
+    assert(errno == ENOENT);
+
+    /* on */
+    assert(close(open(file, O_WRONLY|O_CREAT|O_EXCL, 0600)) == 0);
+    int fd = trace_open(file);
+    assert(fd != -1);
+    assert(write(fd, "a\n", 2) == 2);
+    close(fd);
+    fd = trace_open(file);
+    assert(write(fd, "b\n", 2) == 2);
+    close(fd);
+    struct stat st;
+    assert(stat(file, &st) == 0);
+    assert(st.st_size == 4);
+
+    /* anyone else could have written it */
+    assert(chmod(file, 0622) == 0);
+    errno = 0;
+    assert(trace_open(file) == -1);
+    assert(errno == EPERM);
+    assert(chmod(file, 0644) == 0);
+    assert((fd = trace_open(file)) != -1);
+    close(fd);
+    unlink(file);
+
+    /* not a regular file */
+    assert(mkdir(file, 0700) == 0);
+    assert(trace_open(file) == -1);
+    rmdir(file);
+    assert(symlink("/dev/null", file) == 0);
+    assert(trace_open(file) == -1);
+    unlink(file);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(file, sizeof(file), "%s/trace", base);
+
+    test_path_shape();
+    test_format_and_parse();
+    test_parse();
+    test_open();
+
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
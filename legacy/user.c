@@ -1,5 +1,5 @@
-#define _DEFAULT_SOURCE /* for initgroups(), glibc >= 2.20 */
-#define _BSD_SOURCE     /* for initgroups() */
+#define _DEFAULT_SOURCE /* for setgroups(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for setgroups() */
 
 #include <sys/types.h>
 #include <errno.h>
@@ -9,165 +9,294 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "context.h"
 #include "logging.h"
+#include "nss.h"
 #include "root.h"
 #include "user.h"
 
-const char *get_group_name(gid_t gid)
+const char *get_group_name(struct root_ctx *ctx, gid_t gid)
 {
-    struct group *gp = getgrgid(gid);
-    if (gp != NULL && gp->gr_name != NULL) {
-        return gp->gr_name;
-    }
-    else {
-        return NULL;
-    }
+    return nss_group_name(ctx, gid);
 }
 
-int in_group(gid_t root_gid)
+/*
+ * the calling process's groups, primary group first, in *groupsp
+ *
+ * looked up once and then cached in ctx
+ * returns the number of groups, or -1 (having logged why)
+ */
+int get_groups(struct root_ctx *ctx, const gid_t **groupsp)
 {
-    gid_t gid;
+    if (ctx->ngroups != -1) {
+        *groupsp = ctx->groups;
+        return ctx->ngroups;
+    }
 
-    gid = getgid();
+    int ngroups;
+    gid_t *grouplist;
 
-    if (gid == root_gid) {
-        return 1;
+    errno = 0;
+    ngroups = getgroups(0, NULL);
+    if (ngroups == -1) {
+        error(ctx, "Cannot get number of groups: %s", strerror(errno));
+        return -1;
+    }
+
+    grouplist = arena_alloc(&ctx->arena, (ngroups + 1) * sizeof(gid_t));
+    if (grouplist == NULL) {
+        error(ctx, "Cannot allocate memory for group list");
+        return -1;
     }
-    else {
-        int ngroups;
-        gid_t *grouplist;
 
+    grouplist[0] = getgid();
+    if (ngroups > 0) {
         errno = 0;
-        ngroups = getgroups(0, NULL);
+        ngroups = getgroups(ngroups, grouplist + 1);
         if (ngroups == -1) {
-            error("Cannot get number of groups: %s", strerror(errno));
-            exit(ROOT_SYSTEM_ERROR);
+            error(ctx, "Cannot get group list: %s", strerror(errno));
+            return -1;
         }
+    }
+
+    ctx->groups = grouplist;
+    ctx->ngroups = ngroups + 1;
+    *groupsp = ctx->groups;
+    return ctx->ngroups;
+}
 
-        /* avoid malloc(0), whose result is implementation-defined */
-        if (ngroups == 0) {
-            return 0;
+/*
+ * returns 1 (true) if the calling process is in group root_gid,
+ * 0 (false) if not, or -1 if that could not be determined
+ */
+int in_group(struct root_ctx *ctx, gid_t root_gid)
+{
+    if (getgid() == root_gid) {
+        return 1;
+    }
+
+    const gid_t *groups;
+    int ngroups = get_groups(ctx, &groups);
+    if (ngroups == -1) {
+        return -1;
+    }
+    for (int i = 0; i < ngroups; i++) {
+        if (groups[i] == root_gid) {
+            return 1;
         }
+    }
+    return 0;
+}
+
+/*
+ * the passwd entry for uid
+ *
+ * looked up once and then cached in ctx (a different uid's entry is left
+ * in the arena)
+ * returns NULL (having logged why) if there is none
+ */
+static const struct target_user *get_target_user(struct root_ctx *ctx, uid_t uid)
+{
+    struct target_user target;
 
-        grouplist = malloc(ngroups * sizeof(gid_t));
-        if (grouplist == NULL) {
-            error("Cannot allocate memory for group list");
-            exit(ROOT_SYSTEM_ERROR);
+    if (ctx->have_target && ctx->target.uid == uid) {
+        return &ctx->target;
+    }
+
+    if (nss_user_by_uid(ctx, uid, &target) == -1) {
+        if (errno != 0) {
+            error(ctx, "Cannot get passwd info for uid %lu: %s", (unsigned long)uid, strerror(errno));
+        } else {
+            error(ctx, "Cannot get passwd info for uid %lu", (unsigned long)uid);
         }
+        return NULL;
+    }
 
-        errno = 0;
-        ngroups = getgroups(ngroups, grouplist);
-        if (ngroups == -1) {
-            error("Cannot get group list: %s", strerror(errno));
-            free(grouplist);
-            exit(ROOT_SYSTEM_ERROR);
+    ctx->target = target;
+    ctx->have_target = 1;
+    ctx->target_ngroups = -1;
+    return &ctx->target;
+}
+
+/*
+ * the uid of the user called name, in *uidp
+ *
+ * its passwd entry is cached in ctx for setup_groups and set_home_dir
+ * returns 0, ROOT_INVALID_USAGE if there is no such user, or
+ * ROOT_SYSTEM_ERROR (having logged why)
+ */
+int find_user(struct root_ctx *ctx, const char *name, uid_t *uidp)
+{
+    struct target_user target;
+
+    if (nss_user_by_name(ctx, name, &target) == -1) {
+        if (errno != 0) {
+            error(ctx, "Cannot get passwd info for %s: %s", name, strerror(errno));
+            return ROOT_SYSTEM_ERROR;
         }
+        error(ctx, "Unknown user %s", name);
+        return ROOT_INVALID_USAGE;
+    }
+
+    ctx->target = target;
+    ctx->have_target = 1;
+    ctx->target_ngroups = -1;
+    *uidp = target.uid;
+    return 0;
+}
 
-        for (int i = 0; i < ngroups; i++) {
-            if (grouplist[i] == root_gid) {
-                free(grouplist);
-                return 1;
-            }
+/*
+ * the groups target belongs to, as initgroups would set them, in *groupsp
+ *
+ * looked up once and then cached in ctx while the target stays the same
+ * returns the number of groups, or -1 (having logged why)
+ */
+static int get_target_groups(struct root_ctx *ctx,
+                             const struct target_user *target,
+                             const gid_t **groupsp)
+{
+    if (ctx->target_ngroups == -1) {
+        /* as initgroups would, but with the lookup bounded */
+        gid_t *groups;
+        int ngroups = nss_group_list(ctx, target->name, target->gid, &groups);
+        if (ngroups == -1) {
+            error(ctx, "Cannot get groups for %s: %s", target->name, strerror(errno));
+            return -1;
         }
-        free(grouplist);
-        return 0;
+        long max = sysconf(_SC_NGROUPS_MAX);
+        if (max > 0 && ngroups > max) {
+            ngroups = max;
+        }
+        ctx->target_groups = groups;
+        ctx->target_ngroups = ngroups;
+    }
+    *groupsp = ctx->target_groups;
+    return ctx->target_ngroups;
+}
+
+/*
+ * look up the target uid's passwd entry and groups now, for setup_groups
+ * and set_home_dir to use later
+ *
+ * returns 0 on success, or ROOT_SYSTEM_ERROR (having logged why)
+ */
+int hold_user(struct root_ctx *ctx, uid_t uid)
+{
+    const struct target_user *target;
+    const gid_t *groups;
+
+    target = get_target_user(ctx, uid);
+    if (target == NULL || get_target_groups(ctx, target, &groups) == -1) {
+        return ROOT_SYSTEM_ERROR;
     }
+    return 0;
 }
 
 /*
  * set up groups for the target uid
  *
- * calls exit() on failure because these are unrecoverable system errors
- * and we don't want to leave the process in a partially modified state
- * (e.g. setgid succeeded but initgroups failed)
+ * returns 0 on success, or ROOT_SYSTEM_ERROR (having logged why)
+ *
+ * these are unrecoverable system errors, and the caller must not carry on
+ * with the process in a partially modified state (e.g. setgid succeeded
+ * but initgroups failed)
  */
-int setup_groups(uid_t uid)
+int setup_groups(struct root_ctx *ctx, uid_t uid)
 {
-    struct passwd *ps;
+    const struct target_user *target;
     int result;
 
-    errno = 0;
-    ps = getpwuid(uid);
-    if (ps == NULL) {
-        if (errno != 0) {
-            error("Cannot get passwd info for uid %lu: %s", (unsigned long)uid, strerror(errno));
-        } else {
-            error("Cannot get passwd info for uid %lu", (unsigned long)uid);
-        }
-        exit(ROOT_SYSTEM_ERROR);
+    target = get_target_user(ctx, uid);
+    if (target == NULL) {
+        return ROOT_SYSTEM_ERROR;
     }
 
     errno = 0;
-    result = setgid(ps->pw_gid);
+    result = setgid(target->gid);
     if (result == -1) {
-        error("Cannot setgid %lu: %s", (unsigned long)ps->pw_gid, strerror(errno));
-        exit(ROOT_SYSTEM_ERROR);
+        error(ctx, "Cannot setgid %lu: %s", (unsigned long)target->gid, strerror(errno));
+        return ROOT_SYSTEM_ERROR;
+    }
+
+    /*
+     * the host's groups mean nothing in another user namespace, which may
+     * not allow setgroups at all, in which case the process keeps the
+     * groups it had, as nsenter's would
+     */
+    if (ctx->in_user_ns) {
+        if (setgroups(0, NULL) == -1 && errno != EPERM) {
+            error(ctx, "Cannot setgroups for %s: %s", target->name, strerror(errno));
+            return ROOT_SYSTEM_ERROR;
+        }
+        return 0;
+    }
+
+    const gid_t *groups;
+    int ngroups = get_target_groups(ctx, target, &groups);
+    if (ngroups == -1) {
+        return ROOT_SYSTEM_ERROR;
     }
 
     errno = 0;
-    result = initgroups(ps->pw_name, ps->pw_gid);
+    result = setgroups(ngroups, groups);
     if (result == -1) {
-        error("Cannot initgroups for %s: %s", ps->pw_name, strerror(errno));
-        exit(ROOT_SYSTEM_ERROR);
-    }
-    else {
-        return 1;
+        error(ctx, "Cannot setgroups for %s: %s", target->name, strerror(errno));
+        return ROOT_SYSTEM_ERROR;
     }
+    return 0;
 }
 
 /*
  * set the $HOME environment variable to the target uid's home directory
  *
- * returns 1 (true) on success, 0 (false) on setenv failure
- * calls exit() if getpwuid fails (unrecoverable system error)
+ * returns 0 on success, or ROOT_SYSTEM_ERROR (having logged why)
  */
-int set_home_dir(uid_t uid)
+int set_home_dir(struct root_ctx *ctx, uid_t uid)
 {
-    struct passwd *ps;
+    const struct target_user *target;
 
-    errno = 0;
-    ps = getpwuid(uid);
-    if (ps == NULL) {
-        if (errno != 0) {
-            error("Cannot get passwd info for uid %lu: %s", (unsigned long)uid, strerror(errno));
-        } else {
-            error("Cannot get passwd info for uid %lu", (unsigned long)uid);
-        }
-        exit(ROOT_SYSTEM_ERROR);
+    target = get_target_user(ctx, uid);
+    if (target == NULL) {
+        return ROOT_SYSTEM_ERROR;
     }
 
-    return setenv("HOME", ps->pw_dir, 1) == 0;
+    if (setenv("HOME", target->dir, 1) != 0) {
+        error(ctx, "Cannot set HOME directory");
+        return ROOT_SYSTEM_ERROR;
+    }
+    return 0;
 }
 
 /*
  * become the specified user
  *
- * currently the only supported user is root (uid=0)
+ * call setup_groups first, while we can still change groups
  *
- * returns 1 (true) on success, 0 (false) if uid != 0
- * calls exit() if setuid fails (unrecoverable system error)
+ * returns 0 on success, or ROOT_SYSTEM_ERROR (having logged why)
  */
-int become_user(uid_t uid)
+int become_user(struct root_ctx *ctx, uid_t uid)
 {
-    if (uid != 0) {
-        error("Becoming non-root user has not been tested");
-        return 0;
-    }
-
     /*
      * root should be installed setuid root
      *
      * before setuid:
      * ruid = user, euid = root, suid = root
-     * after setuid(0):
-     * ruid = root, euid = root, suid = root
+     * after setuid(uid):
+     * ruid = uid, euid = uid, suid = uid
      */
     errno = 0;
     if (setuid(uid) == -1) {
-        error("Cannot setuid %lu: %s", (unsigned long)uid, strerror(errno));
-        exit(ROOT_SYSTEM_ERROR);
+        error(ctx, "Cannot setuid %lu: %s", (unsigned long)uid, strerror(errno));
+        return ROOT_SYSTEM_ERROR;
+    }
+
+    /* any other user must not be able to get root back */
+    if (uid != 0 && setuid(0) != -1) {
+        error(ctx, "Cannot give up root privileges to become uid %lu", (unsigned long)uid);
+        return ROOT_SYSTEM_ERROR;
     }
-    return 1;
+    return 0;
 }
 
 /* vim: set ts=4 sw=4 tw=0 et:*/
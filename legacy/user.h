@@ -3,11 +3,16 @@
 
 #include <pwd.h> /* for uid_t and gid_t */
 
-const char *get_group_name(gid_t gid);
-int in_group(gid_t root_gid);
-int setup_groups(uid_t uid);
-int set_home_dir(uid_t uid);
-int become_user(uid_t uid);
+struct root_ctx;
+
+const char *get_group_name(struct root_ctx *ctx, gid_t gid);
+int get_groups(struct root_ctx *ctx, const gid_t **groupsp);
+int in_group(struct root_ctx *ctx, gid_t root_gid);
+int find_user(struct root_ctx *ctx, const char *name, uid_t *uidp);
+int hold_user(struct root_ctx *ctx, uid_t uid);
+int setup_groups(struct root_ctx *ctx, uid_t uid);
+int set_home_dir(struct root_ctx *ctx, uid_t uid);
+int become_user(struct root_ctx *ctx, uid_t uid);
 
 #endif
 /* vim: set ts=4 sw=4 tw=0 et:*/
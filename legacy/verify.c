@@ -0,0 +1,194 @@
+#define _DEFAULT_SOURCE /* for MAP_SHARED and st_mtim with -std=c99, glibc >= 2.20 */
+#define _BSD_SOURCE     /* for MAP_SHARED and st_mtim with -std=c99 */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "digest.h"
+#include "statefile.h"
+#include "verify.h"
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define st_ctim st_ctimespec
+#endif
+
+int manifest_open(struct manifest *m, const char *path)
+{
+    m->base = NULL;
+    m->size = 0;
+
+    int fd = open(path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_uid != 0 || (st.st_mode & (S_IWGRP|S_IWOTH))) {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    if (st.st_size == 0) {
+        /* lists nothing, and can't be mapped */
+        close(fd);
+        return 0;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    m->base = base;
+    m->size = st.st_size;
+    return 0;
+}
+
+void manifest_close(struct manifest *m)
+{
+    if (m->base != NULL) {
+        munmap((void *)m->base, m->size);
+        m->base = NULL;
+    }
+}
+
+int manifest_lookup(const struct manifest *m,
+                    const char *path,
+                    unsigned char digest[DIGEST_SIZE])
+{
+    const size_t pathlen = strlen(path);
+    const size_t hexlen = 2 * DIGEST_SIZE;
+    const char *p = m->base;
+    const char *end = m->base + m->size;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        /* <hex> <space or *><path> */
+        if ((size_t)(eol - p) == hexlen + 2 + pathlen
+            && p[hexlen] == ' '
+            && (p[hexlen + 1] == ' ' || p[hexlen + 1] == '*')
+            && memcmp(p + hexlen + 2, path, pathlen) == 0
+            && digest_from_hex(p, digest) == 0) {
+            return 1;
+        }
+        p = eol + 1;
+    }
+    return 0;
+}
+
+int verify_cache_open(struct verify_cache *cache, const char *path)
+{
+    cache->table = statefile_map(path, sizeof(struct verify_table));
+    return cache->table == NULL ? -1 : 0;
+}
+
+void verify_cache_close(struct verify_cache *cache)
+{
+    if (cache->table != NULL) {
+        munmap(cache->table, sizeof(*cache->table));
+        cache->table = NULL;
+    }
+}
+
+static void make_key(const struct stat *st, struct verify_key *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+    key->ctime_sec = st->st_ctim.tv_sec;
+    key->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+static void make_check(const struct verify_entry *entry,
+                       unsigned char check[DIGEST_SIZE])
+{
+    struct digest d;
+    digest_init(&d);
+    digest_update(&d, &entry->key, sizeof(entry->key));
+    digest_update(&d, entry->digest, sizeof(entry->digest));
+    digest_final(&d, check);
+}
+
+static struct verify_entry *slot_for(struct verify_table *table,
+                                     const struct verify_key *key)
+{
+    uint64_t h = (key->dev * 0x9E3779B97F4A7C15ull) ^ key->ino;
+    h *= 0x9E3779B97F4A7C15ull;
+    return &table->entries[(h >> 32) % VERIFY_CACHE_SLOTS];
+}
+
+int verify_digest(struct verify_cache *cache,
+                  int fd,
+                  unsigned char digest[DIGEST_SIZE],
+                  int *hashedp)
+{
+    *hashedp = 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    struct verify_key key;
+    make_key(&st, &key);
+
+    struct verify_entry *slot = NULL;
+    if (cache->table != NULL) {
+        slot = slot_for(cache->table, &key);
+
+        /* copy it first, in case another root is writing it */
+        struct verify_entry entry;
+        unsigned char check[DIGEST_SIZE];
+        memcpy(&entry, slot, sizeof(entry));
+        if (memcmp(&entry.key, &key, sizeof(key)) == 0) {
+            make_check(&entry, check);
+            if (memcmp(check, entry.check, sizeof(check)) == 0) {
+                memcpy(digest, entry.digest, DIGEST_SIZE);
+                return 0;
+            }
+        }
+    }
+
+    if (digest_fd(fd, digest) == -1) {
+        return -1;
+    }
+    *hashedp = 1;
+
+    /* if it changed while we read it, what we read may be a mixture */
+    struct stat after;
+    struct verify_key after_key;
+    if (fstat(fd, &after) == -1) {
+        return -1;
+    }
+    make_key(&after, &after_key);
+    if (memcmp(&after_key, &key, sizeof(key)) != 0) {
+        slot = NULL;
+    }
+
+    if (slot != NULL) {
+        struct verify_entry entry;
+        entry.key = key;
+        memcpy(entry.digest, digest, DIGEST_SIZE);
+        make_check(&entry, entry.check);
+        memcpy(slot, &entry, sizeof(entry));
+    }
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,120 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "digest.h"
+
+/*
+ * where root looks for the digests of the commands it may run
+ *
+ * override at build time, e.g. make CFLAGS+=-DVERIFY_MANIFEST_PATH='"/srv/root.b3"'
+ */
+#ifndef VERIFY_MANIFEST_PATH
+#define VERIFY_MANIFEST_PATH "/etc/root/manifest"
+#endif
+
+/*
+ * where digests are remembered between runs
+ *
+ * created by root if need be; override at build time, e.g.
+ * make CFLAGS+=-DVERIFY_CACHE_PATH='"/var/cache/root/digests"'
+ */
+#ifndef VERIFY_CACHE_PATH
+#define VERIFY_CACHE_PATH "/run/root/digests"
+#endif
+
+/* the most files whose digests are remembered */
+#define VERIFY_CACHE_SLOTS 256
+
+/*
+ * A manifest, in the format b3sum(1) writes: one line per file, of its
+ * digest in hex, two spaces (or a space and a *), and its absolute path.
+ * Lines that don't look like that are ignored.
+ */
+struct manifest {
+    const char *base;
+    size_t size;
+};
+
+/*
+ * Map the manifest at path.
+ *
+ * The manifest must be a regular file owned by root and not writable by
+ * anyone else.  Returns 0, or -1 with errno set: ENOENT if there is no
+ * manifest, or EPERM if it is not safely owned.
+ */
+int manifest_open(struct manifest *m, const char *path);
+void manifest_close(struct manifest *m);
+
+/*
+ * The digest the manifest lists for path.
+ *
+ * Returns 1, storing it in digest, or 0 if path is not listed.
+ */
+int manifest_lookup(const struct manifest *m,
+                    const char *path,
+                    unsigned char digest[DIGEST_SIZE]);
+
+/*
+ * What identifies one version of a file's content: replacing or writing to
+ * the file changes at least one of these, and nobody can set ctime.
+ */
+struct verify_key {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+};
+
+/*
+ * A cached digest, with a digest of the key and digest together so a
+ * half-written entry, from two roots writing the same slot at once, is
+ * never mistaken for a whole one.
+ */
+struct verify_entry {
+    struct verify_key key;
+    unsigned char digest[DIGEST_SIZE];
+    unsigned char check[DIGEST_SIZE];
+};
+
+/*
+ * The cache, exactly as it is in the file, indexed by a hash of the
+ * device and inode.  A file of zeros is the initial state.
+ */
+struct verify_table {
+    struct verify_entry entries[VERIFY_CACHE_SLOTS];
+};
+
+struct verify_cache {
+    struct verify_table *table;     /* NULL for no cache */
+};
+
+/*
+ * Map the cache at path, creating it (and its directory) if need be.
+ *
+ * Returns 0, or -1 with errno set, as for statefile_map.
+ */
+int verify_cache_open(struct verify_cache *cache, const char *path);
+void verify_cache_close(struct verify_cache *cache);
+
+/*
+ * The digest of the content of the open file fd, from the cache if it is
+ * unchanged since it was last digested, otherwise by reading it, in which
+ * case the cache (if cache->table isn't NULL) is updated and *hashedp is
+ * set to 1.
+ *
+ * Returns 0, or -1 with errno set.
+ */
+int verify_digest(struct verify_cache *cache,
+                  int fd,
+                  unsigned char digest[DIGEST_SIZE],
+                  int *hashedp);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,197 @@
+#define _DEFAULT_SOURCE /* for mkdtemp(), glibc >= 2.20 */
+#define _BSD_SOURCE     /* for mkdtemp() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "digest.h"
+#include "verify.h"
+
+static char base[] = "/tmp/roottestXXXXXX";
+static char manifest[512];
+static char cache[512];
+static char file[512];
+
+/* BLAKE3 of "abc" */
+#define ABC "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85"
+
+static void write_file(const char *path, const char *text, int append)
+{
+    FILE *f = fopen(path, append ? "a" : "w");
+    assert(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+void test_manifest_lookup(void)
+{
+    printf("Running %s\n", __func__);
+    if (geteuid() != 0) {
+        printf("Skipping %s (manifests must be owned by root)\n", __func__);
+        return;
+    }
+    struct manifest m;
+    unsigned char digest[DIGEST_SIZE];
+    char hex[DIGEST_HEX_SIZE];
+
+    write_file(manifest,
+               "not a digest  /bin/junk\n"
+               ABC "  /bin/ls\n"
+               "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262 */bin/true\n"
+               ABC " /bin/oneblank\n"
+               ABC "  /bin/last", 0);
+    assert(manifest_open(&m, manifest) == 0);
+
+    assert(manifest_lookup(&m, "/bin/ls", digest) == 1);
+    digest_to_hex(digest, hex);
+    assert(strcmp(hex, ABC) == 0);
+    assert(manifest_lookup(&m, "/bin/true", digest) == 1);
+    assert(digest[0] == 0xaf);
+    assert(manifest_lookup(&m, "/bin/last", digest) == 1);
+
+    /* whole paths only */
+    assert(manifest_lookup(&m, "/bin/l", digest) == 0);
+    assert(manifest_lookup(&m, "/bin/lsx", digest) == 0);
+    assert(manifest_lookup(&m, "/bin/junk", digest) == 0);
+    assert(manifest_lookup(&m, "/bin/oneblank", digest) == 0);
+    assert(manifest_lookup(&m, "/bin/cat", digest) == 0);
+
+    manifest_close(&m);
+
+    /* an empty manifest lists nothing */
+    write_file(manifest, "", 0);
+    assert(manifest_open(&m, manifest) == 0);
+    assert(manifest_lookup(&m, "/bin/ls", digest) == 0);
+    manifest_close(&m);
+}
+
+void test_manifest_open_rejects(void)
+{
+    printf("Running %s\n", __func__);
+    struct manifest m;
+
+    unlink(manifest);
+    errno = 0;
+    assert(manifest_open(&m, manifest) == -1);
+    assert(errno == ENOENT);
+
+    write_file(manifest, ABC "  /bin/ls\n", 0);
+    assert(chmod(manifest, 0666) == 0);
+    errno = 0;
+    assert(manifest_open(&m, manifest) == -1);
+    assert(errno == EPERM);
+    unlink(manifest);
+}
+
+static int digest_of(struct verify_cache *c, char *hex)
+{
+    unsigned char digest[DIGEST_SIZE];
+    int hashed;
+    int fd = open(file, O_RDONLY);
+    assert(fd != -1);
+    assert(verify_digest(c, fd, digest, &hashed) == 0);
+    close(fd);
+    digest_to_hex(digest, hex);
+    return hashed;
+}
+
+void test_cache(void)
+{
+    printf("Running %s\n", __func__);
+    struct verify_cache c;
+    char hex[DIGEST_HEX_SIZE];
+
+    unlink(cache);
+    assert(verify_cache_open(&c, cache) == 0);
+    write_file(file, "abc", 0);
+
+    assert(digest_of(&c, hex) == 1);
+    assert(strcmp(hex, ABC) == 0);
+    /* unchanged, so not read again */
+    assert(digest_of(&c, hex) == 0);
+    assert(strcmp(hex, ABC) == 0);
+
+    /* another process sees the same cache */
+    struct verify_cache other;
+    assert(verify_cache_open(&other, cache) == 0);
+    assert(digest_of(&other, hex) == 0);
+    verify_cache_close(&other);
+
+    /* any change to the file means reading it again */
+    write_file(file, "d", 1);
+    assert(digest_of(&c, hex) == 1);
+    assert(strcmp(hex, ABC) != 0);
+    assert(digest_of(&c, hex) == 0);
+
+    verify_cache_close(&c);
+}
+
+void test_cache_torn_entry(void)
+{
+    printf("Running %s\n", __func__);
+    struct verify_cache c;
+    char hex[DIGEST_HEX_SIZE];
+    struct stat st;
+
+    unlink(cache);
+    assert(verify_cache_open(&c, cache) == 0);
+    write_file(file, "abc", 0);
+    assert(digest_of(&c, hex) == 1);
+
+    /* as if another root were halfway through writing the entry */
+    assert(stat(file, &st) == 0);
+    int found = 0;
+    for (int i = 0; i < VERIFY_CACHE_SLOTS; i++) {
+        struct verify_entry *e = &c.table->entries[i];
+        if (e->key.ino == (uint64_t)st.st_ino) {
+            e->digest[0] ^= 1;
+            found = 1;
+        }
+    }
+    assert(found);
+    assert(digest_of(&c, hex) == 1);
+    assert(strcmp(hex, ABC) == 0);
+
+    verify_cache_close(&c);
+}
+
+void test_no_cache(void)
+{
+    printf("Running %s\n", __func__);
+    struct verify_cache c = { NULL };
+    char hex[DIGEST_HEX_SIZE];
+
+    write_file(file, "abc", 0);
+    assert(digest_of(&c, hex) == 1);
+    assert(digest_of(&c, hex) == 1);
+    assert(strcmp(hex, ABC) == 0);
+}
+
+int main(int argc, const char *argv[])
+{
+    assert(mkdtemp(base) != NULL);
+    snprintf(manifest, sizeof(manifest), "%s/manifest", base);
+    snprintf(cache, sizeof(cache), "%s/digests", base);
+    snprintf(file, sizeof(file), "%s/file", base);
+
+    test_manifest_lookup();
+    test_manifest_open_rejects();
+    test_cache();
+    test_cache_torn_entry();
+    test_no_cache();
+
+    unlink(manifest);
+    unlink(cache);
+    unlink(file);
+    rmdir(base);
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/